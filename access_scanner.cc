@@ -28,13 +28,19 @@ public:
     }
 
     void visit(StoredValue *v) {
-        if (log != NULL && v->isReferenced(true, &currentBucket->ht)) {
+        if (log == NULL) {
+            return;
+        }
+        // Items referenced in any of the last few scans are logged, so
+        // warmup can load the ones that scored highest first.
+        uint8_t score = v->updateAccessScore(currentBucket->ht);
+        if (score != 0) {
             if (v->isExpired(startTime) || v->isDeleted()) {
                 getLogger()->log(EXTENSION_LOG_INFO, NULL,
                                  "INFO: Skipping expired/deleted item: %s",
                                  v->getKey().c_str());
             } else {
-                log->newItem(currentBucket->getId(), v->getKey(), v->getId());
+                log->accessedItem(currentBucket->getId(), v->getKey(), score);
             }
         }
     }
@@ -49,7 +55,7 @@ public:
 
     virtual void complete() {
         if (log != NULL) {
-            size_t num_items = log->itemsLogged[ML_NEW];
+            size_t num_items = log->itemsLogged[ML_ACCESS];
             log->commit1();
             log->commit2();
             delete log;
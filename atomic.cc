@@ -43,3 +43,18 @@ void SpinLock::release(void) {
     ep_sync_lock_release(&lock);
     EP_SPINLOCK_RELEASED(this);
 }
+
+static Atomic<size_t> nextCounterStripe;
+
+// Not a ThreadLocal: the memory tracker updates striped counters from
+// inside the allocator hooks, and pthread_setspecific may allocate.
+// Stored off by one, as a thread that hasn't been given a stripe yet
+// reads zero.
+static __thread size_t counterStripe;
+
+size_t getCounterStripe(void) {
+    if (counterStripe == 0) {
+        counterStripe = nextCounterStripe++ % COUNTER_STRIPES + 1;
+    }
+    return counterStripe - 1;
+}
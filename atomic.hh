@@ -218,6 +218,109 @@ public:
     }
 };
 
+#define COUNTER_STRIPES 8
+#define CACHE_LINE_SIZE 64
+
+/**
+ * The stripe of every StripedCounter the calling thread updates.
+ * Threads are dealt stripes round robin the first time they ask.
+ */
+size_t getCounterStripe(void);
+
+/**
+ * A counter for statistics that are updated far more often than they
+ * are read.
+ *
+ * Updates go to one of several stripes, each on its own cache line,
+ * picked by the updating thread, so threads bumping the same counter
+ * don't fight over the cache line holding it.  Reads add up all the
+ * stripes, so this isn't for counters read on every operation.  A
+ * read racing with updates sees some of them and not others, and
+ * set() is not atomic with respect to concurrent updates, so this is
+ * only fit for counters nobody needs an exact snapshot of.
+ *
+ * Unlike Atomic, updates don't return the new or old value (there's
+ * no cheap way to know it).
+ */
+template <typename T>
+class StripedCounter {
+public:
+
+    StripedCounter(const T &initial = 0) {
+        set(initial);
+    }
+
+    T get() const {
+        // An increment and a matching decrement can land on different
+        // stripes, and this may see only the decrement.  Add up as a
+        // signed value so the sum can't wrap around, and report 0.
+        int64_t rv = 0;
+        for (size_t i = 0; i < COUNTER_STRIPES; ++i) {
+            rv += static_cast<int64_t>(stripes[i].value);
+        }
+        return rv < 0 ? 0 : static_cast<T>(rv);
+    }
+
+    void set(const T &newValue) {
+        stripes[0].value = newValue;
+        for (size_t i = 1; i < COUNTER_STRIPES; ++i) {
+            stripes[i].value = 0;
+        }
+        ep_sync_synchronize();
+    }
+
+    operator T() const {
+        return get();
+    }
+
+    void operator =(const T &newValue) {
+        set(newValue);
+    }
+
+    void operator ++() {
+        incr(1);
+    }
+
+    void operator ++(int) {
+        incr(1);
+    }
+
+    void operator --() {
+        decr(1);
+    }
+
+    void operator --(int) {
+        decr(1);
+    }
+
+    void operator +=(const T &increment) {
+        incr(increment);
+    }
+
+    void operator -=(const T &decrement) {
+        decr(decrement);
+    }
+
+    void incr(const T &increment) {
+        ep_sync_add_and_fetch(&stripes[getCounterStripe()].value, increment);
+    }
+
+    void decr(const T &decrement) {
+        ep_sync_add_and_fetch(&stripes[getCounterStripe()].value,
+                              -decrement);
+    }
+
+private:
+    struct Stripe {
+        volatile T value;
+        char pad[CACHE_LINE_SIZE - sizeof(T)];
+    };
+
+    Stripe stripes[COUNTER_STRIPES];
+
+    DISALLOW_COPY_AND_ASSIGN(StripedCounter);
+};
+
 /**
  * A lighter-weight, smaller lock than a mutex.
  *
@@ -1,5 +1,7 @@
 /* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
 #include "config.h"
+#include <set>
+
 #include "ep.hh"
 
 const double BgFetcher::sleepInterval = 1.0;
@@ -21,6 +23,34 @@ void BgFetcher::stop() {
     dispatcher->cancel(task);
 }
 
+/**
+ * Completes the fetches of every row as soon as the store has read it,
+ * rather than having them all wait for the last row of the batch.
+ */
+class BgFetchCompletionCallback : public bgfetch_callback_t {
+public:
+    BgFetchCompletionCallback(EventuallyPersistentStore *s, uint16_t vb,
+                              hrtime_t start) :
+        store(s), vbId(vb), startTime(start) {}
+
+    void callback(std::list<VBucketBGFetchItem *> &fetches) {
+        std::vector<VBucketBGFetchItem *> fetchedItems(fetches.begin(),
+                                                       fetches.end());
+        store->completeBGFetchMulti(vbId, fetchedItems, startTime);
+        completed.insert(&fetches);
+    }
+
+    bool isCompleted(const std::list<VBucketBGFetchItem *> &fetches) const {
+        return completed.find(&fetches) != completed.end();
+    }
+
+private:
+    EventuallyPersistentStore *store;
+    uint16_t vbId;
+    hrtime_t startTime;
+    std::set<const std::list<VBucketBGFetchItem *> *> completed;
+};
+
 void BgFetcher::doFetch(uint16_t vbId) {
     hrtime_t startTime(gethrtime());
     getLogger()->log(EXTENSION_LOG_DEBUG, NULL,
@@ -28,21 +58,28 @@ void BgFetcher::doFetch(uint16_t vbId) {
                      "startTime = %lld\n",
                      vbId, items2fetch.size(), startTime/1000000);
 
-    store->getROUnderlying()->getMulti(vbId, items2fetch);
+    BgFetchCompletionCallback cb(store, vbId, startTime);
+    store->getROUnderlying()->getMulti(vbId, items2fetch, &cb);
 
+    // Complete whatever the store didn't report on its own.
     int totalfetches = 0;
     std::vector<VBucketBGFetchItem *> fetchedItems;
     vb_bgfetch_queue_t::iterator itr = items2fetch.begin();
     for (; itr != items2fetch.end(); itr++) {
         std::list<VBucketBGFetchItem *> &requestedItems = (*itr).second;
+        totalfetches += requestedItems.size();
+        if (cb.isCompleted(requestedItems)) {
+            continue;
+        }
         std::list<VBucketBGFetchItem *>::iterator itm = requestedItems.begin();
         for(; itm != requestedItems.end(); itm++) {
             fetchedItems.push_back(*itm);
-            ++totalfetches;
         }
     }
-    store->completeBGFetchMulti(vbId, fetchedItems, startTime);
-    stats.getMultiHisto.add(startTime-gethrtime()/1000, totalfetches);
+    if (!fetchedItems.empty()) {
+        store->completeBGFetchMulti(vbId, fetchedItems, startTime);
+    }
+    stats.getMultiHisto.add((gethrtime() - startTime) / 1000, totalfetches);
     clearItems();
 }
 
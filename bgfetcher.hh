@@ -53,7 +53,15 @@ public:
     }
 
     void notifyBGEvent(void) {
-        if (++numRemainingItems == 1) {
+        notifyBGEvents(1);
+    }
+
+    /**
+     * Account for a number of fetches queued at once, waking the
+     * fetcher up a single time for all of them.
+     */
+    void notifyBGEvents(size_t n) {
+        if ((numRemainingItems += n) == n) {
             LockHolder lh(taskMutex);
             assert(task.get());
             dispatcher->wake(task, &task);
@@ -0,0 +1,101 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+#include "config.h"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+
+#include "bloomfilter.hh"
+
+static const size_t minBits = 64;
+static const size_t maxHashes = 16;
+
+BloomFilter::BloomFilter(size_t keyCount, double falsePositiveProb) {
+    assert(falsePositiveProb > 0.0 && falsePositiveProb < 1.0);
+    double n = static_cast<double>(std::max(keyCount, static_cast<size_t>(1)));
+    double ln2 = std::log(2.0);
+    double m = std::ceil(-n * std::log(falsePositiveProb) / (ln2 * ln2));
+
+    numBits = std::max(static_cast<size_t>(m), minBits);
+    numWords = (numBits + 31) / 32;
+    numBits = numWords * 32;
+    double k = std::floor(static_cast<double>(numBits) / n * ln2 + 0.5);
+    numHashes = std::min(std::max(static_cast<size_t>(k),
+                                  static_cast<size_t>(1)),
+                         maxHashes);
+    words = new uint32_t[numWords];
+    clear();
+}
+
+/**
+ * 64-bit FNV-1a with the MurmurHash3 finalizer, so both halves of the
+ * result are usable as independent hashes.
+ */
+uint64_t BloomFilter::hash(const char *key, size_t nkey) {
+    uint64_t h = 14695981039346656037ULL;
+    for (size_t i = 0; i < nkey; ++i) {
+        h ^= static_cast<uint8_t>(key[i]);
+        h *= 1099511628211ULL;
+    }
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+void BloomFilter::addKey(const char *key, size_t nkey) {
+    uint64_t h = hash(key, nkey);
+    uint64_t h1 = h & 0xffffffff;
+    uint64_t h2 = (h >> 32) | 1;
+    for (size_t i = 0; i < numHashes; ++i) {
+        size_t bit = static_cast<size_t>((h1 + i * h2) % numBits);
+        uint32_t *word = words + bit / 32;
+        uint32_t mask = 1U << (bit % 32);
+        uint32_t old = *word;
+        while (!(old & mask)) {
+            if (ep_sync_bool_compare_and_swap(word, old, old | mask)) {
+                ++numBitsSet;
+                break;
+            }
+            old = *word;
+        }
+    }
+    ++numKeys;
+}
+
+bool BloomFilter::maybeKeyExists(const char *key, size_t nkey) const {
+    uint64_t h = hash(key, nkey);
+    uint64_t h1 = h & 0xffffffff;
+    uint64_t h2 = (h >> 32) | 1;
+    for (size_t i = 0; i < numHashes; ++i) {
+        size_t bit = static_cast<size_t>((h1 + i * h2) % numBits);
+        if (!(words[bit / 32] & (1U << (bit % 32)))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void BloomFilter::clear() {
+    std::memset(words, 0, numWords * sizeof(uint32_t));
+    numKeys.set(0);
+    numBitsSet.set(0);
+}
+
+size_t BloomFilter::getEstimatedKeyCount() const {
+    double m = static_cast<double>(numBits);
+    double x = static_cast<double>(numBitsSet.get());
+    if (x >= m) {
+        return numKeys.get();
+    }
+    double n = -m / static_cast<double>(numHashes) * std::log(1.0 - x / m);
+    return static_cast<size_t>(n + 0.5);
+}
+
+double BloomFilter::getFalsePositiveProb() const {
+    double fill = static_cast<double>(numBitsSet.get()) /
+        static_cast<double>(numBits);
+    return std::pow(fill, static_cast<double>(numHashes));
+}
@@ -0,0 +1,122 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+#ifndef BLOOMFILTER_HH
+#define BLOOMFILTER_HH 1
+
+#include <string>
+
+#include "common.hh"
+#include "atomic.hh"
+
+/**
+ * A fixed size Bloom filter over keys.
+ *
+ * Keys can be added concurrently (bits are set with compare and
+ * swap) but never removed; clear() forgets all of them at once.
+ * maybeKeyExists() never misses an added key, and wrongly reports an
+ * unknown key with about the probability the filter was sized for,
+ * until more keys than it was sized for have been added; after that
+ * getFalsePositiveProb() tells how bad it has become.
+ */
+class BloomFilter {
+public:
+
+    /**
+     * Create a filter.
+     *
+     * @param keyCount the number of keys the filter is sized for
+     * @param falsePositiveProb the desired false positive probability
+     *                          at keyCount keys (0-1)
+     */
+    BloomFilter(size_t keyCount, double falsePositiveProb);
+
+    ~BloomFilter() {
+        delete []words;
+    }
+
+    /**
+     * Add a key to the filter.
+     */
+    void addKey(const char *key, size_t nkey);
+
+    void addKey(const std::string &key) {
+        addKey(key.data(), key.size());
+    }
+
+    /**
+     * False if the key has certainly not been added since the filter
+     * was last cleared.
+     */
+    bool maybeKeyExists(const char *key, size_t nkey) const;
+
+    bool maybeKeyExists(const std::string &key) const {
+        return maybeKeyExists(key.data(), key.size());
+    }
+
+    /**
+     * Forget all keys.  Not safe against concurrent additions.
+     */
+    void clear();
+
+    /**
+     * Get the number of keys added since the filter was last cleared
+     * (counting keys added more than once every time).
+     */
+    size_t getNumKeys() const {
+        return numKeys.get();
+    }
+
+    /**
+     * Estimate the number of distinct keys added from the number of
+     * bits set.
+     */
+    size_t getEstimatedKeyCount() const;
+
+    /**
+     * Get the probability that an unknown key is reported as maybe
+     * existing, given the bits set so far.
+     */
+    double getFalsePositiveProb() const;
+
+    /**
+     * Get the number of bits in the filter.
+     */
+    size_t getNumBits() const {
+        return numBits;
+    }
+
+    /**
+     * Get the number of bits currently set.
+     */
+    size_t getNumBitsSet() const {
+        return numBitsSet.get();
+    }
+
+    /**
+     * Get the number of bits set for every key.
+     */
+    size_t getNumHashes() const {
+        return numHashes;
+    }
+
+    /**
+     * Get the memory used by the filter in bytes.
+     */
+    size_t memorySize() const {
+        return sizeof(BloomFilter) + numWords * sizeof(uint32_t);
+    }
+
+private:
+
+    static uint64_t hash(const char *key, size_t nkey);
+
+    uint32_t         *words;
+    size_t            numWords;
+    size_t            numBits;
+    size_t            numHashes;
+    Atomic<size_t>    numKeys;
+    Atomic<size_t>    numBitsSet;
+
+    DISALLOW_COPY_AND_ASSIGN(BloomFilter);
+};
+
+#endif /* BLOOMFILTER_HH */
@@ -19,6 +19,14 @@ public:
             config.setCheckpointMaxItems(value);
         } else if (key.compare("max_checkpoints") == 0) {
             config.setMaxCheckpoints(value);
+        } else if (key.compare("chk_flush_batch_items") == 0) {
+            config.setFlushBatchItems(value);
+        } else if (key.compare("chk_flush_batch_bytes") == 0) {
+            config.setFlushBatchBytes(value);
+        } else if (key.compare("chk_tap_batch_items") == 0) {
+            config.setTapBatchItems(value);
+        } else if (key.compare("chk_tap_batch_bytes") == 0) {
+            config.setTapBatchBytes(value);
         }
     }
 
@@ -40,6 +48,164 @@ private:
 #include "statwriter.hh"
 #undef STATWRITER_NAMESPACE
 
+CheckpointLog::~CheckpointLog() {
+    std::vector<queued_item*>::iterator it = chunks.begin();
+    for (; it != chunks.end(); ++it) {
+        delete [] *it;
+    }
+}
+
+size_t CheckpointLog::push_back(const queued_item &qi) {
+    if (used == chunks.size() * CHUNK_SIZE) {
+        chunks.push_back(new queued_item[CHUNK_SIZE]);
+    }
+    slot(used) = qi;
+    ++numItems;
+    return used++;
+}
+
+void CheckpointLog::pop_back() {
+    assert(numItems > 0);
+    used = prevPos(used);
+    slot(used).reset();
+    --numItems;
+    while (used > 0 && slot(used - 1).get() == NULL) {
+        --used;
+    }
+}
+
+size_t CheckpointLog::rebuild(const std::vector<queued_item> &items,
+                              std::vector<size_t> &moved) {
+    std::vector<queued_item*> oldChunks;
+    oldChunks.swap(chunks);
+    size_t oldUsed = used;
+    used = 0;
+    numItems = 0;
+
+    size_t inserted = 0;
+    bool done = items.empty();
+    moved.resize(oldUsed + 1);
+    for (size_t pos = 0; pos < oldUsed; ++pos) {
+        queued_item &qi = oldChunks[pos / CHUNK_SIZE][pos % CHUNK_SIZE];
+        if (qi.get() == NULL) {
+            moved[pos] = used;
+            continue;
+        }
+        moved[pos] = push_back(qi);
+        if (numItems == 2 && !done) {
+            inserted = append(items);
+            done = true;
+        }
+    }
+    if (!done) {
+        inserted = append(items);
+    }
+    moved[oldUsed] = used;
+
+    std::vector<queued_item*>::iterator it = oldChunks.begin();
+    for (; it != oldChunks.end(); ++it) {
+        delete [] *it;
+    }
+    return inserted;
+}
+
+size_t CheckpointLog::append(const std::vector<queued_item> &items) {
+    size_t first = used;
+    std::vector<queued_item>::const_iterator it = items.begin();
+    for (; it != items.end(); ++it) {
+        push_back(*it);
+    }
+    return first;
+}
+
+uint32_t CheckpointIndex::hash(const std::string &key) {
+    return HashTable::xxHash(key.data(), key.length());
+}
+
+size_t CheckpointIndex::probe(const std::string &key, uint32_t h, CheckpointLog &log) {
+    size_t mask = table.size() - 1;
+    size_t i = h & mask;
+    while (table[i].mutation_id != 0) {
+        if (table[i].hash == h && log.at(table[i].position)->getKey() == key) {
+            break;
+        }
+        i = (i + 1) & mask;
+    }
+    return i;
+}
+
+index_entry *CheckpointIndex::find(const std::string &key, CheckpointLog &log) {
+    if (numEntries == 0) {
+        return NULL;
+    }
+    index_entry &entry = table[probe(key, hash(key), log)];
+    return entry.mutation_id != 0 ? &entry : NULL;
+}
+
+void CheckpointIndex::set(const std::string &key, CheckpointLog &log,
+                          size_t position, uint64_t mutationId) {
+    assert(mutationId != 0);
+    if ((numEntries + 1) * 4 > table.size() * 3) {
+        grow();
+    }
+    uint32_t h = hash(key);
+    index_entry &entry = table[probe(key, h, log)];
+    if (entry.mutation_id == 0) {
+        entry.hash = h;
+        ++numEntries;
+    }
+    entry.position = static_cast<uint32_t>(position);
+    entry.mutation_id = mutationId;
+}
+
+void CheckpointIndex::erase(const std::string &key, CheckpointLog &log) {
+    if (numEntries == 0) {
+        return;
+    }
+    size_t mask = table.size() - 1;
+    size_t i = probe(key, hash(key), log);
+    if (table[i].mutation_id == 0) {
+        return;
+    }
+    // Shift back the entries behind the removed one that would no longer
+    // be found by probing from their home slot.
+    for (size_t j = (i + 1) & mask; table[j].mutation_id != 0; j = (j + 1) & mask) {
+        size_t home = table[j].hash & mask;
+        bool reachable = i <= j ? (i < home && home <= j) : (i < home || home <= j);
+        if (!reachable) {
+            table[i] = table[j];
+            i = j;
+        }
+    }
+    table[i].mutation_id = 0;
+    --numEntries;
+}
+
+void CheckpointIndex::reposition(const std::vector<size_t> &moved) {
+    std::vector<index_entry>::iterator it = table.begin();
+    for (; it != table.end(); ++it) {
+        if (it->mutation_id != 0) {
+            it->position = static_cast<uint32_t>(moved[it->position]);
+        }
+    }
+}
+
+void CheckpointIndex::grow() {
+    std::vector<index_entry> oldTable(table.size() * 2);
+    oldTable.swap(table);
+    size_t mask = table.size() - 1;
+    std::vector<index_entry>::iterator it = oldTable.begin();
+    for (; it != oldTable.end(); ++it) {
+        if (it->mutation_id != 0) {
+            size_t i = it->hash & mask;
+            while (table[i].mutation_id != 0) {
+                i = (i + 1) & mask;
+            }
+            table[i] = *it;
+        }
+    }
+}
+
 Checkpoint::~Checkpoint() {
     getLogger()->log(EXTENSION_LOG_INFO, NULL,
                      "Checkpoint %llu for vbucket %d is purged from memory.\n",
@@ -54,12 +220,13 @@ void Checkpoint::setState(checkpoint_state state) {
 
 void Checkpoint::popBackCheckpointEndItem() {
     if (toWrite.size() > 0 && toWrite.back()->getOperation() == queue_op_checkpoint_end) {
+        keyIndex.erase(toWrite.back()->getKey(), toWrite);
         toWrite.pop_back();
     }
 }
 
 bool Checkpoint::keyExists(const std::string &key) {
-    return keyIndex.find(key) != keyIndex.end();
+    return keyIndex.find(key, toWrite) != NULL;
 }
 
 queue_dirty_t Checkpoint::queueDirty(const queued_item &qi, CheckpointManager *checkpointManager) {
@@ -68,20 +235,20 @@ queue_dirty_t Checkpoint::queueDirty(const queued_item &qi, CheckpointManager *c
     uint64_t newMutationId = checkpointManager->nextMutationId();
     queue_dirty_t rv;
 
-    checkpoint_index::iterator it = keyIndex.find(qi->getKey());
+    index_entry *entry = keyIndex.find(qi->getKey(), toWrite);
     // Check if this checkpoint already had an item for the same key.
-    if (it != keyIndex.end()) {
-        std::list<queued_item>::iterator currPos = it->second.position;
-        uint64_t currMutationId = it->second.mutation_id;
+    if (entry) {
+        CheckpointLog::iterator currPos(&toWrite, entry->position);
+        uint64_t currMutationId = entry->mutation_id;
         CheckpointCursor &pcursor = checkpointManager->persistenceCursor;
 
         if (*(pcursor.currentCheckpoint) == this) {
             // If the existing item is in the left-hand side of the item pointed by the
             // persistence cursor, decrease the persistence cursor's offset by 1.
             const std::string &key = (*(pcursor.currentPos))->getKey();
-            checkpoint_index::iterator ita = keyIndex.find(key);
-            if (ita != keyIndex.end()) {
-                uint64_t mutationId = ita->second.mutation_id;
+            index_entry *ita = keyIndex.find(key, toWrite);
+            if (ita) {
+                uint64_t mutationId = ita->mutation_id;
                 if (currMutationId <= mutationId) {
                     checkpointManager->decrCursorOffset_UNLOCKED(pcursor, 1);
                 }
@@ -99,9 +266,9 @@ queue_dirty_t Checkpoint::queueDirty(const queued_item &qi, CheckpointManager *c
 
             if (*(map_it->second.currentCheckpoint) == this) {
                 const std::string &key = (*(map_it->second.currentPos))->getKey();
-                checkpoint_index::iterator ita = keyIndex.find(key);
-                if (ita != keyIndex.end()) {
-                    uint64_t mutationId = ita->second.mutation_id;
+                index_entry *ita = keyIndex.find(key, toWrite);
+                if (ita) {
+                    uint64_t mutationId = ita->mutation_id;
                     if (currMutationId <= mutationId) {
                         checkpointManager->decrCursorOffset_UNLOCKED(map_it->second, 1);
                     }
@@ -113,82 +280,158 @@ queue_dirty_t Checkpoint::queueDirty(const queued_item &qi, CheckpointManager *c
             }
         }
 
-        queued_item &existing_itm = *currPos;
+        queued_item existing_itm = *currPos;
         existing_itm->setOperation(qi->getOperation());
         existing_itm->setQueuedTime(qi->getQueuedTime());
-        toWrite.push_back(existing_itm);
-        // Remove the existing item for the same key from the list.
-        toWrite.erase(currPos);
+        // Move the existing item for the same key to the tail and point the index at it.
+        entry->position = static_cast<uint32_t>(toWrite.push_back(existing_itm));
+        entry->mutation_id = newMutationId;
+        toWrite.erase(currPos.getPosition());
         rv = EXISTING_ITEM;
+        maybeCompact(checkpointManager);
     } else {
         if (qi->getOperation() == queue_op_set || qi->getOperation() == queue_op_del) {
             ++numItems;
         }
         rv = NEW_ITEM;
-        // Push the new item into the list
-        toWrite.push_back(qi);
-    }
-
-    if (qi->getKey().size() > 0) {
-        std::list<queued_item>::iterator last = toWrite.end();
-        // --last is okay as the list is not empty now.
-        index_entry entry = {--last, newMutationId};
-        // Set the index of the key to the new item that is pushed back into the list.
-        keyIndex[qi->getKey()] = entry;
-        if (rv == NEW_ITEM) {
-            size_t newEntrySize = qi->getKey().size() + sizeof(index_entry) + sizeof(queued_item);
-            memOverhead += newEntrySize;
-            stats.memOverhead.incr(newEntrySize);
-            assert(stats.memOverhead.get() < GIGANTOR);
+        // Push the new item into the log
+        size_t pos = toWrite.push_back(qi);
+        if (qi->getKey().size() > 0) {
+            keyIndex.set(qi->getKey(), toWrite, pos, newMutationId);
         }
     }
+
+    updateMemOverhead();
     return rv;
 }
 
-size_t Checkpoint::mergePrevCheckpoint(Checkpoint *pPrevCheckpoint) {
-    size_t numNewItems = 0;
-    size_t newEntryMemOverhead = 0;
-    std::list<queued_item>::reverse_iterator rit = pPrevCheckpoint->rbegin();
-
+size_t Checkpoint::mergePrevCheckpoint(Checkpoint *pPrevCheckpoint,
+                                       CheckpointManager *checkpointManager) {
     getLogger()->log(EXTENSION_LOG_INFO, NULL,
                      "Collapse the checkpoint %llu into the checkpoint %llu for vbucket %d.\n",
                      pPrevCheckpoint->getId(), checkpointId, vbucketId);
 
-    for (; rit != pPrevCheckpoint->rend(); ++rit) {
-        const std::string &key = (*rit)->getKey();
-        if (key.size() == 0) {
-            continue;
+    std::vector<queued_item> items;
+    CheckpointLog::iterator it = pPrevCheckpoint->begin();
+    for (; it != pPrevCheckpoint->end(); ++it) {
+        const std::string &key = (*it)->getKey();
+        if (key.size() > 0 && !keyExists(key)) {
+            items.push_back(*it);
         }
-        checkpoint_index::iterator it = keyIndex.find(key);
-        if (it == keyIndex.end()) {
-            std::list<queued_item>::iterator pos = toWrite.begin();
-            // Skip the first two meta items
-            ++pos; ++pos;
-            toWrite.insert(pos, *rit);
-            index_entry entry = {--pos, pPrevCheckpoint->getMutationIdForKey(key)};
-            keyIndex[key] = entry;
-            newEntryMemOverhead += key.size() + sizeof(index_entry);
-            ++numItems;
-            ++numNewItems;
+    }
+    if (items.empty()) {
+        return 0;
+    }
+
+    // Insert the new items right behind the dummy and checkpoint_start items.
+    std::vector<size_t> moved;
+    size_t pos = toWrite.insertAfterHead(items, moved);
+    keyIndex.reposition(moved);
+    repositionCursors(checkpointManager, moved);
+
+    std::vector<queued_item>::iterator iit = items.begin();
+    for (; iit != items.end(); ++iit, ++pos) {
+        const std::string &key = (*iit)->getKey();
+        keyIndex.set(key, toWrite, pos, pPrevCheckpoint->getMutationIdForKey(key));
+    }
+    numItems += items.size();
+    updateMemOverhead();
+    return items.size();
+}
+
+uint64_t Checkpoint::getMutationIdForKey(const std::string &key) {
+    index_entry *entry = keyIndex.find(key, toWrite);
+    return entry ? entry->mutation_id : 0;
+}
+
+void Checkpoint::repositionCursors(CheckpointManager *checkpointManager,
+                                   const std::vector<size_t> &moved) {
+    CheckpointCursor &pcursor = checkpointManager->persistenceCursor;
+    if (*(pcursor.currentCheckpoint) == this) {
+        pcursor.currentPos = CheckpointLog::iterator(&toWrite,
+                                                     moved[pcursor.currentPos.getPosition()]);
+    }
+    std::map<const std::string, CheckpointCursor>::iterator map_it;
+    for (map_it = checkpointManager->tapCursors.begin();
+         map_it != checkpointManager->tapCursors.end(); ++map_it) {
+        CheckpointCursor &cursor = map_it->second;
+        if (*(cursor.currentCheckpoint) == this) {
+            cursor.currentPos = CheckpointLog::iterator(&toWrite,
+                                                        moved[cursor.currentPos.getPosition()]);
         }
     }
-    memOverhead += newEntryMemOverhead;
-    stats.memOverhead.incr(newEntryMemOverhead);
+}
+
+void Checkpoint::maybeCompact(CheckpointManager *checkpointManager) {
+    size_t empty = toWrite.getNumEmptySlots();
+    if (empty < CheckpointLog::CHUNK_SIZE || empty <= toWrite.size()) {
+        return;
+    }
+    std::vector<size_t> moved;
+    toWrite.compact(moved);
+    keyIndex.reposition(moved);
+    repositionCursors(checkpointManager, moved);
+}
+
+void Checkpoint::updateMemOverhead() {
+    size_t current = toWrite.memorySize() + keyIndex.memorySize();
+    if (current > memOverhead) {
+        stats.memOverhead.incr(current - memOverhead);
+    } else {
+        stats.memOverhead.decr(memOverhead - current);
+    }
+    memOverhead = current;
     assert(stats.memOverhead.get() < GIGANTOR);
-    return numNewItems;
 }
 
-uint64_t Checkpoint::getMutationIdForKey(const std::string &key) {
-    uint64_t mid = 0;
-    checkpoint_index::iterator it = keyIndex.find(key);
-    if (it != keyIndex.end()) {
-        mid = it->second.mutation_id;
+struct PendingQueueItem {
+    PendingQueueItem(const queued_item &qi, const RCPtr<VBucket> &vb)
+        : item(qi), vbucket(vb), next(NULL) { }
+
+    queued_item       item;
+    RCPtr<VBucket>    vbucket;
+    PendingQueueItem *next;
+};
+
+CheckpointManager::QueueLockHolder::QueueLockHolder(CheckpointManager &m, bool tryOnly)
+    : manager(m), lh(m.queueLock, NULL, true), timed(!tryOnly), acquired(0) {
+    if (timed) {
+        hrtime_t start = gethrtime();
+        if (!lh.isLocked()) {
+            lh.lock();
+        }
+        acquired = gethrtime();
+        manager.stats.checkpointLockWaitHisto.add((acquired - start) / 1000);
+    }
+    if (lh.isLocked()) {
+        manager.appendPendingItems();
+    }
+}
+
+void CheckpointManager::QueueLockHolder::unlock() {
+    while (lh.isLocked()) {
+        manager.appendPendingItems();
+        if (timed) {
+            manager.stats.checkpointLockHoldHisto.add((gethrtime() - acquired) / 1000);
+            timed = false;
+        }
+        lh.unlock();
+        // A writer that published an item after the append above may have
+        // found the lock still held, and relies on us to append it.
+        if (!manager.pendingItems || !lh.trylock()) {
+            break;
+        }
     }
-    return mid;
 }
 
 CheckpointManager::~CheckpointManager() {
     LockHolder lh(queueLock);
+    PendingQueueItem *pending = pendingItems.swap(NULL);
+    while (pending) {
+        PendingQueueItem *next = pending->next;
+        delete pending;
+        pending = next;
+    }
     std::list<Checkpoint*>::iterator it = checkpointList.begin();
     while(it != checkpointList.end()) {
         delete *it;
@@ -206,7 +449,7 @@ uint64_t CheckpointManager::getOpenCheckpointId_UNLOCKED() {
 }
 
 uint64_t CheckpointManager::getOpenCheckpointId() {
-    LockHolder lh(queueLock);
+    QueueLockHolder lh(*this);
     return getOpenCheckpointId_UNLOCKED();
 }
 
@@ -219,7 +462,7 @@ uint64_t CheckpointManager::getLastClosedCheckpointId_UNLOCKED() {
 }
 
 uint64_t CheckpointManager::getLastClosedCheckpointId() {
-    LockHolder lh(queueLock);
+    QueueLockHolder lh(*this);
     return getLastClosedCheckpointId_UNLOCKED();
 }
 
@@ -231,7 +474,7 @@ void CheckpointManager::setOpenCheckpointId_UNLOCKED(uint64_t id) {
         checkpointList.back()->setId(id);
         // Update the checkpoint_start item with the new Id.
         queued_item qi = createCheckpointItem(id, vbucketId, queue_op_checkpoint_start);
-        std::list<queued_item>::iterator it = ++(checkpointList.back()->begin());
+        CheckpointLog::iterator it = ++(checkpointList.back()->begin());
         *it = qi;
     }
 }
@@ -293,7 +536,7 @@ bool CheckpointManager::addNewCheckpoint_UNLOCKED(uint64_t id) {
 }
 
 bool CheckpointManager::addNewCheckpoint(uint64_t id) {
-    LockHolder lh(queueLock);
+    QueueLockHolder lh(*this);
     return addNewCheckpoint_UNLOCKED(id);
 }
 
@@ -317,12 +560,12 @@ bool CheckpointManager::closeOpenCheckpoint_UNLOCKED(uint64_t id) {
 }
 
 bool CheckpointManager::closeOpenCheckpoint(uint64_t id) {
-    LockHolder lh(queueLock);
+    QueueLockHolder lh(*this);
     return closeOpenCheckpoint_UNLOCKED(id);
 }
 
 void CheckpointManager::registerPersistenceCursor() {
-    LockHolder lh(queueLock);
+    QueueLockHolder lh(*this);
     assert(checkpointList.size() > 0);
     persistenceCursor.currentCheckpoint = checkpointList.begin();
     persistenceCursor.currentPos = checkpointList.front()->begin();
@@ -331,7 +574,7 @@ void CheckpointManager::registerPersistenceCursor() {
 
 bool CheckpointManager::registerTAPCursor(const std::string &name, uint64_t checkpointId,
                                           bool closedCheckpointOnly, bool alwaysFromBeginning) {
-    LockHolder lh(queueLock);
+    QueueLockHolder lh(*this);
     return registerTAPCursor_UNLOCKED(name,
                                       checkpointId,
                                       closedCheckpointOnly,
@@ -383,7 +626,7 @@ bool CheckpointManager::registerTAPCursor_UNLOCKED(const std::string &name,
         (*it)->registerCursorName(name);
     } else {
         size_t offset = 0;
-        std::list<queued_item>::iterator curr;
+        CheckpointLog::iterator curr;
 
         getLogger()->log(EXTENSION_LOG_DEBUG, NULL,
                          "Checkpoint %llu for vbucket %d exists in memory. "
@@ -416,7 +659,7 @@ bool CheckpointManager::registerTAPCursor_UNLOCKED(const std::string &name,
 }
 
 bool CheckpointManager::removeTAPCursor(const std::string &name) {
-    LockHolder lh(queueLock);
+    QueueLockHolder lh(*this);
 
     getLogger()->log(EXTENSION_LOG_INFO, NULL,
                      "Remove the checkpoint cursor with the name \"%s\" from vbucket %d.\n",
@@ -442,7 +685,7 @@ bool CheckpointManager::removeTAPCursor(const std::string &name) {
 }
 
 uint64_t CheckpointManager::getCheckpointIdForTAPCursor(const std::string &name) {
-    LockHolder lh(queueLock);
+    QueueLockHolder lh(*this);
     std::map<const std::string, CheckpointCursor>::iterator it = tapCursors.find(name);
     if (it == tapCursors.end()) {
         return 0;
@@ -452,17 +695,17 @@ uint64_t CheckpointManager::getCheckpointIdForTAPCursor(const std::string &name)
 }
 
 size_t CheckpointManager::getNumOfTAPCursors() {
-    LockHolder lh(queueLock);
+    QueueLockHolder lh(*this);
     return tapCursors.size();
 }
 
 size_t CheckpointManager::getNumCheckpoints() {
-    LockHolder lh(queueLock);
+    QueueLockHolder lh(*this);
     return checkpointList.size();
 }
 
 std::list<std::string> CheckpointManager::getTAPCursorNames() {
-    LockHolder lh(queueLock);
+    QueueLockHolder lh(*this);
     std::list<std::string> cursor_names;
     std::map<const std::string, CheckpointCursor>::iterator tap_it = tapCursors.begin();
         for (; tap_it != tapCursors.end(); ++tap_it) {
@@ -495,7 +738,7 @@ size_t CheckpointManager::removeClosedUnrefCheckpoints(const RCPtr<VBucket> &vbu
                                                        bool &newOpenCheckpointCreated) {
 
     // This function is executed periodically by the non-IO dispatcher.
-    LockHolder lh(queueLock);
+    QueueLockHolder lh(*this);
     assert(vbucket);
     uint64_t oldCheckpointId = 0;
     bool canCreateNewCheckpoint = false;
@@ -635,7 +878,7 @@ void CheckpointManager::collapseClosedCheckpoints(std::list<Checkpoint*> &collap
         ++rit; ++rit;// Move to the second lastest closed checkpoint.
         size_t numDuplicatedItems = 0, numMetaItems = 0;
         for (; rit != checkpointList.rend(); ++rit) {
-            size_t numAddedItems = (*lastClosedChk)->mergePrevCheckpoint(*rit);
+            size_t numAddedItems = (*lastClosedChk)->mergePrevCheckpoint(*rit, this);
             numDuplicatedItems += ((*rit)->getNumItems() - numAddedItems);
             numMetaItems += 2; // checkpoint start and end meta items
             slowCursors.insert((*rit)->getCursorNameList().begin(),
@@ -682,8 +925,42 @@ void CheckpointManager::collapseClosedCheckpoints(std::list<Checkpoint*> &collap
     }
 }
 
-bool CheckpointManager::queueDirty(const queued_item &qi, const RCPtr<VBucket> &vbucket) {
-    LockHolder lh(queueLock);
+void CheckpointManager::queueDirty(const queued_item &qi, const RCPtr<VBucket> &vbucket) {
+    PendingQueueItem *pending = new PendingQueueItem(qi, vbucket);
+    do {
+        pending->next = pendingItems.get();
+    } while (!pendingItems.cas(pending->next, pending));
+
+    QueueLockHolder lh(*this, true);
+    if (!lh.isLocked()) {
+        ++stats.checkpointDeferredItems;
+    }
+}
+
+void CheckpointManager::appendPendingItems() {
+    PendingQueueItem *pending = pendingItems.swap(NULL);
+    // The list is in reverse publication order.
+    PendingQueueItem *ordered = NULL;
+    while (pending) {
+        PendingQueueItem *next = pending->next;
+        pending->next = ordered;
+        ordered = pending;
+        pending = next;
+    }
+    while (ordered) {
+        PendingQueueItem *next = ordered->next;
+        if (queueDirty_UNLOCKED(ordered->item, ordered->vbucket)) {
+            ++stats.queue_size;
+            ++stats.totalEnqueued;
+            ordered->vbucket->doStatsForQueueing(*ordered->item, ordered->item->size());
+        }
+        delete ordered;
+        ordered = next;
+    }
+}
+
+bool CheckpointManager::queueDirty_UNLOCKED(const queued_item &qi,
+                                            const RCPtr<VBucket> &vbucket) {
     if (vbucket->getState() != vbucket_state_active &&
         checkpointList.back()->getState() == closed) {
         // Replica vbucket might receive items from the master even if the current open checkpoint
@@ -744,7 +1021,7 @@ void CheckpointManager::getAllItemsFromCurrentPosition(CheckpointCursor &cursor,
 }
 
 void CheckpointManager::getAllItemsForPersistence(std::vector<queued_item> &items) {
-    LockHolder lh(queueLock);
+    QueueLockHolder lh(*this);
     // Get all the items up to the end of the current open checkpoint.
     getAllItemsFromCurrentPosition(persistenceCursor, 0, items);
     persistenceCursor.offset = numItems;
@@ -755,26 +1032,104 @@ void CheckpointManager::getAllItemsForPersistence(std::vector<queued_item> &item
                      items.size(), vbucketId);
 }
 
-void CheckpointManager::getAllItemsForTAPConnection(const std::string &name,
-                                                    std::vector<queued_item> &items) {
-    LockHolder lh(queueLock);
+bool CheckpointManager::getItemsForPersistence(std::vector<queued_item> &items,
+                                               size_t maxItems, size_t maxBytes) {
+    QueueLockHolder lh(*this);
+    std::list<Checkpoint*>::iterator startCheckpoint = persistenceCursor.currentCheckpoint;
+    size_t numFetched = 0;
+    size_t bytes = 0;
+    bool hasMore = true;
+    while (numFetched < maxItems && (numFetched == 0 || bytes < maxBytes)) {
+        if (!moveCursorToNextItem(persistenceCursor)) {
+            hasMore = false;
+            break;
+        }
+        const queued_item &qi = *(persistenceCursor.currentPos);
+        items.push_back(qi);
+        bytes += qi->size();
+        ++numFetched;
+    }
+    if (hasMore) {
+        CheckpointLog::iterator next = persistenceCursor.currentPos;
+        if (++next == (*(persistenceCursor.currentCheckpoint))->end() &&
+            (*(persistenceCursor.currentCheckpoint))->getState() == opened) {
+            hasMore = false;
+        }
+    }
+
+    if (!hasMore) {
+        persistenceCursor.offset = numItems;
+        pCursorPreCheckpointId = getLastClosedCheckpointId_UNLOCKED();
+    } else if (persistenceCursor.currentCheckpoint != startCheckpoint) {
+        // All the checkpoints before the cursor's current one are handed to the flusher.
+        std::list<Checkpoint*>::iterator prev = persistenceCursor.currentCheckpoint;
+        --prev;
+        pCursorPreCheckpointId = (*prev)->getId();
+    }
+
+    getLogger()->log(EXTENSION_LOG_DEBUG, NULL,
+                     "Grab %ld items through the persistence cursor from vbucket %d.\n",
+                     numFetched, vbucketId);
+    return hasMore;
+}
+
+void CheckpointManager::getItemsForCursor(const std::string &name,
+                                          std::vector<queued_item> &items,
+                                          size_t maxItems, size_t maxBytes,
+                                          bool &isLastMutationItem) {
+    QueueLockHolder lh(*this);
+    isLastMutationItem = false;
     std::map<const std::string, CheckpointCursor>::iterator it = tapCursors.find(name);
     if (it == tapCursors.end()) {
-        getLogger()->log(EXTENSION_LOG_DEBUG, NULL,
-                         "The cursor for TAP connection \"%s\" is not found in the checkpoint.\n",
-                         name.c_str());
+        getLogger()->log(EXTENSION_LOG_WARNING, NULL,
+                         "The cursor with name \"%s\" is not found in "
+                         "the checkpoint of vbucket %d.\n",
+                         name.c_str(), vbucketId);
+        return;
+    }
+    if (checkpointList.back()->getId() == 0) {
+        getLogger()->log(EXTENSION_LOG_INFO, NULL,
+                         "VBucket %d is still in backfill phase that doesn't allow "
+                         " the tap cursor to fetch an item from it's current checkpoint.\n",
+                         vbucketId);
         return;
     }
-    getAllItemsFromCurrentPosition(it->second, 0, items);
-    it->second.offset = numItems;
 
-    getLogger()->log(EXTENSION_LOG_DEBUG, NULL,
-                     "Grab %ld items through the tap cursor with name \"%s\" from vbucket %d.\n",
-                     items.size(), name.c_str(), vbucketId);
+    CheckpointCursor &cursor = it->second;
+    size_t numFetched = 0;
+    size_t bytes = 0;
+    while (numFetched < maxItems && (numFetched == 0 || bytes < maxBytes)) {
+        if (numFetched > 0) {
+            // Leave the last mutation of a checkpoint for a batch of its own.
+            CheckpointLog::iterator next = cursor.currentPos;
+            if (++next != (*(cursor.currentCheckpoint))->end()) {
+                enum queue_operation op = (*next)->getOperation();
+                if ((op == queue_op_set || op == queue_op_del) &&
+                    (++next == (*(cursor.currentCheckpoint))->end() ||
+                     (*next)->getOperation() == queue_op_checkpoint_end)) {
+                    break;
+                }
+            }
+        }
+        if (!moveCursorToNextItem(cursor)) {
+            break;
+        }
+        const queued_item &qi = *(cursor.currentPos);
+        items.push_back(qi);
+        bytes += qi->size();
+        ++numFetched;
+        if (qi->getOperation() == queue_op_checkpoint_end) {
+            break;
+        }
+        if (isLastMutationItemInCheckpoint(cursor)) {
+            isLastMutationItem = numFetched == 1;
+            break;
+        }
+    }
 }
 
 queued_item CheckpointManager::nextItem(const std::string &name, bool &isLastMutationItem) {
-    LockHolder lh(queueLock);
+    QueueLockHolder lh(*this);
     isLastMutationItem = false;
     std::map<const std::string, CheckpointCursor>::iterator it = tapCursors.find(name);
     if (it == tapCursors.end()) {
@@ -855,7 +1210,7 @@ queued_item CheckpointManager::nextItemFromOpenedCheckpoint(CheckpointCursor &cu
 }
 
 void CheckpointManager::clear(vbucket_state_t vbState) {
-    LockHolder lh(queueLock);
+    QueueLockHolder lh(*this);
     std::list<Checkpoint*>::iterator it = checkpointList.begin();
     // Remove all the checkpoints.
     while(it != checkpointList.end()) {
@@ -890,7 +1245,7 @@ void CheckpointManager::resetCursors() {
 }
 
 void CheckpointManager::resetTAPCursors(const std::list<std::string> &cursors) {
-    LockHolder lh(queueLock);
+    QueueLockHolder lh(*this);
     std::list<std::string>::const_iterator it = cursors.begin();
     for (; it != cursors.end(); it++) {
         registerTAPCursor_UNLOCKED(*it, getOpenCheckpointId_UNLOCKED(), false, true);
@@ -917,6 +1272,36 @@ bool CheckpointManager::moveCursorToNextCheckpoint(CheckpointCursor &cursor) {
     return true;
 }
 
+bool CheckpointManager::moveCursorToNextItem(CheckpointCursor &cursor) {
+    Checkpoint *checkpoint = *(cursor.currentCheckpoint);
+    // The cursor already reached to the beginning of the checkpoint that had "open" state
+    // when registered.
+    if (cursor.closedCheckpointOnly &&
+        (checkpoint->getState() == opened ||
+         cursor.openChkIdAtRegistration <= checkpoint->getId())) {
+        return false;
+    }
+
+    ++(cursor.currentPos);
+    if (cursor.currentPos == checkpoint->end()) {
+        if (!moveCursorToNextCheckpoint(cursor)) {
+            --(cursor.currentPos);
+            return false;
+        }
+        checkpoint = *(cursor.currentCheckpoint);
+        if (cursor.closedCheckpointOnly && checkpoint->getState() == opened) {
+            return false;
+        }
+        // Move the cursor to point to the actual first item.
+        if (++(cursor.currentPos) == checkpoint->end()) {
+            --(cursor.currentPos);
+            return false;
+        }
+    }
+    ++(cursor.offset);
+    return true;
+}
+
 uint64_t CheckpointManager::checkOpenCheckpoint_UNLOCKED(bool forceCreation, bool timeBound) {
     int checkpoint_id = 0;
 
@@ -944,7 +1329,7 @@ uint64_t CheckpointManager::checkOpenCheckpoint_UNLOCKED(bool forceCreation, boo
 }
 
 bool CheckpointManager::eligibleForEviction(const std::string &key) {
-    LockHolder lh(queueLock);
+    QueueLockHolder lh(*this);
     uint64_t smallest_mid = 0;
 
     // Get the mutation id of the item pointed by the slowest cursor.
@@ -978,7 +1363,7 @@ bool CheckpointManager::eligibleForEviction(const std::string &key) {
 }
 
 size_t CheckpointManager::getNumItemsForTAPConnection(const std::string &name) {
-    LockHolder lh(queueLock);
+    QueueLockHolder lh(*this);
     size_t remains = 0;
     std::map<const std::string, CheckpointCursor>::iterator it = tapCursors.find(name);
     if (it != tapCursors.end()) {
@@ -988,7 +1373,7 @@ size_t CheckpointManager::getNumItemsForTAPConnection(const std::string &name) {
 }
 
 void CheckpointManager::decrTapCursorFromCheckpointEnd(const std::string &name) {
-    LockHolder lh(queueLock);
+    QueueLockHolder lh(*this);
     std::map<const std::string, CheckpointCursor>::iterator it = tapCursors.find(name);
     if (it != tapCursors.end() &&
         (*(it->second.currentPos))->getOperation() == queue_op_checkpoint_end) {
@@ -998,7 +1383,7 @@ void CheckpointManager::decrTapCursorFromCheckpointEnd(const std::string &name)
 }
 
 bool CheckpointManager::isLastMutationItemInCheckpoint(CheckpointCursor &cursor) {
-    std::list<queued_item>::iterator it = cursor.currentPos;
+    CheckpointLog::iterator it = cursor.currentPos;
     ++it;
     if (it == (*(cursor.currentCheckpoint))->end() ||
         (*it)->getOperation() == queue_op_checkpoint_end) {
@@ -1008,7 +1393,7 @@ bool CheckpointManager::isLastMutationItemInCheckpoint(CheckpointCursor &cursor)
 }
 
 void CheckpointManager::checkAndAddNewCheckpoint(uint64_t id) {
-    LockHolder lh(queueLock);
+    QueueLockHolder lh(*this);
 
     // Ignore CHECKPOINT_START message with ID 0 as 0 is reserved for representing backfill.
     if (id == 0) {
@@ -1067,7 +1452,7 @@ void CheckpointManager::checkAndAddNewCheckpoint(uint64_t id) {
         size_t numDuplicatedItems = 0, numMetaItems = 0;
         // Collapse all checkpoints.
         for (; rit != checkpointList.rend(); ++rit) {
-            size_t numAddedItems = checkpointList.back()->mergePrevCheckpoint(*rit);
+            size_t numAddedItems = checkpointList.back()->mergePrevCheckpoint(*rit, this);
             numDuplicatedItems += ((*rit)->getNumItems() - numAddedItems);
             numMetaItems += 2; // checkpoint start and end meta items
             delete *rit;
@@ -1090,14 +1475,14 @@ void CheckpointManager::checkAndAddNewCheckpoint(uint64_t id) {
 }
 
 bool CheckpointManager::hasNext(const std::string &name) {
-    LockHolder lh(queueLock);
+    QueueLockHolder lh(*this);
     std::map<const std::string, CheckpointCursor>::iterator it = tapCursors.find(name);
     if (it == tapCursors.end() || getOpenCheckpointId_UNLOCKED() == 0) {
         return false;
     }
 
     bool hasMore = true;
-    std::list<queued_item>::iterator curr = it->second.currentPos;
+    CheckpointLog::iterator curr = it->second.currentPos;
     ++curr;
     if (curr == (*(it->second.currentCheckpoint))->end() &&
         (*(it->second.currentCheckpoint))->getState() == opened) {
@@ -1121,9 +1506,9 @@ queued_item CheckpointManager::createCheckpointItem(uint64_t id,
 }
 
 bool CheckpointManager::hasNextForPersistence() {
-    LockHolder lh(queueLock);
+    QueueLockHolder lh(*this);
     bool hasMore = true;
-    std::list<queued_item>::iterator curr = persistenceCursor.currentPos;
+    CheckpointLog::iterator curr = persistenceCursor.currentPos;
     ++curr;
     if (curr == (*(persistenceCursor.currentCheckpoint))->end() &&
         (*(persistenceCursor.currentCheckpoint))->getState() == opened) {
@@ -1133,7 +1518,7 @@ bool CheckpointManager::hasNextForPersistence() {
 }
 
 uint64_t CheckpointManager::createNewCheckpoint() {
-    LockHolder lh(queueLock);
+    QueueLockHolder lh(*this);
     Checkpoint *currOpenChpt = checkpointList.back();
     uint64_t cptId = currOpenChpt->getId();
 
@@ -1164,7 +1549,7 @@ void CheckpointManager::decrCursorPos_UNLOCKED(CheckpointCursor &cursor) {
 }
 
 uint64_t CheckpointManager::getPersistenceCursorPreChkId() {
-    LockHolder lh(queueLock);
+    QueueLockHolder lh(*this);
     return pCursorPreCheckpointId;
 }
 
@@ -1182,6 +1567,14 @@ void CheckpointConfig::addConfigChangeListener(EventuallyPersistentEngine &engin
                               new CheckpointConfigChangeListener(engine.getCheckpointConfig()));
     configuration.addValueChangedListener("keep_closed_chks",
                               new CheckpointConfigChangeListener(engine.getCheckpointConfig()));
+    configuration.addValueChangedListener("chk_flush_batch_items",
+                              new CheckpointConfigChangeListener(engine.getCheckpointConfig()));
+    configuration.addValueChangedListener("chk_flush_batch_bytes",
+                              new CheckpointConfigChangeListener(engine.getCheckpointConfig()));
+    configuration.addValueChangedListener("chk_tap_batch_items",
+                              new CheckpointConfigChangeListener(engine.getCheckpointConfig()));
+    configuration.addValueChangedListener("chk_tap_batch_bytes",
+                              new CheckpointConfigChangeListener(engine.getCheckpointConfig()));
 }
 
 CheckpointConfig::CheckpointConfig(EventuallyPersistentEngine &e) {
@@ -1192,6 +1585,10 @@ CheckpointConfig::CheckpointConfig(EventuallyPersistentEngine &e) {
     inconsistentSlaveCheckpoint = config.isInconsistentSlaveChk();
     itemNumBasedNewCheckpoint = config.isItemNumBasedNewChk();
     keepClosedCheckpoints = config.isKeepClosedChks();
+    flushBatchItems = config.getChkFlushBatchItems();
+    flushBatchBytes = config.getChkFlushBatchBytes();
+    tapBatchItems = config.getChkTapBatchItems();
+    tapBatchBytes = config.getChkTapBatchBytes();
 }
 
 bool CheckpointConfig::validateCheckpointMaxItemsParam(size_t checkpoint_max_items) {
@@ -1255,7 +1652,7 @@ void CheckpointConfig::setMaxCheckpoints(size_t value) {
 }
 
 void CheckpointManager::addStats(ADD_STAT add_stat, const void *cookie) {
-    LockHolder lh(queueLock);
+    QueueLockHolder lh(*this);
     char buf[256];
 
     snprintf(buf, sizeof(buf), "vb_%d:open_checkpoint_id", vbucketId);
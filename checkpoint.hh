@@ -6,6 +6,7 @@
 #include <list>
 #include <map>
 #include <set>
+#include <vector>
 
 #include "common.hh"
 #include "atomic.hh"
@@ -24,6 +25,11 @@
 #define DEFAULT_MAX_CHECKPOINTS 2
 #define MAX_CHECKPOINTS_UPPER_BOUND 5
 
+#define DEFAULT_FLUSH_BATCH_ITEMS 10000
+#define DEFAULT_FLUSH_BATCH_BYTES 16777216 // 16 MB.
+#define DEFAULT_TAP_BATCH_ITEMS 64
+#define DEFAULT_TAP_BATCH_BYTES 262144 // 256 KB.
+
 /**
  * The state of a given checkpoint.
  */
@@ -32,18 +38,259 @@ typedef enum {
     closed  //!< The checkpoint is not open.
 } checkpoint_state;
 
+/**
+ * The items queued in a checkpoint, in the order they were queued.
+ *
+ * Items are appended to fixed size chunks of slots, so queueing an item
+ * only allocates the occasional chunk and walking the log walks
+ * contiguous memory.  An item superseded by a later mutation of the same
+ * key leaves an empty slot behind, which iterators skip; the checkpoint
+ * compacts the log once most of its slots are empty.
+ *
+ * Iterators are positions in the log.  They stay valid while items are
+ * appended or erased, but not across compact() or insertAfterHead().
+ */
+class CheckpointLog {
+public:
+
+    /**
+     * Bidirectional iterator over the items in a log.
+     */
+    class iterator {
+    public:
+        iterator() : log(NULL), pos(0) { }
+
+        iterator(CheckpointLog *l, size_t p) : log(l), pos(p) { }
+
+        queued_item &operator*() const {
+            return log->slot(pos);
+        }
+
+        iterator &operator++() {
+            pos = log->nextPos(pos);
+            return *this;
+        }
+
+        iterator &operator--() {
+            pos = log->prevPos(pos);
+            return *this;
+        }
+
+        bool operator==(const iterator &other) const {
+            return pos == other.pos && log == other.log;
+        }
+
+        bool operator!=(const iterator &other) const {
+            return !(*this == other);
+        }
+
+        size_t getPosition() const {
+            return pos;
+        }
+
+    private:
+        friend class CheckpointLog;
+
+        CheckpointLog *log;
+        size_t         pos;
+    };
+
+    CheckpointLog() : used(0), numItems(0) { }
+
+    ~CheckpointLog();
+
+    iterator begin() {
+        return iterator(this, (used > 0 && slot(0).get()) ? 0 : nextPos(0));
+    }
+
+    iterator end() {
+        return iterator(this, used);
+    }
+
+    /**
+     * Append an item and return its position.
+     */
+    size_t push_back(const queued_item &qi);
+
+    /**
+     * Remove the item at the given position, leaving its slot empty.
+     */
+    void erase(size_t pos) {
+        assert(pos < used && slot(pos).get());
+        slot(pos).reset();
+        --numItems;
+    }
+
+    /**
+     * Remove the last item.
+     */
+    void pop_back();
+
+    /**
+     * Get the last item (the log must not be empty).
+     */
+    queued_item &back() {
+        return slot(prevPos(used));
+    }
+
+    queued_item &at(size_t pos) {
+        return slot(pos);
+    }
+
+    /**
+     * Get the number of items in the log.
+     */
+    size_t size() const {
+        return numItems;
+    }
+
+    /**
+     * Get the number of slots left empty by erased items.
+     */
+    size_t getNumEmptySlots() const {
+        return used - numItems;
+    }
+
+    /**
+     * Move all items to the front of the log, dropping the empty slots.
+     *
+     * @param moved filled in with the new position of the item at each
+     *              old position (and with the new end at the old end)
+     */
+    void compact(std::vector<size_t> &moved) {
+        std::vector<queued_item> none;
+        (void)rebuild(none, moved);
+    }
+
+    /**
+     * Insert items right behind the first two items of the log (the
+     * dummy and checkpoint_start items of a checkpoint), compacting it.
+     *
+     * @param items the items to insert, in order
+     * @param moved filled in with the new position of the item at each
+     *              old position (and with the new end at the old end)
+     * @return the position of the first inserted item
+     */
+    size_t insertAfterHead(const std::vector<queued_item> &items,
+                           std::vector<size_t> &moved) {
+        return rebuild(items, moved);
+    }
+
+    /**
+     * Get the number of bytes allocated for the log.
+     */
+    size_t memorySize() const {
+        return chunks.capacity() * sizeof(queued_item*) +
+            chunks.size() * CHUNK_SIZE * sizeof(queued_item);
+    }
+
+    static const size_t CHUNK_SIZE = 64;
+
+private:
+
+    queued_item &slot(size_t pos) const {
+        return chunks[pos / CHUNK_SIZE][pos % CHUNK_SIZE];
+    }
+
+    /**
+     * Get the position of the first item after pos, or end.
+     */
+    size_t nextPos(size_t pos) const {
+        while (++pos < used && slot(pos).get() == NULL) {
+            continue;
+        }
+        return pos < used ? pos : used;
+    }
+
+    /**
+     * Get the position of the last item before pos.
+     */
+    size_t prevPos(size_t pos) const {
+        while (pos > 0 && slot(--pos).get() == NULL) {
+            continue;
+        }
+        return pos;
+    }
+
+    size_t rebuild(const std::vector<queued_item> &items, std::vector<size_t> &moved);
+    size_t append(const std::vector<queued_item> &items);
+
+    std::vector<queued_item*> chunks;
+    size_t                    used;
+    size_t                    numItems;
+
+    DISALLOW_COPY_AND_ASSIGN(CheckpointLog);
+};
+
 /**
  * A checkpoint index entry.
  */
 struct index_entry {
-    std::list<queued_item>::iterator position;
-    uint64_t mutation_id;
+    uint64_t mutation_id; //!< 0 if the entry is unused.
+    uint32_t position;    //!< Position of the key's item in the checkpoint log.
+    uint32_t hash;
 };
 
 /**
  * The checkpoint index maps a key to a checkpoint index_entry.
+ *
+ * An open addressing hash table with linear probing.  The entries don't
+ * hold a copy of the key; they keep its hash and compare against the key
+ * of the item at their position in the log.
  */
-typedef unordered_map<std::string, index_entry> checkpoint_index;
+class CheckpointIndex {
+public:
+    CheckpointIndex() : table(MIN_SIZE), numEntries(0) { }
+
+    /**
+     * Find the entry for a key.
+     * @return the entry or NULL if the key isn't in the index.
+     */
+    index_entry *find(const std::string &key, CheckpointLog &log);
+
+    /**
+     * Set the position and mutation id of a key, adding it if it isn't
+     * in the index yet.
+     */
+    void set(const std::string &key, CheckpointLog &log,
+             size_t position, uint64_t mutationId);
+
+    /**
+     * Remove a key from the index.
+     */
+    void erase(const std::string &key, CheckpointLog &log);
+
+    /**
+     * Update the positions of all entries after the log was rebuilt.
+     * @param moved the new position of the item at each old position.
+     */
+    void reposition(const std::vector<size_t> &moved);
+
+    size_t size() const {
+        return numEntries;
+    }
+
+    /**
+     * Get the number of bytes allocated for the index.
+     */
+    size_t memorySize() const {
+        return table.capacity() * sizeof(index_entry);
+    }
+
+    static uint32_t hash(const std::string &key);
+
+private:
+
+    size_t probe(const std::string &key, uint32_t h, CheckpointLog &log);
+    void grow();
+
+    static const size_t MIN_SIZE = 8;
+
+    std::vector<index_entry> table;
+    size_t                   numEntries;
+
+    DISALLOW_COPY_AND_ASSIGN(CheckpointIndex);
+};
 
 class Checkpoint;
 class CheckpointManager;
@@ -63,7 +310,7 @@ public:
 
     CheckpointCursor(const std::string &n,
                      std::list<Checkpoint*>::iterator checkpoint,
-                     std::list<queued_item>::iterator pos,
+                     CheckpointLog::iterator pos,
                      size_t os = 0, bool isClosedCheckpointOnly = false,
                      uint64_t openChkId = 1) :
         name(n), currentCheckpoint(checkpoint), currentPos(pos),
@@ -73,7 +320,7 @@ public:
 private:
     std::string                      name;
     std::list<Checkpoint*>::iterator currentCheckpoint;
-    std::list<queued_item>::iterator currentPos;
+    CheckpointLog::iterator          currentPos;
     Atomic<size_t>                   offset;
     bool                             closedCheckpointOnly;
     uint64_t                         openChkIdAtRegistration;
@@ -94,7 +341,8 @@ class Checkpoint {
 public:
     Checkpoint(EPStats &st, uint64_t id, uint16_t vbid, checkpoint_state state = opened) :
         stats(st), checkpointId(id), vbucketId(vbid), creationTime(ep_real_time()),
-        checkpointState(state), numItems(0), memOverhead(0) {
+        checkpointState(state), numItems(0),
+        memOverhead(toWrite.memorySize() + keyIndex.memorySize()) {
         stats.memOverhead.incr(memorySize());
         assert(stats.memOverhead.get() < GIGANTOR);
     }
@@ -189,22 +437,14 @@ public:
     queue_dirty_t queueDirty(const queued_item &qi, CheckpointManager *checkpointManager);
 
 
-    std::list<queued_item>::iterator begin() {
+    CheckpointLog::iterator begin() {
         return toWrite.begin();
     }
 
-    std::list<queued_item>::iterator end() {
+    CheckpointLog::iterator end() {
         return toWrite.end();
     }
 
-    std::list<queued_item>::reverse_iterator rbegin() {
-        return toWrite.rbegin();
-    }
-
-    std::list<queued_item>::reverse_iterator rend() {
-        return toWrite.rend();
-    }
-
     bool keyExists(const std::string &key);
 
     /**
@@ -221,9 +461,11 @@ public:
      * Merge the previous checkpoint into the this checkpoint by adding the items from
      * the previous checkpoint, which don't exist in this checkpoint.
      * @param pPrevCheckpoint pointer to the previous checkpoint.
+     * @param checkpointManager the checkpoint manager to which this checkpoint belongs
      * @return the number of items added from the previous checkpoint.
      */
-    size_t mergePrevCheckpoint(Checkpoint *pPrevCheckpoint);
+    size_t mergePrevCheckpoint(Checkpoint *pPrevCheckpoint,
+                               CheckpointManager *checkpointManager);
 
     /**
      * Get the mutation id for a given key in this checkpoint
@@ -233,6 +475,24 @@ public:
     uint64_t getMutationIdForKey(const std::string &key);
 
 private:
+
+    /**
+     * Move the cursors walking this checkpoint to the new positions of
+     * their items after the log was rebuilt.
+     */
+    void repositionCursors(CheckpointManager *checkpointManager,
+                           const std::vector<size_t> &moved);
+
+    /**
+     * Compact the log once most of its slots are left empty by
+     * deduplicated items.
+     */
+    void maybeCompact(CheckpointManager *checkpointManager);
+
+    /**
+     * Account for the memory allocated for the log and the index.
+     */
+    void updateMemOverhead();
     EPStats                       &stats;
     uint64_t                       checkpointId;
     uint16_t                       vbucketId;
@@ -240,15 +500,25 @@ private:
     checkpoint_state               checkpointState;
     size_t                         numItems;
     std::set<std::string>          cursors; // List of cursors with their unique names.
-    // List is used for queueing mutations as vector incurs shift operations for deduplication.
-    std::list<queued_item>         toWrite;
-    checkpoint_index               keyIndex;
+    CheckpointLog                  toWrite;
+    CheckpointIndex                keyIndex;
     size_t                         memOverhead;
 };
 
+/**
+ * An item published to a checkpoint manager by a writer that didn't get
+ * its queue lock.
+ */
+struct PendingQueueItem;
+
 /**
  * Representation of a checkpoint manager that maintains the list of checkpoints
  * for each vbucket.
+ *
+ * Front-end writers never wait for the queue lock.  queueDirty publishes
+ * the item on a lock-free list and only tries the lock; if a cursor or the
+ * checkpoint remover holds it, the holder appends the published items to
+ * the open checkpoint before releasing it.
  */
 class CheckpointManager {
     friend class Checkpoint;
@@ -279,7 +549,7 @@ public:
     void setOpenCheckpointId_UNLOCKED(uint64_t id);
 
     void setOpenCheckpointId(uint64_t id) {
-        LockHolder lh(queueLock);
+        QueueLockHolder lh(*this);
         setOpenCheckpointId_UNLOCKED(id);
     }
 
@@ -327,12 +597,14 @@ public:
     bool tapCursorExists(const std::string &name);
 
     /**
-     * Queue an item to be written to persistent layer.
+     * Queue an item to be written to persistent layer.  The persistence
+     * queue stats are updated once the item is appended to the open
+     * checkpoint, which may be done by another thread holding the queue
+     * lock.
      * @param item the item to be persisted.
      * @param vbucket the vbucket that a new item is pushed into.
-     * @return true if an item queued increases the size of persistence queue by 1.
      */
-    bool queueDirty(const queued_item &qi, const RCPtr<VBucket> &vbucket);
+    void queueDirty(const queued_item &qi, const RCPtr<VBucket> &vbucket);
 
     /**
      * Return the next item to be sent to a given TAP connection
@@ -351,12 +623,31 @@ public:
     void getAllItemsForPersistence(std::vector<queued_item> &items);
 
     /**
-     * Return the list of all the items to a given TAP cursor since its current position.
+     * Return the next batch of items to be persisted to the flusher. The persistence
+     * cursor is moved past the returned items, so that the next call resumes from there.
+     * @param items the array that the items to be persisted are appended to.
+     * @param maxItems the max number of items to be returned.
+     * @param maxBytes the max size of the items to be returned. At least one item is
+     * returned as long as there is one.
+     * @return true if there are still items left to be persisted after this batch.
+     */
+    bool getItemsForPersistence(std::vector<queued_item> &items,
+                                size_t maxItems, size_t maxBytes);
+
+    /**
+     * Return the next batch of items to be sent to a given TAP connection, and move its
+     * cursor past them. A batch ends with a checkpoint_end item, and the last mutation of
+     * a checkpoint always comes in a batch of its own.
      * @param name the name of a given TAP connection.
-     * @param items the array that will contain the list of items to be returned
-     * to the TAP connection.
+     * @param items the array that the items to be sent are appended to. Nothing is
+     * appended if the cursor reached the end of the open checkpoint or can't move further.
+     * @param maxItems the max number of items to be returned.
+     * @param maxBytes the max size of the items to be returned.
+     * @param isLastMutationItem flag indicating if the batch is the last mutation item
+     * of its checkpoint.
      */
-    void getAllItemsForTAPConnection(const std::string &name, std::vector<queued_item> &items);
+    void getItemsForCursor(const std::string &name, std::vector<queued_item> &items,
+                           size_t maxItems, size_t maxBytes, bool &isLastMutationItem);
 
     /**
      * Return the total number of items that belong to this checkpoint manager.
@@ -377,7 +668,7 @@ public:
     }
 
     size_t getNumItemsForPersistence() {
-        LockHolder lh(queueLock);
+        QueueLockHolder lh(*this);
         return getNumItemsForPersistence_UNLOCKED();
     }
 
@@ -438,6 +729,51 @@ public:
 
 private:
 
+    /**
+     * Holder of the queue lock.  Appends the items published by writers
+     * right after acquiring the lock and again before releasing it, and
+     * records how long the lock was waited for and held.
+     */
+    class QueueLockHolder {
+    public:
+        /**
+         * @param m the checkpoint manager to lock
+         * @param tryOnly if true, don't wait for a busy lock; the holder
+         *                of the lock will append the published items
+         */
+        QueueLockHolder(CheckpointManager &m, bool tryOnly = false);
+
+        ~QueueLockHolder() {
+            unlock();
+        }
+
+        bool isLocked() const {
+            return lh.isLocked();
+        }
+
+        void unlock();
+
+    private:
+        CheckpointManager &manager;
+        LockHolder         lh;
+        bool               timed;
+        hrtime_t           acquired;
+
+        DISALLOW_COPY_AND_ASSIGN(QueueLockHolder);
+    };
+
+    /**
+     * Queue an item into the open checkpoint with the lock held.
+     * @return true if an item queued increases the size of persistence queue by 1.
+     */
+    bool queueDirty_UNLOCKED(const queued_item &qi, const RCPtr<VBucket> &vbucket);
+
+    /**
+     * Append the items published by writers to the open checkpoint in the
+     * order they were published.  The lock should be held.
+     */
+    void appendPendingItems();
+
     bool registerTAPCursor_UNLOCKED(const std::string &name,
                                     uint64_t checkpointId = 1,
                                     bool closedCheckpointOnly = false,
@@ -470,6 +806,13 @@ private:
 
     bool moveCursorToNextCheckpoint(CheckpointCursor &cursor);
 
+    /**
+     * Move a given cursor to the next item, into the next checkpoint if necessary.
+     * @return false if the cursor is at the end of the open checkpoint or isn't allowed
+     * to move into the next checkpoint.
+     */
+    bool moveCursorToNextItem(CheckpointCursor &cursor);
+
     /**
      * Check the current open checkpoint to see if we need to create the new open checkpoint.
      * @param forceCreation is to indicate if a new checkpoint is created due to online update or
@@ -482,7 +825,7 @@ private:
     uint64_t checkOpenCheckpoint_UNLOCKED(bool forceCreation, bool timeBound);
 
     uint64_t checkOpenCheckpoint(bool forceCreation, bool timeBound) {
-        LockHolder lh(queueLock);
+        QueueLockHolder lh(*this);
         return checkOpenCheckpoint_UNLOCKED(forceCreation, timeBound);
     }
 
@@ -522,6 +865,7 @@ private:
     EPStats                 &stats;
     CheckpointConfig        &checkpointConfig;
     Mutex                    queueLock;
+    AtomicPtr<PendingQueueItem> pendingItems;
     uint16_t                 vbucketId;
     Atomic<size_t>           numItems;
     uint64_t                 mutationCounter;
@@ -546,7 +890,11 @@ public:
           maxCheckpoints(DEFAULT_MAX_CHECKPOINTS),
           inconsistentSlaveCheckpoint (false),
           itemNumBasedNewCheckpoint(true),
-          keepClosedCheckpoints(false)
+          keepClosedCheckpoints(false),
+          flushBatchItems(DEFAULT_FLUSH_BATCH_ITEMS),
+          flushBatchBytes(DEFAULT_FLUSH_BATCH_BYTES),
+          tapBatchItems(DEFAULT_TAP_BATCH_ITEMS),
+          tapBatchBytes(DEFAULT_TAP_BATCH_BYTES)
     { /* empty */ }
 
     CheckpointConfig(EventuallyPersistentEngine &e);
@@ -575,6 +923,22 @@ public:
         return keepClosedCheckpoints;
     }
 
+    size_t getFlushBatchItems() const {
+        return flushBatchItems;
+    }
+
+    size_t getFlushBatchBytes() const {
+        return flushBatchBytes;
+    }
+
+    size_t getTapBatchItems() const {
+        return tapBatchItems;
+    }
+
+    size_t getTapBatchBytes() const {
+        return tapBatchBytes;
+    }
+
 protected:
     friend class CheckpointConfigChangeListener;
     friend class EventuallyPersistentEngine;
@@ -599,6 +963,22 @@ protected:
         keepClosedCheckpoints = value;
     }
 
+    void setFlushBatchItems(size_t value) {
+        flushBatchItems = value;
+    }
+
+    void setFlushBatchBytes(size_t value) {
+        flushBatchBytes = value;
+    }
+
+    void setTapBatchItems(size_t value) {
+        tapBatchItems = value;
+    }
+
+    void setTapBatchBytes(size_t value) {
+        tapBatchBytes = value;
+    }
+
     static void addConfigChangeListener(EventuallyPersistentEngine &engine);
 
 private:
@@ -617,6 +997,12 @@ private:
     // Flag indicating if closed checkpoints should be kept in memory if the current memory usage
     // below the high water mark.
     bool keepClosedCheckpoints;
+    // Max number of items and bytes the flusher grabs from a vbucket's checkpoints at once
+    size_t flushBatchItems;
+    size_t flushBatchBytes;
+    // Max number of items and bytes a TAP producer grabs from a vbucket's checkpoints at once
+    size_t tapBatchItems;
+    size_t tapBatchBytes;
 };
 
 #endif /* CHECKPOINT_HH */
@@ -162,6 +162,22 @@
  */
 #define CMD_CHANGE_VB_FILTER 0xb0
 
+/**
+ * Get the values of a batch of keys with a single request.  The body of
+ * the request is a sequence of
+ *
+ *   vbucket (2 bytes), key length (2 bytes), key
+ *
+ * and the body of the response has, for each of the keys, in order,
+ *
+ *   vbucket (2 bytes), key length (2 bytes), status (2 bytes),
+ *   flags (4 bytes), cas (8 bytes), value length (4 bytes), key, value
+ *
+ * where the status is that of a get of the key on its own (the flags,
+ * cas and value are empty unless it is PROTOCOL_BINARY_RESPONSE_SUCCESS).
+ */
+#define CMD_GET_BATCH 0xb1
+
 
 /**
  * TAP OPAQUE command list
@@ -27,6 +27,14 @@ static const int MUTATION_FAILED = -1;
 static const int DOC_NOT_FOUND = 0;
 static const int MUTATION_SUCCESS = 1;
 
+// Bodies written compressed (see couch_compress_docs) are read back
+// uncompressed; those written raw are returned as they are.
+#ifdef COUCH_DOC_IS_COMPRESSED
+static const couchstore_open_options DOC_READ_OPTIONS = DECOMPRESS_DOC_BODIES;
+#else
+static const couchstore_open_options DOC_READ_OPTIONS = 0;
+#endif
+
 extern "C" {
     static int recordDbDumpC(Db *db, DocInfo *docinfo, void *ctx)
     {
@@ -175,7 +183,7 @@ static void batchWarmupCallback(uint16_t vbId,
             fetches.begin();
         for (; itm != fetches.end(); itm++) {
             // ignore duplicate Doc seq_id, if any in access log
-            if (items2fetch.find((*itm).second) == items2fetch.end()) {
+            if (items2fetch.find((*itm).second) != items2fetch.end()) {
                 continue;
             }
             items2fetch[(*itm).second].push_back(
@@ -207,15 +215,98 @@ static void batchWarmupCallback(uint16_t vbId,
 }
 
 
+/**
+ * A copy of a DocInfo that couchstore only lends to a
+ * docinfos_by_sequence callback.
+ */
+class BGFetchDocInfo {
+public:
+    BGFetchDocInfo(const DocInfo &di) :
+        info(di), id(di.id.buf, di.id.size),
+        meta(di.rev_meta.buf, di.rev_meta.size) {
+        info.id.buf = const_cast<char *>(id.data());
+        info.rev_meta.buf = const_cast<char *>(meta.data());
+    }
+
+    DocInfo info;
+
+private:
+    std::string id;
+    std::string meta;
+
+    DISALLOW_COPY_AND_ASSIGN(BGFetchDocInfo);
+};
+
+struct BGFetchDocInfoByOffset {
+    bool operator()(const BGFetchDocInfo *a, const BGFetchDocInfo *b) const {
+        return a->info.bp < b->info.bp;
+    }
+};
+
 struct GetMultiCbCtx {
-    GetMultiCbCtx(CouchKVStore &c, uint16_t v, vb_bgfetch_queue_t &f) :
-        cks(c), vbId(v), fetches(f) {}
+    GetMultiCbCtx() {}
 
-    CouchKVStore &cks;
-    uint16_t vbId;
-    vb_bgfetch_queue_t &fetches;
+    ~GetMultiCbCtx() {
+        std::vector<BGFetchDocInfo *>::iterator it = docinfos.begin();
+        for (; it != docinfos.end(); ++it) {
+            delete *it;
+        }
+    }
+
+    std::vector<BGFetchDocInfo *> docinfos;
 };
 
+/**
+ * Docs fetched together whose bodies are at most this far apart are
+ * read ahead as one range.
+ */
+static const off_t bgFetchReadAheadGap = 32 * 1024;
+
+/**
+ * Ask the kernel to start reading the bodies of the given docs (sorted
+ * by offset) into the page cache, so that reading them one by one
+ * afterwards doesn't wait for the disk once per doc.
+ */
+static void readAhead(const std::string &dbFile,
+                      const std::vector<BGFetchDocInfo *> &docs)
+{
+#ifdef POSIX_FADV_WILLNEED
+    int fd = open(dbFile.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return;
+    }
+    off_t start = 0;
+    off_t end = 0;
+    std::vector<BGFetchDocInfo *>::const_iterator it = docs.begin();
+    for (; it != docs.end(); ++it) {
+        const DocInfo &di = (*it)->info;
+        if (di.bp == 0 || di.size == 0) {
+            continue;
+        }
+        // Leave room for the chunk header and the block markers
+        // couchstore puts at every 4k boundary.
+        off_t docStart = static_cast<off_t>(di.bp);
+        off_t docEnd = docStart + di.size + di.size / 4096 + 16;
+        if (end > 0 && docStart <= end + bgFetchReadAheadGap) {
+            end = std::max(end, docEnd);
+            continue;
+        }
+        if (end > 0) {
+            posix_fadvise(fd, start, end - start, POSIX_FADV_WILLNEED);
+        }
+        start = docStart;
+        end = docEnd;
+    }
+    if (end > 0) {
+        posix_fadvise(fd, start, end - start, POSIX_FADV_WILLNEED);
+    }
+    ::close(fd);
+#else
+    (void) dbFile;
+    (void) docs;
+#endif
+}
+
 struct StatResponseCtx {
 public:
     StatResponseCtx(std::map<std::pair<uint16_t, uint16_t>, vbucket_state> &sm,
@@ -282,7 +373,12 @@ CouchKVStore::CouchKVStore(EventuallyPersistentEngine &theEngine,
     configuration(theEngine.getConfiguration()),
     dbname(configuration.getDbname()),
     couchNotifier(NULL), pendingCommitCnt(0),
-    intransaction(false)
+    intransaction(false),
+    commitController(configuration.getCouchDefaultBatchSize(),
+                     configuration.getMaxTxnSize(),
+                     configuration.getCouchGroupCommitLatency() * 1000),
+    maxReadHandles(configuration.getCouchReadHandleCacheSize()),
+    compressDocs(configuration.isCouchCompressDocs())
 {
     open();
 }
@@ -293,7 +389,12 @@ CouchKVStore::CouchKVStore(const CouchKVStore &copyFrom) :
     configuration(copyFrom.configuration),
     dbname(copyFrom.dbname),
     couchNotifier(NULL),
-    pendingCommitCnt(0), intransaction(false)
+    pendingCommitCnt(0), intransaction(false),
+    commitController(configuration.getCouchDefaultBatchSize(),
+                     configuration.getMaxTxnSize(),
+                     configuration.getCouchGroupCommitLatency() * 1000),
+    maxReadHandles(configuration.getCouchReadHandleCacheSize()),
+    compressDocs(configuration.isCouchCompressDocs())
 {
     open();
     dbFileMap = copyFrom.dbFileMap;
@@ -360,7 +461,9 @@ void CouchKVStore::get(const std::string &key, uint64_t, uint16_t vb,
         cb.callback(rv);
         return;
     }
-    couchstore_error_t errCode = openDB(vb, dbFileRev(dbFile), &db, 0, NULL);
+    bool cached = false;
+    couchstore_error_t errCode = openReadDB(vb, dbFileRev(dbFile), &db,
+                                            cached);
     if (errCode != COUCHSTORE_SUCCESS) {
         ++st.numGetFailure;
         getLogger()->log(EXTENSION_LOG_WARNING, NULL,
@@ -413,12 +516,18 @@ void CouchKVStore::get(const std::string &key, uint64_t, uint16_t vb,
     }
 
     couchstore_free_docinfo(docInfo);
-    closeDatabaseHandle(db);
+    if (!cached) {
+        closeDatabaseHandle(db);
+    } else if (errCode != COUCHSTORE_SUCCESS &&
+               errCode != COUCHSTORE_ERROR_DOC_NOT_FOUND) {
+        invalidateReadDB(vb);
+    }
     rv.setStatus(couchErr2EngineErr(errCode));
     cb.callback(rv);
 }
 
-void CouchKVStore::getMulti(uint16_t vb, vb_bgfetch_queue_t &itms)
+void CouchKVStore::getMulti(uint16_t vb, vb_bgfetch_queue_t &itms,
+                            bgfetch_callback_t *cb)
 {
     Db *db = NULL;
     GetValue returnVal;
@@ -445,7 +554,8 @@ void CouchKVStore::getMulti(uint16_t vb, vb_bgfetch_queue_t &itms)
         return;
     }
 
-    errCode = openDB(vb, dbFileRev(dbFile), &db, 0);
+    bool cached = false;
+    errCode = openReadDB(vb, dbFileRev(dbFile), &db, cached);
     if (errCode != COUCHSTORE_SUCCESS) {
         getLogger()->log(EXTENSION_LOG_WARNING, NULL,
                          "Warning: failed to open database for data fetch, "
@@ -463,6 +573,8 @@ void CouchKVStore::getMulti(uint16_t vb, vb_bgfetch_queue_t &itms)
         return;
     }
 
+    // couchstore walks the by-sequence tree once for all of them, which
+    // it can only do in order.
     std::vector<uint64_t> seqIds;
     VBucketBGFetchItem *item2fetch;
     vb_bgfetch_queue_t::iterator itr = itms.begin();
@@ -470,11 +582,30 @@ void CouchKVStore::getMulti(uint16_t vb, vb_bgfetch_queue_t &itms)
         item2fetch = (*itr).second.front();
         seqIds.push_back(item2fetch->value.getId());
     }
+    std::sort(seqIds.begin(), seqIds.end());
 
-    GetMultiCbCtx ctx(*this, vb, itms);
+    GetMultiCbCtx ctx;
     errCode = couchstore_docinfos_by_sequence(db, &seqIds[0], seqIds.size(),
                                               0, getMultiCbC, &ctx);
-    if (errCode != COUCHSTORE_SUCCESS) {
+    if (errCode == COUCHSTORE_SUCCESS) {
+        // Read the bodies in file order, after telling the kernel about
+        // all of them.
+        std::sort(ctx.docinfos.begin(), ctx.docinfos.end(),
+                  BGFetchDocInfoByOffset());
+        if (ctx.docinfos.size() > 1) {
+            readAhead(dbFile, ctx.docinfos);
+        }
+        std::vector<BGFetchDocInfo *>::iterator dit = ctx.docinfos.begin();
+        for (; dit != ctx.docinfos.end(); ++dit) {
+            DocInfo *docinfo = &(*dit)->info;
+            itr = itms.find(docinfo->db_seq);
+            assert(itr != itms.end());
+            fetchMultiDoc(db, docinfo, vb, itr->second);
+            if (cb) {
+                cb->callback(itr->second);
+            }
+        }
+    } else {
         st.numGetFailure += numItems;
         for (itr = itms.begin(); itr != itms.end(); itr++) {
             std::list<VBucketBGFetchItem *> &fetches = (*itr).second;
@@ -492,7 +623,11 @@ void CouchKVStore::getMulti(uint16_t vb, vb_bgfetch_queue_t &itms)
             }
         }
     }
-    closeDatabaseHandle(db);
+    if (!cached) {
+        closeDatabaseHandle(db);
+    } else if (errCode != COUCHSTORE_SUCCESS) {
+        invalidateReadDB(vb);
+    }
 }
 
 void CouchKVStore::del(const Item &itm,
@@ -592,8 +727,9 @@ void CouchKVStore::getPersistedStats(std::map<std::string, std::string> &stats)
         session_stats.seekg (0, ios::end);
         int flen = session_stats.tellg();
         session_stats.seekg (0, ios::beg);
-        buffer = new char[flen];
+        buffer = new char[flen + 1];
         session_stats.read(buffer, flen);
+        buffer[flen] = '\0';
 
         cJSON *json_obj = cJSON_Parse(buffer);
         if (!json_obj) {
@@ -662,6 +798,35 @@ bool CouchKVStore::snapshotVBuckets(const vbucket_map_t &m)
     return success;
 }
 
+/**
+ * Quote a string as a JSON string.  Stat names and values may hold
+ * client keys (the hot keys), which can contain anything.
+ */
+static std::string toJSONString(const std::string &str) {
+    std::stringstream ss;
+    ss << '"';
+    for (std::string::const_iterator it = str.begin(); it != str.end(); ++it) {
+        unsigned char c = static_cast<unsigned char>(*it);
+        switch (c) {
+        case '"': ss << "\\\""; break;
+        case '\\': ss << "\\\\"; break;
+        case '\n': ss << "\\n"; break;
+        case '\r': ss << "\\r"; break;
+        case '\t': ss << "\\t"; break;
+        default:
+            if (c < 0x20) {
+                char buf[8];
+                snprintf(buf, sizeof(buf), "\\u%04x", c);
+                ss << buf;
+            } else {
+                ss << *it;
+            }
+        }
+    }
+    ss << '"';
+    return ss.str();
+}
+
 bool CouchKVStore::snapshotStats(const std::map<std::string, std::string> &stats)
 {
     assert(!isReadOnly());
@@ -671,7 +836,8 @@ bool CouchKVStore::snapshotStats(const std::map<std::string, std::string> &stats
     stats_buf << "{";
     std::map<std::string, std::string>::const_iterator it = stats.begin();
     for (; it != stats.end(); ++it) {
-        stats_buf << "\"" << it->first << "\": \"" << it->second << "\"";
+        stats_buf << toJSONString(it->first) << ": "
+                  << toJSONString(it->second);
         ++count;
         if (count < size) {
             stats_buf << ", ";
@@ -840,12 +1006,21 @@ void CouchKVStore::dump(uint16_t vb, shared_ptr<Callback<GetValue> > cb)
     loadDB(callback, false, &vbids);
 }
 
+void CouchKVStore::dumpVBuckets(const std::vector<uint16_t> &vbids,
+                                shared_ptr<Callback<GetValue> > cb)
+{
+    shared_ptr<RememberingCallback<bool> > wait(new RememberingCallback<bool>());
+    shared_ptr<LoadCallback> callback(new LoadCallback(cb, wait));
+    std::vector<uint16_t> vbs(vbids);
+    loadDB(callback, false, &vbs, COUCHSTORE_NO_DELETES);
+}
+
 void CouchKVStore::dumpKeys(const std::vector<uint16_t> &vbids,  shared_ptr<Callback<GetValue> > cb)
 {
     shared_ptr<RememberingCallback<bool> > wait(new RememberingCallback<bool>());
     shared_ptr<LoadCallback> callback(new LoadCallback(cb, wait));
-    (void)vbids;
-    loadDB(callback, true, NULL, COUCHSTORE_NO_DELETES);
+    std::vector<uint16_t> vbs(vbids);
+    loadDB(callback, true, &vbs, COUCHSTORE_NO_DELETES);
 }
 
 void CouchKVStore::dumpDeleted(uint16_t vb,  shared_ptr<Callback<GetValue> > cb)
@@ -857,10 +1032,21 @@ void CouchKVStore::dumpDeleted(uint16_t vb,  shared_ptr<Callback<GetValue> > cb)
     loadDB(callback, true, &vbids, COUCHSTORE_DELETES_ONLY);
 }
 
+void CouchKVStore::dumpAllKeys(uint16_t vb,  shared_ptr<Callback<GetValue> > cb)
+{
+    shared_ptr<RememberingCallback<bool> > wait(new RememberingCallback<bool>());
+    shared_ptr<LoadCallback> callback(new LoadCallback(cb, wait));
+    std::vector<uint16_t> vbids;
+    vbids.push_back(vb);
+    loadDB(callback, true, &vbids, COUCHSTORE_NO_OPTIONS);
+}
+
 StorageProperties CouchKVStore::getStorageProperties()
 {
     size_t concurrency(10);
-    StorageProperties rv(concurrency, concurrency - 1, 1, true, true,
+    // Every vbucket has its own file, so writers of disjoint sets of
+    // vbuckets don't get in each other's way.
+    StorageProperties rv(concurrency, concurrency - 1, concurrency - 1, true, true,
                          true, true);
     return rv;
 }
@@ -887,13 +1073,19 @@ void CouchKVStore::addStats(const std::string &prefix,
     addStat(prefix_str, "close",          st.numClose,        add_stat, c);
     addStat(prefix_str, "readTime",       st.readTimeHisto,   add_stat, c);
     addStat(prefix_str, "readSize",       st.readSizeHisto,   add_stat, c);
+    addStat(prefix_str, "openTime",       st.openTimeHisto,   add_stat, c);
+    addStat(prefix_str, "handle_hits",    st.numHandleHits,   add_stat, c);
+    addStat(prefix_str, "handle_misses",  st.numHandleMisses, add_stat, c);
+    addStat(prefix_str, "handle_stale",   st.numHandleStale,  add_stat, c);
+    addStat(prefix_str, "handle_evictions", st.numHandleEvictions,
+            add_stat, c);
     addStat(prefix_str, "numLoadedVb",    st.numLoadedVb,     add_stat, c);
 
     // failure stats
     addStat(prefix_str, "failure_open",   st.numOpenFailure, add_stat, c);
     addStat(prefix_str, "failure_get",    st.numGetFailure,  add_stat, c);
 
-    if (prefix.compare("rw") == 0) {
+    if (prefix.compare(0, 2, "rw") == 0) {
         addStat(prefix_str, "failure_set",   st.numSetFailure,   add_stat, c);
         addStat(prefix_str, "failure_del",   st.numDelFailure,   add_stat, c);
         addStat(prefix_str, "failure_vbset", st.numVbSetFailure, add_stat, c);
@@ -904,16 +1096,39 @@ void CouchKVStore::addStats(const std::string &prefix,
 
 void CouchKVStore::addTimingStats(const std::string &prefix,
                                   ADD_STAT add_stat, const void *c) {
-    if (prefix.compare("rw") != 0) {
+    if (prefix.compare(0, 2, "rw") != 0) {
         return;
     }
     const char *prefix_str = prefix.c_str();
     addStat(prefix_str, "commit",      st.commitHisto,      add_stat, c);
     addStat(prefix_str, "commitRetry", st.commitRetryHisto, add_stat, c);
+    addStat(prefix_str, "commit_batch", st.commitBatchHisto, add_stat, c);
     addStat(prefix_str, "delete",      st.delTimeHisto,     add_stat, c);
     addStat(prefix_str, "save_documents", st.saveDocsHisto, add_stat, c);
     addStat(prefix_str, "writeTime",   st.writeTimeHisto,   add_stat, c);
     addStat(prefix_str, "writeSize",   st.writeSizeHisto,   add_stat, c);
+
+    // group commit decision inputs (times in microseconds)...
+    hrtime_t target = commitController.getTargetLatency();
+    hrtime_t commitTime = commitController.getCommitTime();
+    hrtime_t waitTime = commitController.getWaitTime();
+    size_t pressure = commitController.getQueuePressure();
+    addStat(prefix_str, "gc_target_latency", target,     add_stat, c);
+    addStat(prefix_str, "gc_commit_time",    commitTime, add_stat, c);
+    addStat(prefix_str, "gc_wait_time",      waitTime,   add_stat, c);
+    addStat(prefix_str, "gc_queue_pressure", pressure,   add_stat, c);
+
+    // ...and outputs
+    size_t batchSize = commitController.getBatchSize();
+    size_t maxBatchSize = commitController.getMaxBatchSize();
+    hrtime_t interval = commitController.getCommitInterval();
+    size_t grows = commitController.getNumGrows();
+    size_t shrinks = commitController.getNumShrinks();
+    addStat(prefix_str, "gc_batch_size",     batchSize,    add_stat, c);
+    addStat(prefix_str, "gc_max_batch_size", maxBatchSize, add_stat, c);
+    addStat(prefix_str, "gc_commit_interval", interval,    add_stat, c);
+    addStat(prefix_str, "gc_grows",          grows,        add_stat, c);
+    addStat(prefix_str, "gc_shrinks",        shrinks,      add_stat, c);
 }
 
 template <typename T>
@@ -940,7 +1155,7 @@ void CouchKVStore::loadDB(shared_ptr<LoadCallback> cb, bool keysOnly,
                           couchstore_docinfos_options options)
 {
     std::vector<std::string> files = std::vector<std::string>();
-    std::map<uint16_t, int> &filemap = dbFileMap;
+    std::map<uint16_t, int> *filemap = &dbFileMap;
     std::map<uint16_t, int> vbmap;
     std::vector< std::pair<uint16_t, int> > vbuckets;
     std::vector< std::pair<uint16_t, int> > replicaVbuckets;
@@ -956,7 +1171,7 @@ void CouchKVStore::loadDB(shared_ptr<LoadCallback> cb, bool keysOnly,
         // get entries for given vbucket(s) from dbFileMap
         std::string dirname = dbname;
         getFileNameMap(vbids, dirname, vbmap);
-        filemap = vbmap;
+        filemap = &vbmap;
     }
 
     // order vbuckets data loading by using vbucket states
@@ -964,8 +1179,8 @@ void CouchKVStore::loadDB(shared_ptr<LoadCallback> cb, bool keysOnly,
         listPersistedVbuckets();
     }
 
-    std::map<uint16_t, int>::iterator fitr = filemap.begin();
-    for (; fitr != filemap.end(); fitr++) {
+    std::map<uint16_t, int>::iterator fitr = filemap->begin();
+    for (; fitr != filemap->end(); fitr++) {
         if (loadingData) {
             vbucket_map_t::const_iterator vsit = cachedVBStates.find(fitr->first);
             if (vsit != cachedVBStates.end()) {
@@ -1066,6 +1281,7 @@ void CouchKVStore::open()
 void CouchKVStore::close()
 {
     intransaction = false;
+    closeReadDBs();
     if (!isReadOnly()) {
         delete couchNotifier;
     }
@@ -1136,6 +1352,7 @@ int CouchKVStore::checkNewRevNum(std::string &dbFileName, bool newFile)
 void CouchKVStore::updateDbFileMap(uint16_t vbucketId, int newFileRev,
                                    bool insertImmediately)
 {
+    invalidateReadDB(vbucketId);
     if (insertImmediately) {
         dbFileMap.insert(std::pair<uint16_t, int>(vbucketId, newFileRev));
         return;
@@ -1302,19 +1519,22 @@ couchstore_error_t CouchKVStore::fetchDoc(Db *db, DocInfo *docinfo,
     memcpy(&itemFlags, (metadata.buf) + 12, 4);
     itemFlags = ntohl(itemFlags);
 
-    if (metaOnly) {
-        // we should allow a metadata disk fetch for deleted items only
-        assert(docinfo->deleted);
+    if (metaOnly && docinfo->deleted) {
         it = new Item(docinfo->id.buf, (size_t)docinfo->id.size,
                       docinfo->size, itemFlags, (time_t)exptime, cas);
         it->setSeqno(docinfo->rev_seq);
         docValue = GetValue(it);
+        // Only the metadata of a deleted item.
+        docValue.setPartial();
 
         // update ep-engine IO stats
         ++epStats.io_num_read;
         epStats.io_read_bytes += docinfo->id.size;
     } else {
-        errCode = couchstore_open_doc_with_docinfo(db, docinfo, &doc, 0);
+        // The metadata of a live item is only asked for once the item
+        // was evicted in full; read all of it so it can be restored.
+        errCode = couchstore_open_doc_with_docinfo(db, docinfo, &doc,
+                                                   DOC_READ_OPTIONS);
         if (errCode == COUCHSTORE_SUCCESS) {
             if (docinfo->deleted) {
                 // cannot read a doc that is marked deleted, just return
@@ -1347,10 +1567,6 @@ int CouchKVStore::recordDbDump(Db *db, DocInfo *docinfo, void *ctx)
     EventuallyPersistentEngine *engine= loadCtx->engine;
     bool warmup = engine->stillWarmingUp();
 
-    // TODO enable below when couchstore is ready
-    // bool compressed = (docinfo->content_meta & 0x80);
-    // uint8_t metaflags = (docinfo->content_meta & ~0x80);
-
     void *valuePtr;
     size_t valuelen;
     sized_buf  metadata = docinfo->rev_meta;
@@ -1375,7 +1591,8 @@ int CouchKVStore::recordDbDump(Db *db, DocInfo *docinfo, void *ctx)
 
     if (!loadCtx->keysonly && !docinfo->deleted) {
         couchstore_error_t errCode ;
-        errCode = couchstore_open_doc_with_docinfo(db, docinfo, &doc, 0);
+        errCode = couchstore_open_doc_with_docinfo(db, docinfo, &doc,
+                                                   DOC_READ_OPTIONS);
 
         if (errCode == COUCHSTORE_SUCCESS) {
             if (doc->data.size) {
@@ -1455,12 +1672,19 @@ bool CouchKVStore::commit2couchstore(void)
     }
 
     // flush all
+    hrtime_t oldestWait = committedReqs[0]->getDelta();
+    hrtime_t commitStart = gethrtime();
     errCode = saveDocs(vbucket2flush, fileRev, docs, docinfos, reqIndex);
     if (errCode) {
         getLogger()->log(EXTENSION_LOG_WARNING, NULL,
                 "Warning: commit failed, cannot save CouchDB docs "
                 "for vbucket = %d rev = %d\n", vbucket2flush, fileRev);
         ++epStats.commitFailed;
+    } else {
+        hrtime_t commitTime = (gethrtime() - commitStart) / 1000;
+        st.commitBatchHisto.add(reqIndex);
+        commitController.committed(reqIndex, oldestWait, commitTime,
+                                   getQueuePressure());
     }
     commitCallback(committedReqs, reqIndex, errCode);
 
@@ -1520,9 +1744,22 @@ couchstore_error_t CouchKVStore::saveDocs(uint16_t vbid, int rev, Doc **docs,
                 }
             }
 
+            couchstore_save_options options = 0;
+#ifdef COUCH_DOC_IS_COMPRESSED
+            if (compressDocs) {
+                // couchstore only compresses the bodies flagged for it
+                for (int i = 0; i < docCount; ++i) {
+                    if (!docinfos[i]->deleted) {
+                        docinfos[i]->content_meta |= COUCH_DOC_IS_COMPRESSED;
+                    }
+                }
+                options = COMPRESS_DOC_BODIES;
+            }
+#endif
+
             cs_begin = gethrtime();
             errCode = couchstore_save_documents(db, docs, docinfos, docCount,
-                                                0 /* no options */);
+                                                options);
             st.saveDocsHisto.add((gethrtime() - cs_begin) / 1000);
             if (errCode != COUCHSTORE_SUCCESS) {
                 getLogger()->log(EXTENSION_LOG_WARNING, NULL,
@@ -1591,10 +1828,24 @@ void CouchKVStore::queueItem(CouchRequest *req)
     }
     pendingReqsQ.push_back(req);
     pendingCommitCnt++;
+    if (commitController.shouldCommit(pendingCommitCnt,
+                                      pendingReqsQ.front()->getDelta())) {
+        commit2couchstore();
+    }
+}
+
+double CouchKVStore::getQueuePressure()
+{
+    int cap = epStats.queue_age_cap.get();
+    if (cap <= 0) {
+        return 0.0;
+    }
+    return static_cast<double>(epStats.dirtyAge.get()) / cap;
 }
 
 void CouchKVStore::remVBucketFromDbFileMap(uint16_t vbucketId)
 {
+    invalidateReadDB(vbucketId);
     std::map<uint16_t, int>::iterator itr;
 
     itr = dbFileMap.find(vbucketId);
@@ -1711,30 +1962,31 @@ couchstore_error_t CouchKVStore::saveVBState(Db *db, vbucket_state &vbState)
 
 int CouchKVStore::getMultiCb(Db *db, DocInfo *docinfo, void *ctx)
 {
-    couchstore_error_t errCode;
-    std::string keyStr(docinfo->id.buf, docinfo->id.size);
+    (void) db;
     assert(ctx);
     GetMultiCbCtx *cbCtx = static_cast<GetMultiCbCtx *>(ctx);
-    CouchKVStoreStats &st = cbCtx->cks.getCKVStoreStat();
-
+    cbCtx->docinfos.push_back(new BGFetchDocInfo(*docinfo));
+    return 0;
+}
 
-    vb_bgfetch_queue_t::iterator qitr;
-    qitr = cbCtx->fetches.find(docinfo->db_seq);
-    assert(qitr != cbCtx->fetches.end());
-    std::list<VBucketBGFetchItem *> &fetches = (*qitr).second;
+void CouchKVStore::fetchMultiDoc(Db *db, DocInfo *docinfo, uint16_t vb,
+                                 std::list<VBucketBGFetchItem *> &fetches)
+{
+    couchstore_error_t errCode;
     GetValue returnVal;
 
-    errCode = cbCtx->cks.fetchDoc(db, docinfo, returnVal, cbCtx->vbId, false);
+    errCode = fetchDoc(db, docinfo, returnVal, vb, false);
     if (errCode != COUCHSTORE_SUCCESS) {
+        std::string keyStr(docinfo->id.buf, docinfo->id.size);
         getLogger()->log(EXTENSION_LOG_WARNING, NULL,
                 "Warning: failed to fetch data from database, "
-                "vBucket=%d key=%s error=%s errno=%s\n", cbCtx->vbId,
+                "vBucket=%d key=%s error=%s errno=%s\n", vb,
                 keyStr.c_str(), couchstore_strerror(errCode),
                 couchkvstore_strerrno(errCode));
         st.numGetFailure++;
     }
 
-    returnVal.setStatus(cbCtx->cks.couchErr2EngineErr(errCode));
+    returnVal.setStatus(couchErr2EngineErr(errCode));
     std::list<VBucketBGFetchItem *>::iterator itr = fetches.begin();
     for (; itr != fetches.end(); itr++) {
         // populate return value for remaining fetch items with the
@@ -1746,7 +1998,6 @@ int CouchKVStore::getMultiCb(Db *db, DocInfo *docinfo, void *ctx)
                                  returnVal.getValue()->getNBytes());
         }
     }
-    return 0;
 }
 
 
@@ -1760,6 +2011,96 @@ void CouchKVStore::closeDatabaseHandle(Db *db) {
     st.numClose++;
 }
 
+/**
+ * Get a handle for reading the given file revision of a vbucket.
+ *
+ * If the handle cache is enabled, a handle opened by an earlier fetch
+ * is reused as long as the file hasn't changed since, and a newly
+ * opened one is kept for later fetches.  Cached handles must not be
+ * closed by the caller.
+ */
+couchstore_error_t CouchKVStore::openReadDB(uint16_t vbucketId,
+                                            uint16_t fileRev,
+                                            Db **db, bool &cached)
+{
+    cached = false;
+    if (maxReadHandles == 0) {
+        return openDB(vbucketId, fileRev, db, 0);
+    }
+
+    std::string dbFileName = getDBFileName(dbname, vbucketId, fileRev);
+    struct stat fst;
+    bool statOk = stat(dbFileName.c_str(), &fst) == 0;
+
+    std::map<uint16_t, CachedDbHandle>::iterator it;
+    it = readHandles.find(vbucketId);
+    if (it != readHandles.end()) {
+        CachedDbHandle &handle = it->second;
+        if (statOk && handle.fileRev == fileRev &&
+            handle.inode == fst.st_ino && handle.size == fst.st_size) {
+            ++st.numHandleHits;
+            readHandleLru.splice(readHandleLru.begin(), readHandleLru,
+                                 handle.lru);
+            *db = handle.db;
+            cached = true;
+            return COUCHSTORE_SUCCESS;
+        }
+        ++st.numHandleStale;
+        invalidateReadDB(vbucketId);
+    }
+
+    ++st.numHandleMisses;
+    hrtime_t start = gethrtime();
+    uint16_t openedRev = fileRev;
+    couchstore_error_t errCode = openDB(vbucketId, fileRev, db, 0,
+                                        &openedRev);
+    if (errCode != COUCHSTORE_SUCCESS) {
+        return errCode;
+    }
+    st.openTimeHisto.add((gethrtime() - start) / 1000);
+
+    // The file was looked at before opening it, so a commit racing
+    // with the open can only make the handle look stale, never
+    // current.  If openDB had to move on to a newer revision there's
+    // nothing to compare with, so leave that one for the next fetch.
+    if (!statOk || openedRev != fileRev) {
+        return errCode;
+    }
+
+    if (readHandles.size() >= maxReadHandles) {
+        uint16_t victim = readHandleLru.back();
+        ++st.numHandleEvictions;
+        invalidateReadDB(victim);
+    }
+    readHandleLru.push_front(vbucketId);
+    CachedDbHandle &handle = readHandles[vbucketId];
+    handle.db = *db;
+    handle.fileRev = fileRev;
+    handle.inode = fst.st_ino;
+    handle.size = fst.st_size;
+    handle.lru = readHandleLru.begin();
+    cached = true;
+    return errCode;
+}
+
+void CouchKVStore::invalidateReadDB(uint16_t vbucketId)
+{
+    std::map<uint16_t, CachedDbHandle>::iterator it;
+    it = readHandles.find(vbucketId);
+    if (it != readHandles.end()) {
+        closeDatabaseHandle(it->second.db);
+        readHandleLru.erase(it->second.lru);
+        readHandles.erase(it);
+    }
+}
+
+void CouchKVStore::closeReadDBs(void)
+{
+    while (!readHandleLru.empty()) {
+        invalidateReadDB(readHandleLru.front());
+    }
+}
+
 ENGINE_ERROR_CODE CouchKVStore::couchErr2EngineErr(couchstore_error_t errCode)
 {
     switch (errCode) {
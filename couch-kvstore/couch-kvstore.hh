@@ -1,6 +1,10 @@
 #ifndef COUCH_KVSTORE_H
 #define COUCH_KVSTORE_H 1
 
+#include <list>
+#include <map>
+#include <sys/types.h>
+
 #include "libcouchstore/couch_db.h"
 #include "kvstore.hh"
 #include "item.hh"
@@ -8,6 +12,7 @@
 #include "stats.hh"
 #include "configuration.hh"
 #include "couch-kvstore/couch-notifier.hh"
+#include "couch-kvstore/group-commit.hh"
 
 #define COUCHSTORE_NO_OPTIONS 0
 
@@ -21,8 +26,11 @@ public:
       docsCommitted(0), numOpen(0), numClose(0),
       numLoadedVb(0), numGetFailure(0), numSetFailure(0),
       numDelFailure(0), numOpenFailure(0), numVbSetFailure(0),
+      numHandleHits(0), numHandleMisses(0), numHandleStale(0),
+      numHandleEvictions(0),
       readSizeHisto(ExponentialGenerator<size_t>(1, 2), 25),
-      writeSizeHisto(ExponentialGenerator<size_t>(1, 2), 25) {
+      writeSizeHisto(ExponentialGenerator<size_t>(1, 2), 25),
+      commitBatchHisto(ExponentialGenerator<size_t>(1, 2), 25) {
     }
 
     // the number of docs committed
@@ -42,25 +50,38 @@ public:
     Atomic<size_t> numVbSetFailure;
     Atomic<size_t> numCommitRetry;
 
+    // read handle cache lookups that found a current handle
+    Atomic<size_t> numHandleHits;
+    // read handle cache lookups that had to open the file
+    Atomic<size_t> numHandleMisses;
+    // cached read handles dropped because the file changed
+    Atomic<size_t> numHandleStale;
+    // cached read handles closed to make room for others
+    Atomic<size_t> numHandleEvictions;
+
     /* for flush and vb delete, no error handling in CouchKVStore, such
      * failure should be tracked in MC-engine  */
 
     // How long it takes us to complete a read
-    Histogram<hrtime_t> readTimeHisto;
+    LogLinearHistogram<hrtime_t> readTimeHisto;
+    // How long it takes to open a file for reading
+    LogLinearHistogram<hrtime_t> openTimeHisto;
     // How big are our reads?
     Histogram<size_t> readSizeHisto;
     // How long it takes us to complete a write
-    Histogram<hrtime_t> writeTimeHisto;
+    LogLinearHistogram<hrtime_t> writeTimeHisto;
     // How big are our writes?
     Histogram<size_t> writeSizeHisto;
     // Time spent in delete() calls.
-    Histogram<hrtime_t> delTimeHisto;
+    LogLinearHistogram<hrtime_t> delTimeHisto;
     // Time spent in couchstore commit
-    Histogram<hrtime_t> commitHisto;
+    LogLinearHistogram<hrtime_t> commitHisto;
     // Time spent in couchstore commit retry
-    Histogram<hrtime_t> commitRetryHisto;
+    LogLinearHistogram<hrtime_t> commitRetryHisto;
     // Time spent in couchstore save documents
-    Histogram<hrtime_t> saveDocsHisto;
+    LogLinearHistogram<hrtime_t> saveDocsHisto;
+    // How many docs each couchstore commit carries
+    Histogram<size_t> commitBatchHisto;
 };
 
 class EventuallyPersistentEngine;
@@ -215,7 +236,8 @@ public:
     /**
      * Overrides getMulti().
      */
-    void getMulti(uint16_t vb, vb_bgfetch_queue_t &itms);
+    void getMulti(uint16_t vb, vb_bgfetch_queue_t &itms,
+                  bgfetch_callback_t *cb = NULL);
 
     /**
      * Overrides del().
@@ -244,8 +266,11 @@ public:
      */
     void dump(shared_ptr<Callback<GetValue> > cb);
     void dump(uint16_t vb, shared_ptr<Callback<GetValue> > cb);
+    void dumpVBuckets(const std::vector<uint16_t> &vbids,
+                      shared_ptr<Callback<GetValue> > cb);
     void dumpKeys(const std::vector<uint16_t> &vbids,  shared_ptr<Callback<GetValue> > cb);
     void dumpDeleted(uint16_t vb,  shared_ptr<Callback<GetValue> > cb);
+    void dumpAllKeys(uint16_t vb,  shared_ptr<Callback<GetValue> > cb);
     bool isKeyDumpSupported() {
         return true;
     }
@@ -302,6 +327,7 @@ private:
     void close();
     bool commit2couchstore(void);
     void queueItem(CouchRequest *req);
+    double getQueuePressure(void);
 
     bool getDbFile(uint16_t vbucketId, std::string &dbFileName);
 
@@ -323,6 +349,13 @@ private:
     void setDocsCommitted(uint16_t docs);
     void closeDatabaseHandle(Db *db);
 
+    void fetchMultiDoc(Db *db, DocInfo *docinfo, uint16_t vb,
+                       std::list<VBucketBGFetchItem *> &fetches);
+    couchstore_error_t openReadDB(uint16_t vbucketId, uint16_t fileRev,
+                                  Db **db, bool &cached);
+    void invalidateReadDB(uint16_t vbucketId);
+    void closeReadDBs(void);
+
     EventuallyPersistentEngine &engine;
     EPStats &epStats;
     Configuration &configuration;
@@ -332,6 +365,29 @@ private:
     std::vector<CouchRequest *> pendingReqsQ;
     size_t pendingCommitCnt;
     bool intransaction;
+    GroupCommitController commitController;
+
+    /**
+     * An open read handle together with what the file looked like
+     * when it was opened.  couchstore only sees the header it read at
+     * open time, so the handle is only good for as long as nothing
+     * has been appended to (or replaced) the file.
+     */
+    struct CachedDbHandle {
+        Db *db;
+        uint16_t fileRev;
+        ino_t inode;
+        off_t size;
+        std::list<uint16_t>::iterator lru;
+    };
+
+    /* read handles kept open between fetches, by vbucket */
+    std::map<uint16_t, CachedDbHandle> readHandles;
+    /* vbuckets of the cached read handles, most recently used first */
+    std::list<uint16_t> readHandleLru;
+    size_t maxReadHandles;
+    /* true if couchstore compresses the document bodies it writes */
+    bool compressDocs;
 
     /* all stats */
     CouchKVStoreStats   st;
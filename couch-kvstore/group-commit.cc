@@ -0,0 +1,89 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+#include "config.h"
+#include <algorithm>
+
+#include "group-commit.hh"
+
+/**
+ * Exponentially weighted moving average giving the new sample a
+ * quarter of the weight; the first sample is taken as is.
+ */
+static hrtime_t smooth(hrtime_t avg, hrtime_t sample) {
+    if (avg == 0) {
+        return sample;
+    }
+    return avg - avg / 4 + sample / 4;
+}
+
+GroupCommitController::GroupCommitController(size_t initialBatch,
+                                             size_t maxBatchSize,
+                                             hrtime_t target)
+    : maxBatch(std::max(maxBatchSize, static_cast<size_t>(1))),
+      targetLatency(target) {
+    batchSize.set(std::min(std::max(initialBatch, static_cast<size_t>(1)),
+                           maxBatch));
+}
+
+bool GroupCommitController::shouldCommit(size_t pending,
+                                         hrtime_t oldestWait) const {
+    if (pending >= batchSize.get()) {
+        return true;
+    }
+    hrtime_t interval = commitInterval.get();
+    return pending > 0 && interval > 0 && oldestWait >= interval;
+}
+
+void GroupCommitController::committed(size_t docs, hrtime_t oldestWait,
+                                      hrtime_t commitTime,
+                                      double pressure) {
+    if (docs == 0) {
+        return;
+    }
+    avgCommitTime.set(smooth(avgCommitTime.get(), commitTime));
+    avgWaitTime.set(smooth(avgWaitTime.get(), oldestWait));
+    queuePressure.set(static_cast<size_t>(std::max(pressure, 0.0) * 100));
+    if (!isAdaptive()) {
+        return;
+    }
+
+    size_t batch = batchSize.get();
+    hrtime_t latency = oldestWait + commitTime;
+    hrtime_t avgCommit = avgCommitTime.get();
+    if (pressure >= 1.0) {
+        // Falling behind; go for throughput and don't cut batches short.
+        grow(batch);
+        commitInterval.set(0);
+        return;
+    }
+
+    if (avgCommit >= targetLatency) {
+        grow(batch / 8);
+    } else if (latency > targetLatency) {
+        shrink();
+    } else if (docs >= batch && latency < targetLatency / 2) {
+        grow(batch / 8);
+    }
+    commitInterval.set(avgCommit < targetLatency ? targetLatency - avgCommit : 0);
+}
+
+void GroupCommitController::grow(size_t by) {
+    size_t batch = batchSize.get();
+    size_t grown = std::min(batch + std::max(by, static_cast<size_t>(1)),
+                            maxBatch);
+    if (grown != batch) {
+        batchSize.set(grown);
+        ++numGrows;
+    }
+}
+
+void GroupCommitController::shrink() {
+    size_t batch = batchSize.get();
+    size_t shrunk = std::max(batch - batch / 4, static_cast<size_t>(1));
+    if (shrunk == batch && batch > 1) {
+        --shrunk;
+    }
+    if (shrunk != batch) {
+        batchSize.set(shrunk);
+        ++numShrinks;
+    }
+}
@@ -0,0 +1,141 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+#ifndef GROUP_COMMIT_HH
+#define GROUP_COMMIT_HH 1
+
+#include "common.hh"
+#include "atomic.hh"
+
+/**
+ * Decides how many documents a couchstore commit groups together.
+ *
+ * Every commit pays for an fsync, so committing small batches wastes
+ * disk bandwidth, while large batches keep the first documents of a
+ * batch waiting for the last ones.  The controller is told the outcome
+ * of every commit (how long its oldest document waited to be
+ * committed and how long the commit itself took) and steers the batch
+ * size and commit interval so that the two add up to the target
+ * latency:
+ *
+ * - if the flusher queue holds items older than queue_age_cap the
+ *   flusher is falling behind, and the batch size grows to amortise
+ *   the fsync over more documents,
+ * - if commits alone take longer than the target, smaller batches
+ *   can't help, so the batch size grows as well,
+ * - otherwise a missed target shrinks the batch size, and batches that
+ *   hit the size limit well within the target grow it.
+ *
+ * The commit interval is whatever is left of the target once the
+ * expected commit time is paid for; a pending batch older than that is
+ * committed even if it isn't full.
+ *
+ * Not thread safe, except for the getters used by stats.
+ */
+class GroupCommitController {
+public:
+
+    /**
+     * @param initialBatch the batch size to start with
+     * @param maxBatch the largest batch size to grow to
+     * @param targetLatency the target persistence latency in
+     *                      microseconds; 0 keeps the batch size fixed
+     *                      at initialBatch
+     */
+    GroupCommitController(size_t initialBatch, size_t maxBatch,
+                          hrtime_t targetLatency);
+
+    /**
+     * Should a pending batch be committed now?
+     *
+     * @param pending the number of documents in the batch
+     * @param oldestWait how long the oldest of them has been waiting
+     *                   in microseconds
+     */
+    bool shouldCommit(size_t pending, hrtime_t oldestWait) const;
+
+    /**
+     * Record a completed commit and adjust the batch size and commit
+     * interval.
+     *
+     * @param docs the number of documents committed
+     * @param oldestWait how long the oldest of them waited before the
+     *                   commit started, in microseconds
+     * @param commitTime how long the commit took in microseconds
+     * @param queuePressure the age of the flusher queue as a fraction
+     *                      of queue_age_cap (0 when there is no cap)
+     */
+    void committed(size_t docs, hrtime_t oldestWait, hrtime_t commitTime,
+                   double queuePressure);
+
+    bool isAdaptive() const {
+        return targetLatency > 0;
+    }
+
+    hrtime_t getTargetLatency() const {
+        return targetLatency;
+    }
+
+    size_t getBatchSize() const {
+        return batchSize.get();
+    }
+
+    size_t getMaxBatchSize() const {
+        return maxBatch;
+    }
+
+    /**
+     * Get the age in microseconds at which a pending batch is
+     * committed even if it isn't full (0 if there is no such limit).
+     */
+    hrtime_t getCommitInterval() const {
+        return commitInterval.get();
+    }
+
+    /**
+     * Get the smoothed commit time in microseconds.
+     */
+    hrtime_t getCommitTime() const {
+        return avgCommitTime.get();
+    }
+
+    /**
+     * Get the smoothed time documents wait for their commit to start,
+     * in microseconds.
+     */
+    hrtime_t getWaitTime() const {
+        return avgWaitTime.get();
+    }
+
+    /**
+     * Get the queue pressure seen by the last commit in percent.
+     */
+    size_t getQueuePressure() const {
+        return queuePressure.get();
+    }
+
+    size_t getNumGrows() const {
+        return numGrows.get();
+    }
+
+    size_t getNumShrinks() const {
+        return numShrinks.get();
+    }
+
+private:
+
+    void grow(size_t by);
+    void shrink();
+
+    const size_t         maxBatch;
+    const hrtime_t       targetLatency;
+    Atomic<size_t>       batchSize;
+    Atomic<hrtime_t>     commitInterval;
+    Atomic<hrtime_t>     avgCommitTime;
+    Atomic<hrtime_t>     avgWaitTime;
+    Atomic<size_t>       queuePressure;
+    Atomic<size_t>       numGrows;
+    Atomic<size_t>       numShrinks;
+
+    DISALLOW_COPY_AND_ASSIGN(GroupCommitController);
+};
+
+#endif /* GROUP_COMMIT_HH */
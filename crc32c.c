@@ -0,0 +1,76 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+#include "config.h"
+
+#include <pthread.h>
+#include <string.h>
+
+#include "crc32c.h"
+
+/* The Castagnoli polynomial, bit reversed. */
+#define CRC32C_POLY 0x82f63b78
+
+/*
+ * Tables for the software version, which handles eight bytes at a time
+ * ("slicing-by-8"): crc32c_table[k][b] is the CRC of byte b followed by k
+ * zero bytes.
+ */
+static uint32_t crc32c_table[8][256];
+
+static uint32_t crc32c_sw(uint32_t crc, const uint8_t *buf, size_t len) {
+    for (; len > 0 && ((uintptr_t)buf & 7) != 0; --len, ++buf) {
+        crc = crc32c_table[0][(crc ^ *buf) & 0xff] ^ (crc >> 8);
+    }
+    for (; len >= 8; len -= 8, buf += 8) {
+        uint32_t lo, hi;
+        memcpy(&lo, buf, sizeof(lo));
+        memcpy(&hi, buf + 4, sizeof(hi));
+#ifdef WORDS_BIGENDIAN
+        lo = __builtin_bswap32(lo);
+        hi = __builtin_bswap32(hi);
+#endif
+        lo ^= crc;
+        crc = crc32c_table[7][lo & 0xff] ^
+              crc32c_table[6][(lo >> 8) & 0xff] ^
+              crc32c_table[5][(lo >> 16) & 0xff] ^
+              crc32c_table[4][lo >> 24] ^
+              crc32c_table[3][hi & 0xff] ^
+              crc32c_table[2][(hi >> 8) & 0xff] ^
+              crc32c_table[1][(hi >> 16) & 0xff] ^
+              crc32c_table[0][hi >> 24];
+    }
+    for (; len > 0; --len, ++buf) {
+        crc = crc32c_table[0][(crc ^ *buf) & 0xff] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+static uint32_t (*crc32c_impl)(uint32_t, const uint8_t *, size_t) = crc32c_sw;
+static pthread_once_t crc32c_once = PTHREAD_ONCE_INIT;
+
+static void crc32c_init(void) {
+    uint32_t i, j, k;
+    for (i = 0; i < 256; ++i) {
+        uint32_t crc = i;
+        for (j = 0; j < 8; ++j) {
+            crc = (crc & 1) ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+        }
+        crc32c_table[0][i] = crc;
+    }
+    for (i = 0; i < 256; ++i) {
+        for (k = 1; k < 8; ++k) {
+            uint32_t prev = crc32c_table[k - 1][i];
+            crc32c_table[k][i] = crc32c_table[0][prev & 0xff] ^ (prev >> 8);
+        }
+    }
+
+#ifdef HAVE_HW_CRC32C
+    if (crc32c_hw_available()) {
+        crc32c_impl = crc32c_hw;
+    }
+#endif
+}
+
+uint32_t crc32c(const uint8_t *buf, size_t len) {
+    pthread_once(&crc32c_once, crc32c_init);
+    return ~crc32c_impl(0xffffffff, buf, len);
+}
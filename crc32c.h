@@ -0,0 +1,61 @@
+#ifndef CRC32C_H
+#define CRC32C_H 1
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#include <cpuid.h>
+#define HAVE_HW_CRC32C 1
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * True if the CPU has the SSE4.2 crc32 instruction crc32c_hw() needs.
+ */
+static inline int crc32c_hw_available(void) {
+#ifdef HAVE_HW_CRC32C
+    unsigned int eax, ebx, ecx, edx;
+    return __get_cpuid(1, &eax, &ebx, &ecx, &edx) && (ecx & bit_SSE4_2) != 0;
+#else
+    return 0;
+#endif
+}
+
+#ifdef HAVE_HW_CRC32C
+/**
+ * Continue a CRC32C (without the final inversion) over a buffer with the
+ * SSE4.2 crc32 instruction, eight bytes at a time.  Only call this if
+ * crc32c_hw_available() says so.
+ */
+static inline uint32_t crc32c_hw(uint32_t crc, const uint8_t *buf,
+                                 size_t len) {
+    uint64_t crc64 = crc;
+    for (; len >= 8; len -= 8, buf += 8) {
+        uint64_t word;
+        memcpy(&word, buf, sizeof(word));
+        __asm__("crc32q %1, %0" : "+r"(crc64) : "rm"(word));
+    }
+    crc = (uint32_t)crc64;
+    for (; len > 0; --len, ++buf) {
+        __asm__("crc32b %1, %0" : "+r"(crc) : "rm"(*buf));
+    }
+    return crc;
+}
+#endif
+
+/**
+ * Compute the CRC32C (Castagnoli) checksum of a buffer, using the SSE4.2
+ * crc32 instruction when the CPU has it.
+ */
+uint32_t crc32c(const uint8_t *buf, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CRC32C_H */
@@ -23,9 +23,10 @@ extern "C" {
 }
 
 static void* launch_dispatcher_thread(void *arg) {
-    Dispatcher *dispatcher = (Dispatcher*) arg;
+    DispatcherWorker *worker = (DispatcherWorker*) arg;
+    Dispatcher *dispatcher = worker->dispatcher;
     try {
-        dispatcher->run();
+        dispatcher->run(*worker);
     } catch (std::exception& e) {
         getLogger()->log(EXTENSION_LOG_WARNING, NULL,
                          "%s: Caught an exception: %s\n",
@@ -86,42 +87,108 @@ void Task::snooze(const double secs, bool first) {
 
 void Dispatcher::start() {
     assert(state == dispatcher_running);
-    if(pthread_create(&thread, NULL, launch_dispatcher_thread, this) != 0) {
-        std::stringstream ss;
-        ss << getName().c_str() << ": Initialization error!!!";
-        throw std::runtime_error(ss.str().c_str());
+    LockHolder lh(mutex);
+    std::vector<DispatcherWorker*>::iterator it;
+    for (it = workers.begin(); it != workers.end(); ++it) {
+        if(pthread_create(&(*it)->thread, NULL, launch_dispatcher_thread, *it) != 0) {
+            std::stringstream ss;
+            ss << getName().c_str() << ": Initialization error!!!";
+            throw std::runtime_error(ss.str().c_str());
+        }
+        ++runningWorkers;
     }
 }
 
-TaskId Dispatcher::nextTask() {
-    assert (!empty());
-    return readyQueue.empty() ? futureQueue.top() : readyQueue.top();
+bool Dispatcher::empty() {
+    if (!futureQueue.empty()) {
+        return false;
+    }
+    std::vector<DispatcherWorker*>::iterator it;
+    for (it = workers.begin(); it != workers.end(); ++it) {
+        if (!(*it)->readyQueue.empty()) {
+            return false;
+        }
+    }
+    return true;
 }
 
-void Dispatcher::popNext() {
-    assert (!empty());
-    readyQueue.empty() ? futureQueue.pop() : readyQueue.pop();
+TaskId Dispatcher::takeReadyTask(DispatcherWorker &worker) {
+    TaskId task;
+    if (!worker.readyQueue.empty()) {
+        task = worker.readyQueue.front();
+        worker.readyQueue.pop_front();
+        return task;
+    }
+
+    // Steal the most urgent task queued for a busy worker.
+    DispatcherWorker *victim = NULL;
+    std::vector<DispatcherWorker*>::iterator it;
+    for (it = workers.begin(); it != workers.end(); ++it) {
+        DispatcherWorker *w = *it;
+        if (!w->readyQueue.empty() &&
+            (victim == NULL ||
+             w->readyQueue.front()->priority < victim->readyQueue.front()->priority)) {
+            victim = w;
+        }
+    }
+    if (victim != NULL) {
+        task = victim->readyQueue.front();
+        victim->readyQueue.pop_front();
+        ++worker.steals;
+    }
+    return task;
 }
 
-void Dispatcher::moveReadyTasks(const struct timeval &tv) {
-    if (!readyQueue.empty()) {
-        return;
+TaskId Dispatcher::popAnyTask() {
+    TaskId task;
+    std::vector<DispatcherWorker*>::iterator it;
+    for (it = workers.begin(); it != workers.end(); ++it) {
+        if (!(*it)->readyQueue.empty()) {
+            task = (*it)->readyQueue.front();
+            (*it)->readyQueue.pop_front();
+            return task;
+        }
     }
+    assert(!futureQueue.empty());
+    task = futureQueue.top();
+    futureQueue.pop();
+    return task;
+}
+
+void Dispatcher::moveReadyTasks(const struct timeval &tv) {
     while (!futureQueue.empty()) {
         TaskId tid = futureQueue.top();
-        if (less_tv(tid->waketime, tv)) {
-            readyQueue.push(tid);
-            futureQueue.pop();
-        } else {
+        if (!less_tv(tid->waketime, tv)) {
             // We found all the ready stuff.
             return;
         }
+        futureQueue.pop();
+
+        // Back to the worker that ran it last, for locality.
+        DispatcherWorker *w = NULL;
+        if (tid->worker >= 0 && static_cast<size_t>(tid->worker) < workers.size()) {
+            w = workers[tid->worker];
+        } else {
+            std::vector<DispatcherWorker*>::iterator it;
+            for (it = workers.begin(); it != workers.end(); ++it) {
+                if (w == NULL || (*it)->readyQueue.size() < w->readyQueue.size()) {
+                    w = *it;
+                }
+            }
+        }
+        // Behind the tasks of the same priority.
+        std::deque<TaskId>::iterator pos = w->readyQueue.begin();
+        while (pos != w->readyQueue.end() && (*pos)->priority <= tid->priority) {
+            ++pos;
+        }
+        w->readyQueue.insert(pos, tid);
     }
 }
 
-void Dispatcher::run() {
+void Dispatcher::run(DispatcherWorker &worker) {
     ObjectRegistry::onSwitchThread(&engine);
-    getLogger()->log(EXTENSION_LOG_INFO, NULL, "%s: Starting\n", getName().c_str());
+    getLogger()->log(EXTENSION_LOG_INFO, NULL, "%s: Starting worker %d\n",
+                     getName().c_str(), worker.id);
     for (;;) {
         LockHolder lh(mutex);
         // Having acquired the lock, verify our state and break out if
@@ -134,7 +201,7 @@ void Dispatcher::run() {
             // Wait forever as long as the state didn't change while
             // we grabbed the lock.
             if (state == dispatcher_running) {
-                noTask();
+                worker.taskDesc = "none";
                 mutex.wait();
             }
         } else {
@@ -144,34 +211,44 @@ void Dispatcher::run() {
             // Get any ready tasks out of the due queue.
             moveReadyTasks(tv);
 
-            TaskId task = nextTask();
-            assert(task);
-            LockHolder tlh(task->mutex);
-            if (task->state == task_dead) {
-                popNext();
-                continue;
-            }
-
-            if (less_tv(tv, task->waketime)) {
-                idleTask->setWaketime(task->waketime);
-                idleTask->setDispatcherNotifications(notifications.get());
-                task = idleTask;
-                taskDesc = task->getName();
+            TaskId task = takeReadyTask(worker);
+            DispatcherCallback *cb = NULL;
+            if (task) {
+                LockHolder tlh(task->mutex);
+                if (task->state == task_dead) {
+                    continue;
+                }
+                tlh.unlock();
+                // A woken or rescheduled copy of a task shares its
+                // callback; hold it back until the running one returns.
+                cb = task->callback.get();
+                if (runningCallbacks.find(cb) != runningCallbacks.end()) {
+                    deferredTasks[cb].push_back(task);
+                    continue;
+                }
+                runningCallbacks.insert(cb);
             } else {
-                // Otherwise, do the normal thing.
-                popNext();
-                taskDesc = task->getName();
+                // Nothing is due yet; sleep until the first task is.
+                task = futureQueue.top();
+                LockHolder tlh(task->mutex);
+                if (task->state == task_dead) {
+                    futureQueue.pop();
+                    continue;
+                }
+                worker.idleTask->setWaketime(task->waketime);
+                worker.idleTask->setDispatcherNotifications(notifications.get());
+                task = worker.idleTask;
             }
-            tlh.unlock();
-
-            taskStart = gethrtime();
+            worker.taskDesc = task->getName();
+            worker.taskStart = gethrtime();
+            worker.running_task = true;
+            ++worker.runs;
             lh.unlock();
+
             rel_time_t startReltime = ep_current_time();
+            bool again = false;
             try {
-                running_task = true;
-                if(task->run(*this, TaskId(task))) {
-                    reschedule(task);
-                }
+                again = task->run(*this, TaskId(task));
             } catch (std::exception& e) {
                 getLogger()->log(EXTENSION_LOG_WARNING, NULL,
                                  "%s: Exception caught in task \"%s\": %s\n",
@@ -181,21 +258,68 @@ void Dispatcher::run() {
                                  "%s: Fatal exception caught in task \"%s\"\n",
                                  getName().c_str(), task->getName().c_str());
             }
-            running_task = false;
 
-            hrtime_t runtime((gethrtime() - taskStart) / 1000);
-            JobLogEntry jle(taskDesc, runtime, startReltime);
+            hrtime_t runtime((gethrtime() - worker.taskStart) / 1000);
+            lh.lock();
+            worker.running_task = false;
+            JobLogEntry jle(worker.taskDesc, runtime, startReltime);
             joblog.add(jle);
             if (runtime > task->maxExpectedDuration()) {
                 slowjobs.add(jle);
             }
+            if (again) {
+                task->worker = static_cast<int>(worker.id);
+                futureQueue.push(task);
+                notify();
+            }
+            if (cb != NULL) {
+                runningCallbacks.erase(cb);
+                std::map<DispatcherCallback*, std::vector<TaskId> >::iterator dit;
+                dit = deferredTasks.find(cb);
+                if (dit != deferredTasks.end()) {
+                    std::vector<TaskId>::iterator tit;
+                    for (tit = dit->second.begin(); tit != dit->second.end(); ++tit) {
+                        futureQueue.push(*tit);
+                    }
+                    deferredTasks.erase(dit);
+                    notify();
+                }
+            }
         }
     }
 
-    completeNonDaemonTasks();
-    state = dispatcher_stopped;
-    notify();
-    getLogger()->log(EXTENSION_LOG_INFO, NULL, "%s: Exited\n", getName().c_str());
+    getLogger()->log(EXTENSION_LOG_INFO, NULL, "%s: Worker %d exited\n",
+                     getName().c_str(), worker.id);
+    LockHolder lh(mutex);
+    if (--runningWorkers == 0) {
+        // The last worker out finishes the work left.
+        lh.unlock();
+        completeNonDaemonTasks();
+        lh.lock();
+        state = dispatcher_stopped;
+        notify();
+        getLogger()->log(EXTENSION_LOG_INFO, NULL, "%s: Exited\n", getName().c_str());
+    }
+}
+
+DispatcherState Dispatcher::getDispatcherState() {
+    LockHolder lh(mutex);
+    std::vector<WorkerState> ws;
+    // The dispatcher as a whole reports the longest running task.
+    DispatcherWorker *busiest = workers[0];
+    std::vector<DispatcherWorker*>::iterator it;
+    for (it = workers.begin(); it != workers.end(); ++it) {
+        DispatcherWorker *w = *it;
+        ws.push_back(WorkerState(w->taskDesc, w->taskStart, w->running_task,
+                                 w->readyQueue.size(), w->steals, w->runs));
+        if (w->running_task &&
+            (!busiest->running_task || w->taskStart < busiest->taskStart)) {
+            busiest = w;
+        }
+    }
+    return DispatcherState(busiest->taskDesc, state, busiest->taskStart,
+                           busiest->running_task, joblog.contents(),
+                           slowjobs.contents(), ws);
 }
 
 void Dispatcher::stop(bool force) {
@@ -206,9 +330,18 @@ void Dispatcher::stop(bool force) {
     forceTermination = force;
     getLogger()->log(EXTENSION_LOG_INFO, NULL, "%s: Stopping\n", getName().c_str());
     state = dispatcher_stopping;
+    bool started = runningWorkers > 0;
     notify();
     lh.unlock();
-    pthread_join(thread, NULL);
+    if (started) {
+        std::vector<DispatcherWorker*>::iterator it;
+        for (it = workers.begin(); it != workers.end(); ++it) {
+            pthread_join((*it)->thread, NULL);
+        }
+    } else {
+        completeNonDaemonTasks();
+        state = dispatcher_stopped;
+    }
     getLogger()->log(EXTENSION_LOG_INFO, NULL, "%s: Stopped\n", getName().c_str());
 }
 
@@ -286,8 +419,7 @@ void Dispatcher::reschedule(TaskId task) {
 void Dispatcher::completeNonDaemonTasks() {
     LockHolder lh(mutex);
     while (!empty()) {
-        TaskId task = nextTask();
-        popNext();
+        TaskId task = popAnyTask();
         assert(task);
         // Skip a daemon task
         if (task->isDaemonTask) {
@@ -3,7 +3,10 @@
 #define DISPATCHER_HH
 
 #include <stdexcept>
+#include <map>
 #include <queue>
+#include <set>
+#include <vector>
 
 #include "common.hh"
 #include "atomic.hh"
@@ -125,7 +128,7 @@ protected:
          bool isDaemon = true, bool completeBeforeShutdown = false) :
         callback(cb), priority(p),
         state(task_running), isDaemonTask(isDaemon),
-        blockShutdown(completeBeforeShutdown)
+        blockShutdown(completeBeforeShutdown), worker(-1)
     {
         snooze(sleeptime, true);
     }
@@ -136,6 +139,7 @@ protected:
         callback = task.callback;
         isDaemonTask = task.isDaemonTask;
         blockShutdown = task.blockShutdown;
+        worker = task.worker;
     }
 
     void snooze(const double secs, bool first=false);
@@ -167,6 +171,9 @@ protected:
 
     // Some of the tasks must complete during shutdown
     bool blockShutdown;
+
+    //! The worker that last ran this task (-1 if none yet).
+    int worker;
 };
 
 /**
@@ -231,6 +238,55 @@ public:
     }
 };
 
+/**
+ * Snapshot of the state of a dispatcher worker thread.
+ */
+class WorkerState {
+public:
+    WorkerState(const std::string &name, hrtime_t start, bool running,
+                size_t depth, size_t nsteals, size_t nruns)
+        : taskName(name), taskStart(start), running_task(running),
+          queueDepth(depth), steals(nsteals), runs(nruns) {}
+
+    /**
+     * Get the time the current task started.
+     */
+    hrtime_t getTaskStart() const { return taskStart; }
+
+    /**
+     * Get the name of the currently running task.
+     */
+    const std::string getTaskName() const { return taskName; }
+
+    /**
+     * True if the worker is currently running a task.
+     */
+    bool isRunningTask() const { return running_task; }
+
+    /**
+     * Get the number of ready tasks queued for this worker.
+     */
+    size_t getQueueDepth() const { return queueDepth; }
+
+    /**
+     * Get the number of tasks this worker took from other workers.
+     */
+    size_t getSteals() const { return steals; }
+
+    /**
+     * Get the number of tasks this worker has run.
+     */
+    size_t getRuns() const { return runs; }
+
+private:
+    std::string taskName;
+    hrtime_t taskStart;
+    bool running_task;
+    size_t queueDepth;
+    size_t steals;
+    size_t runs;
+};
+
 /**
  * Snapshot of the state of a dispatcher.
  */
@@ -240,8 +296,9 @@ public:
                     enum dispatcher_state st,
                     hrtime_t start, bool running,
                     std::vector<JobLogEntry> jl,
-                    std::vector<JobLogEntry> sj)
-        : joblog(jl), slowjobs(sj), taskName(name),
+                    std::vector<JobLogEntry> sj,
+                    std::vector<WorkerState> ws)
+        : joblog(jl), slowjobs(sj), workers(ws), taskName(name),
           state(st), taskStart(start), running_task(running) {}
 
     /**
@@ -282,9 +339,15 @@ public:
      */
     const std::vector<JobLogEntry> getSlowLog() const { return slowjobs; }
 
+    /**
+     * Retrieve the state of each worker thread.
+     */
+    const std::vector<WorkerState> &getWorkers() const { return workers; }
+
 private:
     const std::vector<JobLogEntry> joblog;
     const std::vector<JobLogEntry> slowjobs;
+    const std::vector<WorkerState> workers;
     const std::string taskName;
     const enum dispatcher_state state;
     const hrtime_t taskStart;
@@ -292,20 +355,63 @@ private:
 };
 
 /**
- * Schedule and run tasks in another thread.
+ * A worker thread of a dispatcher.
+ */
+class DispatcherWorker {
+public:
+    DispatcherWorker(Dispatcher *d, size_t i) :
+        dispatcher(d), id(i), idleTask(new IdleTask), taskDesc("none"),
+        taskStart(0), running_task(false), steals(0), runs(0) {}
+
+    Dispatcher *dispatcher;
+    size_t id;
+    pthread_t thread;
+
+    //! Ready tasks, most urgent first.
+    std::deque<TaskId> readyQueue;
+    shared_ptr<IdleTask> idleTask;
+    std::string taskDesc;
+    hrtime_t taskStart;
+    bool running_task;
+    size_t steals;
+    size_t runs;
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(DispatcherWorker);
+};
+
+/**
+ * Schedule and run tasks in a pool of threads.
+ *
+ * Every worker thread has its own queue of ready tasks.  A task that
+ * becomes ready goes back to the worker that ran it last (or to the
+ * worker with the fewest ready tasks), and a worker that runs out of
+ * ready tasks steals the most urgent one queued for another worker,
+ * so one long running task doesn't hold up the others.  Tasks of one
+ * dispatcher may thus run concurrently, but a task never runs
+ * concurrently with itself: a task that is woken or rescheduled
+ * while its callback runs is held back until that run returns.
  */
 class Dispatcher {
 public:
-    Dispatcher(EventuallyPersistentEngine &e, const char *desc = NULL) :
+    Dispatcher(EventuallyPersistentEngine &e, const char *desc = NULL,
+               size_t numWorkers = 1) :
         notifications(0), joblog(JOB_LOG_SIZE), slowjobs(JOB_LOG_SIZE),
-        idleTask(new IdleTask), state(dispatcher_running),
+        state(dispatcher_running), runningWorkers(0),
         forceTermination(false), engine(e), name(desc ? desc : "Dispatcher")
     {
-        noTask();
+        assert(numWorkers > 0);
+        for (size_t i = 0; i < numWorkers; ++i) {
+            workers.push_back(new DispatcherWorker(this, i));
+        }
     }
 
     ~Dispatcher() {
         stop();
+        std::vector<DispatcherWorker*>::iterator it;
+        for (it = workers.begin(); it != workers.end(); ++it) {
+            delete *it;
+        }
     }
 
     /**
@@ -335,7 +441,7 @@ public:
     void wake(TaskId task, TaskId *outtid);
 
     /**
-     * Start this dispatcher's thread.
+     * Start this dispatcher's threads.
      */
     void start();
     /**
@@ -345,9 +451,9 @@ public:
     void stop(bool force = false);
 
     /**
-     * Dispatcher's main loop.  Don't run this.
+     * A worker's main loop.  Don't run this.
      */
-    void run();
+    void run(DispatcherWorker &worker);
 
     /**
      * Delay a task.
@@ -363,31 +469,31 @@ public:
     void cancel(TaskId t);
 
     /**
-     * Get the name of the currently executing task.
+     * Get the name of the task executing on the first worker.
      */
-    std::string getCurrentTaskName() { return taskDesc; }
+    std::string getCurrentTaskName() {
+        LockHolder lh(mutex);
+        return workers[0]->taskDesc;
+    }
 
     /**
      * Get the state of the dispatcher.
      */
     enum dispatcher_state getState() { return state; }
 
-    DispatcherState getDispatcherState() {
-        LockHolder lh(mutex);
-        return DispatcherState(taskDesc, state, taskStart, running_task,
-                               joblog.contents(), slowjobs.contents());
-    }
+    DispatcherState getDispatcherState();
 
     const std::string &getName() { return name; }
 
+    /**
+     * Get the number of worker threads.
+     */
+    size_t getNumWorkers() const { return workers.size(); }
+
 private:
 
     friend class IdleTask;
 
-    void noTask() {
-        taskDesc = "none";
-    }
-
     void reschedule(TaskId task);
 
     void notify() {
@@ -401,38 +507,43 @@ private:
     void completeNonDaemonTasks();
 
     /**
-     * Move all tasks that are ready for execution into the "ready"
-     * priority queue.
+     * Move all tasks that are ready for execution into the ready
+     * queues of the workers.
      */
     void moveReadyTasks(const struct timeval &tv);
 
     //! True if there are no tasks scheduled.
-    bool empty() { return readyQueue.empty() && futureQueue.empty(); }
+    bool empty();
 
-    //! Get the next task.
-    TaskId nextTask();
+    /**
+     * Take the next ready task of a worker, stealing one from another
+     * worker if it has none.  Returns an empty TaskId if no task is
+     * ready.
+     */
+    TaskId takeReadyTask(DispatcherWorker &worker);
 
-    //! Remove the next task.
-    void popNext();
+    //! Remove and return any scheduled task (at shutdown).
+    TaskId popAnyTask();
 
-    std::string taskDesc;
-    pthread_t thread;
     SyncObject mutex;
     Atomic<size_t> notifications;
-    std::priority_queue<TaskId, std::deque<TaskId >,
-                        CompareTasksByPriority> readyQueue;
+    std::vector<DispatcherWorker*> workers;
     std::priority_queue<TaskId, std::deque<TaskId >,
                         CompareTasksByDueDate> futureQueue;
+    //! Callbacks being run by a worker right now.
+    std::set<DispatcherCallback*> runningCallbacks;
+    //! Ready tasks waiting for a run of their callback to return.
+    std::map<DispatcherCallback*, std::vector<TaskId> > deferredTasks;
     RingBuffer<JobLogEntry> joblog;
     RingBuffer<JobLogEntry> slowjobs;
-    shared_ptr<IdleTask> idleTask;
     enum dispatcher_state state;
-    hrtime_t taskStart;
-    bool running_task;
+    size_t runningWorkers;
     bool forceTermination;
 
     EventuallyPersistentEngine &engine;
     std::string name;
+
+    DISALLOW_COPY_AND_ASSIGN(Dispatcher);
 };
 
 #endif
@@ -127,15 +127,16 @@ class BGFetchCallback : public DispatcherCallback {
 public:
     BGFetchCallback(EventuallyPersistentStore *e,
                     const std::string &k, uint16_t vbid,
-                    uint64_t r, const void *c, bg_fetch_type_t t) :
+                    uint64_t r, const void *c, bg_fetch_type_t t,
+                    BGFetchGroup *g) :
         ep(e), key(k), vbucket(vbid), rowid(r), cookie(c), type(t),
-        counter(ep->bgFetchQueue), init(gethrtime()) {
+        group(g), counter(ep->bgFetchQueue), init(gethrtime()) {
         assert(ep);
         assert(cookie);
     }
 
     bool callback(Dispatcher &, TaskId) {
-        ep->completeBGFetch(key, vbucket, rowid, cookie, init, type);
+        ep->completeBGFetch(key, vbucket, rowid, cookie, init, type, group);
         return false;
     }
 
@@ -152,6 +153,7 @@ private:
     uint64_t                   rowid;
     const void                *cookie;
     bg_fetch_type_t            type;
+    BGFetchGroup              *group;
     BGFetchCounter             counter;
 
     hrtime_t init;
@@ -200,6 +202,57 @@ private:
     BGFetchCounter                   counter;
 };
 
+/**
+ * Adds the keys read from disk to the key filter of a vbucket, or to
+ * the filter replacing it.
+ */
+class KeyFilterLoader : public Callback<GetValue> {
+public:
+    KeyFilterLoader(RCPtr<VBucket> &vbucket, bool forRebuild) :
+        vb(vbucket), rebuild(forRebuild) {}
+
+    void callback(GetValue &val) {
+        Item *i = val.getValue();
+        if (i != NULL) {
+            if (rebuild) {
+                vb->addToRebuildFilter(i->getKey());
+            } else {
+                vb->addToFilter(i->getKey());
+            }
+            delete i;
+            val.setValue(NULL);
+        }
+    }
+
+private:
+    RCPtr<VBucket> vb;
+    bool           rebuild;
+};
+
+/**
+ * Dispatcher job rebuilding the key filter of a vbucket.
+ */
+class KeyFilterRebuildCallback : public DispatcherCallback {
+public:
+    KeyFilterRebuildCallback(EventuallyPersistentStore *e, RCPtr<VBucket> &vb) :
+        ep(e), vbucket(vb) {}
+
+    bool callback(Dispatcher &, TaskId) {
+        ep->rebuildKeyFilter(vbucket);
+        return false;
+    }
+
+    std::string description() {
+        std::stringstream ss;
+        ss << "Rebuilding the key filter of vbucket " << vbucket->getId();
+        return ss.str();
+    }
+
+private:
+    EventuallyPersistentStore *ep;
+    RCPtr<VBucket>             vbucket;
+};
+
 /**
  * Dispatcher job responsible for keeping the current state of
  * vbuckets recorded in the main db.
@@ -286,6 +339,52 @@ private:
     const void* cookie;
 };
 
+/**
+ * Get the number of threads for the non-IO dispatcher: the configured
+ * number, or one per core (up to maxAutoNonIOWorkers).
+ */
+static size_t getNumNonIOWorkers(Configuration &config) {
+    static const size_t maxAutoNonIOWorkers = 8;
+    size_t n = config.getNonioWorkers();
+    if (n == 0) {
+        n = 1;
+#ifdef _SC_NPROCESSORS_ONLN
+        long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+        if (ncpu > 0) {
+            n = std::min(static_cast<size_t>(ncpu), maxAutoNonIOWorkers);
+        }
+#endif
+    }
+    return n;
+}
+
+/**
+ * Get the number of flusher shards: the configured number, as long as
+ * the store allows that many writers.  The mutation log records the
+ * commits of a single writer, so it restricts persistence to one
+ * shard.
+ */
+static size_t getFlusherShardCount(Configuration &config,
+                                   const StorageProperties &props) {
+    size_t n = std::max(config.getFlusherShards(), static_cast<size_t>(1));
+    if (n > props.maxWriters()) {
+        getLogger()->log(EXTENSION_LOG_WARNING, NULL,
+                         "The store allows %d writer(s), using %d flusher "
+                         "shard(s) instead of %d\n",
+                         static_cast<int>(props.maxWriters()),
+                         static_cast<int>(props.maxWriters()),
+                         static_cast<int>(n));
+        n = std::max(props.maxWriters(), static_cast<size_t>(1));
+    }
+    if (n > 1 && !config.getKlogPath().empty()) {
+        getLogger()->log(EXTENSION_LOG_WARNING, NULL,
+                         "The mutation log is enabled, using a single "
+                         "flusher shard\n");
+        n = 1;
+    }
+    return n;
+}
+
 EventuallyPersistentStore::EventuallyPersistentStore(EventuallyPersistentEngine &theEngine,
                                                      KVStore *t,
                                                      bool startVb0,
@@ -298,8 +397,7 @@ EventuallyPersistentStore::EventuallyPersistentStore(EventuallyPersistentEngine
     accessLog(engine.getConfiguration().getAlogPath(),
               engine.getConfiguration().getAlogBlockSize()),
     diskFlushAll(false),
-    tctx(stats, t, mutationLog),
-    bgFetchDelay(0)
+    bgFetchDelay(0), fullEviction(false)
 {
     getLogger()->log(EXTENSION_LOG_INFO, NULL,
                      "Storage props:  c=%ld/r=%ld/rw=%ld\n",
@@ -327,8 +425,35 @@ EventuallyPersistentStore::EventuallyPersistentStore(EventuallyPersistentEngine
         tapUnderlying = roUnderlying;
         tapDispatcher = roDispatcher;
     }
-    nonIODispatcher = new Dispatcher(theEngine, "NONIO_Dispatcher");
-    flusher = new Flusher(this, dispatcher);
+    // Each IO dispatcher owns a KVStore that isn't thread-safe, so only
+    // the non-IO work is spread over a pool of threads.
+    nonIODispatcher = new Dispatcher(theEngine, "NONIO_Dispatcher",
+                                     getNumNonIOWorkers(theEngine.getConfiguration()));
+
+    // Every shard but the first gets its own store to write through,
+    // and the flushers of those shards a thread each.
+    size_t numShards = getFlusherShardCount(theEngine.getConfiguration(),
+                                            storageProperties);
+    shardLocks = new Mutex[numShards];
+    for (size_t i = 0; i < numShards; ++i) {
+        KVStore *kvs = rwUnderlying;
+        if (i > 0) {
+            kvs = engine.newKVStore();
+            // Learn the persisted vbucket states before updating them.
+            kvs->listPersistedVbuckets();
+        }
+        shards.push_back(new FlusherShard(stats, i, numShards, kvs,
+                                          mutationLog, shardLocks[i]));
+    }
+    flusherDispatcher = NULL;
+    if (numShards > 1) {
+        flusherDispatcher = new Dispatcher(theEngine, "Flusher_Dispatcher",
+                                           numShards - 1);
+    }
+    for (size_t i = 0; i < numShards; ++i) {
+        flushers.push_back(new Flusher(this, i == 0 ? dispatcher : flusherDispatcher,
+                                       shards[i]));
+    }
 
     if (multiBGFetchEnabled()) {
         bgFetcher = new BgFetcher(this, roDispatcher, stats);
@@ -381,6 +506,20 @@ EventuallyPersistentStore::EventuallyPersistentStore(EventuallyPersistentEngine
     config.addValueChangedListener("bg_fetch_delay",
                                    new EPStoreValueChangeListener(*this));
 
+    fullEviction = config.getItemEvictionPolicy() == "full_eviction";
+    if (fullEviction && !rwUnderlying->isKeyDumpSupported()) {
+        // Evicted items are fetched back by key.
+        getLogger()->log(EXTENSION_LOG_WARNING, NULL,
+                         "Full eviction is not supported by the %s backend, "
+                         "ejecting values only\n", config.getBackend().c_str());
+        fullEviction = false;
+    }
+    // Filters are populated with a key dump at warmup.
+    bool keyFilters = config.isBfilterEnabled() &&
+        rwUnderlying->isKeyDumpSupported();
+    VBucket::setDefaultKeyFilter(keyFilters ? config.getBfilterKeyCount() : 0,
+                                 config.getBfilterFpProb());
+
     stats.warmupMemUsedCap.set(static_cast<double>(config.getWarmupMinMemoryThreshold()) / 100.0);
     config.addValueChangedListener("warmup_min_memory_threshold",
                                    new StatsValueChangeListener(stats));
@@ -504,6 +643,10 @@ void EventuallyPersistentStore::initialize() {
                                        new EPStoreValueChangeListener(*this));
     }
 
+    shared_ptr<DispatcherCallback> vc(new ValueCompressor(this, stats));
+    nonIODispatcher->schedule(vc, NULL, Priority::ItemPagerPriority,
+                              config.getValueCompressorStime());
+
     shared_ptr<DispatcherCallback> htr(new HashtableResizer(this));
     nonIODispatcher->schedule(htr, NULL, Priority::HTResizePriority, 10);
 
@@ -541,8 +684,19 @@ EventuallyPersistentStore::~EventuallyPersistentStore() {
         delete tapUnderlying;
     }
     nonIODispatcher->stop(forceShutdown);
+    if (hasSeparateFlusherDispatcher()) {
+        flusherDispatcher->stop(forceShutdown);
+        delete flusherDispatcher;
+    }
 
-    delete flusher;
+    for (size_t i = 0; i < shards.size(); ++i) {
+        delete flushers[i];
+        if (i > 0) {
+            delete shards[i]->underlying;
+        }
+        delete shards[i];
+    }
+    delete []shardLocks;
     delete bgFetcher;
     delete dispatcher;
     delete nonIODispatcher;
@@ -557,6 +711,9 @@ void EventuallyPersistentStore::startDispatcher() {
     if (hasSeparateTapDispatcher()) {
         tapDispatcher->start();
     }
+    if (hasSeparateFlusherDispatcher()) {
+        flusherDispatcher->start();
+    }
 }
 
 void EventuallyPersistentStore::startNonIODispatcher() {
@@ -564,7 +721,7 @@ void EventuallyPersistentStore::startNonIODispatcher() {
 }
 
 const Flusher* EventuallyPersistentStore::getFlusher() {
-    return flusher;
+    return flushers[0];
 }
 
 Warmup* EventuallyPersistentStore::getWarmup(void) const {
@@ -573,23 +730,64 @@ Warmup* EventuallyPersistentStore::getWarmup(void) const {
 
 
 void EventuallyPersistentStore::startFlusher() {
-    flusher->start();
+    std::vector<Flusher*>::iterator it;
+    for (it = flushers.begin(); it != flushers.end(); ++it) {
+        (*it)->start();
+    }
 }
 
 void EventuallyPersistentStore::stopFlusher() {
-    bool rv = flusher->stop(engine.isForceShutdown());
-    if (rv && !engine.isForceShutdown()) {
-        flusher->wait();
+    // Let all the flushers drain their shards at once.
+    std::vector<bool> stopped;
+    std::vector<Flusher*>::iterator it;
+    for (it = flushers.begin(); it != flushers.end(); ++it) {
+        stopped.push_back((*it)->stop(engine.isForceShutdown()));
+    }
+    if (!engine.isForceShutdown()) {
+        for (size_t i = 0; i < flushers.size(); ++i) {
+            if (stopped[i]) {
+                flushers[i]->wait();
+            }
+        }
     }
 }
 
 bool EventuallyPersistentStore::pauseFlusher() {
-    tctx.commitSoon();
-    return flusher->pause();
+    bool rv = true;
+    for (size_t i = 0; i < shards.size(); ++i) {
+        shards[i]->tctx.commitSoon();
+        rv = flushers[i]->pause() && rv;
+    }
+    return rv;
 }
 
 bool EventuallyPersistentStore::resumeFlusher() {
-    return flusher->resume();
+    bool rv = true;
+    std::vector<Flusher*>::iterator it;
+    for (it = flushers.begin(); it != flushers.end(); ++it) {
+        rv = (*it)->resume() && rv;
+    }
+    return rv;
+}
+
+size_t EventuallyPersistentStore::getNumUncommittedItems() {
+    size_t rv = 0;
+    std::vector<FlusherShard*>::iterator it;
+    for (it = shards.begin(); it != shards.end(); ++it) {
+        rv += (*it)->tctx.getNumUncommittedItems();
+    }
+    return rv;
+}
+
+double EventuallyPersistentStore::getTransactionTimePerItem() {
+    // The shards commit in parallel, so an item takes as long as it
+    // takes in the slowest shard divided by the number of shards.
+    double rv = 0;
+    std::vector<FlusherShard*>::iterator it;
+    for (it = shards.begin(); it != shards.end(); ++it) {
+        rv = std::max(rv, (*it)->tctx.getTransactionTimePerItem());
+    }
+    return rv / static_cast<double>(shards.size());
 }
 
 void EventuallyPersistentStore::startBgFetcher() {
@@ -675,6 +873,91 @@ EventuallyPersistentStore::deleteExpiredItems(std::list<std::pair<uint16_t, std:
     std::for_each(keys.begin(), keys.end(), Deleter(this));
 }
 
+void
+EventuallyPersistentStore::evictItems(std::list<std::pair<uint16_t, std::string> > &keys) {
+    std::list<std::pair<uint16_t, std::string> >::iterator it;
+    for (it = keys.begin(); it != keys.end(); ++it) {
+        RCPtr<VBucket> vb = getVBucket(it->first);
+        if (!vb) {
+            continue;
+        }
+        int bucket_num(0);
+        LockHolder lh = vb->ht.getLockedBucket(it->second, &bucket_num);
+        // Clean items are on disk, so the key filter knows them already.
+        vb->ht.unlocked_evict(it->second, bucket_num);
+    }
+}
+
+void EventuallyPersistentStore::addToKeyFilter(RCPtr<VBucket> &vb,
+                                               const std::string &key) {
+    vb->addToFilter(key);
+    maybeRebuildKeyFilter(vb);
+}
+
+void EventuallyPersistentStore::maybeRebuildKeyFilter(RCPtr<VBucket> &vb) {
+    if (vb->startFilterRebuild()) {
+        getLogger()->log(EXTENSION_LOG_INFO, NULL,
+                         "Rebuilding the saturated key filter of vbucket %d\n",
+                         vb->getId());
+        shared_ptr<DispatcherCallback> cb(new KeyFilterRebuildCallback(this, vb));
+        roDispatcher->schedule(cb, NULL, Priority::KeyFilterRebuildPriority, 0,
+                               false);
+    }
+}
+
+void EventuallyPersistentStore::rebuildKeyFilter(RCPtr<VBucket> &vb) {
+    shared_ptr<Callback<GetValue> > cb(new KeyFilterLoader(vb, true));
+    roUnderlying->dumpAllKeys(vb->getId(), cb);
+    vb->completeFilterRebuild();
+}
+
+ENGINE_ERROR_CODE EventuallyPersistentStore::fetchEvictedItem(RCPtr<VBucket> &vb,
+                                                              const std::string &key,
+                                                              int bucket_num,
+                                                              const void *cookie,
+                                                              BGFetchGroup *group) {
+    assert(fullEviction);
+    StoredValue *v = vb->ht.unlocked_find(key, bucket_num, true, false);
+    if (v) {
+        if (v->isTempInitialItem()) {
+            // Already being fetched, but every waiter needs its own
+            // notification.
+            if (cookie) {
+                bgFetch(key, vb->getId(), -1, cookie, BG_FETCH_VALUE, group);
+            }
+            return ENGINE_EWOULDBLOCK;
+        }
+        // Deleted, or known not to exist on disk.
+        return ENGINE_KEY_ENOENT;
+    }
+
+    if (!vb->maybeKeyExistsInFilter(key)) {
+        return ENGINE_KEY_ENOENT;
+    }
+
+    switch (vb->ht.unlocked_addTempDeletedItem(bucket_num, key)) {
+    case ADD_NOMEM:
+        return ENGINE_ENOMEM;
+    case ADD_EXISTS:
+    case ADD_UNDEL:
+        // Since the hashtable bucket is locked, we should never get here
+        abort();
+    case ADD_SUCCESS:
+        if (cookie) {
+            bgFetch(key, vb->getId(), -1, cookie, BG_FETCH_VALUE, group);
+        }
+    }
+    return ENGINE_EWOULDBLOCK;
+}
+
+void EventuallyPersistentStore::forgetRecreatedEvictedItem(RCPtr<VBucket> &vb,
+                                                           const std::string &key) {
+    if (fullEviction && vb->ht.getNumEvictedItems() > 0 &&
+        vb->filterMayHoldKey(key)) {
+        vb->ht.forgetEvictedItem();
+    }
+}
+
 StoredValue *EventuallyPersistentStore::fetchValidValue(RCPtr<VBucket> &vb,
                                                         const std::string &key,
                                                         int bucket_num,
@@ -717,6 +1000,7 @@ protocol_binary_response_status EventuallyPersistentStore::evictKey(const std::s
         }
         if (v->isResident()) {
             if (v->ejectValue(stats, vb->ht)) {
+                vb->ht.unlocked_pack(v, bucket_num);
                 *msg = "Ejected.";
             } else {
                 *msg = "Can't eject: Dirty or a small object.";
@@ -753,8 +1037,22 @@ ENGINE_ERROR_CODE EventuallyPersistentStore::set(const Item &itm,
 
     bool cas_op = (itm.getCas() != 0);
 
+    int bucket_num(0);
+    LockHolder lh = vb->ht.getLockedBucket(itm.getKey(), &bucket_num);
+    if (cas_op && fullEviction &&
+        !vb->ht.unlocked_find(itm.getKey(), bucket_num, false, false)) {
+        // The item to compare with may have been evicted.
+        return fetchEvictedItem(vb, itm.getKey(), bucket_num, cookie);
+    }
+
     int64_t row_id = -1;
-    mutation_type_t mtype = vb->ht.set(itm, row_id, trackReference);
+    mutation_type_t mtype = vb->ht.unlocked_set(itm, itm.getCas(), row_id,
+                                                bucket_num, true, false,
+                                                trackReference);
+    if (mtype == NOT_FOUND && !cas_op) {
+        forgetRecreatedEvictedItem(vb, itm.getKey());
+    }
+    lh.unlock();
     ENGINE_ERROR_CODE ret = ENGINE_SUCCESS;
 
     switch (mtype) {
@@ -803,13 +1101,29 @@ ENGINE_ERROR_CODE EventuallyPersistentStore::add(const Item &itm,
         return ENGINE_NOT_STORED;
     }
 
-    switch (vb->ht.add(itm)) {
+    int bucket_num(0);
+    LockHolder lh = vb->ht.getLockedBucket(itm.getKey(), &bucket_num);
+    if (fullEviction) {
+        StoredValue *v = vb->ht.unlocked_find(itm.getKey(), bucket_num,
+                                              true, false);
+        if (!v || v->isTempInitialItem()) {
+            // The key may still exist on disk.
+            ENGINE_ERROR_CODE ec = fetchEvictedItem(vb, itm.getKey(),
+                                                    bucket_num, cookie);
+            if (ec != ENGINE_KEY_ENOENT) {
+                return ec;
+            }
+        }
+    }
+
+    switch (vb->ht.unlocked_add(bucket_num, itm)) {
     case ADD_NOMEM:
         return ENGINE_ENOMEM;
     case ADD_EXISTS:
         return ENGINE_NOT_STORED;
     case ADD_SUCCESS:
     case ADD_UNDEL:
+        lh.unlock();
         queueDirty(itm.getKey(), itm.getVBucketId(), queue_op_set,
                    itm.getSeqno(), -1);
     }
@@ -836,6 +1150,9 @@ ENGINE_ERROR_CODE EventuallyPersistentStore::addTAPBackfillItem(const Item &itm,
     } else {
         mtype = vb->ht.set(itm, row_id, trackReference);
     }
+    if (mtype == NOT_FOUND) {
+        forgetRecreatedEvictedItem(vb, itm.getKey());
+    }
     ENGINE_ERROR_CODE ret = ENGINE_SUCCESS;
 
     switch (mtype) {
@@ -897,7 +1214,22 @@ void EventuallyPersistentStore::snapshotVBuckets(const Priority &priority) {
     VBucketStateVisitor v(vbuckets);
     visit(v);
     hrtime_t start = gethrtime();
-    if (!rwUnderlying->snapshotVBuckets(v.states)) {
+    // Every shard's store writes the states of its own vbuckets.
+    bool success = true;
+    std::vector<FlusherShard*>::iterator sit;
+    for (sit = shards.begin(); success && sit != shards.end(); ++sit) {
+        FlusherShard &shard = **sit;
+        vbucket_map_t states;
+        vbucket_map_t::iterator it;
+        for (it = v.states.begin(); it != v.states.end(); ++it) {
+            if (shard.owns(it->first)) {
+                states.insert(*it);
+            }
+        }
+        LockHolder slh(shard.mutex);
+        success = shard.underlying->snapshotVBuckets(states);
+    }
+    if (!success) {
         getLogger()->log(EXTENSION_LOG_WARNING, NULL,
                          "VBucket snapshot task failed!!! Reschedule it...\n");
         scheduleVBSnapshot(priority);
@@ -924,6 +1256,8 @@ void EventuallyPersistentStore::setVBucketState(uint16_t vbid,
         scheduleVBSnapshot(Priority::VBucketPersistLowPriority);
     } else {
         RCPtr<VBucket> newvb(new VBucket(vbid, to, stats, engine.getCheckpointConfig()));
+        // Nothing of a new vbucket is on disk yet.
+        newvb->setFilterStatus(BFILTER_ENABLED);
         // The first checkpoint for active vbucket should start with id 2.
         uint64_t start_chk_id = (to == vbucket_state_active) ? 2 : 0;
         newvb->checkpointManager.setOpenCheckpointId(start_chk_id);
@@ -955,7 +1289,9 @@ EventuallyPersistentStore::completeVBucketDeletion(uint16_t vbid) {
     RCPtr<VBucket> vb = vbuckets.getBucket(vbid);
     if (!vb || vb->getState() == vbucket_state_dead || vbuckets.isBucketDeletion(vbid)) {
         lh.unlock();
-        if (rwUnderlying->delVBucket(vbid)) {
+        FlusherShard &shard = getShard(vbid);
+        LockHolder slh(shard.mutex);
+        if (shard.underlying->delVBucket(vbid)) {
             vbuckets.setBucketDeletion(vbid, false);
             mutationLog.deleteAll(vbid);
             // This is happening in an independent transaction, so
@@ -1057,12 +1393,32 @@ void EventuallyPersistentStore::updateBGStats(const hrtime_t init,
     }
 }
 
+/**
+ * Complete the fetch of an item evicted in full: replace its temporary
+ * item by the item from disk, or mark the key as non-existent.  Either
+ * way the waiting operation can be retried.
+ */
+static ENGINE_ERROR_CODE restoreEvictedItem(RCPtr<VBucket> &vb,
+                                            StoredValue *v, GetValue &gv) {
+    switch (gv.getStatus()) {
+    case ENGINE_SUCCESS:
+        vb->ht.unlocked_restoreItem(v, gv.getValue());
+        return ENGINE_SUCCESS;
+    case ENGINE_KEY_ENOENT:
+        v->unlocked_restoreMeta(NULL, ENGINE_KEY_ENOENT);
+        return ENGINE_SUCCESS;
+    default:
+        return gv.getStatus();
+    }
+}
+
 void EventuallyPersistentStore::completeBGFetch(const std::string &key,
                                                 uint16_t vbucket,
                                                 uint64_t rowid,
                                                 const void *cookie,
                                                 hrtime_t init,
-                                                bg_fetch_type_t type) {
+                                                bg_fetch_type_t type,
+                                                BGFetchGroup *group) {
     hrtime_t start(gethrtime());
     ++stats.bg_fetched;
     std::stringstream ss;
@@ -1088,7 +1444,14 @@ void EventuallyPersistentStore::completeBGFetch(const std::string &key,
         int bucket_num(0);
         LockHolder hlh = vb->ht.getLockedBucket(key, &bucket_num);
         StoredValue *v = fetchValidValue(vb, key, bucket_num, true);
-        if (BG_FETCH_METADATA == type) {
+        if (v && v->isTempInitialItem() && status == ENGINE_KEY_ENOENT) {
+            vb->notifyFilterFalsePositive();
+        }
+        if (v && v->isTempInitialItem() && !gcb.val.isPartial()) {
+            // Either a fetch for a key evicted in full, or the metadata
+            // fetch found a live item.
+            status = restoreEvictedItem(vb, v, gcb.val);
+        } else if (BG_FETCH_METADATA == type) {
             if (v && !v->isResident()) {
                 if (v->unlocked_restoreMeta(gcb.val.getValue(),
                                             gcb.val.getStatus())) {
@@ -1108,6 +1471,17 @@ void EventuallyPersistentStore::completeBGFetch(const std::string &key,
                 }
             }
         }
+    } else if (vb && fullEviction && vb->getState() != vbucket_state_dead) {
+        // Items evicted in full are fetched back in any state.
+        int bucket_num(0);
+        LockHolder hlh = vb->ht.getLockedBucket(key, &bucket_num);
+        StoredValue *v = vb->ht.unlocked_find(key, bucket_num, true, false);
+        if (v && v->isTempInitialItem()) {
+            if (status == ENGINE_KEY_ENOENT) {
+                vb->notifyFilterFalsePositive();
+            }
+            status = restoreEvictedItem(vb, v, gcb.val);
+        }
     }
 
     lh.unlock();
@@ -1116,7 +1490,20 @@ void EventuallyPersistentStore::completeBGFetch(const std::string &key,
     updateBGStats(init, start, stop);
 
     delete gcb.val.getValue();
-    engine.notifyIOComplete(cookie, status);
+    notifyBGFetchComplete(cookie, group, status);
+}
+
+void EventuallyPersistentStore::notifyBGFetchComplete(const void *cookie,
+                                                      BGFetchGroup *group,
+                                                      ENGINE_ERROR_CODE status) {
+    if (!group) {
+        engine.notifyIOComplete(cookie, status);
+    } else if (group->complete()) {
+        // The batched get looks every key up again, so how the fetches
+        // went is of no interest to it.
+        engine.notifyIOComplete(group->cookie, ENGINE_SUCCESS);
+        delete group;
+    }
 }
 
 void EventuallyPersistentStore::completeBGFetchMulti(uint16_t vbId,
@@ -1130,6 +1517,14 @@ void EventuallyPersistentStore::completeBGFetchMulti(uint16_t vbId,
                         "EP Store completes %d of batched background fetch for "
                         "for vBucket = %d that is already deleted\n",
                         (int)fetchedItems.size(), vbId);
+       // Don't leave batched gets waiting for the rest of their fetches.
+       std::vector<VBucketBGFetchItem *>::iterator it;
+       for (it = fetchedItems.begin(); it != fetchedItems.end(); ++it) {
+           if ((*it)->group) {
+               notifyBGFetchComplete((*it)->cookie, (*it)->group,
+                                     ENGINE_NOT_MY_VBUCKET);
+           }
+       }
        return;
     }
 
@@ -1159,7 +1554,7 @@ void EventuallyPersistentStore::completeBGFetchMulti(uint16_t vbId,
 
         hrtime_t endTime = gethrtime();
         updateBGStats((*itemItr)->initTime, startTime, endTime);
-        engine.notifyIOComplete((*itemItr)->cookie, status);
+        notifyBGFetchComplete((*itemItr)->cookie, (*itemItr)->group, status);
         std::stringstream ss;
         ss << "Completed a background fetch, now at "
            << vb->numPendingBGFetchItems() << std::endl;
@@ -1176,17 +1571,24 @@ void EventuallyPersistentStore::bgFetch(const std::string &key,
                                         uint16_t vbucket,
                                         uint64_t rowid,
                                         const void *cookie,
-                                        bg_fetch_type_t type) {
+                                        bg_fetch_type_t type,
+                                        BGFetchGroup *group) {
     std::stringstream ss;
+    if (group) {
+        group->add();
+    }
 
     // NOTE: mutil-fetch feature will be disabled for metadata
-    // read until MB-5808 is fixed
-    if (multiBGFetchEnabled() && type != BG_FETCH_METADATA) {
+    // read until MB-5808 is fixed.  Batches are read by rowid, so
+    // neither can they fetch items evicted in full.
+    if (multiBGFetchEnabled() && type != BG_FETCH_METADATA &&
+        rowid != static_cast<uint64_t>(-1)) {
         RCPtr<VBucket> vb = getVBucket(vbucket);
         assert(vb);
 
         // schedule to the current batch of background fetch of the given vbucket
-        VBucketBGFetchItem * fetchThis = new VBucketBGFetchItem(key, rowid, cookie);
+        VBucketBGFetchItem * fetchThis = new VBucketBGFetchItem(key, rowid,
+                                                                cookie, group);
         vb->queueBGFetchItem(fetchThis, bgFetcher);
         ss << "Queued a background fetch, now at "
            << vb->numPendingBGFetchItems() << std::endl;
@@ -1194,7 +1596,8 @@ void EventuallyPersistentStore::bgFetch(const std::string &key,
     } else {
         shared_ptr<BGFetchCallback> dcb(new BGFetchCallback(this, key,
                                                             vbucket,
-                                                            rowid, cookie, type));
+                                                            rowid, cookie, type,
+                                                            group));
         assert(bgFetchQueue > 0);
         ss << "Queued a background fetch, now at " << bgFetchQueue.get()
            << std::endl;
@@ -1229,6 +1632,20 @@ GetValue EventuallyPersistentStore::getInternal(const std::string &key,
         }
     }
 
+    // Plain resident hits don't need to modify the StoredValue, so try
+    // answering them without the bucket lock first.
+    Item *itm(NULL);
+    bool referenced(false);
+    if (vb->ht.optimisticGet(key, vbucket, trackReference, &itm, &referenced)) {
+        if (itm) {
+            return GetValue(itm, ENGINE_SUCCESS, itm->getId(), false,
+                            referenced);
+        }
+        if (!fullEviction) {
+            return GetValue();
+        }
+    }
+
     int bucket_num(0);
     LockHolder lh = vb->ht.getLockedBucket(key, &bucket_num);
     StoredValue *v = fetchValidValue(vb, key, bucket_num, false, trackReference);
@@ -1243,15 +1660,192 @@ GetValue EventuallyPersistentStore::getInternal(const std::string &key,
                             v->isReferenced());
         }
 
+        // Keep values being read raw, so the Item shares the value
+        // instead of uncompressing a copy for every read.
+        if (trackReference) {
+            v->uncompressValue(stats, vb->ht);
+        }
+
         GetValue rv(v->toItem(v->isLocked(ep_current_time()), vbucket),
                     ENGINE_SUCCESS, v->getId(), false, v->isReferenced());
         return rv;
+    } else if (fullEviction) {
+        ENGINE_ERROR_CODE ec = fetchEvictedItem(vb, key, bucket_num,
+                                                queueBG ? cookie : NULL);
+        if (ec == ENGINE_KEY_ENOENT) {
+            return GetValue();
+        }
+        return GetValue(NULL, ec, -1, true);
     } else {
         GetValue rv;
         return rv;
     }
 }
 
+/**
+ * A key of a batched get, ordered by vbucket and then by the hash table
+ * lock in front of its bucket.
+ */
+struct BatchGetKey {
+    bool operator<(const BatchGetKey &other) const {
+        if (vbucket != other.vbucket) {
+            return vbucket < other.vbucket;
+        }
+        if (lock != other.lock) {
+            return lock < other.lock;
+        }
+        return index < other.index;
+    }
+
+    size_t   index;
+    uint16_t vbucket;
+    int      lock;
+    uint32_t hash;
+};
+
+ENGINE_ERROR_CODE
+EventuallyPersistentStore::getBatch(const std::vector<std::pair<uint16_t, std::string> > &keys,
+                                    const void *cookie,
+                                    std::vector<GetValue> &values) {
+    values.assign(keys.size(), GetValue());
+
+    std::vector<BatchGetKey> order(keys.size());
+    for (size_t i = 0; i < keys.size(); ++i) {
+        order[i].index = i;
+        order[i].vbucket = keys[i].first;
+        order[i].lock = 0;
+        order[i].hash = 0;
+    }
+    std::sort(order.begin(), order.end());
+
+    // Check every vbucket before looking anything up: a batch that
+    // waits for a pending vbucket mustn't have fetches queued as well,
+    // or it would be notified for both.
+    std::vector<size_t> starts;
+    std::vector<RCPtr<VBucket> > vbs;
+    for (size_t i = 0; i < order.size(); ++i) {
+        if (i > 0 && order[i].vbucket == order[i - 1].vbucket) {
+            continue;
+        }
+        RCPtr<VBucket> vb = getVBucket(order[i].vbucket);
+        if (vb && vb->getState() == vbucket_state_pending &&
+            vb->addPendingOp(cookie)) {
+            return ENGINE_EWOULDBLOCK;
+        }
+        starts.push_back(i);
+        vbs.push_back(vb);
+    }
+    starts.push_back(order.size());
+
+    BGFetchGroup *group = new BGFetchGroup(cookie);
+    bool wouldBlock = false;
+    std::vector<size_t> locked;
+    std::vector<VBucketBGFetchItem *> fetches;
+    for (size_t r = 0; r < vbs.size(); ++r) {
+        RCPtr<VBucket> &vb = vbs[r];
+        std::vector<BatchGetKey>::iterator first = order.begin() + starts[r];
+        std::vector<BatchGetKey>::iterator last = order.begin() + starts[r + 1];
+        if (!vb || vb->getState() == vbucket_state_dead ||
+            vb->getState() == vbucket_state_replica) {
+            for (std::vector<BatchGetKey>::iterator k = first; k != last; ++k) {
+                values[k->index] = GetValue(NULL, ENGINE_NOT_MY_VBUCKET);
+                ++stats.numNotMyVBuckets;
+            }
+            continue;
+        }
+
+        HashTable &ht = vb->ht;
+        uint16_t vbid = vb->getId();
+        for (std::vector<BatchGetKey>::iterator k = first; k != last; ++k) {
+            k->hash = ht.hash(keys[k->index].second);
+            k->lock = ht.lockForHash(k->hash);
+            ht.prefetchBucket(k->hash);
+        }
+        std::sort(first, last);
+
+        // Answer what can be answered without locks first: a lock held
+        // across the lock-free reads would keep failing them.
+        locked.clear();
+        for (std::vector<BatchGetKey>::iterator k = first; k != last; ++k) {
+            Item *itm(NULL);
+            bool referenced(false);
+            if (ht.optimisticGet(keys[k->index].second, vbid, true, &itm,
+                                 &referenced)) {
+                if (itm) {
+                    values[k->index] = GetValue(itm, ENGINE_SUCCESS,
+                                                itm->getId(), false,
+                                                referenced);
+                    continue;
+                }
+                if (!fullEviction) {
+                    continue;
+                }
+            }
+            locked.push_back(k - order.begin());
+        }
+
+        fetches.clear();
+        size_t i = 0;
+        while (i < locked.size()) {
+            int lockedBucket(0);
+            LockHolder lh = ht.getLockedBucket(order[locked[i]].hash,
+                                               &lockedBucket);
+            int bucket_num = lockedBucket;
+            do {
+                const BatchGetKey &k = order[locked[i]];
+                const std::string &key = keys[k.index].second;
+                GetValue &value = values[k.index];
+                StoredValue *v = fetchValidValue(vb, key, bucket_num, false,
+                                                 true);
+                if (v && !v->isResident()) {
+                    if (multiBGFetchEnabled() && v->getId() != -1) {
+                        group->add();
+                        fetches.push_back(new VBucketBGFetchItem(key,
+                                                                 v->getId(),
+                                                                 cookie,
+                                                                 group));
+                    } else {
+                        bgFetch(key, vbid, v->getId(), cookie,
+                                BG_FETCH_VALUE, group);
+                    }
+                    value = GetValue(NULL, ENGINE_EWOULDBLOCK, v->getId(),
+                                     true, v->isReferenced());
+                    wouldBlock = true;
+                } else if (v) {
+                    v->uncompressValue(stats, ht);
+                    value = GetValue(v->toItem(v->isLocked(ep_current_time()),
+                                               vbid),
+                                     ENGINE_SUCCESS, v->getId(), false,
+                                     v->isReferenced());
+                } else if (fullEviction) {
+                    ENGINE_ERROR_CODE ec = fetchEvictedItem(vb, key, bucket_num,
+                                                            cookie, group);
+                    if (ec == ENGINE_EWOULDBLOCK) {
+                        wouldBlock = true;
+                    }
+                    if (ec != ENGINE_KEY_ENOENT) {
+                        value = GetValue(NULL, ec, -1, true);
+                    }
+                }
+                ++i;
+            } while (i < locked.size() &&
+                     ht.unlocked_getBucketUnder(order[locked[i]].hash,
+                                                lockedBucket, &bucket_num));
+        }
+        vb->queueBGFetchItems(fetches, bgFetcher);
+    }
+
+    // Drop the reference held while queueing; if the fetches are all
+    // done already, their completions left the notification to us.
+    if (group->complete()) {
+        if (wouldBlock) {
+            engine.notifyIOComplete(cookie, ENGINE_SUCCESS);
+        }
+        delete group;
+    }
+    return wouldBlock ? ENGINE_EWOULDBLOCK : ENGINE_SUCCESS;
+}
+
 ENGINE_ERROR_CODE EventuallyPersistentStore::getMetaData(const std::string &key,
                                                          uint16_t vbucket,
                                                          const void *cookie,
@@ -1273,6 +1867,11 @@ ENGINE_ERROR_CODE EventuallyPersistentStore::getMetaData(const std::string &key,
     StoredValue *v = vb->ht.unlocked_find(key, bucket_num, true);
 
     if (v) {
+        if (v->isTempInitialItem()) {
+            // The metadata is still being fetched.
+            bgFetch(key, vbucket, -1, cookie, BG_FETCH_METADATA);
+            return ENGINE_EWOULDBLOCK;
+        }
         stats.numOpsGetMeta++;
 
         if (v->isTempNonExistentItem()) {
@@ -1303,6 +1902,14 @@ ENGINE_ERROR_CODE EventuallyPersistentStore::getMetaData(const std::string &key,
             // Since the hashtable bucket is locked, we should never get here
             abort();
         case ADD_SUCCESS:
+            if (!vb->maybeKeyExistsInFilter(key)) {
+                // Never persisted, so there's no deletion to fetch either.
+                v = vb->ht.unlocked_find(key, bucket_num, true, false);
+                v->unlocked_restoreMeta(NULL, ENGINE_KEY_ENOENT);
+                stats.numOpsGetMeta++;
+                cas = v->getCas();
+                return ENGINE_KEY_ENOENT;
+            }
             bgFetch(key, vbucket, -1, cookie, BG_FETCH_METADATA);
         }
         return ENGINE_EWOULDBLOCK;
@@ -1332,6 +1939,9 @@ ENGINE_ERROR_CODE EventuallyPersistentStore::setWithMeta(const Item &itm,
     int64_t row_id = -1;
     mutation_type_t mtype = vb->ht.set(itm, cas, row_id, allowExisting,
                                        true, trackReference);
+    if (mtype == NOT_FOUND && cas == 0) {
+        forgetRecreatedEvictedItem(vb, itm.getKey());
+    }
     ENGINE_ERROR_CODE ret = ENGINE_SUCCESS;
 
     switch (mtype) {
@@ -1414,6 +2024,13 @@ GetValue EventuallyPersistentStore::getAndUpdateTtl(const std::string &key,
         GetValue rv(v->toItem(v->isLocked(ep_current_time()), vbucket),
                     ENGINE_SUCCESS, v->getId());
         return rv;
+    } else if (fullEviction) {
+        // The item has to be in memory to update its expiry time.
+        ENGINE_ERROR_CODE ec = fetchEvictedItem(vb, key, bucket_num, cookie);
+        if (ec == ENGINE_KEY_ENOENT) {
+            return GetValue();
+        }
+        return GetValue(NULL, ec);
     } else {
         GetValue rv;
         return rv;
@@ -1495,6 +2112,11 @@ bool EventuallyPersistentStore::getLocked(const std::string &key,
         GetValue rv(it);
         cb.callback(rv);
 
+    } else if (fullEviction) {
+        ENGINE_ERROR_CODE ec = fetchEvictedItem(vb, key, bucket_num, cookie);
+        GetValue rv(NULL, ec);
+        cb.callback(rv);
+        return ec == ENGINE_KEY_ENOENT;
     } else {
         GetValue rv;
         cb.callback(rv);
@@ -1618,6 +2240,9 @@ ENGINE_ERROR_CODE EventuallyPersistentStore::deleteItem(const std::string &key,
     if (!v) {
         if (vb->getState() != vbucket_state_active && force) {
             queueDirty(key, vbucket, queue_op_del, newSeqno, -1);
+        } else if (fullEviction && !use_meta) {
+            // Bring an evicted item back to delete it.
+            return fetchEvictedItem(vb, key, bucket_num, cookie);
         }
         return ENGINE_KEY_ENOENT;
     }
@@ -1668,21 +2293,23 @@ void EventuallyPersistentStore::reset() {
     }
 }
 
-bool EventuallyPersistentStore::diskQueueEmpty() {
-    return !hasItemsForPersistence() && writing.empty() && !diskFlushAll;
+bool EventuallyPersistentStore::diskQueueEmpty(FlusherShard &shard) {
+    // The first shard also runs flush_all.
+    return !hasItemsForPersistence(&shard) && shard.writing.empty() &&
+        !(shard.id == 0 && diskFlushAll);
 }
 
-std::queue<queued_item>* EventuallyPersistentStore::beginFlush() {
+std::queue<queued_item>* EventuallyPersistentStore::beginFlush(FlusherShard &shard) {
     std::queue<queued_item> *rv(NULL);
 
-    if (diskQueueEmpty()) {
+    if (diskQueueEmpty(shard)) {
         // If the persistence queue is empty, reset queue-related stats for each vbucket.
         size_t numOfVBuckets = vbuckets.getSize();
         for (size_t i = 0; i < numOfVBuckets; ++i) {
             assert(i <= std::numeric_limits<uint16_t>::max());
             uint16_t vbid = static_cast<uint16_t>(i);
             RCPtr<VBucket> vb = vbuckets.getBucket(vbid);
-            if (vb) {
+            if (vb && shard.owns(vbid)) {
                 vb->dirtyQueueSize.set(0);
                 vb->dirtyQueueMem.set(0);
                 vb->dirtyQueueAge.set(0);
@@ -1690,10 +2317,11 @@ std::queue<queued_item>* EventuallyPersistentStore::beginFlush() {
             }
         }
     } else {
-        assert(rwUnderlying);
-        if (diskFlushAll) {
+        assert(shard.underlying);
+        if (shard.id == 0 && diskFlushAll) {
             queued_item qi(new QueuedItem("", 0xffff, queue_op_flush));
-            writing.push(qi);
+            shard.writing.push(qi);
+            ++stats.flusher_todo;
             stats.memOverhead.incr(sizeof(queued_item));
             assert(stats.memOverhead.get() < GIGANTOR);
         }
@@ -1701,14 +2329,15 @@ std::queue<queued_item>* EventuallyPersistentStore::beginFlush() {
         std::vector<queued_item> item_list;
         item_list.reserve(getTxnSize());
 
+        const CheckpointConfig &chkConfig = engine.getCheckpointConfig();
         const std::vector<int> vblist = vbuckets.getBucketsSortedByState();
         std::vector<int>::const_iterator itr;
         for (itr = vblist.begin(); itr != vblist.end(); ++itr) {
             uint16_t vbid = static_cast<uint16_t>(*itr);
             RCPtr<VBucket> vb = vbuckets.getBucket(vbid);
 
-            if (!vb) {
-                // Undefined vbucket..
+            if (!vb || !shard.owns(vbid)) {
+                // Undefined vbucket, or one of another shard.
                 continue;
             }
 
@@ -1723,27 +2352,30 @@ std::queue<queued_item>* EventuallyPersistentStore::beginFlush() {
 
             // Grab all the backfill items if exist.
             vb->getBackfillItems(item_list);
-            // Get all dirty items from the checkpoint.
-            vb->checkpointManager.getAllItemsForPersistence(item_list);
+            // Get the next batch of dirty items from the checkpoint.
+            vb->checkpointManager.getItemsForPersistence(item_list,
+                                                         chkConfig.getFlushBatchItems(),
+                                                         chkConfig.getFlushBatchBytes());
             if (item_list.size() > 0) {
-                pushToOutgoingQueue(item_list);
+                pushToOutgoingQueue(shard, item_list);
             }
         }
 
         size_t queue_size = getWriteQueueSize();
-        stats.flusher_todo.set(writing.size());
         stats.queue_size.set(queue_size);
         getLogger()->log(EXTENSION_LOG_DEBUG, NULL,
-                         "Flushing %ld items with %ld still in queue\n",
-                         writing.size(), queue_size);
-        rv = &writing;
+                         "Flushing %ld items of shard %ld with %ld still in queue\n",
+                         shard.writing.size(), shard.id, queue_size);
+        rv = &shard.writing;
     }
     return rv;
 }
 
-void EventuallyPersistentStore::pushToOutgoingQueue(std::vector<queued_item> &items) {
+void EventuallyPersistentStore::pushToOutgoingQueue(FlusherShard &shard,
+                                                    std::vector<queued_item> &items) {
     size_t num_items = 0;
-    rwUnderlying->optimizeWrites(items);
+    std::queue<queued_item> &writing = shard.writing;
+    shard.underlying->optimizeWrites(items);
     std::vector<queued_item>::iterator it = items.begin();
     for(; it != items.end(); ++it) {
         if (writing.empty() || writing.back()->getKey() != (*it)->getKey()) {
@@ -1758,31 +2390,34 @@ void EventuallyPersistentStore::pushToOutgoingQueue(std::vector<queued_item> &it
         }
     }
     items.clear();
+    stats.flusher_todo.incr(num_items);
     stats.memOverhead.incr(num_items * sizeof(queued_item));
     assert(stats.memOverhead.get() < GIGANTOR);
 }
 
-void EventuallyPersistentStore::requeueRejectedItems(std::queue<queued_item> *rej) {
+void EventuallyPersistentStore::requeueRejectedItems(FlusherShard &shard,
+                                                     std::queue<queued_item> *rej) {
     size_t queue_size = rej->size();
     // Requeue the rejects.
     while (!rej->empty()) {
-        writing.push(rej->front());
+        shard.writing.push(rej->front());
         rej->pop();
     }
     stats.memOverhead.incr(queue_size * sizeof(queued_item));
     assert(stats.memOverhead.get() < GIGANTOR);
     stats.queue_size.set(getWriteQueueSize());
-    stats.flusher_todo.set(writing.size());
+    stats.flusher_todo.incr(queue_size);
 }
 
-void EventuallyPersistentStore::completeFlush(rel_time_t flush_start) {
+void EventuallyPersistentStore::completeFlush(FlusherShard &shard,
+                                              rel_time_t flush_start) {
     size_t numOfVBuckets = vbuckets.getSize();
     bool schedule_vb_snapshot = false;
     for (size_t i = 0; i < numOfVBuckets; ++i) {
         assert(i <= std::numeric_limits<uint16_t>::max());
         uint16_t vbid = static_cast<uint16_t>(i);
         RCPtr<VBucket> vb = vbuckets.getBucket(vbid);
-        if (!vb || vb->getState() == vbucket_state_dead) {
+        if (!vb || vb->getState() == vbucket_state_dead || !shard.owns(vbid)) {
             continue;
         }
         uint64_t pcursor_chkid = vb->checkpointManager.getPersistenceCursorPreChkId();
@@ -1799,7 +2434,6 @@ void EventuallyPersistentStore::completeFlush(rel_time_t flush_start) {
         scheduleVBSnapshot(Priority::VBucketPersistHighPriority);
     }
 
-    stats.flusher_todo.set(writing.size());
     stats.queue_size.set(getWriteQueueSize());
     rel_time_t complete_time = ep_current_time();
     stats.flushDuration.set(complete_time - flush_start);
@@ -1808,8 +2442,11 @@ void EventuallyPersistentStore::completeFlush(rel_time_t flush_start) {
     stats.cumulativeFlushTime.incr(complete_time - flush_start);
 }
 
-int EventuallyPersistentStore::flushSome(std::queue<queued_item> *q,
+int EventuallyPersistentStore::flushSome(FlusherShard &shard,
+                                         std::queue<queued_item> *q,
                                          std::queue<queued_item> *rejectQueue) {
+    LockHolder slh(shard.mutex);
+    TransactionContext &tctx = shard.tctx;
     if (!tctx.enter()) {
         ++stats.beginFailed;
         getLogger()->log(EXTENSION_LOG_WARNING, NULL,
@@ -1825,15 +2462,15 @@ int EventuallyPersistentStore::flushSome(std::queue<queued_item> *q,
     int oldest = stats.min_data_age;
     int completed(0);
     for (completed = 0;
-         completed < tsz && !q->empty() && !shouldPreemptFlush(completed);
+         completed < tsz && !q->empty() && !shouldPreemptFlush(shard, completed);
          ++completed) {
 
-        int n = flushOne(q, rejectQueue);
+        int n = flushOne(shard, q, rejectQueue);
         if (n != 0 && n < oldest) {
             oldest = n;
         }
     }
-    if (shouldPreemptFlush(completed)) {
+    if (shouldPreemptFlush(shard, completed)) {
         ++stats.flusherPreempts;
     } else {
         tctx.commit();
@@ -1856,12 +2493,15 @@ size_t EventuallyPersistentStore::getWriteQueueSize(void) {
     return size;
 }
 
-bool EventuallyPersistentStore::hasItemsForPersistence(void) {
+bool EventuallyPersistentStore::hasItemsForPersistence(FlusherShard *shard) {
     bool hasItems = false;
     size_t numOfVBuckets = vbuckets.getSize();
     for (size_t i = 0; i < numOfVBuckets; ++i) {
         assert(i <= std::numeric_limits<uint16_t>::max());
         uint16_t vbid = static_cast<uint16_t>(i);
+        if (shard && !shard->owns(vbid)) {
+            continue;
+        }
         RCPtr<VBucket> vb = vbuckets.getBucket(vbid);
         if (vb && (vb->getState() != vbucket_state_dead)) {
             LockHolder rlh(restore.mutex);
@@ -1908,6 +2548,8 @@ public:
                 LockHolder lh = vb->ht.getLockedBucket(queuedItem->getKey(), &bucket_num);
                 StoredValue *v = store->fetchValidValue(vb, queuedItem->getKey(),
                                                         bucket_num, true, false);
+                // Before the item can be evicted.
+                store->addToKeyFilter(vb, queuedItem->getKey());
                 if (v && value.second > 0) {
                     mutationLog->newItem(queuedItem->getVBucketId(), queuedItem->getKey(),
                                          value.second);
@@ -1989,6 +2631,8 @@ public:
                 LockHolder lh = vb->ht.getLockedBucket(queuedItem->getKey(), &bucket_num);
                 StoredValue *v = store->fetchValidValue(vb, queuedItem->getKey(),
                                                         bucket_num, true, false);
+                // Before the deleted item is removed from memory.
+                store->addToKeyFilter(vb, queuedItem->getKey());
                 if (v && v->isDeleted()) {
                     if (store->getEPEngine().isDegradedMode()) {
                         LockHolder rlh(store->restore.mutex);
@@ -2032,8 +2676,15 @@ private:
     DISALLOW_COPY_AND_ASSIGN(PersistenceCallback);
 };
 
-int EventuallyPersistentStore::flushOneDeleteAll() {
-    rwUnderlying->reset();
+int EventuallyPersistentStore::flushOneDeleteAll(FlusherShard &shard) {
+    assert(shard.id == 0);
+    // The caller holds the first shard's lock; keep the other shards
+    // off the files while every shard's store resets.
+    MultiLockHolder lh(shardLocks + 1, shards.size() - 1);
+    std::vector<FlusherShard*>::iterator sit;
+    for (sit = shards.begin(); sit != shards.end(); ++sit) {
+        (*sit)->underlying->reset();
+    }
     // Log a flush of every known vbucket.
     std::vector<int> vbs(vbuckets.getBuckets());
     for (std::vector<int>::iterator it(vbs.begin()); it != vbs.end(); ++it) {
@@ -2050,8 +2701,9 @@ int EventuallyPersistentStore::flushOneDeleteAll() {
 // While I actually know whether a delete or set was intended, I'm
 // still a bit better off running the older code that figures it out
 // based on what's in memory.
-int EventuallyPersistentStore::flushOneDelOrSet(const queued_item &qi,
-                                           std::queue<queued_item> *rejectQueue) {
+int EventuallyPersistentStore::flushOneDelOrSet(FlusherShard &shard,
+                                                const queued_item &qi,
+                                                std::queue<queued_item> *rejectQueue) {
 
     RCPtr<VBucket> vb = getVBucket(qi->getVBucketId());
     if (!vb) {
@@ -2074,7 +2726,7 @@ int EventuallyPersistentStore::flushOneDelOrSet(const queued_item &qi,
     Item itm(qi->getKey(),
              found ? v->getFlags() : 0,
              found ? v->getExptime() : 0,
-             found ? v->getValue() : value_t(NULL),
+             found ? v->getUncompressedValue() : value_t(NULL),
              found ? v->getCas() : 0,
              rowid,
              qi->getVBucketId(),
@@ -2152,8 +2804,8 @@ int EventuallyPersistentStore::flushOneDelOrSet(const queued_item &qi,
                 PersistenceCallback *cb;
                 cb = new PersistenceCallback(qi, rejectQueue, this, &mutationLog,
                                              queued, dirtied, &stats, itm.getCas());
-                tctx.addCallback(cb);
-                rwUnderlying->set(itm, *cb);
+                shard.tctx.addCallback(cb);
+                shard.underlying->set(itm, *cb);
                 if (rowid == -1)  {
                     ++vb->opsCreate;
                 } else {
@@ -2169,15 +2821,16 @@ int EventuallyPersistentStore::flushOneDelOrSet(const queued_item &qi,
             cb = new PersistenceCallback(qi, rejectQueue, this, &mutationLog,
                                          queued, dirtied, &stats, 0);
 
-            tctx.addCallback(cb);
-            rwUnderlying->del(itm, rowid, *cb);
+            shard.tctx.addCallback(cb);
+            shard.underlying->del(itm, rowid, *cb);
         }
     }
 
     return ret;
 }
 
-int EventuallyPersistentStore::flushOne(std::queue<queued_item> *q,
+int EventuallyPersistentStore::flushOne(FlusherShard &shard,
+                                        std::queue<queued_item> *q,
                                         std::queue<queued_item> *rejectQueue) {
 
     queued_item qi = q->front();
@@ -2188,24 +2841,24 @@ int EventuallyPersistentStore::flushOne(std::queue<queued_item> *q,
     int rv = 0;
     switch (qi->getOperation()) {
     case queue_op_flush:
-        rv = flushOneDeleteAll();
+        rv = flushOneDeleteAll(shard);
         break;
     case queue_op_set:
         {
             size_t prevRejectCount = rejectQueue->size();
-            rv = flushOneDelOrSet(qi, rejectQueue);
+            rv = flushOneDelOrSet(shard, qi, rejectQueue);
             if (rejectQueue->size() == prevRejectCount) {
                 // flush operation was not rejected
-                tctx.addUncommittedItem(qi);
+                shard.tctx.addUncommittedItem(qi);
             }
         }
         break;
     case queue_op_del:
-        rv = flushOneDelOrSet(qi, rejectQueue);
+        rv = flushOneDelOrSet(shard, qi, rejectQueue);
         break;
     case queue_op_commit:
-        tctx.commit();
-        tctx.enter();
+        shard.tctx.commit();
+        shard.tctx.enter();
         break;
     case queue_op_empty:
         assert(false);
@@ -2232,9 +2885,10 @@ void EventuallyPersistentStore::queueDirty(const std::string &key,
                                             rowid, seqno);
 
             queued_item itm(qi);
-            bool rv = tapBackfill ?
-                      vb->queueBackfillItem(itm) : vb->checkpointManager.queueDirty(itm, vb);
-            if (rv) {
+            if (!tapBackfill) {
+                // The checkpoint manager updates the queue stats.
+                vb->checkpointManager.queueDirty(itm, vb);
+            } else if (vb->queueBackfillItem(itm)) {
                 ++stats.queue_size;
                 ++stats.totalEnqueued;
                 vb->doStatsForQueueing(*itm, itm->size());
@@ -2289,6 +2943,23 @@ void EventuallyPersistentStore::completeDegradedMode() {
     restore.itemsDeleted.clear();
 }
 
+void EventuallyPersistentStore::warmupKeyFilters() {
+    // The key dump only had the keys of live items; add the deleted
+    // ones before trusting the filters.
+    std::vector<int> vbs = vbuckets.getBuckets();
+    std::vector<int>::iterator it;
+    for (it = vbs.begin(); it != vbs.end(); ++it) {
+        RCPtr<VBucket> vb = getVBucket(*it);
+        if (!vb || vb->getFilterStatus() != BFILTER_PENDING) {
+            continue;
+        }
+        shared_ptr<Callback<GetValue> > cb(new KeyFilterLoader(vb, false));
+        roUnderlying->dumpDeleted(vb->getId(), cb);
+        vb->setFilterStatus(BFILTER_ENABLED);
+        maybeRebuildKeyFilter(vb);
+    }
+}
+
 void EventuallyPersistentStore::warmupCompleted() {
     engine.warmupCompleted();
     if (!engine.isDegradedMode()) {
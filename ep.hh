@@ -214,6 +214,44 @@ private:
     std::list<PersistenceCallback*> transactionCallbacks;
 };
 
+/**
+ * The vbuckets one flusher persists, with the store and transaction
+ * it writes them through.
+ *
+ * Shards own disjoint sets of vbuckets, so with a store that keeps
+ * every vbucket in its own file they never write to the same file and
+ * can commit in parallel.
+ */
+class FlusherShard {
+public:
+
+    FlusherShard(EPStats &st, size_t i, size_t n, KVStore *kv,
+                 MutationLog &log, Mutex &m)
+        : id(i), numShards(n), underlying(kv), mutex(m),
+          tctx(st, kv, log) {}
+
+    /**
+     * True if this shard persists the given vbucket.
+     */
+    bool owns(uint16_t vbid) const {
+        return vbid % numShards == id;
+    }
+
+    const size_t id;
+    const size_t numShards;
+    KVStore *underlying;
+
+    //! Held by whoever writes to the files of the shard's vbuckets.
+    Mutex &mutex;
+
+    //! Items being flushed; used by the shard's flusher only.
+    std::queue<queued_item> writing;
+    TransactionContext tctx;
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(FlusherShard);
+};
+
 /**
  * VBucket visitor callback adaptor.
  */
@@ -325,6 +363,27 @@ public:
     }
 
 
+    /**
+     * Retrieve the values of a batch of keys from active vbuckets.
+     *
+     * The keys are looked up a vbucket at a time.  Those a lock-free
+     * read can't answer are found in the order of the hash table locks
+     * they are behind, under one acquisition of each lock, and the
+     * values that have to come from disk are queued to the background
+     * fetcher together.
+     *
+     * @param keys the vbuckets and keys to fetch
+     * @param cookie the connection cookie
+     * @param values receives a GetValue for each key, in the order of keys
+     *
+     * @return ENGINE_EWOULDBLOCK if the batch has to wait for a pending
+     *         vbucket or for values to be fetched from disk (the cookie is
+     *         notified once, when all of them are in), or ENGINE_SUCCESS
+     */
+    ENGINE_ERROR_CODE getBatch(const std::vector<std::pair<uint16_t, std::string> > &keys,
+                               const void *cookie,
+                               std::vector<GetValue> &values);
+
     /**
      * Retrieve the meta data for an item
      *
@@ -491,6 +550,21 @@ public:
         return nonIODispatcher;
     }
 
+    /**
+     * True if some flushers run on a dispatcher of their own.
+     */
+    bool hasSeparateFlusherDispatcher() {
+        return flusherDispatcher != NULL;
+    }
+
+    /**
+     * Get the dispatcher of all flushers but the first one.
+     */
+    Dispatcher* getFlusherDispatcher(void) {
+        assert(flusherDispatcher);
+        return flusherDispatcher;
+    }
+
     void stopFlusher(void);
 
     void startFlusher(void);
@@ -510,12 +584,14 @@ public:
      * @param cookie the cookie of the requestor
      * @param type whether the fetch is for a non-resident value or metadata of
      *             a (possibly) deleted item
+     * @param group the batched get the fetch is part of, if any
      */
     void bgFetch(const std::string &key,
                  uint16_t vbucket,
                  uint64_t rowid,
                  const void *cookie,
-                 bg_fetch_type_t type = BG_FETCH_VALUE);
+                 bg_fetch_type_t type = BG_FETCH_VALUE,
+                 BGFetchGroup *group = NULL);
 
     /**
      * Complete a background fetch of a non resident value or metadata.
@@ -527,13 +603,15 @@ public:
      * @param init the timestamp of when the request came in
      * @param type whether the fetch is for a non-resident value or metadata of
      *             a (possibly) deleted item
+     * @param group the batched get the fetch is part of, if any
      */
     void completeBGFetch(const std::string &key,
                          uint16_t vbucket,
                          uint64_t rowid,
                          const void *cookie,
                          hrtime_t init,
-                         bg_fetch_type_t type);
+                         bg_fetch_type_t type,
+                         BGFetchGroup *group = NULL);
     /**
      * Complete a batch of background fetch of a non resident value or metadata.
      *
@@ -607,20 +685,19 @@ public:
     }
 
     int getTxnSize() {
-        return tctx.getTxnSize();
+        return shards[0]->tctx.getTxnSize();
     }
 
     void setTxnSize(int to) {
-        tctx.setTxnSize(to);
+        std::vector<FlusherShard*>::iterator it;
+        for (it = shards.begin(); it != shards.end(); ++it) {
+            (*it)->tctx.setTxnSize(to);
+        }
     }
 
-    size_t getNumUncommittedItems() {
-        return tctx.getNumUncommittedItems();
-    }
+    size_t getNumUncommittedItems();
 
-    double getTransactionTimePerItem() {
-        return tctx.getTransactionTimePerItem();
-    }
+    double getTransactionTimePerItem();
 
     const Flusher* getFlusher();
     Warmup* getWarmup(void) const;
@@ -658,6 +735,22 @@ public:
         return rwUnderlying;
     }
 
+    /**
+     * Get the number of flushers persisting vbuckets in parallel.
+     */
+    size_t getNumFlusherShards() const {
+        return shards.size();
+    }
+
+    /**
+     * Get the store a flusher shard writes through (the RW store for
+     * the first shard).
+     */
+    KVStore* getShardUnderlying(size_t shard) {
+        assert(shard < shards.size());
+        return shards[shard]->underlying;
+    }
+
     KVStore* getROUnderlying() {
         // This method might also be called leakAbstraction()
         return roUnderlying;
@@ -670,6 +763,25 @@ public:
 
     void deleteExpiredItems(std::list<std::pair<uint16_t, std::string> > &);
 
+    /**
+     * Remove the given items from memory, keys and metadata included,
+     * if they are still clean and ejected (full eviction).
+     */
+    void evictItems(std::list<std::pair<uint16_t, std::string> > &);
+
+    /**
+     * Rebuild the key filter of a vbucket from the keys on disk, once
+     * VBucket::startFilterRebuild() asked for it.
+     */
+    void rebuildKeyFilter(RCPtr<VBucket> &vb);
+
+    /**
+     * True if the item pager removes whole items, not just values.
+     */
+    bool isFullEviction() const {
+        return fullEviction;
+    }
+
     /**
      * Get the memoized storage properties from the DB.kv
      */
@@ -776,6 +888,7 @@ protected:
 
     bool warmupFromLog(const std::map<uint16_t, vbucket_state> &state,
                        shared_ptr<Callback<GetValue> >cb);
+    void warmupKeyFilters();
     void warmupCompleted();
 
 private:
@@ -783,6 +896,13 @@ private:
     void scheduleVBDeletion(RCPtr<VBucket> &vb,
                             const void* cookie, double delay);
 
+    /**
+     * Remember that an item or a deletion of the key is now on disk,
+     * rebuilding the key filter in the background once it fills up.
+     */
+    void addToKeyFilter(RCPtr<VBucket> &vb, const std::string &key);
+    void maybeRebuildKeyFilter(RCPtr<VBucket> &vb);
+
     RCPtr<VBucket> getVBucket(uint16_t vbid, vbucket_state_t wanted_state);
 
     /* Queue an item to be written to persistent layer. */
@@ -827,32 +947,73 @@ private:
         return v != NULL;
     }
 
-    bool diskQueueEmpty();
+    bool diskQueueEmpty(FlusherShard &shard);
 
-    std::queue<queued_item> *beginFlush();
-    void pushToOutgoingQueue(std::vector<queued_item> &items);
-    void requeueRejectedItems(std::queue<queued_item> *rejects);
-    void completeFlush(rel_time_t flush_start);
+    FlusherShard &getShard(uint16_t vbid) {
+        return *shards[vbid % shards.size()];
+    }
+
+    std::queue<queued_item> *beginFlush(FlusherShard &shard);
+    void pushToOutgoingQueue(FlusherShard &shard, std::vector<queued_item> &items);
+    void requeueRejectedItems(FlusherShard &shard, std::queue<queued_item> *rejects);
+    void completeFlush(FlusherShard &shard, rel_time_t flush_start);
 
-    int flushSome(std::queue<queued_item> *q,
+    int flushSome(FlusherShard &shard, std::queue<queued_item> *q,
                   std::queue<queued_item> *rejectQueue);
-    int flushOne(std::queue<queued_item> *q,
+    int flushOne(FlusherShard &shard, std::queue<queued_item> *q,
                  std::queue<queued_item> *rejectQueue);
-    int flushOneDeleteAll(void);
-    int flushOneDelOrSet(const queued_item &qi, std::queue<queued_item> *rejectQueue);
+    int flushOneDeleteAll(FlusherShard &shard);
+    int flushOneDelOrSet(FlusherShard &shard, const queued_item &qi,
+                         std::queue<queued_item> *rejectQueue);
 
     StoredValue *fetchValidValue(RCPtr<VBucket> &vb, const std::string &key,
                                  int bucket_num, bool wantsDeleted=false, bool trackReference=true);
 
-    bool shouldPreemptFlush(size_t completed) {
-        return (completed > 100
+    /**
+     * Handle a key that isn't in the hash table in full eviction mode,
+     * where its item may have been evicted to disk.  Unless the
+     * vbucket's key filter rules the key out, add a temporary item for
+     * it and fetch the item from disk; the operation is retried once
+     * the temporary item has been replaced by the item, or marked as
+     * non-existent.  The bucket must be locked.
+     *
+     * @return ENGINE_KEY_ENOENT if the key doesn't exist on disk either,
+     *         ENGINE_EWOULDBLOCK if the caller has to wait for a fetch,
+     *         or ENGINE_ENOMEM
+     */
+    ENGINE_ERROR_CODE fetchEvictedItem(RCPtr<VBucket> &vb,
+                                       const std::string &key,
+                                       int bucket_num, const void *cookie,
+                                       BGFetchGroup *group = NULL);
+
+    /**
+     * Stop counting an item evicted in full whose key a set has just
+     * recreated in memory without fetching it first.  Only keys the
+     * key filter may hold can have been evicted, so a false positive
+     * or a key deleted since can make this forget one too many.
+     */
+    void forgetRecreatedEvictedItem(RCPtr<VBucket> &vb,
+                                    const std::string &key);
+
+    /**
+     * Tell the requestor of a background fetch it is done: right away,
+     * or if it was part of a batched get, once the last fetch of the
+     * batch is.
+     */
+    void notifyBGFetchComplete(const void *cookie, BGFetchGroup *group,
+                               ENGINE_ERROR_CODE status);
+
+    bool shouldPreemptFlush(FlusherShard &shard, size_t completed) {
+        // Only the first shard shares its dispatcher with bg fetches.
+        return (shard.id == 0
+                && completed > 100
                 && bgFetchQueue > 0
                 && !hasSeparateRODispatcher());
     }
 
     size_t getWriteQueueSize(void);
 
-    bool hasItemsForPersistence(void);
+    bool hasItemsForPersistence(FlusherShard *shard = NULL);
 
     GetValue getInternal(const std::string &key, uint16_t vbucket,
                          const void *cookie, bool queueBG,
@@ -883,7 +1044,10 @@ private:
     Dispatcher                     *roDispatcher;
     Dispatcher                     *tapDispatcher;
     Dispatcher                     *nonIODispatcher;
-    Flusher                        *flusher;
+    Dispatcher                     *flusherDispatcher;
+    std::vector<Flusher*>           flushers;
+    std::vector<FlusherShard*>      shards;
+    Mutex                          *shardLocks;
     BgFetcher                      *bgFetcher;
     Warmup                         *warmupTask;
     VBucketMap                      vbuckets;
@@ -893,17 +1057,12 @@ private:
     MutationLogCompactorConfig      mlogCompactorConfig;
     MutationLog                     accessLog;
 
-    // The writing queue is used by the flusher thread to keep
-    // track of the objects it works on. It should _not_ be used
-    // by any other threads (because the flusher use it without
-    // locking...
-    std::queue<queued_item>              writing;
     pthread_t                            thread;
     Atomic<size_t>                       bgFetchQueue;
     Atomic<bool>                         diskFlushAll;
-    TransactionContext                   tctx;
     Mutex                                vbsetMutex;
     uint32_t                             bgFetchDelay;
+    bool                                 fullEviction;
     // During restore we're bypassing the checkpoint lists with the
     // objects we're restoring, but we need them to be persisted.
     // This is solved by using a separate list for those objects.
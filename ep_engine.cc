@@ -292,6 +292,18 @@ extern "C" {
             } else if (strcmp(keyz, "max_checkpoints") == 0) {
                 validate(v, DEFAULT_MAX_CHECKPOINTS, MAX_CHECKPOINTS_UPPER_BOUND);
                 e->getConfiguration().setMaxCheckpoints(v);
+            } else if (strcmp(keyz, "chk_flush_batch_items") == 0) {
+                validate(v, 1, std::numeric_limits<int>::max());
+                e->getConfiguration().setChkFlushBatchItems(v);
+            } else if (strcmp(keyz, "chk_flush_batch_bytes") == 0) {
+                validate(v, 1, std::numeric_limits<int>::max());
+                e->getConfiguration().setChkFlushBatchBytes(v);
+            } else if (strcmp(keyz, "chk_tap_batch_items") == 0) {
+                validate(v, 1, std::numeric_limits<int>::max());
+                e->getConfiguration().setChkTapBatchItems(v);
+            } else if (strcmp(keyz, "chk_tap_batch_bytes") == 0) {
+                validate(v, 1, std::numeric_limits<int>::max());
+                e->getConfiguration().setChkTapBatchBytes(v);
             } else if (strcmp(keyz, "item_num_based_new_chk") == 0) {
                 if (strcmp(valz, "true") == 0) {
                     e->getConfiguration().setItemNumBasedNewChk(true);
@@ -421,6 +433,32 @@ extern "C" {
                 e->getConfiguration().setAlogTaskTime(v);
             } else if (strcmp(keyz, "pager_active_vb_pcnt") == 0) {
                 e->getConfiguration().setPagerActiveVbPcnt(v);
+            } else if (strcmp(keyz, "pager_policy") == 0) {
+                e->getConfiguration().setPagerPolicy(valz);
+            } else if (strcmp(keyz, "pager_sample_size") == 0) {
+                validate(v, 1, 4096);
+                e->getConfiguration().setPagerSampleSize(v);
+            } else if (strcmp(keyz, "value_compression") == 0) {
+                if (strcmp(valz, "true") == 0) {
+                    e->getConfiguration().setValueCompression(true);
+                } else if(strcmp(valz, "false") == 0) {
+                    e->getConfiguration().setValueCompression(false);
+                } else {
+                    throw std::runtime_error("value out of range.");
+                }
+            } else if (strcmp(keyz, "value_compression_min_size") == 0) {
+                validate(v, 0, std::numeric_limits<int>::max());
+                e->getConfiguration().setValueCompressionMinSize(v);
+            } else if (strcmp(keyz, "value_compression_max_ratio") == 0) {
+                e->getConfiguration().setValueCompressionMaxRatio(v);
+            } else if (strcmp(keyz, "value_compressor_stime") == 0) {
+                e->getConfiguration().setValueCompressorStime(v);
+            } else if (strcmp(keyz, "hotkeys_sample_rate") == 0) {
+                validate(v, 0, std::numeric_limits<int>::max());
+                e->getConfiguration().setHotkeysSampleRate(v);
+            } else if (strcmp(keyz, "hotkeys_size") == 0) {
+                validate(v, 0, 1000);
+                e->getConfiguration().setHotkeysSize(v);
             } else {
                 *msg = "Unknown config param";
                 rv = PROTOCOL_BINARY_RESPONSE_KEY_ENOENT;
@@ -881,6 +919,12 @@ extern "C" {
             break;
         case CMD_OBSERVE:
             return h->observe(cookie, request, response);
+        case CMD_GET_BATCH:
+            {
+                BlockTimer timer(&stats.getBatchCmdHisto);
+                rv = h->getBatch(cookie, request, response);
+                return rv;
+            }
         case CMD_DEREGISTER_TAP_CLIENT:
             {
                 rv = h->deregisterTapClient(cookie, request, response);
@@ -1246,6 +1290,10 @@ public:
             engine.setGetlDefaultTimeout(value);
         } else if (key.compare("max_item_size") == 0) {
             engine.setMaxItemSize(value);
+        } else if (key.compare("hotkeys_sample_rate") == 0) {
+            engine.getHotKeyProfiler().setSampleRate(value);
+        } else if (key.compare("hotkeys_size") == 0) {
+            engine.getHotKeyProfiler().setSize(value);
         }
     }
 
@@ -1271,6 +1319,16 @@ ENGINE_ERROR_CODE EventuallyPersistentEngine::initialize(const char* config) {
     // Start updating the variables from the config!
     HashTable::setDefaultNumBuckets(configuration.getHtSize());
     HashTable::setDefaultNumLocks(configuration.getHtLocks());
+    HashTable::setDefaultOptimisticReads(configuration.isHtOptimisticReads());
+    HashTable::setDefaultPowerOfTwoSize(configuration.isHtPow2Size());
+    HashTable::setDefaultSlabArena(configuration.isHtSlabArena());
+    HashTable::setDefaultPackEjected(configuration.isHtPackEjected());
+    if (!HashTable::setDefaultHashFunction(configuration.getHtHashFunction().c_str())) {
+        getLogger()->log(EXTENSION_LOG_WARNING, NULL,
+                         "Unsupported hash function: %s, using %s",
+                         configuration.getHtHashFunction().c_str(),
+                         HashTable::getHashFunctionStr(HashTable::getDefaultHashFunction()));
+    }
     StoredValue::setMutationMemoryThreshold(configuration.getMutationMemThreshold());
     std::string storedValType = configuration.getStoredValType();
     if (storedValType.length() > 0) {
@@ -1318,6 +1376,13 @@ ENGINE_ERROR_CODE EventuallyPersistentEngine::initialize(const char* config) {
     configuration.addValueChangedListener("flushall_enabled",
                                           new EpEngineValueChangeListener(*this));
 
+    hotKeys.setSampleRate(configuration.getHotkeysSampleRate());
+    configuration.addValueChangedListener("hotkeys_sample_rate",
+                                          new EpEngineValueChangeListener(*this));
+    hotKeys.setSize(configuration.getHotkeysSize());
+    configuration.addValueChangedListener("hotkeys_size",
+                                          new EpEngineValueChangeListener(*this));
+
     tapConnMap = new TapConnMap(*this);
     tapConfig = new TapConfig(*this);
     tapThrottle = new TapThrottle(configuration, stats);
@@ -1442,6 +1507,7 @@ ENGINE_ERROR_CODE  EventuallyPersistentEngine::store(const void *cookie,
     item *i = NULL;
 
     it->setVBucketId(vbucket);
+    hotKeys.sample(HOTKEY_STORE, it->getKey(), vbucket, it->getNBytes());
 
     switch (operation) {
     case OPERATION_CAS:
@@ -2396,6 +2462,8 @@ ENGINE_ERROR_CODE EventuallyPersistentEngine::doEngineStats(const void *cookie,
     add_casted_stat("ep_flusher_state",
                     epstore->getFlusher()->stateName(),
                     add_stat, cookie);
+    add_casted_stat("ep_flusher_shards",
+                    epstore->getNumFlusherShards(), add_stat, cookie);
     add_casted_stat("ep_commit_num", epstats.flusherCommits,
                     add_stat, cookie);
     add_casted_stat("ep_commit_time",
@@ -2578,6 +2646,11 @@ ENGINE_ERROR_CODE EventuallyPersistentEngine::doEngineStats(const void *cookie,
                     add_stat, cookie);
     add_casted_stat("ep_num_pager_runs", epstats.pagerRuns, add_stat,
                     cookie);
+    add_casted_stat("ep_pager_items_inspected", epstats.pagerItemsInspected,
+                    add_stat, cookie);
+    add_casted_stat("ep_pager_time", epstats.pagerTime, add_stat, cookie);
+    add_casted_stat("ep_pager_hot_ejects", epstats.pagerHotEjects,
+                    add_stat, cookie);
     add_casted_stat("ep_num_expiry_pager_runs", epstats.expiryPagerRuns, add_stat,
                     cookie);
     add_casted_stat("ep_num_checkpoint_remover_runs", epstats.checkpointRemoverRuns,
@@ -2588,6 +2661,18 @@ ENGINE_ERROR_CODE EventuallyPersistentEngine::doEngineStats(const void *cookie,
                     cookie);
     add_casted_stat("ep_num_eject_failures", epstats.numFailedEjects, add_stat,
                     cookie);
+    add_casted_stat("ep_num_compressor_runs", epstats.compressorRuns, add_stat,
+                    cookie);
+    add_casted_stat("ep_num_value_compressions", epstats.numValueCompressions,
+                    add_stat, cookie);
+    add_casted_stat("ep_num_compression_failures",
+                    epstats.numFailedCompressions, add_stat, cookie);
+    add_casted_stat("ep_num_compressed_values", epstats.numCompressedValues,
+                    add_stat, cookie);
+    add_casted_stat("ep_compressed_value_savings",
+                    epstats.compressedValueSavings, add_stat, cookie);
+    add_casted_stat("ep_num_key_ejects", epstats.numKeyEjects, add_stat,
+                    cookie);
     add_casted_stat("ep_num_not_my_vbuckets", epstats.numNotMyVBuckets, add_stat,
                     cookie);
     add_casted_stat("ep_db_cleaner_status",
@@ -2718,6 +2803,17 @@ ENGINE_ERROR_CODE EventuallyPersistentEngine::doMemoryStats(const void *cookie,
     add_casted_stat("ep_kv_size", stats.currentSize, add_stat, cookie);
     add_casted_stat("ep_value_size", stats.totalValueSize, add_stat, cookie);
     add_casted_stat("ep_overhead", stats.memOverhead, add_stat, cookie);
+    add_casted_stat("ep_num_compressed_values", stats.numCompressedValues,
+                    add_stat, cookie);
+    add_casted_stat("ep_compressed_value_savings",
+                    stats.compressedValueSavings, add_stat, cookie);
+    size_t arenaSize = stats.slabArenaSize.get();
+    size_t arenaUsed = stats.slabArenaUsed.get();
+    add_casted_stat("ep_slab_arena_size", arenaSize, add_stat, cookie);
+    add_casted_stat("ep_slab_arena_used", arenaUsed, add_stat, cookie);
+    add_casted_stat("ep_slab_arena_occupancy",
+                    arenaSize > 0 ? arenaUsed * 100 / arenaSize : 0,
+                    add_stat, cookie);
     add_casted_stat("ep_max_data_size", stats.getMaxDataSize(), add_stat, cookie);
     add_casted_stat("ep_mem_low_wat", stats.mem_low_wat, add_stat, cookie);
     add_casted_stat("ep_mem_high_wat", stats.mem_high_wat, add_stat, cookie);
@@ -2792,6 +2888,9 @@ ENGINE_ERROR_CODE EventuallyPersistentEngine::doHashStats(const void *cookie,
             add_casted_stat(buf, vb->ht.getSize(), add_stat, cookie);
             snprintf(buf, sizeof(buf), "vb_%d:locks", vbid);
             add_casted_stat(buf, vb->ht.getNumLocks(), add_stat, cookie);
+            snprintf(buf, sizeof(buf), "vb_%d:hash", vbid);
+            add_casted_stat(buf, HashTable::getHashFunctionStr(vb->ht.getHashFunction()),
+                            add_stat, cookie);
             snprintf(buf, sizeof(buf), "vb_%d:min_depth", vbid);
             add_casted_stat(buf, depthVisitor.min == -1 ? 0 : depthVisitor.min,
                             add_stat, cookie);
@@ -2805,11 +2904,24 @@ ENGINE_ERROR_CODE EventuallyPersistentEngine::doHashStats(const void *cookie,
             add_casted_stat(buf, depthVisitor.size, add_stat, cookie);
             snprintf(buf, sizeof(buf), "vb_%d:resized", vbid);
             add_casted_stat(buf, vb->ht.getNumResizes(), add_stat, cookie);
+            snprintf(buf, sizeof(buf), "vb_%d:resize_remaining", vbid);
+            add_casted_stat(buf, vb->ht.getResizeRemaining(), add_stat, cookie);
+            snprintf(buf, sizeof(buf), "vb_%d:resize_pause", vbid);
+            add_casted_stat(buf, vb->ht.getResizePauseHisto(), add_stat, cookie);
             snprintf(buf, sizeof(buf), "vb_%d:mem_size", vbid);
             add_casted_stat(buf, vb->ht.memSize, add_stat, cookie);
             snprintf(buf, sizeof(buf), "vb_%d:mem_size_counted", vbid);
             add_casted_stat(buf, depthVisitor.memUsed, add_stat, cookie);
 
+            snprintf(buf, sizeof(buf), "vb_%d:packed_items", vbid);
+            add_casted_stat(buf, depthVisitor.numPacked, add_stat, cookie);
+            snprintf(buf, sizeof(buf), "vb_%d:packed_savings", vbid);
+            add_casted_stat(buf, depthVisitor.packedSavings, add_stat, cookie);
+            snprintf(buf, sizeof(buf), "vb_%d:compressed_items", vbid);
+            add_casted_stat(buf, depthVisitor.numCompressed, add_stat, cookie);
+            snprintf(buf, sizeof(buf), "vb_%d:compressed_savings", vbid);
+            add_casted_stat(buf, depthVisitor.compressedSavings, add_stat, cookie);
+
             return false;
         }
 
@@ -2861,6 +2973,10 @@ ENGINE_ERROR_CODE EventuallyPersistentEngine::doCheckpointStats(const void *cook
     if (nkey == 10) {
         StatCheckpointVisitor cv(epstore, cookie, add_stat);
         epstore->visit(cv);
+        add_casted_stat("chk_deferred_items", stats.checkpointDeferredItems,
+                        add_stat, cookie);
+        add_casted_stat("chk_lock_wait", stats.checkpointLockWaitHisto, add_stat, cookie);
+        add_casted_stat("chk_lock_hold", stats.checkpointLockHoldHisto, add_stat, cookie);
     } else if (nkey > 11) {
         std::string vbid(&stat_key[11], nkey - 11);
         uint16_t vbucket_id(0);
@@ -3221,6 +3337,7 @@ ENGINE_ERROR_CODE EventuallyPersistentEngine::doTimingStats(const void *cookie,
 
     // Regular commands
     add_casted_stat("get_cmd", stats.getCmdHisto, add_stat, cookie);
+    add_casted_stat("get_batch_cmd", stats.getBatchCmdHisto, add_stat, cookie);
     add_casted_stat("arith_cmd", stats.arithCmdHisto, add_stat, cookie);
     add_casted_stat("get_stats_cmd", stats.getStatsCmdHisto, add_stat, cookie);
     // Admin commands
@@ -3305,6 +3422,36 @@ static void doDispatcherStat(const char *prefix, const DispatcherState &ds,
                         add_stat, cookie);
     }
 
+    const std::vector<WorkerState> &workers(ds.getWorkers());
+    snprintf(statname, sizeof(statname), "%s:workers", prefix);
+    add_casted_stat(statname, workers.size(), add_stat, cookie);
+    for (size_t i = 0; i < workers.size(); ++i) {
+        const WorkerState &ws(workers[i]);
+        snprintf(statname, sizeof(statname), "%s:worker_%d:status",
+                 prefix, static_cast<int>(i));
+        add_casted_stat(statname, ws.isRunningTask() ? "running" : "idle",
+                        add_stat, cookie);
+        if (ws.isRunningTask()) {
+            snprintf(statname, sizeof(statname), "%s:worker_%d:task",
+                     prefix, static_cast<int>(i));
+            add_casted_stat(statname, ws.getTaskName().c_str(),
+                            add_stat, cookie);
+            snprintf(statname, sizeof(statname), "%s:worker_%d:runtime",
+                     prefix, static_cast<int>(i));
+            add_casted_stat(statname, (gethrtime() - ws.getTaskStart()) / 1000,
+                            add_stat, cookie);
+        }
+        snprintf(statname, sizeof(statname), "%s:worker_%d:queue_depth",
+                 prefix, static_cast<int>(i));
+        add_casted_stat(statname, ws.getQueueDepth(), add_stat, cookie);
+        snprintf(statname, sizeof(statname), "%s:worker_%d:steals",
+                 prefix, static_cast<int>(i));
+        add_casted_stat(statname, ws.getSteals(), add_stat, cookie);
+        snprintf(statname, sizeof(statname), "%s:worker_%d:runs",
+                 prefix, static_cast<int>(i));
+        add_casted_stat(statname, ws.getRuns(), add_stat, cookie);
+    }
+
     showJobLog(prefix, "log", ds.getLog(), cookie, add_stat);
     showJobLog(prefix, "slow", ds.getSlowLog(), cookie, add_stat);
 }
@@ -3327,6 +3474,11 @@ ENGINE_ERROR_CODE EventuallyPersistentEngine::doDispatcherStats(const void *cook
     DispatcherState nds(epstore->getNonIODispatcher()->getDispatcherState());
     doDispatcherStat("nio_dispatcher", nds, cookie, add_stat);
 
+    if (epstore->hasSeparateFlusherDispatcher()) {
+        DispatcherState fds(epstore->getFlusherDispatcher()->getDispatcherState());
+        doDispatcherStat("flusher_dispatcher", fds, cookie, add_stat);
+    }
+
     return ENGINE_SUCCESS;
 }
 
@@ -3377,6 +3529,9 @@ ENGINE_ERROR_CODE EventuallyPersistentEngine::getStats(const void* cookie,
         rv = doKlogStats(cookie, add_stat);
     } else if (nkey == 7 && strncmp(stat_key, "timings", 7) == 0) {
         rv = doTimingStats(cookie, add_stat);
+    } else if (nkey == 7 && strncmp(stat_key, "hotkeys", 7) == 0) {
+        hotKeys.addStats(add_stat, cookie);
+        rv = ENGINE_SUCCESS;
     } else if (nkey == 10 && strncmp(stat_key, "dispatcher", 10) == 0) {
         rv = doDispatcherStats(cookie, add_stat);
     } else if (nkey == 6 && strncmp(stat_key, "memory", 6) == 0) {
@@ -3420,10 +3575,22 @@ ENGINE_ERROR_CODE EventuallyPersistentEngine::getStats(const void* cookie,
     } else if (nkey == 9 && strncmp(stat_key, "kvtimings", 9) == 0) {
         getEpStore()->getROUnderlying()->addTimingStats("ro", add_stat, cookie);
         getEpStore()->getRWUnderlying()->addTimingStats("rw", add_stat, cookie);
+        for (size_t i = 1; i < getEpStore()->getNumFlusherShards(); ++i) {
+            std::stringstream prefix;
+            prefix << "rw_" << i;
+            getEpStore()->getShardUnderlying(i)->addTimingStats(prefix.str(),
+                                                                add_stat, cookie);
+        }
         rv = ENGINE_SUCCESS;
     } else if (nkey == 7 && strncmp(stat_key, "kvstore", 7) == 0) {
         getEpStore()->getROUnderlying()->addStats("ro", add_stat, cookie);
         getEpStore()->getRWUnderlying()->addStats("rw", add_stat, cookie);
+        for (size_t i = 1; i < getEpStore()->getNumFlusherShards(); ++i) {
+            std::stringstream prefix;
+            prefix << "rw_" << i;
+            getEpStore()->getShardUnderlying(i)->addStats(prefix.str(),
+                                                          add_stat, cookie);
+        }
         rv = ENGINE_SUCCESS;
     } else if (nkey == 6 && strncmp(stat_key, "warmup", 6) == 0) {
         epstore->getWarmup()->addStats(add_stat, cookie);
@@ -3568,6 +3735,121 @@ ENGINE_ERROR_CODE EventuallyPersistentEngine::observe(const void* cookie,
                                 cookie);
 }
 
+ENGINE_ERROR_CODE EventuallyPersistentEngine::getBatch(const void* cookie,
+                                                       protocol_binary_request_header *request,
+                                                       ADD_RESPONSE response) {
+    protocol_binary_request_no_extras *req =
+        (protocol_binary_request_no_extras*)request;
+
+    size_t offset = 0;
+    const char* data = reinterpret_cast<const char*>(req->bytes) + sizeof(req->bytes);
+    uint32_t data_len = ntohl(req->message.header.request.bodylen);
+    std::vector<std::pair<uint16_t, std::string> > keys;
+
+    while (offset < data_len) {
+        uint16_t vb_id;
+        uint16_t keylen;
+
+        if (data_len - offset < 4) {
+            std::string msg("Invalid packet structure");
+            return sendResponse(response, NULL, 0, 0, 0, msg.c_str(), msg.length(),
+                                PROTOCOL_BINARY_RAW_BYTES,
+                                PROTOCOL_BINARY_RESPONSE_EINVAL, 0,
+                                cookie);
+        }
+
+        memcpy(&vb_id, data + offset, sizeof(uint16_t));
+        vb_id = ntohs(vb_id);
+        offset += sizeof(uint16_t);
+
+        memcpy(&keylen, data + offset, sizeof(uint16_t));
+        keylen = ntohs(keylen);
+        offset += sizeof(uint16_t);
+
+        if (data_len - offset < keylen) {
+            std::string msg("Invalid packet structure");
+            return sendResponse(response, NULL, 0, 0, 0, msg.c_str(), msg.length(),
+                                PROTOCOL_BINARY_RAW_BYTES,
+                                PROTOCOL_BINARY_RESPONSE_EINVAL, 0,
+                                cookie);
+        }
+
+        keys.push_back(std::make_pair(vb_id, std::string(data + offset, keylen)));
+        offset += keylen;
+    }
+
+    if (isDegradedMode()) {
+        return sendResponse(response, NULL, 0, NULL, 0, NULL, 0,
+                            PROTOCOL_BINARY_RAW_BYTES,
+                            PROTOCOL_BINARY_RESPONSE_ETMPFAIL, 0, cookie);
+    }
+
+    // Blocked batches are looked up again in full once memcached calls
+    // back, so nothing is kept from the first attempt.
+    std::vector<GetValue> values;
+    ENGINE_ERROR_CODE rv = epstore->getBatch(keys, cookie, values);
+    if (rv == ENGINE_EWOULDBLOCK) {
+        std::vector<GetValue>::iterator it;
+        for (it = values.begin(); it != values.end(); ++it) {
+            delete it->getValue();
+        }
+        return rv;
+    }
+
+    size_t needed = 0;
+    for (size_t i = 0; i < keys.size(); ++i) {
+        Item *itm = values[i].getValue();
+        needed += 22 + keys[i].second.length() + (itm ? itm->getNBytes() : 0);
+    }
+    std::string result;
+    result.reserve(needed);
+    for (size_t i = 0; i < keys.size(); ++i) {
+        const std::string &key = keys[i].second;
+        Item *itm = values[i].getValue();
+        uint16_t status;
+        switch (values[i].getStatus()) {
+        case ENGINE_SUCCESS:
+            status = PROTOCOL_BINARY_RESPONSE_SUCCESS;
+            break;
+        case ENGINE_KEY_ENOENT:
+            status = PROTOCOL_BINARY_RESPONSE_KEY_ENOENT;
+            break;
+        case ENGINE_NOT_MY_VBUCKET:
+            status = PROTOCOL_BINARY_RESPONSE_NOT_MY_VBUCKET;
+            break;
+        case ENGINE_ENOMEM:
+            status = PROTOCOL_BINARY_RESPONSE_ENOMEM;
+            break;
+        default:
+            status = PROTOCOL_BINARY_RESPONSE_ETMPFAIL;
+        }
+        hotKeys.sample(HOTKEY_GET, key, keys[i].first,
+                       itm ? itm->getNBytes() : 0);
+
+        uint16_t vb_id = htons(keys[i].first);
+        uint16_t keylen = htons(static_cast<uint16_t>(key.length()));
+        status = htons(status);
+        uint32_t flags = itm ? itm->getFlags() : 0;
+        uint64_t cas = htonll(itm ? itm->getCas() : 0);
+        uint32_t nbytes = htonl(itm ? itm->getNBytes() : 0);
+        result.append(reinterpret_cast<char*>(&vb_id), sizeof(vb_id));
+        result.append(reinterpret_cast<char*>(&keylen), sizeof(keylen));
+        result.append(reinterpret_cast<char*>(&status), sizeof(status));
+        result.append(reinterpret_cast<char*>(&flags), sizeof(flags));
+        result.append(reinterpret_cast<char*>(&cas), sizeof(cas));
+        result.append(reinterpret_cast<char*>(&nbytes), sizeof(nbytes));
+        result.append(key);
+        if (itm) {
+            result.append(itm->getData(), itm->getNBytes());
+            delete itm;
+        }
+    }
+
+    return sendResponse(response, NULL, 0, 0, 0, result.data(), result.length(),
+                        PROTOCOL_BINARY_RAW_BYTES,
+                        PROTOCOL_BINARY_RESPONSE_SUCCESS, 0, cookie);
+}
+
 ENGINE_ERROR_CODE EventuallyPersistentEngine::touch(const void *cookie,
                                                     protocol_binary_request_header *request,
                                                     ADD_RESPONSE response)
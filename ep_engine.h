@@ -25,6 +25,7 @@
 #include "tapthrottle.hh"
 #include "restore.hh"
 #include "configuration.hh"
+#include "hotkeys.hh"
 
 extern "C" {
     EXPORT_FUNCTION
@@ -221,6 +222,7 @@ public:
                                                     false, // not force
                                                     false, // not use metadata
                                                     &itemMeta);
+        hotKeys.sample(HOTKEY_DELETE, key, vbucket, 0);
 
         if (ret == ENGINE_KEY_ENOENT || ret == ENGINE_NOT_MY_VBUCKET) {
             if (isDegradedMode()) {
@@ -248,6 +250,8 @@ public:
 
         GetValue gv(epstore->get(k, vbucket, cookie, serverApi->core));
         ENGINE_ERROR_CODE ret = gv.getStatus();
+        hotKeys.sample(HOTKEY_GET, k, vbucket,
+                       gv.getValue() ? gv.getValue()->getNBytes() : 0);
 
         if (ret == ENGINE_SUCCESS) {
             *itm = gv.getValue();
@@ -265,7 +269,10 @@ public:
                                int nkey,
                                ADD_STAT add_stat);
 
-    void resetStats() { stats.reset(); }
+    void resetStats() {
+        stats.reset();
+        hotKeys.reset();
+    }
 
     ENGINE_ERROR_CODE store(const void *cookie,
                             item* itm,
@@ -517,6 +524,10 @@ public:
                               protocol_binary_request_header *request,
                               ADD_RESPONSE response);
 
+    ENGINE_ERROR_CODE getBatch(const void* cookie,
+                               protocol_binary_request_header *request,
+                               ADD_RESPONSE response);
+
     RCPtr<VBucket> getVBucket(uint16_t vbucket) {
         return epstore->getVBucket(vbucket);
     }
@@ -527,6 +538,8 @@ public:
 
     ~EventuallyPersistentEngine() {
         delete epstore;
+        // Nothing can be reading our hash tables any more.
+        EpochReclaimer::drain(this);
         delete tapConnMap;
         delete tapConfig;
         delete checkpointConfig;
@@ -545,6 +558,8 @@ public:
 
     EventuallyPersistentStore* getEpStore() { return epstore; }
 
+    HotKeyProfiler &getHotKeyProfiler() { return hotKeys; }
+
     TapConnMap &getTapConnMap() { return *tapConnMap; }
 
     TapConfig &getTapConfig() { return *tapConfig; }
@@ -798,6 +813,7 @@ private:
     size_t getlMaxTimeout;
     EPStats stats;
     Configuration configuration;
+    HotKeyProfiler hotKeys;
     Atomic<bool> warmingUp;
     Atomic<bool> trafficEnabled;
     struct {
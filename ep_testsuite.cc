@@ -16,6 +16,7 @@
  */
 #include "config.h"
 
+#include <fstream>
 #include <iostream>
 #include <sstream>
 #include <map>
@@ -54,6 +55,7 @@
 #include "ep_testsuite.h"
 #include "command_ids.h"
 #include "mock/mccouch.hh"
+#include "tools/cJSON.h"
 
 
 #ifdef linux
@@ -603,6 +605,37 @@ static protocol_binary_request_header*
     return req;
 }
 
+static protocol_binary_request_header*
+       createGetBatchPacket(const std::vector<std::pair<uint16_t, std::string> > &keys) {
+    std::stringstream value;
+    std::vector<std::pair<uint16_t, std::string> >::const_iterator it;
+    for (it = keys.begin(); it != keys.end(); it++) {
+        uint16_t vb = htons(it->first);
+        uint16_t keylen = htons(it->second.length());
+        value.write((char*) &vb, sizeof(uint16_t));
+        value.write((char*) &keylen, sizeof(uint16_t));
+        value.write(it->second.c_str(), it->second.length());
+    }
+
+    uint32_t val_len = value.str().length();
+
+    char *pkt_raw;
+    pkt_raw = static_cast<char*>(calloc(1, sizeof(protocol_binary_request_header)
+                                           + val_len));
+    assert(pkt_raw);
+    protocol_binary_request_header *req = (protocol_binary_request_header*)pkt_raw;
+    req->request.opcode = CMD_GET_BATCH;
+    req->request.vbucket = ntohs(0);
+    req->request.bodylen = htonl(val_len);
+    req->request.keylen = htons(0);
+
+    if (val_len > 0) {
+        memcpy(pkt_raw + sizeof(protocol_binary_request_header),
+            value.str().data(), val_len);
+    }
+    return req;
+}
+
 static void evict_key(ENGINE_HANDLE *h, ENGINE_HANDLE_V1 *h1,
                       const char *key, uint16_t vbucketId=0,
                       const char *msg = NULL, bool expectError = false) {
@@ -1727,6 +1760,150 @@ static enum test_result test_flush_multiv_restart(ENGINE_HANDLE *h, ENGINE_HANDL
     return SUCCESS;
 }
 
+static enum test_result test_sharded_flusher_restart(ENGINE_HANDLE *h,
+                                                     ENGINE_HANDLE_V1 *h1) {
+    check(get_int_stat(h, h1, "ep_flusher_shards") == 4,
+          "Expected four flusher shards");
+    // One vbucket per shard.
+    for (uint16_t vb = 1; vb < 4; ++vb) {
+        check(set_vbucket_state(h, h1, vb, vbucket_state_active),
+              "Failed to set vbucket state.");
+    }
+    item *i = NULL;
+    for (uint16_t vb = 0; vb < 4; ++vb) {
+        check(store(h, h1, NULL, OPERATION_SET, "key", "somevalue", &i,
+                    0, vb) == ENGINE_SUCCESS, "Failed set.");
+        h1->release(h, NULL, i);
+        check(store(h, h1, NULL, OPERATION_SET, "gone", "somevalue", &i,
+                    0, vb) == ENGINE_SUCCESS, "Failed set.");
+        h1->release(h, NULL, i);
+    }
+    wait_for_flusher_to_settle(h, h1);
+    for (uint16_t vb = 0; vb < 4; ++vb) {
+        check(h1->remove(h, NULL, "gone", 4, 0, vb) == ENGINE_SUCCESS,
+              "Failed remove.");
+    }
+    wait_for_flusher_to_settle(h, h1);
+
+    testHarness.reload_engine(&h, &h1,
+                              testHarness.engine_path,
+                              testHarness.get_current_testcase()->cfg,
+                              true, false);
+    wait_for_warmup_complete(h, h1);
+
+    for (uint16_t vb = 0; vb < 4; ++vb) {
+        check_key_value(h, h1, "key", "somevalue", 9, vb);
+        check(ENGINE_KEY_ENOENT == verify_vb_key(h, h1, "gone", vb),
+              "Expected missing key");
+    }
+    return SUCCESS;
+}
+
+static enum test_result test_sharded_flusher_pause_resume(ENGINE_HANDLE *h,
+                                                          ENGINE_HANDLE_V1 *h1) {
+    check(get_int_stat(h, h1, "ep_flusher_shards") == 4,
+          "Expected four flusher shards");
+    for (uint16_t vb = 1; vb < 4; ++vb) {
+        check(set_vbucket_state(h, h1, vb, vbucket_state_active),
+              "Failed to set vbucket state.");
+    }
+    // Every flusher is running once its shard has been written.
+    item *i = NULL;
+    for (uint16_t vb = 0; vb < 4; ++vb) {
+        check(store(h, h1, NULL, OPERATION_SET, "key", "somevalue", &i,
+                    0, vb) == ENGINE_SUCCESS, "Failed set.");
+        h1->release(h, NULL, i);
+    }
+    wait_for_flusher_to_settle(h, h1);
+
+    // Pause and resume the flushers while they write, then stop them
+    // with items still queued.
+    const int rounds = 10;
+    for (int r = 0; r < rounds; ++r) {
+        stop_persistence(h, h1);
+        for (uint16_t vb = 0; vb < 4; ++vb) {
+            for (int j = 0; j < 50; ++j) {
+                std::stringstream key;
+                key << "key-" << r << "-" << j;
+                check(store(h, h1, NULL, OPERATION_SET, key.str().c_str(),
+                            "somevalue", &i, 0, vb) == ENGINE_SUCCESS,
+                      "Failed set.");
+                h1->release(h, NULL, i);
+            }
+        }
+        start_persistence(h, h1);
+    }
+
+    testHarness.reload_engine(&h, &h1,
+                              testHarness.engine_path,
+                              testHarness.get_current_testcase()->cfg,
+                              true, false);
+    wait_for_warmup_complete(h, h1);
+
+    for (int r = 0; r < rounds; ++r) {
+        for (uint16_t vb = 0; vb < 4; ++vb) {
+            for (int j = 0; j < 50; ++j) {
+                std::stringstream key;
+                key << "key-" << r << "-" << j;
+                check_key_value(h, h1, key.str().c_str(), "somevalue", 9, vb);
+            }
+        }
+    }
+    return SUCCESS;
+}
+
+static enum test_result test_parallel_warmup(ENGINE_HANDLE *h,
+                                             ENGINE_HANDLE_V1 *h1) {
+    for (uint16_t vb = 1; vb < 4; ++vb) {
+        check(set_vbucket_state(h, h1, vb, vbucket_state_active),
+              "Failed to set vbucket state.");
+    }
+    item *i = NULL;
+    for (uint16_t vb = 0; vb < 4; ++vb) {
+        for (int j = 0; j < 100; ++j) {
+            std::stringstream key;
+            key << "key-" << j;
+            check(store(h, h1, NULL, OPERATION_SET, key.str().c_str(),
+                        "somevalue", &i, 0, vb) == ENGINE_SUCCESS,
+                  "Failed set.");
+            h1->release(h, NULL, i);
+        }
+    }
+    wait_for_flusher_to_settle(h, h1);
+    check(set_vbucket_state(h, h1, 3, vbucket_state_replica),
+          "Failed to set vbucket state.");
+    wait_for_flusher_to_settle(h, h1);
+
+    testHarness.reload_engine(&h, &h1,
+                              testHarness.engine_path,
+                              testHarness.get_current_testcase()->cfg,
+                              true, false);
+    wait_for_warmup_complete(h, h1);
+
+    for (uint16_t vb = 0; vb < 3; ++vb) {
+        for (int j = 0; j < 100; ++j) {
+            std::stringstream key;
+            key << "key-" << j;
+            check_key_value(h, h1, key.str().c_str(), "somevalue", 9, vb);
+        }
+    }
+    check(get_int_stat(h, h1, "vb_replica_curr_items") == 100,
+          "Expected the replica vbucket to be loaded");
+
+    // Every vbucket was loaded by one of four readers.
+    int vbuckets = 0;
+    for (int r = 0; r < 4; ++r) {
+        std::stringstream stat;
+        stat << "ep_warmup_key_dump_reader_" << r << "_vbuckets";
+        vbuckets += get_int_stat(h, h1, stat.str().c_str(), "warmup");
+    }
+    check(vbuckets == 4, "Expected all vbuckets to be read in parallel");
+    check(get_int_stat(h, h1, "ep_warmup_traffic_time", "warmup") <=
+          get_int_stat(h, h1, "ep_warmup_time", "warmup"),
+          "Traffic enabled after warmup completed");
+    return SUCCESS;
+}
+
 static enum test_result test_delete(ENGINE_HANDLE *h, ENGINE_HANDLE_V1 *h1) {
     item *i = NULL;
     // First try to delete something we know to not be there.
@@ -4379,6 +4556,105 @@ static enum test_result test_io_stats(ENGINE_HANDLE *h, ENGINE_HANDLE_V1 *h1) {
     return SUCCESS;
 }
 
+static enum test_result test_hotkeys_stats(ENGINE_HANDLE *h,
+                                           ENGINE_HANDLE_V1 *h1) {
+    item *i = NULL;
+    check(store(h, h1, NULL, OPERATION_SET, "hot", "somevalue", &i) == ENGINE_SUCCESS,
+          "Failed to store a value");
+    h1->release(h, NULL, i);
+    check(store(h, h1, NULL, OPERATION_SET, "cold", "somevalue", &i) == ENGINE_SUCCESS,
+          "Failed to store a value");
+    h1->release(h, NULL, i);
+
+    h1->reset_stats(h, NULL);
+    for (int j = 0; j < 50; ++j) {
+        check_key_value(h, h1, "hot", "somevalue", 9);
+        if (j % 10 == 0) {
+            check_key_value(h, h1, "cold", "somevalue", 9);
+        }
+    }
+
+    check(get_int_stat(h, h1, "hotkeys_get_samples", "hotkeys") >= 50,
+          "Expected every get to be sampled");
+    check(get_str_stat(h, h1, "hotkeys_get_key_0", "hotkeys") == "hot",
+          "Expected the hot key to be the hottest");
+    check(get_str_stat(h, h1, "hotkeys_get_key_1", "hotkeys") == "cold",
+          "Expected the cold key to be the second hottest");
+    checkeq(0, get_int_stat(h, h1, "hotkeys_get_vb_0", "hotkeys"),
+            "Expected vbucket 0 to be the hottest");
+    checkeq(9, get_int_stat(h, h1, "hotkeys_get_large_0_bytes", "hotkeys"),
+            "Expected the size of the values fetched");
+
+    h1->reset_stats(h, NULL);
+    checkeq(0, get_int_stat(h, h1, "hotkeys_get_samples", "hotkeys"),
+            "Expected reset stats to clear the hot keys");
+
+    return SUCCESS;
+}
+
+static enum test_result test_hotkeys_stats_snapshot(ENGINE_HANDLE *h,
+                                                    ENGINE_HANDLE_V1 *h1) {
+    const char *key = "say \"hi\"\\\n";
+    item *i = NULL;
+    check(store(h, h1, NULL, OPERATION_SET, key, "somevalue", &i) == ENGINE_SUCCESS,
+          "Failed to store a value");
+    h1->release(h, NULL, i);
+    check_key_value(h, h1, key, "somevalue", 9);
+    check(get_str_stat(h, h1, "hotkeys_get_key_0", "hotkeys") == key,
+          "Expected the quoted key to be the hottest");
+
+    // A clean shutdown snapshots the stats, hot keys included.
+    testHarness.reload_engine(&h, &h1,
+                              testHarness.engine_path,
+                              testHarness.get_current_testcase()->cfg,
+                              true, false);
+    wait_for_warmup_complete(h, h1);
+
+    std::ifstream in("/tmp/test.db/stats.json");
+    check(in.good(), "Expected a stats snapshot");
+    std::stringstream doc;
+    doc << in.rdbuf();
+    cJSON *json = cJSON_Parse(doc.str().c_str());
+    check(json != NULL, "Expected the stats snapshot to be valid JSON");
+    cJSON *hot = cJSON_GetObjectItem(json, "hotkeys_get_key_0");
+    cJSON *shutdown = cJSON_GetObjectItem(json, "ep_force_shutdown");
+    bool keyKept = hot != NULL && strcmp(hot->valuestring, key) == 0;
+    bool shutdownKept = shutdown != NULL &&
+        strcmp(shutdown->valuestring, "false") == 0;
+    cJSON_Delete(json);
+    check(keyKept, "Expected the quoted key in the stats snapshot");
+    check(shutdownKept, "Expected the clean shutdown in the stats snapshot");
+
+    return SUCCESS;
+}
+
+static enum test_result test_sampled_pager(ENGINE_HANDLE *h,
+                                          ENGINE_HANDLE_V1 *h1) {
+    check(get_str_stat(h, h1, "ep_pager_policy") == "sampled",
+          "Expected the sampled pager policy");
+    checkeq(0, get_int_stat(h, h1, "ep_pager_items_inspected"),
+            "Expected no items inspected without memory pressure");
+    checkeq(0, get_int_stat(h, h1, "ep_pager_hot_ejects"),
+            "Expected no hot ejects without memory pressure");
+    check(vals.find("ep_pager_time") != vals.end(), "Found no ep_pager_time.");
+
+    check(set_param(h, h1, engine_param_flush, "pager_sample_size", "128"),
+          "Failed to set pager_sample_size");
+    checkeq(128, get_int_stat(h, h1, "ep_pager_sample_size"),
+            "Expected the new sample size");
+    check(!set_param(h, h1, engine_param_flush, "pager_sample_size", "0"),
+          "Expected an empty sample to be refused");
+
+    check(!set_param(h, h1, engine_param_flush, "pager_policy", "lru"),
+          "Expected an unknown pager policy to be refused");
+    check(set_param(h, h1, engine_param_flush, "pager_policy", "sweep"),
+          "Failed to set pager_policy");
+    check(get_str_stat(h, h1, "ep_pager_policy") == "sweep",
+          "Expected the sweep pager policy");
+
+    return SUCCESS;
+}
+
 static enum test_result test_bg_stats(ENGINE_HANDLE *h, ENGINE_HANDLE_V1 *h1) {
     h1->reset_stats(h, NULL);
     wait_for_persisted_value(h, h1, "a", "b\r\n");
@@ -5079,6 +5355,32 @@ static enum test_result test_disk_gt_ram_delete_paged_out(ENGINE_HANDLE *h,
     return SUCCESS;
 }
 
+static enum test_result test_bg_fetch_read_handle_cache(ENGINE_HANDLE *h,
+                                                        ENGINE_HANDLE_V1 *h1) {
+    wait_for_persisted_value(h, h1, "k1", "some value");
+    wait_for_persisted_value(h, h1, "k2", "other value");
+    evict_key(h, h1, "k1");
+    evict_key(h, h1, "k2");
+
+    int hits = get_int_stat(h, h1, "ro:handle_hits", "kvstore");
+    int misses = get_int_stat(h, h1, "ro:handle_misses", "kvstore");
+    check_key_value(h, h1, "k1", "some value", 10);
+    check_key_value(h, h1, "k2", "other value", 11);
+    checkeq(misses + 1, get_int_stat(h, h1, "ro:handle_misses", "kvstore"),
+            "Expected the first fetch to open the file");
+    checkeq(hits + 1, get_int_stat(h, h1, "ro:handle_hits", "kvstore"),
+            "Expected the second fetch to reuse the file");
+
+    // A write makes the kept open file stale.
+    wait_for_persisted_value(h, h1, "k3", "new value");
+    evict_key(h, h1, "k3");
+    int stale = get_int_stat(h, h1, "ro:handle_stale", "kvstore");
+    check_key_value(h, h1, "k3", "new value", 9);
+    checkeq(stale + 1, get_int_stat(h, h1, "ro:handle_stale", "kvstore"),
+            "Expected the fetch to reopen the written file");
+    return SUCCESS;
+}
+
 extern "C" {
     static void* bg_set_thread(void *arg) {
         ThreadData *td(static_cast<ThreadData*>(arg));
@@ -7093,6 +7395,99 @@ static enum test_result test_observe_multi_key(ENGINE_HANDLE *h, ENGINE_HANDLE_V
     return SUCCESS;
 }
 
+/**
+ * Check the next entry of a batched get response, returning the offset
+ * of the one after it.
+ */
+static size_t check_batch_entry(size_t offset, uint16_t vbucket,
+                                const char *key, uint16_t status,
+                                const char *value) {
+    uint16_t vb, keylen, st;
+    uint32_t flags, nbytes;
+    uint64_t cas;
+    check(offset + 22 <= last_bodylen, "Short batched get response");
+    memcpy(&vb, last_body + offset, sizeof(vb));
+    memcpy(&keylen, last_body + offset + 2, sizeof(keylen));
+    memcpy(&st, last_body + offset + 4, sizeof(st));
+    memcpy(&flags, last_body + offset + 6, sizeof(flags));
+    memcpy(&cas, last_body + offset + 10, sizeof(cas));
+    memcpy(&nbytes, last_body + offset + 18, sizeof(nbytes));
+    offset += 22;
+    checkeq(vbucket, ntohs(vb), "Wrong vbucket in result");
+    checkeq(strlen(key), static_cast<size_t>(ntohs(keylen)),
+            "Wrong keylen in result");
+    check(memcmp(last_body + offset, key, strlen(key)) == 0,
+          "Wrong key in result");
+    offset += ntohs(keylen);
+    checkeq(status, ntohs(st), "Wrong status in result");
+    if (value) {
+        check(cas != 0, "Expected a cas for a found key");
+        checkeq(strlen(value), static_cast<size_t>(ntohl(nbytes)),
+                "Wrong value length in result");
+        check(memcmp(last_body + offset, value, strlen(value)) == 0,
+              "Wrong value in result");
+    } else {
+        checkeq(static_cast<uint32_t>(0), ntohl(nbytes),
+                "Expected no value for a key that wasn't found");
+    }
+    return offset + ntohl(nbytes);
+}
+
+static enum test_result test_get_batch(ENGINE_HANDLE *h, ENGINE_HANDLE_V1 *h1) {
+    check(set_vbucket_state(h, h1, 1, vbucket_state_active),
+          "Failed to set vbucket state.");
+    item *i = NULL;
+    check(store(h, h1, NULL, OPERATION_SET, "key1", "value1", &i) == ENGINE_SUCCESS,
+          "Failed to store a value");
+    h1->release(h, NULL, i);
+    check(store(h, h1, NULL, OPERATION_SET, "key2", "value22", &i, 0, 1) == ENGINE_SUCCESS,
+          "Failed to store a value");
+    h1->release(h, NULL, i);
+    check(store(h, h1, NULL, OPERATION_SET, "key3", "value333", &i) == ENGINE_SUCCESS,
+          "Failed to store a value");
+    h1->release(h, NULL, i);
+    wait_for_flusher_to_settle(h, h1);
+    evict_key(h, h1, "key3", 0, "Ejected.");
+
+    std::vector<std::pair<uint16_t, std::string> > keys;
+    keys.push_back(std::make_pair(1, std::string("key2")));
+    keys.push_back(std::make_pair(0, std::string("key3")));
+    keys.push_back(std::make_pair(0, std::string("nokey")));
+    keys.push_back(std::make_pair(2, std::string("key1")));
+    keys.push_back(std::make_pair(0, std::string("key1")));
+    protocol_binary_request_header *pkt = createGetBatchPacket(keys);
+    check(h1->unknown_command(h, NULL, pkt, add_response) == ENGINE_SUCCESS,
+          "Batched get failed.");
+    free(pkt);
+    check(last_status == PROTOCOL_BINARY_RESPONSE_SUCCESS, "Expected success");
+
+    // The results come back in the order of the request.
+    size_t offset = 0;
+    offset = check_batch_entry(offset, 1, "key2",
+                               PROTOCOL_BINARY_RESPONSE_SUCCESS, "value22");
+    offset = check_batch_entry(offset, 0, "key3",
+                               PROTOCOL_BINARY_RESPONSE_SUCCESS, "value333");
+    offset = check_batch_entry(offset, 0, "nokey",
+                               PROTOCOL_BINARY_RESPONSE_KEY_ENOENT, NULL);
+    offset = check_batch_entry(offset, 2, "key1",
+                               PROTOCOL_BINARY_RESPONSE_NOT_MY_VBUCKET, NULL);
+    offset = check_batch_entry(offset, 0, "key1",
+                               PROTOCOL_BINARY_RESPONSE_SUCCESS, "value1");
+    checkeq(static_cast<size_t>(last_bodylen), offset,
+            "Expected nothing after the last key");
+
+    // A malformed body is refused.
+    pkt = createGetBatchPacket(keys);
+    pkt->request.bodylen = htonl(ntohl(pkt->request.bodylen) - 1);
+    check(h1->unknown_command(h, NULL, pkt, add_response) == ENGINE_SUCCESS,
+          "Batched get failed.");
+    free(pkt);
+    check(last_status == PROTOCOL_BINARY_RESPONSE_EINVAL,
+          "Expected a truncated batch to be refused");
+
+    return SUCCESS;
+}
+
 static enum test_result test_multiple_observes(ENGINE_HANDLE *h, ENGINE_HANDLE_V1 *h1) {
     // Holds the result
     uint16_t vb;
@@ -7683,6 +8078,8 @@ engine_test_t* get_tests(void) {
                  NULL, prepare, cleanup, BACKEND_ALL),
         TestCase("test multiple observes", test_multiple_observes, NULL, teardown,
                  NULL, prepare, cleanup, BACKEND_ALL),
+        TestCase("test get batch", test_get_batch, NULL, teardown,
+                 NULL, prepare, cleanup, BACKEND_ALL),
         TestCase("test observe with not found", test_observe_with_not_found, NULL, teardown,
                  NULL, prepare, cleanup, BACKEND_ALL),
         TestCase("test observe not my vbucket", test_observe_errors, NULL, teardown,
@@ -7694,6 +8091,13 @@ engine_test_t* get_tests(void) {
                  NULL, prepare, cleanup, BACKEND_ALL),
         TestCase("bg stats", test_bg_stats, test_setup, teardown,
                  NULL, prepare, cleanup, BACKEND_ALL),
+        TestCase("hotkeys stats", test_hotkeys_stats, test_setup, teardown,
+                 "hotkeys_sample_rate=1", prepare, cleanup, BACKEND_ALL),
+        TestCase("hotkeys stats snapshot", test_hotkeys_stats_snapshot,
+                 test_setup, teardown, "hotkeys_sample_rate=1", prepare,
+                 cleanup, BACKEND_COUCH),
+        TestCase("sampled item pager", test_sampled_pager, test_setup, teardown,
+                 "pager_policy=sampled", prepare, cleanup, BACKEND_ALL),
         TestCase("mem stats", test_mem_stats, test_setup, teardown,
                  "chk_remover_stime=1;chk_period=60", prepare, cleanup,
                  BACKEND_ALL),
@@ -7802,6 +8206,18 @@ engine_test_t* get_tests(void) {
         TestCase("flush multiv+restart", test_flush_multiv_restart,
                  test_setup, teardown, NULL, prepare, cleanup,
                  BACKEND_ALL),
+        TestCase("flush multiv+restart with sharded flusher",
+                 test_flush_multiv_restart, test_setup, teardown,
+                 "flusher_shards=4", prepare, cleanup, BACKEND_COUCH),
+        TestCase("sharded flusher+restart", test_sharded_flusher_restart,
+                 test_setup, teardown, "flusher_shards=4", prepare, cleanup,
+                 BACKEND_COUCH),
+        TestCase("sharded flusher pause+resume+stop",
+                 test_sharded_flusher_pause_resume, test_setup, teardown,
+                 "flusher_shards=4", prepare, cleanup, BACKEND_COUCH),
+        TestCase("parallel warmup", test_parallel_warmup,
+                 test_setup, teardown, "warmup_reader_threads=4", prepare,
+                 cleanup, BACKEND_COUCH),
         TestCase("test kill -9 bucket", test_kill9_bucket,
                  test_setup, teardown, NULL, prepare, cleanup,
                  BACKEND_ALL),
@@ -7826,6 +8242,9 @@ engine_test_t* get_tests(void) {
         TestCase("disk>RAM delete paged-out", test_disk_gt_ram_delete_paged_out,
                  test_setup, teardown, NULL, prepare, cleanup,
                  BACKEND_ALL),
+        TestCase("bg fetch read handle cache", test_bg_fetch_read_handle_cache,
+                 test_setup, teardown, NULL, prepare, cleanup,
+                 BACKEND_COUCH),
         TestCase("disk>RAM paged-out incr", test_disk_gt_ram_incr,
                  test_setup, teardown, NULL, prepare, cleanup,
                  BACKEND_ALL),
@@ -143,6 +143,7 @@ void Flusher::wake(void) {
 }
 
 bool Flusher::step(Dispatcher &d, TaskId tid) {
+    LockHolder lh(stepMutex);
     try {
         switch (_state) {
         case initializing:
@@ -155,6 +156,12 @@ bool Flusher::step(Dispatcher &d, TaskId tid) {
             return false;
         case running:
             {
+                if (shard->id != 0 && store->isFlushAllScheduled()) {
+                    // The first shard wipes all vbuckets first; don't
+                    // write anything it would wipe.
+                    d.snooze(tid, DEFAULT_MIN_SLEEP_TIME);
+                    return true;
+                }
                 doFlush();
                 if (_state == running) {
                     double tosleep = computeMinSleepTime();
@@ -215,7 +222,7 @@ double Flusher::computeMinSleepTime() {
     }
 
     if (flushRv + prevFlushRv == 0) {
-        if (!store->diskQueueEmpty()) {
+        if (!store->diskQueueEmpty(*shard)) {
             return 0.0;
         }
         minSleepTime = std::min(minSleepTime * 2, 1.0);
@@ -231,7 +238,7 @@ int Flusher::doFlush() {
     // On a fresh entry, flushQueue is null and we need to build one.
     if (!flushQueue) {
         flushRv = store->stats.min_data_age;
-        flushQueue = store->beginFlush();
+        flushQueue = store->beginFlush(*shard);
         if (flushQueue) {
             getLogger()->log(EXTENSION_LOG_DEBUG, NULL,
                              "Beginning a write queue flush.\n");
@@ -243,7 +250,7 @@ int Flusher::doFlush() {
     // Now do the every pass thing.
     if (flushQueue) {
         if (!flushQueue->empty()) {
-            int n = store->flushSome(flushQueue, rejectQueue);
+            int n = store->flushSome(*shard, flushQueue, rejectQueue);
             if (_state == pausing) {
                 transition_state(paused);
             }
@@ -253,12 +260,13 @@ int Flusher::doFlush() {
         if (flushQueue->empty()) {
             if (!rejectQueue->empty()) {
                 // Requeue the rejects.
-                store->requeueRejectedItems(rejectQueue);
+                store->requeueRejectedItems(*shard, rejectQueue);
             } else {
-                store->completeFlush(flushStart);
+                store->completeFlush(*shard, flushStart);
                 getLogger()->log(EXTENSION_LOG_INFO, NULL,
-                                 "Completed a flush, age of oldest item was %ds\n",
-                                 flushRv);
+                                 "Completed a flush of shard %d, age of oldest "
+                                 "item was %ds\n",
+                                 static_cast<int>(shard->id), flushRv);
 
                 delete rejectQueue;
                 rejectQueue = NULL;
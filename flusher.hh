@@ -45,12 +45,14 @@ private:
 
 /**
  * Manage persistence of data for an EventuallyPersistentStore.
+ *
+ * Every flusher persists the vbuckets of one FlusherShard.
  */
 class Flusher {
 public:
 
-    Flusher(EventuallyPersistentStore *st, Dispatcher *d) :
-        store(st), _state(initializing), dispatcher(d),
+    Flusher(EventuallyPersistentStore *st, Dispatcher *d, FlusherShard *sh) :
+        store(st), shard(sh), _state(initializing), dispatcher(d),
         flushRv(0), prevFlushRv(0), minSleepTime(0.1),
         flushQueue(NULL), rejectQueue(NULL), vbStateLoaded(false),
         forceShutdownReceived(false) {
@@ -99,8 +101,12 @@ private:
     const char * stateName(enum flusher_state st) const;
 
     EventuallyPersistentStore   *store;
+    FlusherShard                *shard;
     volatile enum flusher_state  _state;
     Mutex                        taskMutex;
+    // Held for a whole step: stop, pause and resume schedule a new
+    // stepper that another worker may start before the old one returns.
+    Mutex                        stepMutex;
     TaskId                       task;
     Dispatcher                  *dispatcher;
 
@@ -355,6 +355,230 @@ private:
     DISALLOW_COPY_AND_ASSIGN(Histogram);
 };
 
+/**
+ * Every power of two a LogLinearHistogram counts is split into
+ * 2^LOG_LINEAR_SUB_BITS buckets, so values are counted to within
+ * about 3% of their size.
+ */
+#define LOG_LINEAR_SUB_BITS 5
+
+/**
+ * Values of 2^LOG_LINEAR_MAX_BITS and over all land in the last
+ * bucket of a LogLinearHistogram (for microseconds, that's over 19
+ * hours).
+ */
+#define LOG_LINEAR_MAX_BITS 36
+
+/**
+ * A histogram with log-linear buckets, as in HdrHistogram.
+ *
+ * Values below 2^LOG_LINEAR_SUB_BITS get a bucket each, and every
+ * power of two above that is split into 2^LOG_LINEAR_SUB_BITS equally
+ * wide buckets.  Finding the bucket of a value is a computation rather
+ * than the search Histogram does, and the counts live in flat arrays,
+ * one per counter stripe (see StripedCounter), allocated the first time
+ * a thread dealt that stripe adds to the histogram.  Reads add up the
+ * stripes, so they're meant for stats requests rather than hot paths.
+ *
+ * T must be an unsigned type that holds 2^LOG_LINEAR_MAX_BITS.
+ */
+template <typename T>
+class LogLinearHistogram {
+public:
+
+    static const size_t SUB_BUCKETS = 1 << LOG_LINEAR_SUB_BITS;
+    static const size_t NUM_BUCKETS =
+        (LOG_LINEAR_MAX_BITS - LOG_LINEAR_SUB_BITS + 1) * SUB_BUCKETS;
+    //! Power of two bins: [0, 1), [1, 2), [2, 4) ... [2^35, max]
+    static const size_t NUM_OCTAVES = LOG_LINEAR_MAX_BITS + 1;
+
+    LogLinearHistogram() {
+        for (size_t i = 0; i < COUNTER_STRIPES; ++i) {
+            stripes[i] = NULL;
+        }
+    }
+
+    ~LogLinearHistogram() {
+        for (size_t i = 0; i < COUNTER_STRIPES; ++i) {
+            delete []stripes[i];
+        }
+    }
+
+    /**
+     * Add a value to this histogram.
+     *
+     * @param amount the size of the thing being added
+     * @param count the quantity at this size being added
+     */
+    void add(T amount, size_t count=1) {
+        size_t *counts = getStripe();
+        ep_sync_add_and_fetch(&counts[bucketOf(amount)], count);
+    }
+
+    /**
+     * Set all buckets to 0.
+     *
+     * Values added while this runs may or may not survive it.
+     */
+    void reset() {
+        for (size_t s = 0; s < COUNTER_STRIPES; ++s) {
+            size_t *counts = stripes[s];
+            if (counts == NULL) {
+                continue;
+            }
+            for (size_t i = 0; i < NUM_BUCKETS; ++i) {
+                size_t count = counts[i];
+                if (count != 0) {
+                    ep_sync_add_and_fetch(&counts[i], -count);
+                }
+            }
+        }
+    }
+
+    /**
+     * Get the counts of all buckets, added up across stripes.
+     *
+     * @param counts resized to NUM_BUCKETS and filled with the counts
+     * @return the total number of samples
+     */
+    size_t snapshot(std::vector<size_t> &counts) const {
+        counts.assign(NUM_BUCKETS, 0);
+        size_t total = 0;
+        for (size_t s = 0; s < COUNTER_STRIPES; ++s) {
+            const size_t *stripe = stripes[s];
+            if (stripe == NULL) {
+                continue;
+            }
+            for (size_t i = 0; i < NUM_BUCKETS; ++i) {
+                counts[i] += stripe[i];
+                total += stripe[i];
+            }
+        }
+        return total;
+    }
+
+    /**
+     * Get the total number of samples counted.
+     */
+    size_t total() const {
+        std::vector<size_t> counts;
+        return snapshot(counts);
+    }
+
+    /**
+     * Get the value at or below which the given percentage of samples
+     * fall (to the precision of a bucket).
+     */
+    T getPercentile(double pct) const {
+        std::vector<size_t> counts;
+        size_t total = snapshot(counts);
+        return percentile(counts, total, pct);
+    }
+
+    /**
+     * Get a percentile from a snapshot: the highest value of the bucket
+     * holding the sample of that rank, or 0 if there are no samples.
+     */
+    static T percentile(const std::vector<size_t> &counts, size_t total,
+                        double pct) {
+        size_t rank = static_cast<size_t>(std::ceil(total * pct / 100.0));
+        if (rank == 0) {
+            rank = 1;
+        }
+        size_t seen = 0;
+        for (size_t i = 0; i < counts.size(); ++i) {
+            seen += counts[i];
+            if (seen >= rank) {
+                return i == NUM_BUCKETS - 1 ? bucketStart(i) : bucketEnd(i) - 1;
+            }
+        }
+        return 0;
+    }
+
+    /**
+     * Get the bucket counting the given value.
+     */
+    static size_t bucketOf(T value) {
+        uint64_t v = static_cast<uint64_t>(value);
+        if (v < SUB_BUCKETS) {
+            return static_cast<size_t>(v);
+        }
+        int msb = 63 - __builtin_clzll(v);
+        if (msb >= LOG_LINEAR_MAX_BITS) {
+            return NUM_BUCKETS - 1;
+        }
+        int shift = msb - LOG_LINEAR_SUB_BITS;
+        return (shift + 1) * SUB_BUCKETS +
+            static_cast<size_t>((v >> shift) - SUB_BUCKETS);
+    }
+
+    /**
+     * The smallest value counted by the given bucket.
+     */
+    static T bucketStart(size_t bucket) {
+        if (bucket < SUB_BUCKETS) {
+            return static_cast<T>(bucket);
+        }
+        size_t shift = bucket / SUB_BUCKETS - 1;
+        uint64_t start = static_cast<uint64_t>(SUB_BUCKETS + bucket % SUB_BUCKETS);
+        return static_cast<T>(start << shift);
+    }
+
+    /**
+     * The end of the given bucket (exclusive, but for the last one).
+     */
+    static T bucketEnd(size_t bucket) {
+        if (bucket == NUM_BUCKETS - 1) {
+            return std::numeric_limits<T>::max();
+        }
+        return bucketStart(bucket + 1);
+    }
+
+    /**
+     * The power of two bin the given bucket falls in.
+     */
+    static size_t octaveOf(size_t bucket) {
+        if (bucket < SUB_BUCKETS) {
+            return bucket == 0 ? 0 : 64 - __builtin_clzll(bucket);
+        }
+        return bucket / SUB_BUCKETS + LOG_LINEAR_SUB_BITS;
+    }
+
+    static T octaveStart(size_t octave) {
+        return octave == 0 ? 0 : static_cast<T>(1ULL << (octave - 1));
+    }
+
+    static T octaveEnd(size_t octave) {
+        if (octave == NUM_OCTAVES - 1) {
+            return std::numeric_limits<T>::max();
+        }
+        return static_cast<T>(1ULL << octave);
+    }
+
+private:
+
+    size_t *getStripe() {
+        size_t stripe = getCounterStripe();
+        size_t *rv = stripes[stripe];
+        if (rv == NULL) {
+            size_t *fresh = new size_t[NUM_BUCKETS]();
+            if (ep_sync_bool_compare_and_swap(&stripes[stripe],
+                                              static_cast<size_t*>(NULL),
+                                              fresh)) {
+                rv = fresh;
+            } else {
+                delete []fresh;
+                rv = stripes[stripe];
+            }
+        }
+        return rv;
+    }
+
+    size_t * volatile stripes[COUNTER_STRIPES];
+
+    DISALLOW_COPY_AND_ASSIGN(LogLinearHistogram);
+};
+
 /**
  * Times blocks automatically and records the values in a histogram.
  */
@@ -367,7 +591,8 @@ public:
      *
      * @param d the histogram that will hold the result
      */
-    BlockTimer(Histogram<hrtime_t> *d, const char *n=NULL, std::ostream *o=NULL)
+    BlockTimer(LogLinearHistogram<hrtime_t> *d, const char *n=NULL,
+               std::ostream *o=NULL)
         : dest(d), start(gethrtime()), name(n), out(o) {}
 
     ~BlockTimer() {
@@ -383,10 +608,10 @@ public:
     }
 
 private:
-    Histogram<hrtime_t> *dest;
-    hrtime_t             start;
-    const char          *name;
-    std::ostream        *out;
+    LogLinearHistogram<hrtime_t> *dest;
+    hrtime_t                      start;
+    const char                   *name;
+    std::ostream                 *out;
 };
 
 // How to print a bin.
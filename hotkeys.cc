@@ -0,0 +1,255 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+
+#include "config.h"
+
+#include <algorithm>
+#include <sstream>
+
+#include "hotkeys.hh"
+#include "locks.hh"
+#include "statwriter.hh"
+
+static const char *opNames[HOTKEY_OPS] = { "get", "store", "delete" };
+
+// Per thread (not per profiler, which would need a ThreadLocal per
+// bucket on every operation): the number of operations left until the
+// next sample, and the state of the generator picking the intervals.
+static __thread size_t sampleCountdown;
+static __thread uint32_t sampleSeed;
+
+/**
+ * Orders entries by count, the largest first.
+ */
+static bool moreCounted(const HotKeyEntry &a, const HotKeyEntry &b) {
+    return a.count > b.count;
+}
+
+/**
+ * Orders entries by count, the smallest first.
+ */
+static bool lessCounted(const HotKeyEntry &a, const HotKeyEntry &b) {
+    return a.count < b.count;
+}
+
+void TopKeys::add(const std::string &key, uint16_t vbucket) {
+    std::map<std::string, size_t>::iterator it = index.find(key);
+    if (it != index.end()) {
+        HotKeyEntry &e = entries[it->second];
+        ++e.count;
+        e.vbucket = vbucket;
+        return;
+    }
+
+    if (entries.size() < capacity) {
+        index[key] = entries.size();
+        entries.push_back(HotKeyEntry(key, vbucket, 1, 0));
+        return;
+    }
+    if (entries.empty()) {
+        return;
+    }
+
+    std::vector<HotKeyEntry>::iterator victim =
+        std::min_element(entries.begin(), entries.end(), lessCounted);
+    index.erase(victim->key);
+    index[key] = victim - entries.begin();
+    size_t floor = victim->count;
+    *victim = HotKeyEntry(key, vbucket, floor + 1, floor);
+}
+
+void TopKeys::getTop(std::vector<HotKeyEntry> &out) const {
+    out = entries;
+    std::stable_sort(out.begin(), out.end(), moreCounted);
+}
+
+void TopKeys::setCapacity(size_t cap) {
+    capacity = cap;
+    if (entries.size() > capacity) {
+        std::vector<HotKeyEntry> top;
+        getTop(top);
+        top.resize(capacity);
+        clear();
+        for (size_t i = 0; i < top.size(); ++i) {
+            index[top[i].key] = i;
+        }
+        entries = top;
+    }
+}
+
+HotKeyProfiler::HotKeyProfiler(size_t rate, size_t size)
+    : sampleRate(rate), topSize(size) {
+    for (int i = 0; i < HOTKEY_OPS; ++i) {
+        profiles[i] = new OpProfile(size);
+    }
+}
+
+HotKeyProfiler::~HotKeyProfiler() {
+    for (int i = 0; i < HOTKEY_OPS; ++i) {
+        delete profiles[i];
+    }
+}
+
+/**
+ * Pick the interval until the next sample uniformly from [1, 2 * rate - 1],
+ * so it averages out to rate.
+ */
+static size_t nextSampleInterval(size_t rate) {
+    if (sampleSeed == 0) {
+        sampleSeed = static_cast<uint32_t>(gethrtime()) | 1;
+    }
+    sampleSeed ^= sampleSeed << 13;
+    sampleSeed ^= sampleSeed >> 17;
+    sampleSeed ^= sampleSeed << 5;
+    return 1 + sampleSeed % (2 * rate - 1);
+}
+
+bool HotKeyProfiler::shouldSample() {
+    if (sampleCountdown > 1) {
+        --sampleCountdown;
+        return false;
+    }
+
+    size_t rate = sampleRate.get();
+    if (rate == 0) {
+        sampleCountdown = 0;
+        return false;
+    }
+    if (sampleCountdown == 0) {
+        // The first operation of this thread (or since sampling was
+        // turned back on).
+        sampleCountdown = nextSampleInterval(rate);
+        if (sampleCountdown > 1) {
+            --sampleCountdown;
+            return false;
+        }
+    }
+    sampleCountdown = nextSampleInterval(rate);
+    return true;
+}
+
+void HotKeyProfiler::record(hotkey_op op, const std::string &key,
+                            uint16_t vbucket, size_t nbytes) {
+    OpProfile &p = *profiles[op];
+    LockHolder lh(p.mutex);
+    ++p.samples;
+    p.keys.add(key, vbucket);
+
+    if (p.vbuckets.size() <= vbucket) {
+        p.vbuckets.resize(vbucket + 1, 0);
+    }
+    ++p.vbuckets[vbucket];
+
+    if (nbytes == 0 || topSize.get() == 0) {
+        return;
+    }
+    std::vector<HotKeyEntry>::iterator it;
+    for (it = p.largest.begin(); it != p.largest.end(); ++it) {
+        if (it->key == key) {
+            break;
+        }
+    }
+    if (it != p.largest.end()) {
+        it->count = nbytes;
+        it->vbucket = vbucket;
+    } else if (p.largest.size() < topSize.get()) {
+        p.largest.push_back(HotKeyEntry(key, vbucket, nbytes, 0));
+    } else if (nbytes > p.largest.front().count) {
+        p.largest.front() = HotKeyEntry(key, vbucket, nbytes, 0);
+    } else {
+        return;
+    }
+    std::sort(p.largest.begin(), p.largest.end(), lessCounted);
+}
+
+void HotKeyProfiler::setSize(size_t size) {
+    topSize.set(size);
+    for (int i = 0; i < HOTKEY_OPS; ++i) {
+        OpProfile &p = *profiles[i];
+        LockHolder lh(p.mutex);
+        p.keys.setCapacity(size * HOTKEYS_TRACKED_FACTOR);
+        if (p.largest.size() > size) {
+            p.largest.erase(p.largest.begin(),
+                            p.largest.begin() + (p.largest.size() - size));
+        }
+    }
+}
+
+void HotKeyProfiler::reset() {
+    for (int i = 0; i < HOTKEY_OPS; ++i) {
+        OpProfile &p = *profiles[i];
+        LockHolder lh(p.mutex);
+        p.keys.clear();
+        p.vbuckets.clear();
+        p.largest.clear();
+        p.samples = 0;
+    }
+}
+
+void HotKeyProfiler::addStats(ADD_STAT add_stat, const void *cookie) {
+    add_casted_stat("hotkeys_sample_rate", sampleRate, add_stat, cookie);
+    add_casted_stat("hotkeys_size", topSize, add_stat, cookie);
+    for (int i = 0; i < HOTKEY_OPS; ++i) {
+        addOpStats(static_cast<hotkey_op>(i), add_stat, cookie);
+    }
+}
+
+void HotKeyProfiler::addOpStats(hotkey_op op, ADD_STAT add_stat,
+                                const void *cookie) {
+    OpProfile &p = *profiles[op];
+    std::vector<HotKeyEntry> keys;
+    std::vector<HotKeyEntry> vbuckets;
+    std::vector<HotKeyEntry> largest;
+    size_t samples;
+    {
+        LockHolder lh(p.mutex);
+        samples = p.samples;
+        p.keys.getTop(keys);
+        for (size_t vb = 0; vb < p.vbuckets.size(); ++vb) {
+            if (p.vbuckets[vb] != 0) {
+                vbuckets.push_back(HotKeyEntry("", static_cast<uint16_t>(vb),
+                                               p.vbuckets[vb], 0));
+            }
+        }
+        largest.assign(p.largest.rbegin(), p.largest.rend());
+    }
+
+    size_t size = topSize.get();
+    if (keys.size() > size) {
+        keys.resize(size);
+    }
+    std::stable_sort(vbuckets.begin(), vbuckets.end(), moreCounted);
+    if (vbuckets.size() > size) {
+        vbuckets.resize(size);
+    }
+
+    const char *name = opNames[op];
+    std::stringstream ss;
+    ss << "hotkeys_" << name << "_samples";
+    add_casted_stat(ss.str().c_str(), samples, add_stat, cookie);
+
+    for (size_t i = 0; i < keys.size(); ++i) {
+        std::stringstream prefix;
+        prefix << "hotkeys_" << name << "_key_" << i;
+        std::string p(prefix.str());
+        add_casted_stat(p.c_str(), keys[i].key, add_stat, cookie);
+        add_casted_stat((p + "_vb").c_str(), keys[i].vbucket, add_stat, cookie);
+        add_casted_stat((p + "_samples").c_str(), keys[i].count, add_stat, cookie);
+        add_casted_stat((p + "_error").c_str(), keys[i].error, add_stat, cookie);
+    }
+    for (size_t i = 0; i < vbuckets.size(); ++i) {
+        std::stringstream prefix;
+        prefix << "hotkeys_" << name << "_vb_" << i;
+        std::string p(prefix.str());
+        add_casted_stat(p.c_str(), vbuckets[i].vbucket, add_stat, cookie);
+        add_casted_stat((p + "_samples").c_str(), vbuckets[i].count,
+                        add_stat, cookie);
+    }
+    for (size_t i = 0; i < largest.size(); ++i) {
+        std::stringstream prefix;
+        prefix << "hotkeys_" << name << "_large_" << i;
+        std::string p(prefix.str());
+        add_casted_stat(p.c_str(), largest[i].key, add_stat, cookie);
+        add_casted_stat((p + "_vb").c_str(), largest[i].vbucket, add_stat, cookie);
+        add_casted_stat((p + "_bytes").c_str(), largest[i].count, add_stat, cookie);
+    }
+}
@@ -0,0 +1,153 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+#ifndef HOTKEYS_HH
+#define HOTKEYS_HH 1
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include <memcached/engine.h>
+
+#include "common.hh"
+#include "atomic.hh"
+#include "mutex.hh"
+
+/**
+ * How many more keys than it reports the hot key profiler tracks, to
+ * keep the reported counts of keys that aren't quite as hot accurate.
+ */
+#define HOTKEYS_TRACKED_FACTOR 4
+
+/**
+ * The operations the hot key profiler tells apart.
+ */
+enum hotkey_op {
+    HOTKEY_GET,
+    HOTKEY_STORE,
+    HOTKEY_DELETE,
+    HOTKEY_OPS
+};
+
+/**
+ * A key the profiler has seen, and how much.
+ */
+struct HotKeyEntry {
+    HotKeyEntry() : vbucket(0), count(0), error(0) {}
+    HotKeyEntry(const std::string &k, uint16_t vb, size_t c, size_t e)
+        : key(k), vbucket(vb), count(c), error(e) {}
+
+    std::string key;
+    uint16_t    vbucket;
+    //! Samples counted (space saving: may overcount by up to error).
+    size_t      count;
+    size_t      error;
+};
+
+/**
+ * The most frequent keys of a stream, approximated in fixed space with
+ * the space saving algorithm: a key that isn't tracked yet takes over
+ * the slot of the least counted one, inheriting its count as its error.
+ * Any key seen more than 1/capacity of the time is guaranteed a slot.
+ */
+class TopKeys {
+public:
+
+    TopKeys(size_t cap) : capacity(cap) {}
+
+    void add(const std::string &key, uint16_t vbucket);
+
+    /**
+     * Get the tracked keys, the most counted first.
+     */
+    void getTop(std::vector<HotKeyEntry> &out) const;
+
+    void setCapacity(size_t cap);
+
+    void clear() {
+        index.clear();
+        entries.clear();
+    }
+
+private:
+    size_t                        capacity;
+    std::map<std::string, size_t> index;
+    std::vector<HotKeyEntry>      entries;
+};
+
+/**
+ * Samples the keys of gets, stores and deletes, and keeps track of the
+ * hottest keys and vbuckets and the largest values of each.
+ *
+ * One in about every sample rate operations of each thread is sampled
+ * (at random intervals, so sampling can't fall into step with a client's
+ * access pattern), so the cost of operations that aren't sampled is a
+ * thread local countdown.  Samples take a lock per operation type.
+ */
+class HotKeyProfiler {
+public:
+
+    HotKeyProfiler(size_t rate = 100, size_t size = 10);
+
+    ~HotKeyProfiler();
+
+    /**
+     * Maybe sample an operation.
+     *
+     * @param op the operation
+     * @param key the key operated on
+     * @param vbucket the vbucket of the key
+     * @param nbytes the size of the value stored or returned (0 if none)
+     */
+    void sample(hotkey_op op, const std::string &key, uint16_t vbucket,
+                size_t nbytes) {
+        if (shouldSample()) {
+            record(op, key, vbucket, nbytes);
+        }
+    }
+
+    /**
+     * Sample one in about this many operations (0 to not sample).
+     */
+    void setSampleRate(size_t rate) {
+        sampleRate.set(rate);
+    }
+
+    /**
+     * Track this many keys, vbuckets and values per operation.
+     */
+    void setSize(size_t size);
+
+    void reset();
+
+    void addStats(ADD_STAT add_stat, const void *cookie);
+
+private:
+
+    struct OpProfile {
+        OpProfile(size_t size)
+            : keys(size * HOTKEYS_TRACKED_FACTOR), samples(0) {}
+
+        Mutex                    mutex;
+        TopKeys                  keys;
+        //! Samples per vbucket, indexed by vbucket id.
+        std::vector<size_t>      vbuckets;
+        //! The largest values sampled, one per key, smallest first.
+        std::vector<HotKeyEntry> largest;
+        size_t                   samples;
+    };
+
+    bool shouldSample();
+
+    void record(hotkey_op op, const std::string &key, uint16_t vbucket,
+                size_t nbytes);
+
+    void addOpStats(hotkey_op op, ADD_STAT add_stat, const void *cookie);
+
+    Atomic<size_t> sampleRate;
+    Atomic<size_t> topSize;
+    OpProfile     *profiles[HOTKEY_OPS];
+
+    DISALLOW_COPY_AND_ASSIGN(HotKeyProfiler);
+};
+
+#endif /* HOTKEYS_HH */
@@ -18,6 +18,9 @@ public:
 
     bool visitBucket(RCPtr<VBucket> &vb) {
         vb->ht.resize();
+        // Front end operations move a few buckets each, but don't
+        // leave the rest of the work to them.
+        vb->ht.completeResize();
         return false;
     }
 
@@ -16,11 +16,58 @@
  */
 #include "item.hh"
 
+#ifdef HAVE_LIBSNAPPY
+#include <snappy-c.h>
+#endif
+
 #include "tools/cJSON.h"
 
 Atomic<uint64_t> Item::casCounter(1);
 const uint32_t Item::metaDataSize(2 * sizeof(uint32_t) + 2 * sizeof(uint64_t) + 2);
 
+#ifdef HAVE_LIBSNAPPY
+Blob* Blob::NewCompressed(const char *start, const size_t len,
+                          size_t maxRatio) {
+    size_t clen = snappy_max_compressed_length(len);
+    char *buf = new char[clen];
+    Blob *t = NULL;
+    if (snappy_compress(start, len, buf, &clen) == SNAPPY_OK
+        && clen < len && clen * 100 <= len * maxRatio) {
+        t = new (::operator new(clen + sizeof(Blob))) Blob(buf, clen,
+                                                           compressed);
+    }
+    delete []buf;
+    return t;
+}
+
+Blob* Blob::uncompress() const {
+    if (!isCompressed()) {
+        return New(data, size);
+    }
+    size_t len;
+    if (snappy_uncompressed_length(data, size, &len) != SNAPPY_OK) {
+        return NULL;
+    }
+    Blob *t = New(len);
+    if (snappy_uncompress(data, size, const_cast<char*>(t->getData()),
+                          &len) != SNAPPY_OK) {
+        delete t;
+        return NULL;
+    }
+    return t;
+}
+#else
+Blob* Blob::NewCompressed(const char *, const size_t, size_t) {
+    return NULL;
+}
+
+Blob* Blob::uncompress() const {
+    // Without snappy there are no compressed blobs to begin with.
+    assert(!isCompressed());
+    return New(data, size);
+}
+#endif
+
 bool Item::append(const Item &i) {
     assert(value.get() != NULL);
     assert(i.getValue().get() != NULL);
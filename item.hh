@@ -62,6 +62,28 @@ public:
         return t;
     }
 
+    /**
+     * Create a new Blob holding a compressed copy of the given data.
+     *
+     * @param start the beginning of the data to compress
+     * @param len the amount of data to compress
+     * @param maxRatio the largest size (in percent of len) worth
+     *                 keeping the compressed copy for
+     *
+     * @return the new Blob instance, or NULL if compression isn't
+     *         available or doesn't save enough
+     */
+    static Blob* NewCompressed(const char *start, const size_t len,
+                               size_t maxRatio = 100);
+
+    /**
+     * Create a new Blob holding the uncompressed contents of this one.
+     *
+     * @return the new Blob instance, or NULL if the data can't be
+     *         uncompressed
+     */
+    Blob* uncompress() const;
+
     // Actual accessorish things.
 
     /**
@@ -78,6 +100,32 @@ public:
         return size;
     }
 
+    /**
+     * True if the contents of this Blob are compressed.
+     */
+    bool isCompressed() const {
+        return datatype == compressed;
+    }
+
+    /**
+     * Get the length of the value this Blob holds once uncompressed.
+     */
+    size_t getUncompressedLength() const {
+        if (!isCompressed()) {
+            return size;
+        }
+        // Snappy data starts with the uncompressed length as a varint.
+        size_t len = 0;
+        for (uint32_t i = 0, shift = 0; i < size && shift < 32; ++i, shift += 7) {
+            uint8_t c = static_cast<uint8_t>(data[i]);
+            len |= static_cast<size_t>(c & 0x7f) << shift;
+            if ((c & 0x80) == 0) {
+                break;
+            }
+        }
+        return len;
+    }
+
     /**
      * Get the size of this Blob instance.
      */
@@ -103,20 +151,30 @@ public:
 
 private:
 
-    explicit Blob(const char *start, const size_t len) :
-        size(static_cast<uint32_t>(len))
+    /**
+     * How the data of a Blob is encoded.
+     */
+    enum blob_datatype {
+        raw = 0,        //!< The value as it was stored
+        compressed = 1  //!< The value compressed with snappy
+    };
+
+    explicit Blob(const char *start, const size_t len,
+                  blob_datatype type = raw) :
+        size(static_cast<uint32_t>(len)), datatype(type)
     {
         std::memcpy(data, start, len);
         ObjectRegistry::onCreateBlob(this);
     }
 
     explicit Blob(const size_t len) :
-        size(static_cast<uint32_t>(len))
+        size(static_cast<uint32_t>(len)), datatype(raw)
     {
         ObjectRegistry::onCreateBlob(this);
     }
 
     const uint32_t size;
+    const uint8_t datatype;
     char data[1];
 
     DISALLOW_COPY_AND_ASSIGN(Blob);
@@ -249,6 +307,16 @@ public:
         ObjectRegistry::onCreateItem(this);
     }
 
+    Item(const void *k, uint16_t nk, const uint32_t fl, const time_t exp,
+         const value_t &val, uint64_t theCas = 0, int64_t i = -1,
+         uint16_t vbid = 0, uint64_t sno = 1) :
+         metaData(theCas, sno, fl, exp), value(val), id(i), vbucketId(vbid)
+    {
+        assert(id != 0);
+        key.assign(static_cast<const char*>(k), nk);
+        ObjectRegistry::onCreateItem(this);
+    }
+
     ~Item() {
         ObjectRegistry::onDeleteItem(this);
     }
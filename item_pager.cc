@@ -5,6 +5,7 @@
 #include <cstdlib>
 #include <utility>
 #include <list>
+#include <algorithm>
 
 #include "common.hh"
 #include "item_pager.hh"
@@ -13,6 +14,15 @@
 
 static const double EJECTION_RATIO_THRESHOLD(0.1);
 static const size_t MAX_PERSISTENCE_QUEUE_SIZE = 1000000;
+// The most items the sampled pager looks at in one run before it lets
+// other tasks have the dispatcher (and picks up where it left off).
+static const size_t MAX_SAMPLED_ITEMS_PER_RUN = 1000000;
+// How many hash buckets the sampled pager may probe per item it wants
+// in a sample, so a sparse hash table doesn't keep it looking forever.
+static const size_t MAX_PROBES_PER_SAMPLED_ITEM = 4;
+// The share of each sample (of the coldest items) the sampled pager
+// ejects, before the active vbucket bias.
+static const double SAMPLE_EJECTION_RATIO = 0.25;
 
 const bool PagingConfig::phaseConfig[paging_max] = {false, true};
 
@@ -39,10 +49,13 @@ public:
                   bool *sfin, bool pause = false, double bias = 1, bool nru = true)
       : store(s), stats(st), randomEvict(PagingConfig::phaseConfig[0]), percent(pcnt),
         activeBias(bias), ejected(0), totalEjected(0), totalEjectionAttempts(0),
+        inspected(0), hotEjected(0), visitStart(0), trackCost(pcnt > 0),
         startTime(ep_real_time()), stateFinalizer(sfin), canPause(pause),
         useNru(nru) {}
 
     void visit(StoredValue *v) {
+        ++inspected;
+
         // Remember expired objects -- we're going to delete them.
         if ((v->isExpired(startTime) && !v->isDeleted()) || v->isTempItem()) {
             expired.push_back(std::make_pair(currentBucket->getId(), v->getKey()));
@@ -59,12 +72,27 @@ public:
             1 : static_cast<double>(std::rand()) / static_cast<double>(RAND_MAX);
         if ((useNru && !v->isReferenced()) || percent >= r) {
             ++totalEjectionAttempts;
+            bool fullEviction = store.isFullEviction();
+            if (fullEviction && !v->isResident() && v->isClean() &&
+                !v->isDeleted()) {
+                // Its value is gone already, take the key along too.
+                evicted.push_back(std::make_pair(currentBucket->getId(),
+                                                 v->getKey()));
+                return;
+            }
             if (!v->eligibleForEviction()) {
                 ++stats.numFailedEjects;
                 return;
             }
             if (v->ejectValue(stats, currentBucket->ht)) {
                 ++ejected;
+                if (v->getAccessScore() != 0) {
+                    ++hotEjected;
+                }
+                if (fullEviction) {
+                    evicted.push_back(std::make_pair(currentBucket->getId(),
+                                                     v->getKey()));
+                }
             }
         }
     }
@@ -92,6 +120,7 @@ public:
         if (current > lower) {
             double p = (current - static_cast<double>(lower)) / current;
             adjustPercent(p, vb->getState());
+            visitStart = gethrtime();
             return VBucketVisitor::visitBucket(vb);
         }
         return false;
@@ -99,6 +128,20 @@ public:
 
     void update() {
         store.deleteExpiredItems(expired);
+        // The items can't be removed while the visitor walks their
+        // hash buckets.
+        store.evictItems(evicted);
+
+        if (trackCost) {
+            if (visitStart != 0) {
+                stats.pagerTime += (gethrtime() - visitStart) / 1000;
+                visitStart = 0;
+            }
+            stats.pagerItemsInspected += inspected;
+            stats.pagerHotEjects += hotEjected;
+        }
+        inspected = 0;
+        hotEjected = 0;
 
         if (numEjected() > 0) {
             getLogger()->log(EXTENSION_LOG_INFO, NULL,
@@ -114,6 +157,7 @@ public:
         totalEjected += (ejected + num_expired);
         ejected = 0;
         expired.clear();
+        evicted.clear();
     }
 
     bool pauseVisitor() {
@@ -166,6 +210,7 @@ private:
     }
 
     std::list<std::pair<uint16_t, std::string> > expired;
+    std::list<std::pair<uint16_t, std::string> > evicted;
 
     EventuallyPersistentStore &store;
     EPStats                   &stats;
@@ -175,12 +220,126 @@ private:
     size_t                     ejected;
     size_t                     totalEjected;
     size_t                     totalEjectionAttempts;
+    size_t                     inspected;
+    size_t                     hotEjected;
+    hrtime_t                   visitStart;
+    bool                       trackCost;
     time_t                     startTime;
     bool                      *stateFinalizer;
     bool                       canPause;
     bool                       useNru;
 };
 
+/**
+ * As part of the sampled ItemPager, look at the items of a few hash
+ * buckets of a vbucket, and collect the ones whose values (or, with
+ * full eviction, whole items) could be ejected along with how much
+ * they've been used lately, and the expired ones to delete.
+ */
+class SamplingVisitor : public HashTableVisitor {
+public:
+
+    /**
+     * An item that could be ejected.
+     */
+    struct Candidate {
+        bool operator<(const Candidate &other) const {
+            return score < other.score;
+        }
+
+        std::string key;
+        //! See StoredValue::getAccessScore.
+        uint8_t     score;
+    };
+
+    /**
+     * Construct a SamplingVisitor.
+     *
+     * @param vb the vbucket whose hash buckets are visited
+     * @param full true if whole items may be ejected (full eviction)
+     * @param nru false if ignoring how much items have been used
+     */
+    SamplingVisitor(uint16_t vb, bool full, bool nru)
+      : inspected(0), vbid(vb), fullEviction(full), useNru(nru),
+        startTime(ep_real_time()) {}
+
+    void visit(StoredValue *v) {
+        ++inspected;
+        if ((v->isExpired(startTime) && !v->isDeleted()) || v->isTempItem()) {
+            expired.push_back(std::make_pair(vbid, v->getKey()));
+            return;
+        }
+        if (v->eligibleForEviction() ||
+            (fullEviction && !v->isResident() && v->isClean() &&
+             !v->isDeleted())) {
+            Candidate c;
+            c.key = v->getKey();
+            c.score = useNru ? v->getAccessScore() : 0;
+            candidates.push_back(c);
+        }
+    }
+
+    std::vector<Candidate>                       candidates;
+    std::list<std::pair<uint16_t, std::string> > expired;
+    size_t                                       inspected;
+
+private:
+    uint16_t vbid;
+    bool     fullEviction;
+    bool     useNru;
+    time_t   startTime;
+};
+
+/**
+ * As part of the ValueCompressor, visit all of the objects in memory
+ * and compress the values worth compressing.
+ */
+class CompressingVisitor : public VBucketVisitor {
+public:
+
+    /**
+     * Construct a CompressingVisitor.
+     *
+     * @param st the stats where we'll track what we've done
+     * @param minSize the smallest value to compress
+     * @param maxRatio the largest compressed size (in percent of the raw
+     *                 size) worth keeping
+     * @param sfin pointer to a bool to be set to true after run completes
+     */
+    CompressingVisitor(EPStats &st, size_t minSize, size_t maxRatio,
+                       bool *sfin)
+      : stats(st), minValueSize(minSize), maxCompressionRatio(maxRatio),
+        compressed(0), stateFinalizer(sfin) {}
+
+    void visit(StoredValue *v) {
+        // Values read recently (still referenced) stay raw.
+        if (v->isReferenced()) {
+            return;
+        }
+        if (v->compressValue(stats, currentBucket->ht, minValueSize,
+                             maxCompressionRatio)) {
+            ++compressed;
+        }
+    }
+
+    void complete() {
+        if (compressed > 0) {
+            getLogger()->log(EXTENSION_LOG_INFO, NULL,
+                             "Compressed %ld values\n", compressed);
+        }
+        if (stateFinalizer) {
+            *stateFinalizer = true;
+        }
+    }
+
+private:
+    EPStats &stats;
+    size_t   minValueSize;
+    size_t   maxCompressionRatio;
+    size_t   compressed;
+    bool    *stateFinalizer;
+};
+
 bool ItemPager::checkAccessScannerTask() {
     if (store.pager.biased) {
         return true;
@@ -197,12 +356,144 @@ bool ItemPager::checkAccessScannerTask() {
     return biased;
 }
 
+size_t ItemPager::ejectSampled(RCPtr<VBucket> &vb, double ratio, bool nru,
+                               size_t *inspected, size_t *attempts) {
+    Configuration &cfg = store.getEPEngine().getConfiguration();
+    size_t sampleSize = cfg.getPagerSampleSize();
+    bool fullEviction = store.isFullEviction();
+    HashTable &ht = vb->ht;
+
+    SamplingVisitor sv(vb->getId(), fullEviction, nru);
+    for (size_t probes = 0; sv.inspected < sampleSize &&
+             probes < sampleSize * MAX_PROBES_PER_SAMPLED_ITEM &&
+             ht.getNumInMemoryItems() + ht.getNumTempItems() > 0;
+         ++probes) {
+        uint32_t h = (static_cast<uint32_t>(std::rand()) << 16) ^
+            static_cast<uint32_t>(std::rand());
+        ht.visitBucket(h, sv);
+    }
+    stats.pagerItemsInspected += sv.inspected;
+    *inspected += sv.inspected;
+
+    // The coldest share of the sample goes, and anything else that
+    // hasn't been used lately along with it.
+    std::vector<SamplingVisitor::Candidate> &victims = sv.candidates;
+    std::stable_sort(victims.begin(), victims.end());
+    size_t toEject = static_cast<size_t>(victims.size() * ratio + 0.5);
+    if (toEject == 0 && !victims.empty()) {
+        toEject = 1;
+    }
+    if (nru) {
+        while (toEject < victims.size() && victims[toEject].score == 0) {
+            ++toEject;
+        }
+    }
+
+    size_t ejected = 0;
+    for (size_t i = 0; i < toEject; ++i) {
+        if (stats.getTotalMemoryUsed() <= stats.mem_low_wat) {
+            break;
+        }
+        const SamplingVisitor::Candidate &c = victims[i];
+        int bucket_num(0);
+        LockHolder lh = ht.getLockedBucket(c.key, &bucket_num);
+        StoredValue *v = ht.unlocked_find(c.key, bucket_num, false, false);
+        // Leave it be if it's been used since it was sampled.
+        if (!v || (nru && v->getAccessScore() > c.score)) {
+            continue;
+        }
+        ++*attempts;
+        if (fullEviction && !v->isResident()) {
+            // Its value is gone already, take the key along too.
+            if (ht.unlocked_evict(c.key, bucket_num)) {
+                ++ejected;
+            }
+            continue;
+        }
+        if (v->ejectValue(stats, ht)) {
+            ++ejected;
+            if (c.score != 0) {
+                ++stats.pagerHotEjects;
+            }
+            // Unlike the sweep, nothing is walking the bucket, so the
+            // item can go right away.
+            if (fullEviction) {
+                ht.unlocked_evict(c.key, bucket_num);
+            } else {
+                ht.unlocked_pack(v, bucket_num);
+            }
+        }
+    }
+
+    store.deleteExpiredItems(sv.expired);
+    return ejected + sv.expired.size();
+}
+
+bool ItemPager::pageSampled(double bias, bool nru, size_t *attempts,
+                            size_t *ejected) {
+    const VBucketMap &vbuckets = store.getVBuckets();
+    size_t num_vbuckets = vbuckets.getSize();
+    size_t inspected = 0;
+    hrtime_t start = gethrtime();
+
+    // Go around the vbuckets ejecting a little from each until memory
+    // usage is down to the low watermark, so no vbucket gives up more
+    // than its share.
+    bool progress = true;
+    bool done = false;
+    while (!done && progress &&
+           inspected < MAX_SAMPLED_ITEMS_PER_RUN) {
+        progress = false;
+        for (size_t i = 0; i < num_vbuckets && !done; ++i) {
+            assert(i <= std::numeric_limits<uint16_t>::max());
+            RCPtr<VBucket> vb = vbuckets.getBucket(static_cast<uint16_t>(i));
+            if (!vb) {
+                continue;
+            }
+
+            // skip active vbuckets if active resident ratio is lower than replica
+            size_t current = stats.getTotalMemoryUsed();
+            if (vb->getState() == vbucket_state_active &&
+                current < stats.mem_high_wat &&
+                store.cachedResidentRatio.activeRatio <
+                store.cachedResidentRatio.replicaRatio) {
+                continue;
+            }
+
+            double ratio = SAMPLE_EJECTION_RATIO;
+            if (vb->getState() == vbucket_state_active) {
+                ratio *= bias;
+            } else {
+                ratio *= 2 - bias;
+            }
+            size_t n = ejectSampled(vb, ratio, nru, &inspected, attempts);
+            if (n > 0) {
+                *ejected += n;
+                progress = true;
+            }
+            done = stats.getTotalMemoryUsed() <= stats.mem_low_wat;
+        }
+    }
+
+    stats.pagerTime += (gethrtime() - start) / 1000;
+    if (*ejected > 0) {
+        getLogger()->log(EXTENSION_LOG_INFO, NULL,
+                         "Paged out %ld values (sampled %ld items)\n",
+                         *ejected, inspected);
+    }
+    // Out of luck if a whole round of samples found nothing to eject.
+    return done || !progress;
+}
+
 bool ItemPager::callback(Dispatcher &d, TaskId t) {
     double current = static_cast<double>(stats.getTotalMemoryUsed());
     double upper = static_cast<double>(stats.mem_high_wat);
     double lower = static_cast<double>(stats.mem_low_wat);
     double sleepTime = 10;
-    if (available && current > upper) {
+    if (sampling && current <= lower) {
+        sampling = false;
+    }
+    if (available && (current > upper || sampling)) {
         ++stats.pagerRuns;
 
         double toKill = (current - static_cast<double>(lower)) / current;
@@ -224,23 +515,41 @@ bool ItemPager::callback(Dispatcher &d, TaskId t) {
             ++phase;
         }
 
-        available = false;
-        shared_ptr<PagingVisitor> pv(new PagingVisitor(store, stats, toKill,
-                                                       &available, false, bias, nru));
+        double total_eject_attms = 0;
+        double total_ejected = 0;
         std::srand(ep_real_time());
-        pv->configPaging(PagingConfig::phaseConfig[phase]);
-        store.visit(pv, "Item pager", &d, Priority::ItemPagerPriority);
-
-        phase = phase + 1;
-        if (stats.getTotalMemoryUsed() <= stats.mem_low_wat ||
-            phase >= PagingConfig::paging_max) {
-            phase = PagingConfig::paging_unreferenced;
-        } else { // move fast to next paging phase if memory usage is still high
-            sleepTime = 5;
-        }
+        if (cfg.getPagerPolicy() == "sampled") {
+            if (store.getEPEngine().isDegradedMode()) {
+                nru = false;
+            }
+            size_t attempts = 0;
+            size_t ejected = 0;
+            // Keep at it if the run stopped short of the low watermark.
+            sampling = !pageSampled(bias, nru, &attempts, &ejected);
+            if (sampling) {
+                sleepTime = 1;
+            }
+            total_eject_attms = static_cast<double>(attempts);
+            total_ejected = static_cast<double>(ejected);
+        } else {
+            sampling = false;
+            available = false;
+            shared_ptr<PagingVisitor> pv(new PagingVisitor(store, stats, toKill,
+                                                           &available, false, bias, nru));
+            pv->configPaging(PagingConfig::phaseConfig[phase]);
+            store.visit(pv, "Item pager", &d, Priority::ItemPagerPriority);
+
+            phase = phase + 1;
+            if (stats.getTotalMemoryUsed() <= stats.mem_low_wat ||
+                phase >= PagingConfig::paging_max) {
+                phase = PagingConfig::paging_unreferenced;
+            } else { // move fast to next paging phase if memory usage is still high
+                sleepTime = 5;
+            }
 
-        double total_eject_attms = static_cast<double>(pv->getTotalEjectionAttempts());
-        double total_ejected = static_cast<double>(pv->getTotalEjected());
+            total_eject_attms = static_cast<double>(pv->getTotalEjectionAttempts());
+            total_ejected = static_cast<double>(pv->getTotalEjected());
+        }
         double ejection_ratio =
             total_eject_attms > 0 ? total_ejected / total_eject_attms : 0;
 
@@ -278,3 +587,20 @@ bool ExpiredItemPager::callback(Dispatcher &d, TaskId t) {
     d.snooze(t, sleepTime);
     return true;
 }
+
+bool ValueCompressor::callback(Dispatcher &d, TaskId t) {
+    Configuration &cfg = store.getEPEngine().getConfiguration();
+    if (available && cfg.isValueCompression()) {
+        ++stats.compressorRuns;
+
+        available = false;
+        shared_ptr<CompressingVisitor> cv(new CompressingVisitor(stats,
+                                              cfg.getValueCompressionMinSize(),
+                                              cfg.getValueCompressionMaxRatio(),
+                                              &available));
+        store.visit(cv, "Value compressor", &d, Priority::ItemPagerPriority,
+                    true, 10);
+    }
+    d.snooze(t, static_cast<double>(cfg.getValueCompressorStime()));
+    return true;
+}
@@ -14,6 +14,7 @@ typedef std::pair<int64_t, int64_t> row_range_t;
 
 // Forward declaration.
 class EventuallyPersistentStore;
+class VBucket;
 
 /**
  * ItemPager visits replica vbuckets and active vbuckets in one phases.
@@ -33,6 +34,12 @@ public:
 /**
  * Dispatcher job responsible for periodically pushing data out of
  * memory.
+ *
+ * With the sweep pager policy, each run visits every item, ejecting
+ * unreferenced ones first and random ones if that wasn't enough.  With
+ * the sampled policy, each run samples a few items of each vbucket at a
+ * time and ejects the least used of them, until memory usage is down to
+ * the low watermark.
  */
 class ItemPager : public DispatcherCallback {
 public:
@@ -44,7 +51,8 @@ public:
      * @param st the stats
      */
     ItemPager(EventuallyPersistentStore *s, EPStats &st) :
-        store(*s), stats(st), available(true), phase(PagingConfig::paging_unreferenced) {}
+        store(*s), stats(st), available(true), sampling(false),
+        phase(PagingConfig::paging_unreferenced) {}
 
     bool callback(Dispatcher &d, TaskId t);
 
@@ -53,9 +61,36 @@ public:
 private:
     bool checkAccessScannerTask();
 
+    /**
+     * Eject sampled items until memory usage is down to the low
+     * watermark.
+     *
+     * @param bias active vbuckets eviction bias multiplier (0-1)
+     * @param nru false if ignoring how much items have been used
+     * @param attempts incremented by the number of items tried
+     * @param ejected incremented by the number of items ejected or expired
+     * @return false if the run stopped short of the low watermark
+     */
+    bool pageSampled(double bias, bool nru, size_t *attempts, size_t *ejected);
+
+    /**
+     * Sample a vbucket and eject the least used share of the sample.
+     *
+     * @param vb the vbucket
+     * @param ratio the share of the sample to eject (0-1)
+     * @param nru false if ignoring how much items have been used
+     * @param inspected incremented by the number of items sampled
+     * @param attempts incremented by the number of items tried
+     * @return the number of items ejected or expired
+     */
+    size_t ejectSampled(RCPtr<VBucket> &vb, double ratio, bool nru,
+                        size_t *inspected, size_t *attempts);
+
     EventuallyPersistentStore &store;
     EPStats                   &stats;
     bool                       available;
+    //! True if a sampled run stopped short of the low watermark.
+    bool                       sampling;
     short int                  phase;
 };
 
@@ -89,4 +124,30 @@ private:
     bool                       available;
 };
 
+/**
+ * Dispatcher job responsible for compressing the values of resident
+ * items that aren't compressed yet (see value_compression).
+ */
+class ValueCompressor : public DispatcherCallback {
+public:
+
+    /**
+     * Construct a ValueCompressor.
+     *
+     * @param s the store (where we'll visit)
+     * @param st the stats
+     */
+    ValueCompressor(EventuallyPersistentStore *s, EPStats &st) :
+        store(*s), stats(st), available(true) {}
+
+    bool callback(Dispatcher &d, TaskId t);
+
+    std::string description() { return std::string("Compressing values."); }
+
+private:
+    EventuallyPersistentStore &store;
+    EPStats                   &stats;
+    bool                       available;
+};
+
 #endif /* ITEM_PAGER_HH */
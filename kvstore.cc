@@ -77,12 +77,22 @@ static void warmupCallback(void *arg, uint16_t vb,
     }
 }
 
+static void batchWarmupCallback(uint16_t vb,
+                                std::vector<std::pair<std::string, uint64_t> > &fetches,
+                                void *arg)
+{
+    std::vector<std::pair<std::string, uint64_t> >::iterator it;
+    for (it = fetches.begin(); it != fetches.end(); ++it) {
+        warmupCallback(arg, vb, it->first, it->second);
+    }
+}
+
 size_t KVStore::warmup(MutationLog &lf,
                        const std::map<uint16_t, vbucket_state> &vbmap,
                        Callback<GetValue> &cb,
                        Callback<size_t> &estimate)
 {
-    MutationLogHarvester harvester(lf);
+    MutationLogHarvester harvester(lf, getEngine());
     std::map<uint16_t, vbucket_state>::const_iterator it;
     for (it = vbmap.begin(); it != vbmap.end(); ++it) {
         harvester.setVBucket(it->first);
@@ -102,7 +112,7 @@ size_t KVStore::warmup(MutationLog &lf,
 
     WarmupCookie cookie(this, cb);
     start = gethrtime();
-    harvester.apply(&cookie, &warmupCallback);
+    harvester.apply(&cookie, &batchWarmupCallback);
     end = gethrtime();
 
     getLogger()->log(EXTENSION_LOG_DEBUG, NULL,
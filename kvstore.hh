@@ -44,6 +44,12 @@ struct vbucket_state {
  */
 typedef std::map<uint16_t, vbucket_state> vbucket_map_t;
 
+/**
+ * Told about the fetches of a row by getMulti() as soon as the row has
+ * been read.
+ */
+typedef Callback<std::list<VBucketBGFetchItem *> > bgfetch_callback_t;
+
 /**
  * Properites of the storage layer.
  *
@@ -180,9 +186,14 @@ public:
 
     /**
      * Get multiple items if supported by the kv store
+     *
+     * @param cb if not NULL, called for every row as soon as it has
+     *           been read; rows that fail to be read as a whole may
+     *           not be reported
      */
-    virtual void getMulti(uint16_t vb, vb_bgfetch_queue_t &itms) {
-        (void) itms; (void) vb;
+    virtual void getMulti(uint16_t vb, vb_bgfetch_queue_t &itms,
+                          bgfetch_callback_t *cb = NULL) {
+        (void) itms; (void) vb; (void) cb;
         throw std::runtime_error("Backend does not support getMulti()");
     }
 
@@ -234,6 +245,21 @@ public:
      */
     virtual void dump(uint16_t vbid, shared_ptr<Callback<GetValue> > cb) = 0;
 
+    /**
+     * Pass the live items of the given vbuckets through the given
+     * callback, leaving out deletions.
+     *
+     * @param vbids the vbuckets to dump
+     * @param cb the callback to fire for each document
+     */
+    virtual void dumpVBuckets(const std::vector<uint16_t> &vbids,
+                              shared_ptr<Callback<GetValue> > cb) {
+        std::vector<uint16_t>::const_iterator it;
+        for (it = vbids.begin(); it != vbids.end(); ++it) {
+            dump(*it, cb);
+        }
+    }
+
     /**
      * Check if the kv-store supports a dumping all of the keys
      * @return true you may call dumpKeys() to do a prefetch
@@ -258,6 +284,17 @@ public:
         throw std::runtime_error("Backend does not support dumpDeleted()");
     }
 
+    /**
+     * Dump the keys of all items of a vbucket, deleted ones included.
+     *
+     * @param vbid the vbucket to dump
+     * @param cb the callback to fire for each document
+     */
+    virtual void dumpAllKeys(uint16_t vbid, shared_ptr<Callback<GetValue> > cb) {
+        (void) vbid; (void) cb;
+        throw std::runtime_error("Backend does not support dumpAllKeys()");
+    }
+
     /**
      * Get the number of data shards in this kvstore.
      */
@@ -11,6 +11,42 @@
 #include "mutex.hh"
 #include "syncobject.hh"
 
+/**
+ * Sequence counter that a LockHolder bumps on both lock and unlock.
+ *
+ * The counter is odd while the associated lock is held, which lets a
+ * reader that doesn't take the lock detect that a writer was active
+ * during its read (see HashTable::optimisticGet).
+ */
+class LockSequence {
+public:
+    LockSequence() : seqno(0) {}
+
+    /**
+     * Get the current sequence number.
+     */
+    uint64_t get() const {
+        return seqno;
+    }
+
+    /**
+     * Called with the lock held before any protected data is modified.
+     */
+    void writeBegin();
+
+    /**
+     * Called with the lock held after all protected data is modified.
+     */
+    void writeEnd();
+
+private:
+    volatile uint64_t seqno;
+    // Keep neighbouring sequences out of each other's cache line.
+    char padding[64 - sizeof(uint64_t)];
+
+    DISALLOW_COPY_AND_ASSIGN(LockSequence);
+};
+
 /**
  * RAII lock holder to guarantee release of the lock.
  *
@@ -21,16 +57,38 @@ class LockHolder {
 public:
     /**
      * Acquire the lock in the given mutex.
+     *
+     * @param m the mutex to lock
+     * @param s optional sequence to bump whenever the lock changes hands
      */
-    LockHolder(Mutex &m) : mutex(m), locked(false) {
+    LockHolder(Mutex &m, LockSequence *s = NULL) : mutex(m), seq(s),
+                                                   locked(false) {
         lock();
     }
 
+    /**
+     * Acquire the lock in the given mutex only if nobody holds it.
+     *
+     * @param m the mutex to lock
+     * @param s sequence to bump whenever the lock changes hands (or NULL)
+     * @param tryOnly if true, don't wait for a busy mutex; check
+     *                isLocked() to see whether it was acquired
+     */
+    LockHolder(Mutex &m, LockSequence *s, bool tryOnly) : mutex(m), seq(s),
+                                                          locked(false) {
+        if (tryOnly) {
+            trylock();
+        } else {
+            lock();
+        }
+    }
+
     /**
      * Copy constructor hands this lock to the new copy and then
      * consider it released locally (i.e. renders unlock() a noop).
      */
-    LockHolder(const LockHolder& from) : mutex(from.mutex), locked(true) {
+    LockHolder(const LockHolder& from) : mutex(from.mutex), seq(from.seq),
+                                         locked(true) {
         const_cast<LockHolder*>(&from)->locked = false;
     }
 
@@ -47,6 +105,33 @@ public:
     void lock() {
         mutex.acquire();
         locked = true;
+        if (seq) {
+            seq->writeBegin();
+        }
+    }
+
+    /**
+     * Relock a lock that was manually unlocked, unless somebody else
+     * holds it.
+     *
+     * @return true if the lock is now held
+     */
+    bool trylock() {
+        if (!mutex.tryAcquire()) {
+            return false;
+        }
+        locked = true;
+        if (seq) {
+            seq->writeBegin();
+        }
+        return true;
+    }
+
+    /**
+     * True if this holder currently holds the lock.
+     */
+    bool isLocked() const {
+        return locked;
     }
 
     /**
@@ -55,12 +140,16 @@ public:
     void unlock() {
         if (locked) {
             locked = false;
+            if (seq) {
+                seq->writeEnd();
+            }
             mutex.release();
         }
     }
 
 private:
     Mutex &mutex;
+    LockSequence *seq;
     bool locked;
 
     void operator=(const LockHolder&);
@@ -77,10 +166,10 @@ public:
      *
      * @param m beginning of an array of locks
      * @param n the number of locks to lock
+     * @param s optional array of n sequences paired with the locks
      */
-    MultiLockHolder(Mutex *m, size_t n) : mutexes(m),
-                                          locked(new bool[n]),
-                                          n_locks(n) {
+    MultiLockHolder(Mutex *m, size_t n, LockSequence *s = NULL) :
+        mutexes(m), seqs(s), locked(new bool[n]), n_locks(n) {
         std::fill_n(locked, n_locks, false);
         lock();
     }
@@ -98,6 +187,9 @@ public:
             assert(!locked[i]);
             mutexes[i].acquire();
             locked[i] = true;
+            if (seqs) {
+                seqs[i].writeBegin();
+            }
         }
     }
 
@@ -108,14 +200,18 @@ public:
         for (size_t i = 0; i < n_locks; i++) {
             if (locked[i]) {
                 locked[i] = false;
+                if (seqs) {
+                    seqs[i].writeEnd();
+                }
                 mutexes[i].release();
             }
         }
     }
 
 private:
-    Mutex  *mutexes;
-    bool   *locked;
+    Mutex        *mutexes;
+    LockSequence *seqs;
+    bool         *locked;
     size_t  n_locks;
 
     DISALLOW_COPY_AND_ASSIGN(MultiLockHolder);
@@ -0,0 +1,42 @@
+dnl  Copyright (C) 2012 Couchbase, Inc
+dnl This file is free software; Couchbase, Inc
+dnl gives unlimited permission to copy and/or distribute it,
+dnl with or without modifications, as long as this notice is preserved.
+
+AC_DEFUN([_PANDORA_SEARCH_LIBSNAPPY],[
+  AC_REQUIRE([AC_LIB_PREFIX])
+
+  dnl --------------------------------------------------------------------
+  dnl  Check for libsnappy
+  dnl --------------------------------------------------------------------
+
+  AC_ARG_ENABLE([libsnappy],
+    [AS_HELP_STRING([--disable-libsnappy],
+      [Build with libsnappy support @<:@default=on@:>@])],
+    [ac_enable_libsnappy="$enableval"],
+    [ac_enable_libsnappy="yes"])
+
+  AS_IF([test "x$ac_enable_libsnappy" = "xyes"],[
+    AC_LIB_HAVE_LINKFLAGS(snappy,,[
+      #include <stddef.h>
+      #include <snappy-c.h>
+    ],[
+      size_t len;
+      snappy_uncompressed_length(NULL, 0, &len);
+    ])
+  ],[
+    ac_cv_libsnappy="no"
+  ])
+
+  AM_CONDITIONAL(HAVE_LIBSNAPPY, [test "x${ac_cv_libsnappy}" = "xyes"])
+])
+
+AC_DEFUN([PANDORA_HAVE_LIBSNAPPY],[
+  AC_REQUIRE([_PANDORA_SEARCH_LIBSNAPPY])
+])
+
+AC_DEFUN([PANDORA_REQUIRE_LIBSNAPPY],[
+  AC_REQUIRE([_PANDORA_SEARCH_LIBSNAPPY])
+  AS_IF([test "x${ac_cv_libsnappy}" = "xno"],
+    AC_MSG_ERROR([libsnappy is required for ${PACKAGE}]))
+])
@@ -2,7 +2,11 @@
 
 #include "config.h"
 #include <algorithm>
+#include <functional>
+#include <map>
 
+#include <pthread.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 
 #include "mutation_log.hh"
@@ -11,9 +15,10 @@
 extern "C" {
 #include "crc32.h"
 }
+#include "crc32c.h"
 
 const char *mutation_log_type_names[] = {
-    "new", "del", "del_all", "commit1", "commit2", NULL
+    "new", "del", "del_all", "commit1", "commit2", "access", NULL
 };
 
 static inline ssize_t doWrite(int fd, const uint8_t *buf, size_t nbytes) {
@@ -51,7 +56,9 @@ static void writeFully(int fd, const uint8_t *buf, size_t nbytes) {
 }
 
 uint64_t MutationLogEntry::rowid() const {
-    return ntohll(_rowid);
+    uint64_t r;
+    memcpy(&r, &_rowid, sizeof(r));
+    return ntohll(r);
 }
 
 MutationLog::MutationLog(const std::string &path,
@@ -65,7 +72,9 @@ MutationLog::MutationLog(const std::string &path,
     entryBuffer(static_cast<uint8_t*>(calloc(MutationLogEntry::len(256), 1))),
     blockBuffer(static_cast<uint8_t*>(calloc(bs, 1))),
     syncConfig(DEFAULT_SYNC_CONF),
-    readOnly(false)
+    readOnly(false),
+    mapped(NULL),
+    mappedLen(0)
 {
     assert(entryBuffer);
     assert(blockBuffer);
@@ -104,6 +113,15 @@ void MutationLog::delItem(uint16_t vbucket, const std::string &key) {
     }
 }
 
+void MutationLog::accessedItem(uint16_t vbucket, const std::string &key,
+                               uint8_t score) {
+    if (isEnabled()) {
+        MutationLogEntry *mle = MutationLogEntry::newEntry(entryBuffer,
+                                                           score, ML_ACCESS, vbucket, key);
+        writeEntry(mle);
+    }
+}
+
 void MutationLog::deleteAll(uint16_t vbucket) {
     if (isEnabled()) {
         MutationLogEntry *mle = MutationLogEntry::newEntry(entryBuffer,
@@ -151,6 +169,7 @@ void MutationLog::writeInitialBlock() {
     assert(!readOnly);
     assert(isEnabled());
     assert(isOpen());
+    headerBlock = LogHeaderBlock();
     headerBlock.set(blockSize);
 
     writeFully(file, (uint8_t*)&headerBlock, sizeof(headerBlock));
@@ -175,7 +194,8 @@ void MutationLog::readInitialBlock() {
     headerBlock.set(buf, sizeof(buf));
 
     // These are reserved for future use.
-    assert(headerBlock.version() == LOG_VERSION);
+    assert(headerBlock.version() == LOG_VERSION ||
+           headerBlock.version() == LOG_VERSION_CRC32);
     assert(headerBlock.blockCount() == 1);
 
     blockSize = headerBlock.blockSize();
@@ -294,6 +314,7 @@ void MutationLog::close() {
     if (!isEnabled() || !isOpen()) {
         return;
     }
+    unmap();
 
     if (!readOnly) {
         flush();
@@ -372,8 +393,7 @@ void MutationLog::flush() {
         entries = htons(entries);
         memcpy(blockBuffer + 2, &entries, sizeof(entries));
 
-        uint32_t crc32(crc32buf(blockBuffer + 2, blockSize - 2));
-        uint16_t crc16(htons(crc32 & 0xffff));
+        uint16_t crc16(htons(blockChecksum(blockBuffer)));
         memcpy(blockBuffer, &crc16, sizeof(crc16));
 
         writeFully(file, blockBuffer, blockSize);
@@ -384,6 +404,55 @@ void MutationLog::flush() {
     }
 }
 
+uint16_t MutationLog::blockChecksum(const uint8_t *block) const {
+    uint32_t crc;
+    if (headerBlock.version() == LOG_VERSION_CRC32) {
+        crc = crc32buf(const_cast<uint8_t*>(block) + 2, blockSize - 2);
+    } else {
+        crc = crc32c(block + 2, blockSize - 2);
+    }
+    return crc & 0xffff;
+}
+
+bool MutationLog::isValidBlock(const uint8_t *block) const {
+    uint16_t retrieved_crc16;
+    memcpy(&retrieved_crc16, block, sizeof(retrieved_crc16));
+    return blockChecksum(block) == ntohs(retrieved_crc16);
+}
+
+void MutationLog::mapForRead() {
+    if (!isOpen()) {
+        return;
+    }
+    struct stat st;
+    int stat_result = fstat(file, &st);
+    assert(stat_result == 0);
+    size_t len(static_cast<size_t>(st.st_size));
+    if (mapped != NULL && len == mappedLen) {
+        return;
+    }
+
+    unmap();
+    void *m = mmap(NULL, len, PROT_READ, MAP_SHARED, file, 0);
+    if (m == MAP_FAILED) {
+        std::stringstream ss;
+        ss << "Unable to map log file: " << strerror(errno);
+        throw ReadException(ss.str());
+    }
+    madvise(m, len, MADV_SEQUENTIAL);
+    mapped = static_cast<uint8_t*>(m);
+    mappedLen = len;
+}
+
+void MutationLog::unmap() {
+    if (mapped != NULL) {
+        int munmap_result = munmap(mapped, mappedLen);
+        assert(munmap_result == 0);
+        mapped = NULL;
+        mappedLen = 0;
+    }
+}
+
 void MutationLog::writeEntry(MutationLogEntry *mle) {
     assert(isEnabled());
     assert(isOpen());
@@ -429,54 +498,27 @@ static const char* logType(uint8_t t) {
 // Mutation log iterator
 // ----------------------------------------------------------------------
 
-MutationLog::iterator::iterator(const MutationLog *l, bool e)
+MutationLog::iterator::iterator(const MutationLog *l, bool e,
+                                size_t first, size_t last)
   : log(l),
-    entryBuf(NULL),
-    buf(NULL),
-    p(buf),
+    block(NULL),
+    p(NULL),
     offset(l->header().blockSize() * l->header().blockCount()),
     items(0),
-    isEnd(e)
+    isEnd(e),
+    firstChecked(first),
+    lastChecked(last)
 {
     assert(log);
 }
 
-MutationLog::iterator::iterator(const MutationLog::iterator& mit)
-  : log(mit.log),
-    entryBuf(NULL),
-    buf(NULL),
-    p(NULL),
-    offset(mit.offset),
-    items(mit.items),
-    isEnd(mit.isEnd)
-{
-    assert(log);
-    if (mit.buf != NULL) {
-        buf = static_cast<uint8_t*>(calloc(1, log->header().blockSize()));
-        assert(buf);
-        memcpy(buf, mit.buf, log->header().blockSize());
-        p = buf + (mit.p - mit.buf);
-    }
-
-    if (mit.entryBuf != NULL) {
-        entryBuf = static_cast<uint8_t*>(calloc(1, LOG_ENTRY_BUF_SIZE));
-        assert(entryBuf);
-        memcpy(entryBuf, mit.entryBuf, LOG_ENTRY_BUF_SIZE);
-    }
-}
-
-MutationLog::iterator::~iterator() {
-    free(entryBuf);
-    free(buf);
-}
-
 void MutationLog::iterator::prepItem() {
-    MutationLogEntry *e = MutationLogEntry::newEntry(p, bufferBytesRemaining());
-    if (entryBuf == NULL) {
-        entryBuf = static_cast<uint8_t*>(calloc(1, LOG_ENTRY_BUF_SIZE));
-        assert(entryBuf);
+    if (!MutationLogEntry::isValid(p, bufferBytesRemaining()) &&
+        !log->isValidBlock(block)) {
+        // A block whose checksum was left to another reader.
+        throw CRCReadException();
     }
-    memcpy(entryBuf, p, e->len());
+    assert(MutationLogEntry::isValid(p, bufferBytesRemaining()));
 }
 
 MutationLog::iterator& MutationLog::iterator::operator++() {
@@ -509,45 +551,40 @@ bool MutationLog::iterator::operator!=(const MutationLog::iterator& rhs) {
 }
 
 const MutationLogEntry* MutationLog::iterator::operator*() {
-    assert(entryBuf != NULL);
-    return MutationLogEntry::newEntry(entryBuf, LOG_ENTRY_BUF_SIZE);
+    assert(p != NULL);
+    return reinterpret_cast<const MutationLogEntry*>(p);
 }
 
 size_t MutationLog::iterator::bufferBytesRemaining() {
-    return log->header().blockSize() - (p - buf);
+    return log->header().blockSize() - (p - block);
 }
 
 void MutationLog::iterator::nextBlock() {
     assert(!log->isEnabled() || log->isOpen());
-    if (buf == NULL) {
-        buf = static_cast<uint8_t*>(calloc(1, log->header().blockSize()));
-        assert(buf);
-    }
-    p = buf;
-
-    ssize_t bytesread = pread(log->fd(), buf, log->header().blockSize(), offset);
-    if (bytesread < 1) {
-        isEnd = true;
-        return;
-    }
-    if (bytesread != (ssize_t)(log->header().blockSize())) {
-        throw ShortReadException();
-    }
-    offset += bytesread;
+    size_t blockSize(log->header().blockSize());
+    size_t headerSize(log->header().blockSize() * log->header().blockCount());
+    do {
+        if (log->mapped == NULL || static_cast<size_t>(offset) >= log->mappedLen) {
+            isEnd = true;
+            return;
+        }
+        if (offset + blockSize > log->mappedLen) {
+            throw ShortReadException();
+        }
+        block = log->mapped + offset;
+        size_t blockNum((offset - headerSize) / blockSize);
+        offset += blockSize;
 
-    uint32_t crc32(crc32buf(buf + 2, log->header().blockSize() - 2));
-    uint16_t computed_crc16(crc32 & 0xffff);
-    uint16_t retrieved_crc16;
-    memcpy(&retrieved_crc16, buf, sizeof(retrieved_crc16));
-    retrieved_crc16 = ntohs(retrieved_crc16);
-    if (computed_crc16 != retrieved_crc16) {
-        throw CRCReadException();
-    }
+        if (blockNum >= firstChecked && blockNum < lastChecked &&
+            !log->isValidBlock(block)) {
+            throw CRCReadException();
+        }
 
-    memcpy(&items, buf + 2, 2);
-    items = ntohs(items);
+        memcpy(&items, block + 2, 2);
+        items = ntohs(items);
+    } while (items == 0);
 
-    p = p + 4;
+    p = block + HEADER_RESERVED;
 
     prepItem();
 }
@@ -562,67 +599,219 @@ void MutationLog::resetCounts(size_t *items) {
 // Reading entries
 // ----------------------------------------------------------------------
 
-bool MutationLogHarvester::load() {
-    bool clean(false);
-    std::set<uint16_t> shouldClear;
-    for (MutationLog::iterator it(mlog.begin()); it != mlog.end(); ++it) {
-        const MutationLogEntry *le = *it;
-        ++itemsSeen[le->type()];
-        clean = false;
+typedef unordered_map<std::string, mutation_log_event_t> loading_map_t;
+typedef unordered_map<std::string, uint64_t> committed_map_t;
+
+/**
+ * One thread's share of loading a mutation log: a pass over the whole
+ * log harvesting the entries of the vbuckets it owns.
+ */
+struct HarvestTask {
+    HarvestTask(MutationLogHarvester &h, size_t i, const MutationLog::iterator &b,
+                const MutationLog::iterator &e, const std::vector<int> &o,
+                const std::vector<loading_map_t*> &l,
+                const std::vector<committed_map_t*> &c)
+        : harvester(h), id(i), it(b), end(e), owners(o), loading(l), committed(c),
+          clean(false), error(no_error)
+    {
+        memset(itemsSeen, 0, sizeof(itemsSeen));
+    }
+
+    void run() {
+        try {
+            harvester.harvest(*this);
+        } catch (MutationLog::CRCReadException &e) {
+            error = crc_error;
+        } catch (MutationLog::ShortReadException &e) {
+            error = short_read;
+        } catch (MutationLog::ReadException &e) {
+            error = read_error;
+            message = e.what();
+        }
+    }
 
+    MutationLogHarvester &harvester;
+    size_t id;
+    MutationLog::iterator it;
+    MutationLog::iterator end;
+    //! The index of the task owning each vbucket, or -1.
+    const std::vector<int> &owners;
+    const std::vector<loading_map_t*> &loading;
+    const std::vector<committed_map_t*> &committed;
+    size_t itemsSeen[MUTATION_LOG_TYPES];
+    bool clean;
+    enum { no_error, crc_error, short_read, read_error } error;
+    std::string message;
+    pthread_t thread;
+};
+
+extern "C" {
+    static void *harvestThread(void *arg) {
+        static_cast<HarvestTask*>(arg)->run();
+        return NULL;
+    }
+}
+
+MutationLogHarvester::MutationLogHarvester(MutationLog &ml, EventuallyPersistentEngine *e) :
+    mlog(ml), engine(e),
+    numThreads(e ? e->getConfiguration().getKlogHarvestThreads() : 1)
+{
+    memset(itemsSeen, 0, sizeof(itemsSeen));
+    setNumThreads(numThreads);
+}
+
+void MutationLogHarvester::harvest(HarvestTask &task) {
+    // vbuckets with entries since the last commit2.
+    std::vector<uint16_t> dirty;
+    std::vector<uint16_t> shouldClear;
+    for (; task.it != task.end; ++task.it) {
+        const MutationLogEntry *le = *task.it;
+        ++task.itemsSeen[le->type()];
+        task.clean = false;
+
+        uint16_t vb(le->vbucket());
+        bool owned(vb < task.owners.size() &&
+                   task.owners[vb] == static_cast<int>(task.id));
         switch (le->type()) {
         case ML_DEL:
             // FALLTHROUGH
+        case ML_ACCESS:
+            // FALLTHROUGH
         case ML_NEW:
-            if (vbid_set.find(le->vbucket()) != vbid_set.end()) {
-                loading[le->vbucket()][le->key()] = std::make_pair(le->rowid(), le->type());
+            if (owned) {
+                loading_map_t &l(*task.loading[vb]);
+                if (l.empty()) {
+                    dirty.push_back(vb);
+                }
+                l[le->key()] = std::make_pair(le->rowid(), le->type());
             }
             break;
         case ML_COMMIT2: {
-            clean = true;
-            for (std::set<uint16_t>::iterator vit(shouldClear.begin()); vit != shouldClear.end(); ++vit) {
-                committed[*vit].clear();
+            task.clean = true;
+            std::vector<uint16_t>::iterator vit;
+            for (vit = shouldClear.begin(); vit != shouldClear.end(); ++vit) {
+                task.committed[*vit]->clear();
             }
             shouldClear.clear();
 
-            for (std::set<uint16_t>::const_iterator vit = vbid_set.begin(); vit != vbid_set.end(); ++vit) {
-                uint16_t vb(*vit);
-
-                unordered_map<std::string, mutation_log_event_t>::iterator copyit2;
-                for (copyit2 = loading[vb].begin();
-                     copyit2 != loading[vb].end();
-                     ++copyit2) {
+            for (vit = dirty.begin(); vit != dirty.end(); ++vit) {
+                loading_map_t &l(*task.loading[*vit]);
+                committed_map_t &c(*task.committed[*vit]);
+                loading_map_t::iterator copyit2;
+                for (copyit2 = l.begin(); copyit2 != l.end(); ++copyit2) {
 
                     mutation_log_event_t t = copyit2->second;
 
                     switch (t.second) {
+                    case ML_ACCESS:
+                        // FALLTHROUGH
                     case ML_NEW:
-                        committed[vb][copyit2->first] = t.first;
+                        c[copyit2->first] = t.first;
                         break;
                     case ML_DEL:
-                        committed[vb].erase(copyit2->first);
+                        c.erase(copyit2->first);
                         break;
                     default:
                         abort();
                     }
                 }
+                l.clear();
             }
+            dirty.clear();
         }
-            loading.clear();
             break;
         case ML_COMMIT1:
             // nothing in particular
             break;
         case ML_DEL_ALL:
-            if (vbid_set.find(le->vbucket()) != vbid_set.end()) {
-                loading[le->vbucket()].clear();
-                shouldClear.insert(le->vbucket());
+            if (owned) {
+                task.loading[vb]->clear();
+                if (std::find(shouldClear.begin(), shouldClear.end(), vb) ==
+                    shouldClear.end()) {
+                    shouldClear.push_back(vb);
+                }
             }
             break;
         default:
             abort();
         }
     }
+}
+
+bool MutationLogHarvester::load() {
+    size_t nthreads(std::max(std::min(numThreads, vbid_set.size()),
+                             static_cast<size_t>(1)));
+    size_t numBlocks(mlog.getNumBlocks());
+
+    // Set up the maps of all the vbuckets up front, so that the threads
+    // don't modify the vbucket maps themselves.
+    std::vector<int> owners(vbid_set.empty() ? 0 : *vbid_set.rbegin() + 1, -1);
+    std::vector<loading_map_t*> loadingMaps(owners.size(), NULL);
+    std::vector<committed_map_t*> committedMaps(owners.size(), NULL);
+    size_t n(0);
+    std::set<uint16_t>::const_iterator vit;
+    for (vit = vbid_set.begin(); vit != vbid_set.end(); ++vit, ++n) {
+        owners[*vit] = static_cast<int>(n % nthreads);
+        loadingMaps[*vit] = &loading[*vit];
+        committedMaps[*vit] = &committed[*vit];
+    }
+
+    std::vector<HarvestTask*> tasks;
+    for (size_t i = 0; i < nthreads; ++i) {
+        tasks.push_back(new HarvestTask(*this, i,
+                                        mlog.begin(numBlocks * i / nthreads,
+                                                   numBlocks * (i + 1) / nthreads),
+                                        mlog.end(), owners,
+                                        loadingMaps, committedMaps));
+    }
+
+    hrtime_t start(gethrtime());
+    std::vector<HarvestTask*>::iterator it;
+    for (it = tasks.begin() + 1; it != tasks.end(); ++it) {
+        int rc = pthread_create(&(*it)->thread, NULL, harvestThread, *it);
+        assert(rc == 0);
+    }
+    tasks.front()->run();
+    for (it = tasks.begin() + 1; it != tasks.end(); ++it) {
+        int rc = pthread_join((*it)->thread, NULL);
+        assert(rc == 0);
+    }
+    getLogger()->log(EXTENSION_LOG_DEBUG, NULL,
+                     "Harvested %ld blocks of the mutation log with %ld threads in %s\n",
+                     numBlocks, nthreads, hrtime2text(gethrtime() - start).c_str());
+
+    HarvestTask *failed(NULL);
+    for (it = tasks.begin(); it != tasks.end() && failed == NULL; ++it) {
+        if ((*it)->error != HarvestTask::no_error) {
+            failed = *it;
+        }
+    }
+    bool clean(tasks.front()->clean);
+    memcpy(itemsSeen, tasks.front()->itemsSeen, sizeof(itemsSeen));
+
+    if (failed != NULL) {
+        // Don't leave anything from a log that can't be read in full.
+        committed.clear();
+        loading.clear();
+        memset(itemsSeen, 0, sizeof(itemsSeen));
+        int error(failed->error);
+        std::string message(failed->message);
+        for (it = tasks.begin(); it != tasks.end(); ++it) {
+            delete *it;
+        }
+        switch (error) {
+        case HarvestTask::crc_error:
+            throw MutationLog::CRCReadException();
+        case HarvestTask::short_read:
+            throw MutationLog::ShortReadException();
+        default:
+            throw MutationLog::ReadException(message);
+        }
+    }
+
+    for (it = tasks.begin(); it != tasks.end(); ++it) {
+        delete *it;
+    }
     return clean;
 }
 
@@ -641,27 +830,62 @@ void MutationLogHarvester::apply(void *arg, mlCallback mlc) {
     }
 }
 
+static bool byRowid(const std::pair<std::string, uint64_t> &a,
+                    const std::pair<std::string, uint64_t> &b) {
+    return a.second < b.second;
+}
+
 void MutationLogHarvester::apply(void *arg, mlCallbackWithQueue mlc) {
     assert(engine);
-    std::vector<std::pair<std::string, uint64_t> > fetches;
-    std::set<uint16_t>::const_iterator it = vbid_set.begin();
-    for (; it != vbid_set.end(); ++it) {
-        uint16_t vb(*it);
-        RCPtr<VBucket> vbucket = engine->getEpStore()->getVBucket(vb);
-        if (!vbucket) {
-            continue;
+    size_t batchSize = engine->getConfiguration().getWarmupBatchSize();
+
+    // Group the keys of every vbucket by access score in one pass.  Logs
+    // written before access scores were logged have the rowids of the
+    // time of the scan instead; all their keys go in a single group.
+    bool scored = itemsSeen[ML_ACCESS] > 0;
+    typedef std::map<uint16_t, std::vector<const std::string*> > vb_keys_t;
+    std::map<uint64_t, vb_keys_t, std::greater<uint64_t> > groups;
+    std::set<uint16_t>::const_iterator it;
+    for (it = vbid_set.begin(); it != vbid_set.end(); ++it) {
+        unordered_map<std::string, uint64_t>::iterator it2;
+        for (it2 = committed[*it].begin(); it2 != committed[*it].end();
+             ++it2) {
+            uint64_t score = scored ? it2->second : 0;
+            groups[score][*it].push_back(&it2->first);
         }
-        unordered_map<std::string, uint64_t>::iterator it2 = committed[vb].begin();
-        for (; it2 != committed[vb].end(); ++it2) {
-            // cannot use rowid from access log, so must read from hashtable
-            std::string key = it2->first;
-            StoredValue *v = NULL;
-            if ((v = vbucket->ht.find(key, false))) {
-                fetches.push_back(std::make_pair(it2->first, v->getId()));
+    }
+
+    std::vector<std::pair<std::string, uint64_t> > fetches;
+    std::vector<std::pair<std::string, uint64_t> > batch;
+    std::map<uint64_t, vb_keys_t, std::greater<uint64_t> >::iterator git;
+    for (git = groups.begin(); git != groups.end(); ++git) {
+        vb_keys_t::iterator vit;
+        for (vit = git->second.begin(); vit != git->second.end(); ++vit) {
+            uint16_t vb(vit->first);
+            RCPtr<VBucket> vbucket = engine->getEpStore()->getVBucket(vb);
+            if (!vbucket) {
+                continue;
+            }
+            std::vector<const std::string*>::iterator kit;
+            for (kit = vit->second.begin(); kit != vit->second.end(); ++kit) {
+                // cannot use rowid from access log, so must read from hashtable
+                StoredValue *v = NULL;
+                if ((v = vbucket->ht.find(**kit, false))) {
+                    fetches.push_back(std::make_pair(**kit, v->getId()));
+                }
+            }
+            std::sort(fetches.begin(), fetches.end(), byRowid);
+            for (size_t i = 0; i < fetches.size(); i += batchSize) {
+                if (!engine->stillWarmingUp()) {
+                    // Enough was loaded to enable traffic.
+                    return;
+                }
+                size_t end = std::min(i + batchSize, fetches.size());
+                batch.assign(fetches.begin() + i, fetches.begin() + end);
+                mlc(vb, batch, arg);
             }
+            fetches.clear();
         }
-        mlc(vb, fetches, arg);
-        fetches.clear();
     }
 }
 
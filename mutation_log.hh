@@ -24,7 +24,9 @@
 const size_t MIN_LOG_HEADER_SIZE(4096);
 const uint8_t MUTATION_LOG_MAGIC(0x45);
 const size_t HEADER_RESERVED(4);
-const uint32_t LOG_VERSION(1);
+const uint32_t LOG_VERSION(2);
+//! Logs of this version checksum their blocks with IEEE CRC32 rather than CRC32C.
+const uint32_t LOG_VERSION_CRC32(1);
 const size_t LOG_ENTRY_BUF_SIZE(512);
 const int DISABLED_FD(-3);
 
@@ -93,10 +95,10 @@ private:
 };
 
 typedef enum {
-    ML_NEW, ML_DEL, ML_DEL_ALL, ML_COMMIT1, ML_COMMIT2
+    ML_NEW, ML_DEL, ML_DEL_ALL, ML_COMMIT1, ML_COMMIT2, ML_ACCESS
 } mutation_log_type_t;
 
-#define MUTATION_LOG_TYPES 5
+#define MUTATION_LOG_TYPES 6
 
 extern const char *mutation_log_type_names[];
 
@@ -127,11 +129,18 @@ public:
      * @param buflen the length of said buf
      */
     static MutationLogEntry* newEntry(uint8_t *buf, size_t buflen) {
-        assert(buflen >= len(0));
-        MutationLogEntry *me = reinterpret_cast<MutationLogEntry*>(buf);
-        assert(me->magic == MUTATION_LOG_MAGIC);
-        assert(buflen >= me->len());
-        return me;
+        assert(isValid(buf, buflen));
+        return reinterpret_cast<MutationLogEntry*>(buf);
+    }
+
+    /**
+     * Check if the given buffer starts with a MutationLogEntry of a known
+     * type that fits in it.
+     */
+    static bool isValid(const uint8_t *buf, size_t buflen) {
+        const MutationLogEntry *me = reinterpret_cast<const MutationLogEntry*>(buf);
+        return buflen >= len(0) && me->magic == MUTATION_LOG_MAGIC &&
+            me->_type < MUTATION_LOG_TYPES && buflen >= me->len();
     }
 
     void operator delete(void *) {
@@ -172,7 +181,10 @@ public:
      * This entry's vbucket.
      */
     uint16_t vbucket() const {
-        return ntohs(_vbucket);
+        // Entries are read in place and aren't necessarily aligned.
+        uint16_t vb;
+        memcpy(&vb, &_vbucket, sizeof(vb));
+        return ntohs(vb);
     }
 
     /**
@@ -224,6 +236,12 @@ public:
 
     void delItem(uint16_t vbucket, const std::string &key);
 
+    /**
+     * Log an item found by an access scan.  The entry carries the
+     * item's access score in place of a rowid.
+     */
+    void accessedItem(uint16_t vbucket, const std::string &key, uint8_t score);
+
     void deleteAll(uint16_t vbucket);
 
     void commit1();
@@ -244,6 +262,11 @@ public:
         return file >= 0;
     }
 
+    /**
+     * Check the checksum of a block of this log.
+     */
+    bool isValidBlock(const uint8_t *block) const;
+
     LogHeaderBlock header() const {
         return headerBlock;
     }
@@ -346,10 +369,6 @@ public:
                                            const MutationLogEntry*> {
     public:
 
-        iterator(const iterator& mit);
-
-        ~iterator();
-
         iterator& operator++();
 
         iterator& operator++(int);
@@ -364,30 +383,58 @@ public:
 
         friend class MutationLog;
 
-        iterator(const MutationLog *l, bool e=false);
+        iterator(const MutationLog *l, bool e=false,
+                 size_t firstChecked=0,
+                 size_t lastChecked=std::numeric_limits<size_t>::max());
 
         void nextBlock();
         size_t bufferBytesRemaining();
         void prepItem();
 
         const MutationLog *log;
-        uint8_t           *entryBuf;
-        uint8_t           *buf;
-        uint8_t           *p;
+        const uint8_t     *block;
+        const uint8_t     *p;
         off_t              offset;
         uint16_t           items;
         bool               isEnd;
+        size_t             firstChecked;
+        size_t             lastChecked;
     };
 
     /**
      * An iterator pointing to the beginning of the log file.
+     *
+     * The log is read through a read only mapping of the file, which is
+     * set up here; iterators obtained before the log grew must not be
+     * used past that point.
      */
     iterator begin() {
-        iterator it(iterator(this));
+        return begin(0, std::numeric_limits<size_t>::max());
+    }
+
+    /**
+     * An iterator pointing to the beginning of the log file that only
+     * verifies the checksums of the blocks numbered [firstChecked,
+     * lastChecked), and of any other block it fails to parse.  Readers
+     * that go over the same log side by side use it to share the work.
+     */
+    iterator begin(size_t firstChecked, size_t lastChecked) {
+        mapForRead();
+        iterator it(this, false, firstChecked, lastChecked);
         it.nextBlock();
         return it;
     }
 
+    /**
+     * The number of blocks following the header, which is what begin()
+     * would map.
+     */
+    size_t getNumBlocks() {
+        mapForRead();
+        size_t headerSize(headerBlock.blockSize() * headerBlock.blockCount());
+        return mappedLen > headerSize ? (mappedLen - headerSize) / blockSize : 0;
+    }
+
     /**
      * An iterator pointing at the end of the log file.
      */
@@ -400,9 +447,9 @@ public:
     //! Histogram of block padding sizes.
     Histogram<uint32_t> paddingHisto;
     //! Flush time histogram.
-    Histogram<hrtime_t> flushTimeHisto;
+    LogLinearHistogram<hrtime_t> flushTimeHisto;
     //! Sync time histogram.
-    Histogram<hrtime_t> syncTimeHisto;
+    LogLinearHistogram<hrtime_t> syncTimeHisto;
     //! Size of the log
     Atomic<size_t> logSize;
 
@@ -420,6 +467,11 @@ private:
 
     void prepareWrites();
 
+    uint16_t blockChecksum(const uint8_t *block) const;
+
+    void mapForRead();
+    void unmap();
+
     int fd() const { return file; }
 
     LogHeaderBlock     headerBlock;
@@ -432,6 +484,8 @@ private:
     uint8_t           *blockBuffer;
     uint8_t            syncConfig;
     bool               readOnly;
+    uint8_t           *mapped;
+    size_t             mappedLen;
 
     DISALLOW_COPY_AND_ASSIGN(MutationLog);
 };
@@ -462,16 +516,22 @@ struct mutation_log_uncommitted_t {
 };
 
 class EventuallyPersistentEngine;
+struct HarvestTask;
 
 /**
  * Read log entries back from the log to reconstruct the state.
  */
 class MutationLogHarvester {
 public:
-    MutationLogHarvester(MutationLog &ml, EventuallyPersistentEngine *e = NULL) :
-        mlog(ml), engine(e)
-    {
-        memset(itemsSeen, 0, sizeof(itemsSeen));
+    MutationLogHarvester(MutationLog &ml, EventuallyPersistentEngine *e = NULL);
+
+    /**
+     * Set the number of threads that load the log.  Each of them goes
+     * over the whole log, verifies the checksums of a share of its blocks
+     * and harvests the entries of a share of the vbuckets.
+     */
+    void setNumThreads(size_t n) {
+        numThreads = std::max(n, static_cast<size_t>(1));
     }
 
     /**
@@ -492,6 +552,13 @@ public:
      * Apply the processed log entries through the given function.
      */
     void apply(void *arg, mlCallback mlc);
+
+    /**
+     * Apply the keys of an access log, in batches of at most
+     * warmup_batch_size keys of a vbucket with their rowids from the
+     * hash table.  The keys with the highest access scores come first,
+     * and each batch is sorted by rowid so it can be read in file order.
+     */
     void apply(void *arg, mlCallbackWithQueue mlc);
 
     /**
@@ -513,8 +580,13 @@ public:
 
 private:
 
+    friend struct HarvestTask;
+
+    void harvest(HarvestTask &task);
+
     MutationLog &mlog;
     EventuallyPersistentEngine *engine;
+    size_t numThreads;
     std::set<uint16_t> vbid_set;
 
     unordered_map<uint16_t, unordered_map<std::string, uint64_t> > committed;
@@ -16,6 +16,13 @@
  */
 #include "config.h"
 #include "mutex.hh"
+#include "locks.hh"
+
+#if defined(HAVE_GCC_ATOMICS)
+#include "atomic/gcc_atomics.h"
+#elif defined(HAVE_ATOMIC_H)
+#include "atomic/libatomic.h"
+#endif
 
 Mutex::Mutex() : held(false)
 {
@@ -77,6 +84,23 @@ void Mutex::acquire() {
     EP_MUTEX_ACQUIRED(this);
 }
 
+bool Mutex::tryAcquire() {
+    int e;
+    if ((e = pthread_mutex_trylock(&mutex)) != 0) {
+        if (e == EBUSY) {
+            return false;
+        }
+        std::cerr << "MUTEX ERROR: Failed to try lock: ";
+        std::cerr << std::strerror(e) << std::endl;
+        std::cerr.flush();
+        abort();
+    }
+    setHolder(true);
+
+    EP_MUTEX_ACQUIRED(this);
+    return true;
+}
+
 void Mutex::release() {
     assert(held && pthread_equal(holder, pthread_self()));
     setHolder(false);
@@ -90,3 +114,15 @@ void Mutex::release() {
     EP_MUTEX_RELEASED(this);
 }
 
+
+void LockSequence::writeBegin() {
+    ++seqno;
+    // Readers must see the odd sequence before any modification.
+    ep_sync_synchronize();
+}
+
+void LockSequence::writeEnd() {
+    // All modifications must be visible before the even sequence.
+    ep_sync_synchronize();
+    ++seqno;
+}
@@ -37,6 +37,7 @@ protected:
     friend class MultiLockHolder;
 
     void acquire();
+    bool tryAcquire();
     void release();
 
     void setHolder(bool isHeld) {
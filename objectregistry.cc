@@ -54,6 +54,11 @@ void ObjectRegistry::onCreateBlob(Blob *blob)
        EPStats &stats = engine->getEpStats();
        stats.currentSize.incr(blob->getSize());
        stats.totalValueSize.incr(blob->getSize());
+       if (blob->isCompressed()) {
+           ++stats.numCompressedValues;
+           stats.compressedValueSavings.incr(blob->getUncompressedLength() -
+                                             blob->length());
+       }
        assert(stats.currentSize.get() < GIGANTOR);
    }
 }
@@ -65,6 +70,11 @@ void ObjectRegistry::onDeleteBlob(Blob *blob)
        EPStats &stats = engine->getEpStats();
        stats.currentSize.decr(blob->getSize());
        stats.totalValueSize.decr(blob->getSize());
+       if (blob->isCompressed()) {
+           --stats.numCompressedValues;
+           stats.compressedValueSavings.decr(blob->getUncompressedLength() -
+                                             blob->length());
+       }
        assert(stats.currentSize.get() < GIGANTOR);
    }
 }
@@ -120,6 +130,10 @@ EventuallyPersistentEngine *ObjectRegistry::onSwitchThread(EventuallyPersistentE
     return old_engine;
 }
 
+EventuallyPersistentEngine *ObjectRegistry::getCurrentEngine() {
+    return th->get();
+}
+
 void ObjectRegistry::setStats(Atomic<size_t>* init_track) {
     initial_track->set(init_track);
 }
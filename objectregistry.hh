@@ -34,6 +34,7 @@ public:
 
     static EventuallyPersistentEngine *onSwitchThread(EventuallyPersistentEngine *engine,
                                                       bool want_old_thread_local = false);
+    static EventuallyPersistentEngine *getCurrentEngine();
 
     static void setStats(Atomic<size_t>* init_track);
     static bool memoryAllocated(size_t mem);
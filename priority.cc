@@ -22,6 +22,7 @@ const Priority Priority::BgFetcherPriority("bg_fetcher_priority", 0);
 const Priority Priority::BgFetcherGetMetaPriority("bg_fetcher_meta_priority", 1);
 const Priority Priority::WarmupPriority("warmup_priority", 0);
 const Priority Priority::VKeyStatBgFetcherPriority("vkey_stat_bg_fetcher_priority", 3);
+const Priority Priority::KeyFilterRebuildPriority("key_filter_rebuild_priority", 9);
 
 // Priorities for TAP dispatcher
 const Priority Priority::TapBgFetcherPriority("tap_bg_fetcher_priority", 1);
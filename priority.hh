@@ -17,6 +17,7 @@ public:
     static const Priority TapBgFetcherPriority;
     static const Priority VKeyStatBgFetcherPriority;
     static const Priority WarmupPriority;
+    static const Priority KeyFilterRebuildPriority;
 
     // Priorities for Read-Write dispatcher
     static const Priority VBucketPersistHighPriority;
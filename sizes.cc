@@ -66,9 +66,11 @@ int main(int, char **) {
     display("GIGANTOR", GIGANTOR);
     display("Small Stored Value", StoredValue::sizeOf(true));
     display("Featured Stored Value", StoredValue::sizeOf(false));
+    display("Tiny Stored Value", StoredValue::sizeOf(tiny));
 
     display("... Small data", sizeof(struct small_data));
     display("... Feature data", sizeof(struct feature_data));
+    display("... Tiny data", sizeof(struct tiny_data));
     display("... Bodies Union", sizeof(union stored_value_bodies));
 
     display("Stored Value Factory", sizeof(StoredValueFactory));
@@ -87,13 +89,15 @@ int main(int, char **) {
     display("HistogramBin<size_t>", sizeof(HistogramBin<size_t>));
     display("HistogramBin<hrtime_t>", sizeof(HistogramBin<hrtime_t>));
     display("HistogramBin<int>", sizeof(HistogramBin<int>));
+    display("LogLinearHistogram<hrtime_t>", sizeof(LogLinearHistogram<hrtime_t>));
 
     std::cout << std::endl << "Histogram Ranges" << std::endl << std::endl;
 
     EPStats stats;
     HashTableDepthStatVisitor dv;
-    display("Default Histo", stats.diskInsertHisto);
-    display("Commit Histo", stats.diskCommitHisto);
+    Histogram<hrtime_t> defaultHisto;
+    display("Default Histo", defaultHisto);
+    display("Storage Age Histo", stats.dirtyAgeHisto);
     display("Hash table depth histo", dv.depthHisto);
 
     SQLiteStats sqstats;
@@ -0,0 +1,213 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+#include "config.h"
+#include <algorithm>
+#include <cassert>
+#include <cstdlib>
+#include <new>
+
+#include "slab_arena.hh"
+
+const size_t SlabArena::slabSize;
+const size_t SlabArena::granularity;
+
+/**
+ * Header at the start of every slab; objects follow it.
+ */
+struct SlabArena::Slab {
+    SlabArena *arena;
+    Slab      *prev;
+    Slab      *next;
+    void      *freeList;   //!< Objects freed back to this slab.
+    uint32_t   sizeClass;
+    uint32_t   objSize;
+    uint32_t   capacity;
+    uint32_t   used;       //!< Objects currently allocated.
+    uint32_t   carved;     //!< Objects ever handed out from fresh space.
+};
+
+/**
+ * Objects start at this offset within a slab.
+ */
+static const size_t slabHeaderSize = 64;
+
+static void *allocSlab() {
+    void *rv = NULL;
+#ifdef WIN32
+    rv = _aligned_malloc(SlabArena::slabSize, SlabArena::slabSize);
+#else
+    if (posix_memalign(&rv, SlabArena::slabSize, SlabArena::slabSize) != 0) {
+        rv = NULL;
+    }
+#endif
+    if (rv == NULL) {
+        throw std::bad_alloc();
+    }
+    return rv;
+}
+
+static void freeSlab(void *slab) {
+#ifdef WIN32
+    _aligned_free(slab);
+#else
+    free(slab);
+#endif
+}
+
+static char *slabObject(void *slab, size_t objSize, size_t n) {
+    return static_cast<char*>(slab) + slabHeaderSize + n * objSize;
+}
+
+SlabArena::SlabArena(EPStats &st, size_t maxSize) : stats(st) {
+    assert(sizeof(Slab) <= slabHeaderSize);
+    assert(maxSize >= sizeof(void*) && maxSize <= slabSize - slabHeaderSize);
+    numClasses = (maxSize + granularity - 1) / granularity;
+    classes = new SizeClass[numClasses];
+}
+
+SlabArena::~SlabArena() {
+    assert(numObjects == 0);
+    releaseEmptySlabs();
+    delete []classes;
+}
+
+void *SlabArena::allocate(size_t len) {
+    size_t cls = (std::max(len, sizeof(void*)) + granularity - 1) / granularity - 1;
+    assert(cls < numClasses);
+    SizeClass &sc = classes[cls];
+
+    SpinLockHolder lh(&sc.lock);
+    Slab *slab = sc.avail;
+    if (slab == NULL) {
+        if (sc.spare != NULL) {
+            slab = sc.spare;
+            sc.spare = NULL;
+        } else {
+            slab = newSlab(cls);
+        }
+        link(sc, slab);
+    }
+
+    void *rv;
+    if (slab->freeList != NULL) {
+        rv = slab->freeList;
+        slab->freeList = *static_cast<void**>(rv);
+    } else {
+        rv = slabObject(slab, slab->objSize, slab->carved++);
+    }
+    if (++slab->used == slab->capacity) {
+        unlink(sc, slab);
+    }
+    size_t objSize = slab->objSize;
+    lh.unlock();
+
+    ++numObjects;
+    usedBytes.incr(objSize);
+    stats.slabArenaUsed.incr(objSize);
+    return rv;
+}
+
+void SlabArena::deallocate(void *p) {
+    uintptr_t base = reinterpret_cast<uintptr_t>(p) & ~(slabSize - 1);
+    Slab *slab = reinterpret_cast<Slab*>(base);
+    slab->arena->release(slab, p);
+}
+
+void SlabArena::release(Slab *slab, void *p) {
+    SizeClass &sc = classes[slab->sizeClass];
+    size_t objSize = slab->objSize;
+    Slab *victim = NULL;
+
+    SpinLockHolder lh(&sc.lock);
+    *static_cast<void**>(p) = slab->freeList;
+    slab->freeList = p;
+    if (slab->used-- == slab->capacity) {
+        link(sc, slab);
+    }
+    if (slab->used == 0) {
+        unlink(sc, slab);
+        if (sc.spare == NULL) {
+            sc.spare = slab;
+        } else {
+            victim = slab;
+        }
+    }
+    lh.unlock();
+
+    if (victim != NULL) {
+        freeSlab(victim);
+        slabBytes.decr(slabSize);
+        stats.slabArenaSize.decr(slabSize);
+    }
+    usedBytes.decr(objSize);
+    stats.slabArenaUsed.decr(objSize);
+    if (--numObjects == 0) {
+        maybeDestroy();
+    }
+}
+
+void SlabArena::releaseEmptySlabs() {
+    for (size_t i = 0; i < numClasses; ++i) {
+        SizeClass &sc = classes[i];
+        SpinLockHolder lh(&sc.lock);
+        Slab *slab = sc.spare;
+        sc.spare = NULL;
+        lh.unlock();
+        if (slab != NULL) {
+            freeSlab(slab);
+            slabBytes.decr(slabSize);
+            stats.slabArenaSize.decr(slabSize);
+        }
+    }
+}
+
+void SlabArena::orphan() {
+    orphaned.set(true);
+    if (numObjects.get() == 0) {
+        maybeDestroy();
+    }
+}
+
+void SlabArena::maybeDestroy() {
+    // Both orphan() and the last deallocation may get here; only one
+    // of them may delete the arena.
+    if (orphaned.get() && destroying.cas(false, true)) {
+        delete this;
+    }
+}
+
+SlabArena::Slab *SlabArena::newSlab(size_t cls) {
+    Slab *slab = static_cast<Slab*>(allocSlab());
+    slab->arena = this;
+    slab->prev = slab->next = NULL;
+    slab->freeList = NULL;
+    slab->sizeClass = static_cast<uint32_t>(cls);
+    slab->objSize = static_cast<uint32_t>((cls + 1) * granularity);
+    slab->capacity = static_cast<uint32_t>((slabSize - slabHeaderSize) /
+                                           slab->objSize);
+    slab->used = 0;
+    slab->carved = 0;
+    slabBytes.incr(slabSize);
+    stats.slabArenaSize.incr(slabSize);
+    return slab;
+}
+
+void SlabArena::link(SizeClass &sc, Slab *slab) {
+    slab->prev = NULL;
+    slab->next = sc.avail;
+    if (sc.avail != NULL) {
+        sc.avail->prev = slab;
+    }
+    sc.avail = slab;
+}
+
+void SlabArena::unlink(SizeClass &sc, Slab *slab) {
+    if (slab->prev != NULL) {
+        slab->prev->next = slab->next;
+    } else {
+        sc.avail = slab->next;
+    }
+    if (slab->next != NULL) {
+        slab->next->prev = slab->prev;
+    }
+    slab->prev = slab->next = NULL;
+}
@@ -0,0 +1,119 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+#ifndef SLAB_ARENA_HH
+#define SLAB_ARENA_HH 1
+
+#include "common.hh"
+#include "atomic.hh"
+#include "stats.hh"
+
+/**
+ * Size-classed slab allocator for small, variable length objects.
+ *
+ * Objects are rounded up to a multiple of granularity bytes and carved
+ * out of slabSize byte slabs dedicated to that size, so objects with
+ * similar sizes (e.g. StoredValues with similar key lengths) share
+ * slabs instead of being scattered across the general heap.  Slabs are
+ * aligned on their size, which lets deallocate() find the owning slab
+ * (and arena) from the object's address alone.  A slab is released as
+ * soon as its last object is freed, keeping at most one empty slab per
+ * size class around for reuse.
+ *
+ * The arena outlives its owner if objects are still out (e.g. waiting
+ * for deferred reclamation): orphan() hands it over to whoever frees
+ * the last object.
+ */
+class SlabArena {
+public:
+
+    //! Size (and alignment) of each slab in bytes.
+    static const size_t slabSize = 4096;
+
+    //! Object sizes are rounded up to a multiple of this.
+    static const size_t granularity = 8;
+
+    /**
+     * Create an arena.
+     *
+     * @param st the stats to account slab and object bytes in
+     * @param maxSize the largest object size that will be requested
+     */
+    SlabArena(EPStats &st, size_t maxSize);
+
+    /**
+     * Allocate len bytes (throws std::bad_alloc if out of memory).
+     */
+    void *allocate(size_t len);
+
+    /**
+     * Free memory returned by allocate() on any arena.
+     */
+    static void deallocate(void *p);
+
+    /**
+     * Release the empty slabs kept around for reuse.
+     */
+    void releaseEmptySlabs();
+
+    /**
+     * Called by the owner instead of deleting the arena.  The arena
+     * deletes itself now, or when its last object is deallocated.
+     */
+    void orphan();
+
+    /**
+     * Bytes of memory held in slabs.
+     */
+    size_t getSlabBytes() const {
+        return slabBytes.get();
+    }
+
+    /**
+     * Bytes of slab memory handed out as (rounded up) objects.
+     */
+    size_t getUsedBytes() const {
+        return usedBytes.get();
+    }
+
+    /**
+     * Get the number of objects currently allocated.
+     */
+    size_t getNumObjects() const {
+        return numObjects.get();
+    }
+
+private:
+
+    struct Slab;
+
+    /**
+     * Slabs of one object size.
+     */
+    struct SizeClass {
+        SizeClass() : avail(NULL), spare(NULL) {}
+
+        SpinLock  lock;
+        Slab     *avail;    //!< Partially used slabs.
+        Slab     *spare;    //!< An empty slab kept for reuse.
+    };
+
+    ~SlabArena();
+
+    Slab *newSlab(size_t cls);
+    void release(Slab *slab, void *p);
+    void link(SizeClass &sc, Slab *slab);
+    void unlink(SizeClass &sc, Slab *slab);
+    void maybeDestroy();
+
+    EPStats        &stats;
+    SizeClass      *classes;
+    size_t          numClasses;
+    Atomic<size_t>  slabBytes;
+    Atomic<size_t>  usedBytes;
+    Atomic<size_t>  numObjects;
+    Atomic<bool>    orphaned;
+    Atomic<bool>    destroying;
+
+    DISALLOW_COPY_AND_ASSIGN(SlabArena);
+};
+
+#endif /* SLAB_ARENA_HH */
@@ -25,8 +25,6 @@ public:
 
     EPStats() : dirtyAgeHisto(GrowingWidthGenerator<hrtime_t>(0, ONE_SECOND, 1.4), 25),
                 dataAgeHisto(GrowingWidthGenerator<hrtime_t>(0, ONE_SECOND, 1.4), 25),
-                diskCommitHisto(GrowingWidthGenerator<hrtime_t>(0, ONE_SECOND, 1.4), 25),
-                mlogCompactorHisto(GrowingWidthGenerator<hrtime_t>(0, ONE_SECOND, 1.4), 25),
                 timingLog(NULL), maxDataSize(DEFAULT_MAX_DATA_SIZE) {}
 
     ~EPStats() {
@@ -91,7 +89,7 @@ public:
     //! Number of items persisted.
     Atomic<size_t> totalPersisted;
     //! Cumulative number of items added to the queue.
-    Atomic<size_t> totalEnqueued;
+    StripedCounter<size_t> totalEnqueued;
     //! Number of new items created in the DB.
     Atomic<size_t> newItems;
     //! Number of items removed from the DB.
@@ -101,7 +99,7 @@ public:
     //! Number of times an item is not flushed due to the item's expiry
     Atomic<size_t> flushExpired;
     //! Number of times an object was expired on access.
-    Atomic<size_t> expired_access;
+    StripedCounter<size_t> expired_access;
     //! Number of times an object was expired by pager.
     Atomic<size_t> expired_pager;
     //! Number of times we failed to start a transaction
@@ -132,21 +130,33 @@ public:
     //! Maximum data age before a record is forced to be persisted
     Atomic<int> queue_age_cap;
     //! Number of times background fetches occurred.
-    Atomic<size_t> bg_fetched;
+    StripedCounter<size_t> bg_fetched;
     //! Number of times we needed to kick in the pager
     Atomic<size_t> pagerRuns;
+    //! Number of items the item pager looked at to pick what to eject
+    Atomic<size_t> pagerItemsInspected;
+    //! Time (in usec) the item pager spent looking at items and ejecting them
+    Atomic<hrtime_t> pagerTime;
+    //! Number of values the item pager ejected that had been used lately
+    Atomic<size_t> pagerHotEjects;
     //! Number of times the expiry pager runs for purging expired items
     Atomic<size_t> expiryPagerRuns;
+    //! Number of times the value compressor ran.
+    Atomic<size_t> compressorRuns;
     //! Number of times the checkpoint remover runs for removing closed unreferenced checkpoints.
     Atomic<size_t> checkpointRemoverRuns;
     //! Number of items removed from closed unreferenced checkpoints.
     Atomic<size_t> itemsRemovedFromCheckpoints;
+    //! Number of items queued while another thread held the checkpoint queue lock.
+    Atomic<size_t> checkpointDeferredItems;
     //! Number of times a value is ejected
     Atomic<size_t> numValueEjects;
     //! Number of times a value could not be ejected
     Atomic<size_t> numFailedEjects;
+    //! Number of items removed from memory along with their keys
+    Atomic<size_t> numKeyEjects;
     //! Number of times "Not my bucket" happened
-    Atomic<size_t> numNotMyVBuckets;
+    StripedCounter<size_t> numNotMyVBuckets;
     //! Whether the DB cleaner completes cleaning up invalid items with old vb versions
     Atomic<bool> dbCleanerComplete;
     //! Number of deleted items reverted from hot reload
@@ -158,9 +168,21 @@ public:
     //! Total size of stored objects.
     Atomic<size_t> currentSize;
     //! Total memory overhead to store values for resident keys.
-    Atomic<size_t> totalValueSize;
+    StripedCounter<size_t> totalValueSize;
     //! Amount of memory used to track items and what-not.
     Atomic<size_t> memOverhead;
+    //! Number of values held compressed in memory.
+    StripedCounter<size_t> numCompressedValues;
+    //! Bytes compressed values take up less than their raw form.
+    StripedCounter<size_t> compressedValueSavings;
+    //! Number of values compressed by the value compressor.
+    Atomic<size_t> numValueCompressions;
+    //! Number of values the compressor tried but kept raw.
+    Atomic<size_t> numFailedCompressions;
+    //! Memory held in hash table slab arenas.
+    Atomic<size_t> slabArenaSize;
+    //! Slab arena memory occupied by stored values.
+    Atomic<size_t> slabArenaUsed;
     //! The total amount of memory used by this bucket (From memory tracking)
     Atomic<size_t> totalMemory;
     //! True if the memory usage tracker is enabled.
@@ -172,18 +194,18 @@ public:
     Atomic<size_t> mem_high_wat;
 
     //! Number of times unrecoverable oom errors happened while processing operations.
-    Atomic<size_t> oom_errors;
+    StripedCounter<size_t> oom_errors;
     //! Number of times temporary oom errors encountered while processing operations.
-    Atomic<size_t> tmp_oom_errors;
+    StripedCounter<size_t> tmp_oom_errors;
 
     //! Number of read related io operations
-    Atomic<size_t> io_num_read;
+    StripedCounter<size_t> io_num_read;
     //! Number of write related io operations
-    Atomic<size_t> io_num_write;
+    StripedCounter<size_t> io_num_write;
     //! Number of bytes read
-    Atomic<size_t> io_read_bytes;
+    StripedCounter<size_t> io_read_bytes;
     //! Number of bytes written
-    Atomic<size_t> io_write_bytes;
+    StripedCounter<size_t> io_write_bytes;
 
     //! Number of ops blocked on all vbuckets in pending state
     Atomic<size_t> pendingOps;
@@ -195,7 +217,7 @@ public:
     Atomic<hrtime_t> pendingOpsMaxDuration;
 
     //! Histogram of pending operation wait times.
-    Histogram<hrtime_t> pendingOpsHisto;
+    LogLinearHistogram<hrtime_t> pendingOpsHisto;
 
     //! The number of samples the bgWaitDelta and bgLoadDelta contains of
     Atomic<size_t> bgNumOperations;
@@ -209,7 +231,7 @@ public:
     Atomic<hrtime_t> bgMaxWait;
 
     //! Histogram of background wait times.
-    Histogram<hrtime_t> bgWaitHisto;
+    LogLinearHistogram<hrtime_t> bgWaitHisto;
 
     /** The sum of the deltas (in usec) from the dispatcher started to load
      *  item until was done
@@ -226,14 +248,14 @@ public:
     Atomic<hrtime_t> vbucketDelTotWalltime;
 
     //! Histogram of background wait loads.
-    Histogram<hrtime_t> bgLoadHisto;
+    LogLinearHistogram<hrtime_t> bgLoadHisto;
 
     //! Histogram of time an item spends non-resident.
     Histogram<rel_time_t> pagedOutTimeHisto;
 
     /* TAP related stats */
     //! The total number of tap events sent (not including noops)
-    Atomic<size_t> numTapFetched;
+    StripedCounter<size_t> numTapFetched;
     //! Number of background fetched tap items
     Atomic<size_t> numTapBGFetched;
     //! Number of times a tap background fetch task is requeued
@@ -259,7 +281,7 @@ public:
     Atomic<hrtime_t> tapBgMaxWait;
 
     //! Histogram of tap background wait loads.
-    Histogram<hrtime_t> tapBgWaitHisto;
+    LogLinearHistogram<hrtime_t> tapBgWaitHisto;
 
     /** The sum of the deltas (in usec) from the dispatcher started to load
      *  a tap item until was done
@@ -271,11 +293,11 @@ public:
     Atomic<hrtime_t> tapBgMaxLoad;
 
     //! The number of get with meta operations
-    Atomic<size_t>  numOpsGetMeta;
+    StripedCounter<size_t> numOpsGetMeta;
     //! The number of set with meta operations
-    Atomic<size_t>  numOpsSetMeta;
+    StripedCounter<size_t> numOpsSetMeta;
     //! The number of delete with meta operations
-    Atomic<size_t>  numOpsDelMeta;
+    StripedCounter<size_t> numOpsDelMeta;
 
     //! The number of tiems the mutation log compactor is exectued
     Atomic<size_t> mlogCompactorRuns;
@@ -285,7 +307,7 @@ public:
     Atomic<hrtime_t> alogTime;
 
     //! Histogram of tap background wait loads.
-    Histogram<hrtime_t> tapBgLoadHisto;
+    LogLinearHistogram<hrtime_t> tapBgLoadHisto;
 
     //! Histogram of queue processing dirty age.
     Histogram<hrtime_t> dirtyAgeHisto;
@@ -300,67 +322,76 @@ public:
     //
 
     //! Histogram of getvbucket timings
-    Histogram<hrtime_t> getVbucketCmdHisto;
+    LogLinearHistogram<hrtime_t> getVbucketCmdHisto;
 
     //! Histogram of setvbucket timings
-    Histogram<hrtime_t> setVbucketCmdHisto;
+    LogLinearHistogram<hrtime_t> setVbucketCmdHisto;
 
     //! Histogram of delvbucket timings
-    Histogram<hrtime_t> delVbucketCmdHisto;
+    LogLinearHistogram<hrtime_t> delVbucketCmdHisto;
 
     //! Histogram of get commands.
-    Histogram<hrtime_t> getCmdHisto;
+    LogLinearHistogram<hrtime_t> getCmdHisto;
+
+    //! Histogram of batched get timings
+    LogLinearHistogram<hrtime_t> getBatchCmdHisto;
 
     //! Histogram of arithmetic commands.
-    Histogram<hrtime_t> arithCmdHisto;
+    LogLinearHistogram<hrtime_t> arithCmdHisto;
 
     //! Histogram of tap VBucket reset timings
-    Histogram<hrtime_t> tapVbucketResetHisto;
+    LogLinearHistogram<hrtime_t> tapVbucketResetHisto;
 
     //! Histogram of tap mutation timings.
-    Histogram<hrtime_t> tapMutationHisto;
+    LogLinearHistogram<hrtime_t> tapMutationHisto;
 
     //! Histogram of tap vbucket set timings.
-    Histogram<hrtime_t> tapVbucketSetHisto;
+    LogLinearHistogram<hrtime_t> tapVbucketSetHisto;
 
     //! Time spent notifying completion of IO.
-    Histogram<hrtime_t> notifyIOHisto;
+    LogLinearHistogram<hrtime_t> notifyIOHisto;
 
     //! Histogram of get_stats commands.
-    Histogram<hrtime_t> getStatsCmdHisto;
+    LogLinearHistogram<hrtime_t> getStatsCmdHisto;
 
     //
     // DB timers.
     //
 
     //! Histogram of insert disk writes
-    Histogram<hrtime_t> diskInsertHisto;
+    LogLinearHistogram<hrtime_t> diskInsertHisto;
 
     //! Histogram of update disk writes
-    Histogram<hrtime_t> diskUpdateHisto;
+    LogLinearHistogram<hrtime_t> diskUpdateHisto;
 
     //! Histogram of delete disk writes
-    Histogram<hrtime_t> diskDelHisto;
+    LogLinearHistogram<hrtime_t> diskDelHisto;
 
     //! Histogram of execution time of disk vbucket deletions
-    Histogram<hrtime_t> diskVBDelHisto;
+    LogLinearHistogram<hrtime_t> diskVBDelHisto;
 
     //! Histogram of execution time of invalid vbucket table deletions from disk
-    Histogram<hrtime_t> diskInvalidVBTableDelHisto;
+    LogLinearHistogram<hrtime_t> diskInvalidVBTableDelHisto;
 
     //! Histogram of disk commits
-    Histogram<hrtime_t> diskCommitHisto;
+    LogLinearHistogram<hrtime_t> diskCommitHisto;
+
+    LogLinearHistogram<hrtime_t> checkpointRevertHisto;
+
+    //! Histogram of time spent waiting for checkpoint queue locks
+    LogLinearHistogram<hrtime_t> checkpointLockWaitHisto;
 
-    Histogram<hrtime_t> checkpointRevertHisto;
+    //! Histogram of time checkpoint queue locks were held by cursors and the remover
+    LogLinearHistogram<hrtime_t> checkpointLockHoldHisto;
 
     //! Histogram of setting vbucket state
-    Histogram<hrtime_t> snapshotVbucketHisto;
+    LogLinearHistogram<hrtime_t> snapshotVbucketHisto;
 
     //! Histogram of mutation log compactor
-    Histogram<hrtime_t> mlogCompactorHisto;
+    LogLinearHistogram<hrtime_t> mlogCompactorHisto;
 
     //! Historgram of batch reads
-    Histogram<hrtime_t> getMultiHisto;
+    LogLinearHistogram<hrtime_t> getMultiHisto;
 
     //! Reset all stats to reasonable values.
     void reset() {
@@ -372,10 +403,18 @@ public:
         flushDurationHighWat.set(0);
         commit_time.set(0);
         pagerRuns.set(0);
+        pagerItemsInspected.set(0);
+        pagerTime.set(0);
+        pagerHotEjects.set(0);
+        compressorRuns.set(0);
         checkpointRemoverRuns.set(0);
         itemsRemovedFromCheckpoints.set(0);
+        checkpointDeferredItems.set(0);
         numValueEjects.set(0);
         numFailedEjects.set(0);
+        numValueCompressions.set(0);
+        numFailedCompressions.set(0);
+        numKeyEjects.set(0);
         numNotMyVBuckets.set(0);
         io_num_read.set(0);
         io_num_write.set(0);
@@ -417,6 +456,7 @@ public:
         setVbucketCmdHisto.reset();
         delVbucketCmdHisto.reset();
         getCmdHisto.reset();
+        getBatchCmdHisto.reset();
         arithCmdHisto.reset();
         tapVbucketResetHisto.reset();
         tapMutationHisto.reset();
@@ -435,6 +475,8 @@ public:
         dirtyAgeHisto.reset();
         mlogCompactorHisto.reset();
         getMultiHisto.reset();
+        checkpointLockWaitHisto.reset();
+        checkpointLockHoldHisto.reset();
     }
 
     // Used by stats logging infrastructure.
@@ -28,7 +28,8 @@ extern "C" {
 bool StatSnap::getStats() {
     map.clear();
     bool rv = engine->getStats(this, NULL, 0, add_stat) == ENGINE_SUCCESS &&
-              engine->getStats(this, "tap", 3, add_stat) == ENGINE_SUCCESS;
+              engine->getStats(this, "tap", 3, add_stat) == ENGINE_SUCCESS &&
+              engine->getStats(this, "hotkeys", 7, add_stat) == ENGINE_SUCCESS;
     if (rv && engine->isShutdownMode()) {
         map["ep_force_shutdown"] = engine->isForceShutdown() ? "true" : "false";
         std::stringstream ss;
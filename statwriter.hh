@@ -32,6 +32,12 @@ void add_casted_stat(const char *k, const Atomic<T> &v,
     add_casted_stat(k, v.get(), add_stat, cookie);
 }
 
+template <typename T>
+void add_casted_stat(const char *k, const StripedCounter<T> &v,
+                            ADD_STAT add_stat, const void *cookie) {
+    add_casted_stat(k, v.get(), add_stat, cookie);
+}
+
 /// @cond DETAILS
 /**
  * Convert a histogram into a bunch of calls to add stats.
@@ -60,6 +66,44 @@ void add_casted_stat(const char *k, const Histogram<T> &v,
     std::for_each(v.begin(), v.end(), a);
 }
 
+/**
+ * Report a log-linear histogram in the same form as the default
+ * Histogram (power of two bins), followed by its percentiles as
+ * k_p50, k_p99 and k_p99.9.
+ */
+template <typename T>
+void add_casted_stat(const char *k, const LogLinearHistogram<T> &v,
+                            ADD_STAT add_stat, const void *cookie) {
+    std::vector<size_t> counts;
+    size_t total = v.snapshot(counts);
+    if (total == 0) {
+        return;
+    }
+
+    std::vector<size_t> octaves(LogLinearHistogram<T>::NUM_OCTAVES, 0);
+    for (size_t i = 0; i < counts.size(); ++i) {
+        octaves[LogLinearHistogram<T>::octaveOf(i)] += counts[i];
+    }
+    for (size_t i = 0; i < octaves.size(); ++i) {
+        if (octaves[i]) {
+            std::stringstream ss;
+            ss << k << "_" << LogLinearHistogram<T>::octaveStart(i) << ","
+               << LogLinearHistogram<T>::octaveEnd(i);
+            add_casted_stat(ss.str().c_str(), octaves[i], add_stat, cookie);
+        }
+    }
+
+    static const char *names[] = { "p50", "p99", "p99.9" };
+    static const double pcts[] = { 50.0, 99.0, 99.9 };
+    for (size_t i = 0; i < sizeof(pcts) / sizeof(pcts[0]); ++i) {
+        std::stringstream ss;
+        ss << k << "_" << names[i];
+        add_casted_stat(ss.str().c_str(),
+                        LogLinearHistogram<T>::percentile(counts, total, pcts[i]),
+                        add_stat, cookie);
+    }
+}
+
 template <typename P, typename T>
 void add_prefixed_stat(P prefix, const char *nm, T val,
                   ADD_STAT add_stat, const void *cookie) {
@@ -78,6 +122,15 @@ void add_prefixed_stat(P prefix, const char *nm, Histogram<T> &val,
     add_casted_stat(name.str().c_str(), val, add_stat, cookie);
 }
 
+template <typename P, typename T>
+void add_prefixed_stat(P prefix, const char *nm, LogLinearHistogram<T> &val,
+                  ADD_STAT add_stat, const void *cookie) {
+    std::stringstream name;
+    name << prefix << ":" << nm;
+
+    add_casted_stat(name.str().c_str(), val, add_stat, cookie);
+}
+
 }
 
 using namespace STATWRITER_NAMESPACE;
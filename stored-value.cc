@@ -2,8 +2,10 @@
 #include "config.h"
 #include <cassert>
 #include <limits>
+#include <vector>
 
 #include "stored-value.hh"
+#include "objectregistry.hh"
 
 #ifndef DEFAULT_HT_SIZE
 #define DEFAULT_HT_SIZE 1531
@@ -12,6 +14,12 @@
 size_t HashTable::defaultNumBuckets = DEFAULT_HT_SIZE;
 size_t HashTable::defaultNumLocks = 193;
 enum stored_value_type HashTable::defaultStoredValueType = featured;
+bool HashTable::defaultOptimisticReads = false;
+enum hash_function_type HashTable::defaultHashFunction = hash_djb2;
+bool HashTable::defaultPowerOfTwoSize = false;
+bool HashTable::defaultSlabArena = false;
+bool HashTable::defaultPackEjected = false;
+volatile bool EpochReclaimer::enabled = false;
 double StoredValue::mutation_mem_threshold = 0.9;
 const int64_t StoredValue::state_id_cleared = -1;
 const int64_t StoredValue::state_id_pending = -2;
@@ -19,6 +27,24 @@ const int64_t StoredValue::state_deleted_key = -3;
 const int64_t StoredValue::state_non_existent_key = -4;
 const int64_t StoredValue::state_temp_init = -5;
 
+/**
+ * How many buckets of an in progress resize an operation on the hash
+ * table moves along the way.
+ */
+static const size_t resizeBucketsPerOp = 2;
+
+/**
+ * How many buckets completeResize() moves between releasing the
+ * resize lock.
+ */
+static const size_t resizeBucketsPerStep = 256;
+
+/**
+ * The most buckets a resize moves while holding their locks (which
+ * bounds how long it keeps operations waiting).
+ */
+static const size_t resizeBucketsPerLock = 16;
+
 static ssize_t prime_size_table[] = {
     3, 7, 13, 23, 47, 97, 193, 383, 769, 1531, 3067, 6143, 12289, 24571, 49157,
     98299, 196613, 393209, 786433, 1572869, 3145721, 6291449, 12582917,
@@ -35,6 +61,7 @@ bool StoredValue::ejectValue(EPStats &stats, HashTable &ht) {
         value_t sp(Blob::New(uval.chlen, sizeof(uval)));
         extra.feature.resident = false;
         timestampEviction();
+        releaseValue();
         value = sp;
         size_t newsize = size();
         size_t new_valsize = value->length();
@@ -65,8 +92,67 @@ bool StoredValue::ejectValue(EPStats &stats, HashTable &ht) {
     return false;
 }
 
+bool StoredValue::compressValue(EPStats &stats, HashTable &ht,
+                                size_t minSize, size_t maxRatio) {
+    if (!isResident() || isDirty() || isDeleted() || value->isCompressed()
+        || value->length() < minSize) {
+        return false;
+    }
+    Blob *compressed = Blob::NewCompressed(value->getData(), value->length(),
+                                           maxRatio);
+    if (compressed == NULL) {
+        ++stats.numFailedCompressions;
+        return false;
+    }
+
+    size_t oldsize = size();
+    size_t old_valsize = value->length();
+    releaseValue();
+    value.reset(compressed);
+    size_t newsize = size();
+    size_t new_valsize = value->length();
+
+    reduceCacheSize(ht, oldsize - newsize);
+    // Only the alignment padding of the key/meta data overhead may
+    // differ; the blob's own size is accounted for by the blob.
+    size_t old_keymeta_overhead = (oldsize - old_valsize);
+    size_t new_keymeta_overhead = (newsize - new_valsize);
+    if (old_keymeta_overhead < new_keymeta_overhead) {
+        increaseCurrentSize(stats, new_keymeta_overhead - old_keymeta_overhead);
+    } else if (new_keymeta_overhead < old_keymeta_overhead) {
+        reduceCurrentSize(stats, old_keymeta_overhead - new_keymeta_overhead);
+    }
+    ++stats.numValueCompressions;
+    return true;
+}
+
+bool StoredValue::uncompressValue(EPStats &stats, HashTable &ht) {
+    if (!isResident() || isDeleted() || !value->isCompressed()) {
+        return false;
+    }
+    Blob *raw = value->uncompress();
+    assert(raw);
+
+    size_t oldsize = size();
+    size_t old_valsize = value->length();
+    releaseValue();
+    value.reset(raw);
+    size_t newsize = size();
+    size_t new_valsize = value->length();
+
+    increaseCacheSize(ht, newsize - oldsize);
+    size_t old_keymeta_overhead = (oldsize - old_valsize);
+    size_t new_keymeta_overhead = (newsize - new_valsize);
+    if (old_keymeta_overhead < new_keymeta_overhead) {
+        increaseCurrentSize(stats, new_keymeta_overhead - old_keymeta_overhead);
+    } else if (new_keymeta_overhead < old_keymeta_overhead) {
+        reduceCurrentSize(stats, old_keymeta_overhead - new_keymeta_overhead);
+    }
+    return true;
+}
+
 void StoredValue::referenced(HashTable &ht) {
-    if (!_isSmall && extra.feature.nru == false) {
+    if (!_isSmall && !_isTiny && extra.feature.nru == false) {
         extra.feature.nru = true;
         ++ht.numReferenced;
     }
@@ -74,7 +160,7 @@ void StoredValue::referenced(HashTable &ht) {
 
 bool StoredValue::isReferenced(bool reset, HashTable *ht) {
     bool ret = false;
-    if (!_isSmall) {
+    if (!_isSmall && !_isTiny) {
         ret = extra.feature.nru;
         if (reset && extra.feature.nru) {
             extra.feature.nru = false;
@@ -85,8 +171,21 @@ bool StoredValue::isReferenced(bool reset, HashTable *ht) {
     return ret;
 }
 
+uint8_t StoredValue::updateAccessScore(HashTable &ht) {
+    if (_isSmall || _isTiny) {
+        return 0;
+    }
+    uint8_t history = extra.feature.access_history >> 1;
+    if (isReferenced(true, &ht)) {
+        history |= 0x8;
+    }
+    extra.feature.access_history = history;
+    return history;
+}
+
 bool StoredValue::unlocked_restoreValue(Item *itm, EPStats &stats,
                                         HashTable &ht) {
+    assert(!_isTiny);
     // If cas == we loaded the object from our meta file, but
     // we didn't know the size of the object.. Don't report
     // this as an unexpected size change.
@@ -122,6 +221,7 @@ bool StoredValue::unlocked_restoreValue(Item *itm, EPStats &stats,
         rel_time_t evicted_time(getEvictedTime());
         stats.pagedOutTimeHisto.add(ep_current_time() - evicted_time);
         extra.feature.resident = true;
+        releaseValue();
         value = itm->getValue();
 
         size_t newsize = size();
@@ -158,13 +258,13 @@ mutation_type_t HashTable::insert(const Item &itm, bool eject, bool partial) {
     StoredValue *v = unlocked_find(itm.getKey(), bucket_num, true, false);
 
     if (v == NULL) {
-        v = valFact(itm, values[bucket_num], *this);
+        v = valFact(itm, bucketHead(bucket_num), *this);
         v->markClean(NULL);
         if (partial) {
             v->extra.feature.resident = false;
             ++numNonResidentItems;
         }
-        values[bucket_num] = v;
+        bucketHead(bucket_num) = v;
         ++numItems;
     } else {
         if (partial) {
@@ -191,8 +291,8 @@ mutation_type_t HashTable::insert(const Item &itm, bool eject, bool partial) {
 
     v->markClean(NULL);
 
-    if (eject && !partial) {
-        v->ejectValue(stats, *this);
+    if (eject && !partial && v->ejectValue(stats, *this)) {
+        unlocked_pack(v, bucket_num);
     }
 
     return NOT_FOUND;
@@ -201,6 +301,7 @@ mutation_type_t HashTable::insert(const Item &itm, bool eject, bool partial) {
 
 bool StoredValue::unlocked_restoreMeta(Item *itm, ENGINE_ERROR_CODE status) {
     assert(state_deleted_key != getId() && state_non_existent_key != getId());
+    assert(!_isTiny);
     switch(status) {
     case ENGINE_SUCCESS:
         assert(0 == itm->getValue()->length());
@@ -251,6 +352,16 @@ void HashTable::setDefaultNumLocks(size_t to) {
     }
 }
 
+/**
+ * Set whether new hashtables allow optimistic reads.
+ */
+void HashTable::setDefaultOptimisticReads(bool to) {
+    if (to) {
+        EpochReclaimer::enable();
+    }
+    defaultOptimisticReads = to;
+}
+
 HashTableStatVisitor HashTable::clear(bool deactivate) {
     HashTableStatVisitor rv;
 
@@ -258,7 +369,8 @@ HashTableStatVisitor HashTable::clear(bool deactivate) {
         // If not deactivating, assert we're already active.
         assert(isActive());
     }
-    MultiLockHolder mlh(mutexes, n_locks);
+    LockHolder rlh(resizeLock);
+    MultiLockHolder mlh(mutexes, n_locks, lockSeqs);
     if (deactivate) {
         setActiveState(false);
     }
@@ -267,8 +379,29 @@ HashTableStatVisitor HashTable::clear(bool deactivate) {
             StoredValue *v = values[i];
             rv.visit(v);
             values[i] = v->next;
-            delete v;
+            releaseStoredValue(v);
+        }
+    }
+    if (oldValues) {
+        for (size_t i = migrated.get(); i < oldSize; i++) {
+            while (oldValues[i]) {
+                StoredValue *v = oldValues[i];
+                rv.visit(v);
+                oldValues[i] = v->next;
+                releaseStoredValue(v);
+            }
+        }
+        // Nothing left to move.
+        stats.memOverhead.decr(memorySize());
+        if (lockSeqs) {
+            EpochReclaimer::retire(oldValues);
+        } else {
+            free(oldValues);
         }
+        oldValues = NULL;
+        oldSize = 0;
+        migrated.set(0);
+        stats.memOverhead.incr(memorySize());
     }
 
     stats.currentSize.decr(rv.memSize - rv.valSize);
@@ -276,21 +409,32 @@ HashTableStatVisitor HashTable::clear(bool deactivate) {
 
     numItems.set(0);
     numTempItems.set(0);
+    numEvictedItems.set(0);
     numNonResidentItems.set(0);
     memSize.set(0);
     cacheSize.set(0);
     numReferenced.set(0);
     numReferencedEjects.set(0);
 
+    if (arena) {
+        // Hand back the slabs emptied above.
+        arena->releaseEmptySlabs();
+    }
+
     return rv;
 }
 
 void HashTable::resize(size_t newSize) {
     assert(isActive());
 
+    if (powerOfTwoSize) {
+        newSize = nextPowerOfTwo(newSize);
+    }
+
     // Due to the way hashing works, we can't fit anything larger than
-    // an int.
-    if (newSize > static_cast<size_t>(std::numeric_limits<int>::max())) {
+    // an int.  While resizing, buckets of both arrays are numbered
+    // together, so their sum has to fit as well.
+    if (newSize > static_cast<size_t>(std::numeric_limits<int>::max()) - size) {
         return;
     }
 
@@ -299,14 +443,23 @@ void HashTable::resize(size_t newSize) {
         return;
     }
 
-    MultiLockHolder mlh(mutexes, n_locks);
+    LockHolder rlh(resizeLock);
+    while (oldValues) {
+        if (!moveBuckets(resizeBucketsPerStep, true)) {
+            // Visitors are in the way, the next attempt will pick it up.
+            return;
+        }
+    }
+
+    MultiLockHolder mlh(mutexes, n_locks, lockSeqs);
     if (visitors.get() > 0) {
         // Do not allow a resize while any visitors are actually
         // processing.  The next attempt will have to pick it up.  New
-        // visitors cannot start doing meaningful work (we own all
-        // locks at this point).
+        // visitors cannot start doing meaningful work (we own the
+        // resize lock).
         return;
     }
+    hrtime_t start = gethrtime();
 
     // Get a place for the new items.
     StoredValue **newValues = static_cast<StoredValue**>(calloc(newSize,
@@ -319,29 +472,194 @@ void HashTable::resize(size_t newSize) {
     stats.memOverhead.decr(memorySize());
     ++numResizes;
 
-    // Set the new size so all the hashy stuff works.
-    size_t oldSize = size;
+    // Existing records stay where they are until resizeStep() gets to
+    // them.  getLockedBucket() finds the ones that haven't moved yet.
+    oldValues = values;
+    oldSize = size;
+    migrated.set(0);
+    values = newValues;
     size = newSize;
     ep_sync_synchronize();
 
-    // Move existing records into the new space.
-    for (size_t i = 0; i < oldSize; i++) {
-        while (values[i]) {
-            StoredValue *v = values[i];
-            values[i] = v->next;
+    stats.memOverhead.incr(memorySize());
+    assert(stats.memOverhead.get() < GIGANTOR);
 
-            int newBucket = getBucketForHash(hash(v->getKeyBytes(), v->getKeyLen()));
-            v->next = newValues[newBucket];
-            newValues[newBucket] = v;
+    resizePauseHisto.reset();
+    resizePauseHisto.add((gethrtime() - start) / 1000);
+}
+
+bool HashTable::resizeStep(size_t maxBuckets, bool wait) {
+    LockHolder rlh(resizeLock, NULL, !wait);
+    if (!rlh.isLocked()) {
+        return false;
+    }
+    return moveBuckets(maxBuckets, wait);
+}
+
+bool HashTable::completeResize() {
+    while (isResizing()) {
+        if (!resizeStep(resizeBucketsPerStep, true)) {
+            return false;
         }
     }
+    return true;
+}
 
-    // values still points to the old (now empty) table.
-    free(values);
-    values = newValues;
+void HashTable::helpResize() {
+    resizeStep(resizeBucketsPerOp, false);
+}
+
+/**
+ * Move up to maxBuckets buckets of the resize in progress.  The
+ * caller must hold the resize lock.
+ */
+bool HashTable::moveBuckets(size_t maxBuckets, bool wait) {
+    bool progress = false;
+    while (oldValues && maxBuckets > 0) {
+        if (visitors.get() > 0) {
+            // Items moving between buckets would confuse a visitor.
+            break;
+        }
+        size_t n = std::min(maxBuckets, resizeBucketsPerLock);
+        bool moved = migrated.get() < oldSize ? migrateBuckets(n, wait)
+                                               : finishResize(wait);
+        if (!moved) {
+            break;
+        }
+        maxBuckets -= n;
+        progress = true;
+    }
+    return progress;
+}
+
+/**
+ * Move the next n buckets of oldValues into values.
+ *
+ * The chains move while holding the locks of their buckets and of all
+ * the buckets their items are going to, so nobody can see one half
+ * moved.  Locks are taken in order, except for a destination's lock
+ * which is only taken out of order if it's free.  When one isn't,
+ * everything is dropped and taken again in order.
+ */
+bool HashTable::migrateBuckets(size_t n, bool wait) {
+    size_t first = migrated.get();
+    size_t last = std::min(oldSize, first + n);
+    std::vector<int> &stripes(resizeStripes);
+    std::vector<int> &targets(resizeTargets);
+    stripes.clear();
+    for (size_t i = first; i < std::min(last, first + n_locks); ++i) {
+        stripes.push_back(mutexForBucket(static_cast<int>(i)));
+    }
+    std::sort(stripes.begin(), stripes.end());
+
+    while (true) {
+        if (!lockStripes(stripes, wait)) {
+            return false;
+        }
+        hrtime_t start = gethrtime();
+
+        bool covered = true;
+        targets.clear();
+        for (size_t i = first; i < last; ++i) {
+            for (StoredValue *v = oldValues[i]; v; v = v->next) {
+                int b = getBucketForHash(hash(v->getKeyBytes(), v->getKeyLen()));
+                targets.push_back(b);
+                int lock_num = mutexForBucket(b);
+                if (!stripeHolders[lock_num]->isLocked() &&
+                    std::find(stripes.begin(), stripes.end(),
+                              lock_num) == stripes.end()) {
+                    stripes.push_back(lock_num);
+                    if (!stripeHolders[lock_num]->trylock()) {
+                        covered = false;
+                    }
+                }
+            }
+        }
+
+        if (covered) {
+            std::vector<int>::iterator target = targets.begin();
+            for (size_t i = first; i < last; ++i) {
+                while (oldValues[i]) {
+                    StoredValue *v = oldValues[i];
+                    oldValues[i] = v->next;
+                    v->next = values[*target];
+                    values[*target] = v;
+                    ++target;
+                }
+            }
+            migrated.set(last);
+        }
+        unlockStripes(stripes);
+        if (covered) {
+            resizePauseHisto.add((gethrtime() - start) / 1000);
+            return true;
+        }
+        if (!wait) {
+            return false;
+        }
+        std::sort(stripes.begin(), stripes.end());
+    }
+}
 
+/**
+ * Drop the old bucket array once every bucket has moved.
+ */
+bool HashTable::finishResize(bool wait) {
+    std::vector<int> &stripes(resizeStripes);
+    stripes.clear();
+    for (int i = 0; i < static_cast<int>(n_locks); ++i) {
+        stripes.push_back(i);
+    }
+    if (!lockStripes(stripes, wait)) {
+        return false;
+    }
+    hrtime_t start = gethrtime();
+
+    stats.memOverhead.decr(memorySize());
+    StoredValue **emptied = oldValues;
+    oldValues = NULL;
+    oldSize = 0;
+    migrated.set(0);
+    if (lockSeqs) {
+        EpochReclaimer::retire(emptied);
+    } else {
+        free(emptied);
+    }
     stats.memOverhead.incr(memorySize());
     assert(stats.memOverhead.get() < GIGANTOR);
+
+    unlockStripes(stripes);
+    resizePauseHisto.add((gethrtime() - start) / 1000);
+    return true;
+}
+
+/**
+ * Lock the given locks in the given (ascending) order.
+ *
+ * @return false if wait is false and one of them was busy, in which
+ *         case none of them are held
+ */
+bool HashTable::lockStripes(const std::vector<int> &stripes, bool wait) {
+    std::vector<int>::const_iterator it;
+    for (it = stripes.begin(); it != stripes.end(); ++it) {
+        if (wait) {
+            stripeHolders[*it]->lock();
+        } else if (!stripeHolders[*it]->trylock()) {
+            unlockStripes(stripes);
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Release whichever of the given locks are held.
+ */
+void HashTable::unlockStripes(const std::vector<int> &stripes) {
+    std::vector<int>::const_reverse_iterator it;
+    for (it = stripes.rbegin(); it != stripes.rend(); ++it) {
+        stripeHolders[*it]->unlock();
+    }
 }
 
 static size_t distance(size_t a, size_t b) {
@@ -362,6 +680,21 @@ void HashTable::resize() {
     int i(0);
     size_t new_size(0);
 
+    if (powerOfTwoSize) {
+        // Same policy as below, using powers of two instead of primes.
+        size_t upper = nextPowerOfTwo(ni);
+        size_t lower = upper > 1 ? upper >> 1 : upper;
+        if (upper < defaultNumBuckets) {
+            new_size = defaultNumBuckets;
+        } else if (size == lower || size == upper) {
+            new_size = size;
+        } else {
+            new_size = nearest(ni, lower, upper);
+        }
+        resize(new_size);
+        return;
+    }
+
     // Figure out where in the prime table we are.
     ssize_t target(static_cast<ssize_t>(ni));
     for (i = 0; prime_size_table[i] > 0 && prime_size_table[i] < target; ++i) {
@@ -391,33 +724,66 @@ void HashTable::visit(HashTableVisitor &visitor) {
         return;
     }
     VisitorTracker vt(&visitors);
+    {
+        // Let a resize step that's under way finish; no more will
+        // start while we're visiting.
+        LockHolder rlh(resizeLock);
+    }
     bool aborted = !visitor.shouldContinue();
     size_t visited = 0;
     for (int l = 0; isActive() && !aborted && l < static_cast<int>(n_locks); l++) {
-        LockHolder lh(mutexes[l]);
+        LockHolder lh(mutexes[l], lockSequence(l));
         for (int i = l; i < static_cast<int>(size); i+= n_locks) {
             assert(l == mutexForBucket(i));
-            StoredValue *v = values[i];
-            assert(v == NULL || i == getBucketForHash(hash(v->getKeyBytes(),
-                                                           v->getKeyLen())));
-            while (v) {
-                visitor.visit(v);
-                v = v->next;
-            }
+            assert(values[i] == NULL ||
+                   i == getBucketForHash(hash(values[i]->getKeyBytes(),
+                                              values[i]->getKeyLen())));
+            visitChain(visitor, &values[i]);
             ++visited;
         }
+        // Buckets a resize has already moved are empty.
+        for (int i = l; i < static_cast<int>(oldSize); i+= n_locks) {
+            visitChain(visitor, &oldValues[i]);
+        }
         lh.unlock();
         aborted = !visitor.shouldContinue();
     }
     assert(aborted || visited == size);
 }
 
+size_t HashTable::visitChain(HashTableVisitor &visitor, StoredValue **link) {
+    size_t visited = 0;
+    while (*link) {
+        ++visited;
+        StoredValue *v = *link;
+        visitor.visit(v);
+        // Pack whatever the visitor (e.g. the item pager) ejected.
+        if (packEjected && v->isPackable()) {
+            v = repack(link, tiny);
+        }
+        link = &v->next;
+    }
+    return visited;
+}
+
+size_t HashTable::visitBucket(uint32_t h, HashTableVisitor &visitor) {
+    if (!isActive()) {
+        return 0;
+    }
+    int bucket_num(0);
+    LockHolder lh = getLockedBucket(h, &bucket_num);
+    return visitChain(visitor, &bucketHead(bucket_num));
+}
+
 void HashTable::visitDepth(HashTableDepthVisitor &visitor) {
     if (numItems.get() == 0 || !isActive()) {
         return;
     }
     size_t visited = 0;
     VisitorTracker vt(&visitors);
+    {
+        LockHolder rlh(resizeLock);
+    }
 
     for (int l = 0; l < static_cast<int>(n_locks); l++) {
         LockHolder lh(mutexes[l]);
@@ -430,16 +796,143 @@ void HashTable::visitDepth(HashTableDepthVisitor &visitor) {
             while (p) {
                 depth++;
                 mem += p->size();
+                visitor.visitItem(p);
                 p = p->next;
             }
             visitor.visit(i, depth, mem);
             ++visited;
         }
+        // Buckets a resize hasn't moved yet are numbered after the
+        // new ones, as in getLockedBucket().
+        for (int i = l; i < static_cast<int>(oldSize); i+= n_locks) {
+            if (static_cast<size_t>(i) < migrated.get()) {
+                continue;
+            }
+            size_t depth = 0;
+            size_t mem(0);
+            for (StoredValue *p = oldValues[i]; p; p = p->next) {
+                depth++;
+                mem += p->size();
+                visitor.visitItem(p);
+            }
+            visitor.visit(static_cast<int>(size) + i, depth, mem);
+        }
     }
 
     assert(visited == size);
 }
 
+bool HashTable::setDefaultHashFunction(const char *t) {
+    bool rv = false;
+    if (t && strcmp(t, "djb2") == 0) {
+        defaultHashFunction = hash_djb2;
+        rv = true;
+    } else if (t && strcmp(t, "xxhash") == 0) {
+        defaultHashFunction = hash_xxhash;
+        rv = true;
+    } else if (t && strcmp(t, "crc32c") == 0 && crc32c_hw_available()) {
+        defaultHashFunction = hash_crc32c;
+        rv = true;
+    }
+    return rv;
+}
+
+enum hash_function_type HashTable::getDefaultHashFunction() {
+    return defaultHashFunction;
+}
+
+const char* HashTable::getHashFunctionStr(enum hash_function_type t) {
+    const char *rv = "unknown";
+    switch(t) {
+    case hash_djb2: rv = "djb2"; break;
+    case hash_xxhash: rv = "xxhash"; break;
+    case hash_crc32c: rv = "crc32c"; break;
+    default: abort();
+    }
+    return rv;
+}
+
+void HashTable::setDefaultPowerOfTwoSize(bool to) {
+    defaultPowerOfTwoSize = to;
+}
+
+void HashTable::setDefaultSlabArena(bool to) {
+    defaultSlabArena = to;
+}
+
+void HashTable::setDefaultPackEjected(bool to) {
+    defaultPackEjected = to;
+}
+
+StoredValue *HashTable::repack(StoredValue **link, enum stored_value_type t) {
+    StoredValue *v = *link;
+    size_t oldsize = v->size();
+    size_t old_keymeta_overhead = oldsize - v->heldValueLength();
+    size_t old_metadata = v->metaDataSize();
+
+    StoredValue *rv = valFact.convert(*v, t);
+    *link = rv;
+
+    size_t newsize = rv->size();
+    size_t new_keymeta_overhead = newsize - rv->heldValueLength();
+    StoredValue::reduceCacheSize(*this, oldsize);
+    StoredValue::increaseCacheSize(*this, newsize);
+    StoredValue::reduceCurrentSize(stats, old_keymeta_overhead);
+    StoredValue::increaseCurrentSize(stats, new_keymeta_overhead);
+    StoredValue::reduceMetaDataSize(*this, old_metadata);
+    StoredValue::increaseMetaDataSize(*this, rv->metaDataSize());
+    releaseStoredValue(v);
+    return rv;
+}
+
+void HashTable::unlocked_pack(StoredValue *v, int bucket_num) {
+    if (!packEjected || !v->isPackable()) {
+        return;
+    }
+    for (StoredValue **link = &bucketHead(bucket_num); *link;
+         link = &(*link)->next) {
+        if (*link == v) {
+            repack(link, tiny);
+            return;
+        }
+    }
+}
+
+bool HashTable::unlocked_evict(const std::string &key, int bucket_num) {
+    StoredValue *v = bucketHead(bucket_num);
+    while (v && !v->hasKey(key)) {
+        v = v->next;
+    }
+    if (!v || v->isResident() || v->isDirty() || v->isDeleted() ||
+        v->isTempItem() || v->isLocked(ep_current_time())) {
+        return false;
+    }
+    // Recreating the key mustn't reuse a seqno it had on disk.
+    updateMaxDeletedSeqno(v->getSeqno());
+    --numNonResidentItems;
+    bool deleted = unlocked_del(key, bucket_num);
+    assert(deleted);
+    ++numEvictedItems;
+    ++stats.numKeyEjects;
+    return true;
+}
+
+void HashTable::unlocked_restoreItem(StoredValue *v, Item *itm) {
+    assert(v->isTempInitialItem());
+    v->setValue(*itm, stats, *this, true);
+    v->markClean(NULL);
+    // Keep the disk id, so the next write isn't taken for a new item.
+    if (itm->getId() > 0) {
+        v->setId(itm->getId());
+    } else {
+        v->clearId();
+    }
+    --numTempItems;
+    ++numItems;
+    forgetEvictedItem();
+    v->referenced(*this);
+}
+
 bool HashTable::setDefaultStorageValueType(const char *t) {
     bool rv = false;
     if (t && strcmp(t, "featured") == 0) {
@@ -486,6 +979,11 @@ add_type_t HashTable::unlocked_add(int &bucket_num,
         }
         if (v) {
             rv = (v->isDeleted() || v->isExpired(ep_real_time())) ? ADD_UNDEL : ADD_SUCCESS;
+            if (v->isTempItem()) {
+                v->clearId();
+                --numTempItems;
+                ++numItems;
+            }
             v->setValue(itm, stats, *this, false);
             if (isDirty) {
                 v->markDirty();
@@ -493,8 +991,8 @@ add_type_t HashTable::unlocked_add(int &bucket_num,
                 v->markClean(NULL);
             }
         } else {
-            v = valFact(itm, values[bucket_num], *this, isDirty);
-            values[bucket_num] = v;
+            v = valFact(itm, bucketHead(bucket_num), *this, isDirty);
+            bucketHead(bucket_num) = v;
 
             if (v->isTempItem()) {
                 ++numTempItems;
@@ -546,16 +1044,12 @@ void StoredValue::setMutationMemoryThreshold(double memThreshold) {
 
 void StoredValue::increaseCacheSize(HashTable &ht, size_t by) {
     ht.cacheSize.incr(by);
-    assert(ht.cacheSize.get() < GIGANTOR);
     ht.memSize.incr(by);
-    assert(ht.memSize.get() < GIGANTOR);
 }
 
 void StoredValue::reduceCacheSize(HashTable &ht, size_t by) {
     ht.cacheSize.decr(by);
-    assert(ht.cacheSize.get() < GIGANTOR);
     ht.memSize.decr(by);
-    assert(ht.memSize.get() < GIGANTOR);
 }
 
 void StoredValue::increaseCurrentSize(EPStats &st, size_t by) {
@@ -573,12 +1067,10 @@ void StoredValue::reduceCurrentSize(EPStats &st, size_t by) {
 
 void StoredValue::increaseMetaDataSize(HashTable &ht, size_t by) {
     ht.metaDataMemory.incr(by);
-    assert(ht.metaDataMemory.get() < GIGANTOR);
 }
 
 void StoredValue::reduceMetaDataSize(HashTable &ht, size_t by) {
     ht.metaDataMemory.decr(by);
-    assert(ht.metaDataMemory.get() < GIGANTOR);
 }
 
 /**
@@ -592,8 +1084,357 @@ bool StoredValue::hasAvailableSpace(EPStats &st, const Item &itm) {
 }
 
 Item* StoredValue::toItem(bool lck, uint16_t vbucket) const {
-    return new Item(getKey(), getFlags(), getExptime(),
-                    value,
+    value_t v(getUncompressedValue());
+    if (_isTiny) {
+        // Hand out the same placeholder a featured item would have.
+        blobval uval;
+        uval.len = extra.tiny.vallen;
+        v.reset(Blob::New(uval.chlen, sizeof(uval)));
+    }
+    return new Item(getKeyBytes(), getKeyLen(), getFlags(), getExptime(), v,
                     lck ? static_cast<uint64_t>(-1) : getCas(),
                     id, vbucket, getSeqno());
 }
+
+StoredValue::StoredValue(const StoredValue &v, enum stored_value_type t) :
+    next(v.next), id(v.id), dirtiness(v.dirtiness), _inArena(false),
+    _isSmall(false), _isTiny(t == tiny), _isDirty(v._isDirty), flags(v.flags)
+{
+    blobval uval;
+    if (_isTiny) {
+        assert(v.isPackable());
+        std::memcpy(uval.chlen, v.value->getData(), sizeof(uval));
+        extra.tiny.cas = v.extra.feature.cas;
+        extra.tiny.seqno = static_cast<uint32_t>(v.extra.feature.seqno);
+        extra.tiny.exptime = v.extra.feature.exptime;
+        extra.tiny.vallen = uval.len;
+        extra.tiny.keylen = v.extra.feature.keylen;
+        std::memcpy(extra.tiny.keybytes, v.extra.feature.keybytes,
+                    v.extra.feature.keylen);
+    } else {
+        assert(v._isTiny && t == featured);
+        uval.len = v.extra.tiny.vallen;
+        value.reset(Blob::New(uval.chlen, sizeof(uval)));
+        extra.feature.cas = v.extra.tiny.cas;
+        extra.feature.seqno = v.extra.tiny.seqno;
+        extra.feature.exptime = v.extra.tiny.exptime;
+        extra.feature.lock_expiry = 0;
+        extra.feature.locked = false;
+        extra.feature.resident = false;
+        extra.feature.nru = false;
+        extra.feature.access_history = 0;
+        extra.feature.keylen = v.extra.tiny.keylen;
+        std::memcpy(extra.feature.keybytes, v.extra.tiny.keybytes,
+                    v.extra.tiny.keylen);
+    }
+}
+
+/**
+ * How many times optimisticGet() tries to beat concurrent writers
+ * before leaving the lookup to the locked path.
+ */
+static const int optimisticGetAttempts = 4;
+
+/**
+ * Longest chain optimisticGet() will walk.  A chain being rehashed
+ * under a reader can look arbitrarily long, so give up well before.
+ */
+static const int optimisticGetMaxDepth = 1024;
+
+bool HashTable::optimisticGet(const std::string &key, uint16_t vbucket,
+                              bool trackReference, Item **itm,
+                              bool *referenced) {
+    if (!lockSeqs || !isActive()) {
+        return false;
+    }
+
+    uint32_t h = hash(key);
+    EpochGuard guard;
+    for (int attempt = 0; attempt < optimisticGetAttempts; ++attempt) {
+        size_t currSize = size;
+        int bucket_num = getBucketForHash(h, currSize);
+        LockSequence &seq = lockSeqs[bucket_num % static_cast<int>(n_locks)];
+        uint64_t before = seq.get();
+        if (before & 1) {
+            continue;
+        }
+        ep_sync_synchronize();
+        StoredValue **vals = values;
+        if (size != currSize) {
+            continue;
+        }
+        if (oldSize != 0) {
+            // The key may not have been moved to vals yet.
+            return false;
+        }
+        // A resize holds every lock, so an unchanged sequence means the
+        // size and bucket array read above belong together.
+        ep_sync_synchronize();
+        if (seq.get() != before) {
+            continue;
+        }
+
+        StoredValue *v = vals[bucket_num];
+        int depth = 0;
+        while (v && depth < optimisticGetMaxDepth && !v->hasKey(key)) {
+            v = v->next;
+            ++depth;
+        }
+        if (depth == optimisticGetMaxDepth) {
+            continue;
+        }
+
+        bool found = v != NULL && !v->isDeleted();
+        bool needsLock = false;
+        bool nru = false;
+        uint64_t cas = 0;
+        uint64_t seqno = 0;
+        time_t exptime = 0;
+        uint32_t flags = 0;
+        int64_t id = 0;
+        value_t value;
+        if (found) {
+            if (v->_isTiny) {
+                needsLock = true;
+            } else if (!v->_isSmall) {
+                const struct feature_data &fd = v->extra.feature;
+                needsLock = !fd.resident || fd.locked
+                    || (trackReference && !fd.nru);
+                nru = fd.nru;
+                cas = fd.cas;
+                seqno = fd.seqno;
+                exptime = fd.exptime;
+            }
+            flags = v->flags;
+            id = v->id;
+            value = v->value;
+            // Compressed values are uncompressed in place under the
+            // lock (see EventuallyPersistentStore::get).
+            if (value.get() != NULL && value->isCompressed()) {
+                needsLock = true;
+            }
+            if (exptime != 0 && exptime < ep_real_time()) {
+                needsLock = true;
+            }
+        }
+
+        ep_sync_synchronize();
+        if (seq.get() != before) {
+            continue;
+        }
+        if (needsLock) {
+            return false;
+        }
+
+        *itm = found ? new Item(key, flags, exptime, value, cas, id,
+                                vbucket, seqno) : NULL;
+        *referenced = nru;
+        return true;
+    }
+    return false;
+}
+
+/// @cond DETAILS
+
+/**
+ * Memory handed to EpochReclaimer, waiting for readers to move on.
+ */
+struct RetiredObject {
+    RetiredObject() : epoch(0), engine(NULL), storedValue(NULL),
+                      buckets(NULL) {}
+
+    void release() {
+        if (storedValue) {
+            StoredValue::destroy(storedValue);
+        }
+        storedValue = NULL;
+        free(buckets);
+        buckets = NULL;
+        value.reset();
+    }
+
+    uint64_t                    epoch;
+    EventuallyPersistentEngine *engine;
+    StoredValue                *storedValue;
+    StoredValue               **buckets;
+    value_t                     value;
+};
+
+/**
+ * Per-thread reclamation state.
+ *
+ * Slots are never freed.  The slot of an exited thread is reused by
+ * the next thread that needs one, along with whatever it had retired.
+ */
+struct EpochSlot {
+    EpochSlot() : epoch(0), inUse(1), depth(0), next(NULL) {}
+
+    //! Epoch this thread entered its read-side section in, or 0.
+    volatile uint64_t          epoch;
+    volatile int               inUse;
+    int                        depth;
+    //! Only contended by EpochReclaimer::drain().
+    SpinLock                   lock;
+    std::vector<RetiredObject> retired;
+    EpochSlot                 *next;
+};
+
+struct RetiredBefore {
+    RetiredBefore(uint64_t e) : epoch(e) {}
+    bool operator()(const RetiredObject &o) const { return o.epoch < epoch; }
+    uint64_t epoch;
+};
+
+struct RetiredBy {
+    RetiredBy(EventuallyPersistentEngine *e) : engine(e) {}
+    bool operator()(const RetiredObject &o) const { return o.engine == engine; }
+    EventuallyPersistentEngine *engine;
+};
+
+/// @endcond
+
+//! Number of objects a thread retires before trying to release them.
+static const size_t reclaimBatchSize = 128;
+
+static Atomic<uint64_t> globalEpoch(1);
+static AtomicPtr<EpochSlot> epochSlots;
+
+extern "C" {
+    static void releaseEpochSlot(void *p) {
+        EpochSlot *slot = static_cast<EpochSlot*>(p);
+        slot->depth = 0;
+        slot->epoch = 0;
+        ep_sync_synchronize();
+        slot->inUse = 0;
+    }
+}
+
+static ThreadLocal<EpochSlot*> threadEpochSlot(releaseEpochSlot);
+
+static EpochSlot *getEpochSlot() {
+    EpochSlot *slot = threadEpochSlot.get();
+    if (slot != NULL) {
+        return slot;
+    }
+
+    for (slot = epochSlots.get(); slot != NULL; slot = slot->next) {
+        if (slot->inUse == 0 &&
+            ep_sync_bool_compare_and_swap(&slot->inUse, 0, 1)) {
+            break;
+        }
+    }
+    if (slot == NULL) {
+        slot = new EpochSlot();
+        do {
+            slot->next = epochSlots.get();
+        } while (!epochSlots.cas(slot->next, slot));
+    }
+    threadEpochSlot.set(slot);
+    return slot;
+}
+
+/**
+ * Release the objects in the given slot matching the predicate.  The
+ * caller must hold the slot's lock.
+ */
+template <typename P>
+static void releaseRetired(EpochSlot *slot, const P &matches) {
+    EventuallyPersistentEngine *current = ObjectRegistry::getCurrentEngine();
+    EventuallyPersistentEngine *engine = current;
+    std::vector<RetiredObject> keep;
+    std::vector<RetiredObject>::iterator it;
+    for (it = slot->retired.begin(); it != slot->retired.end(); ++it) {
+        if (matches(*it)) {
+            // Account the memory to the bucket that retired it.
+            if (it->engine != engine) {
+                engine = it->engine;
+                ObjectRegistry::onSwitchThread(engine);
+            }
+            it->release();
+        } else {
+            keep.push_back(*it);
+        }
+    }
+    slot->retired.swap(keep);
+    if (engine != current) {
+        ObjectRegistry::onSwitchThread(current);
+    }
+}
+
+static void addRetired(RetiredObject &obj) {
+    EpochSlot *slot = getEpochSlot();
+    // The object must be unreachable before its epoch is sampled.
+    ep_sync_synchronize();
+    obj.epoch = globalEpoch.get();
+    obj.engine = ObjectRegistry::getCurrentEngine();
+
+    SpinLockHolder lh(&slot->lock);
+    slot->retired.push_back(obj);
+    if (slot->retired.size() < reclaimBatchSize) {
+        return;
+    }
+
+    // Anything retired before the epoch moved on is safe once no
+    // reader remains in an older epoch.
+    uint64_t safe = ++globalEpoch;
+    for (EpochSlot *s = epochSlots.get(); s != NULL; s = s->next) {
+        uint64_t e = s->epoch;
+        if (e != 0 && e < safe) {
+            safe = e;
+        }
+    }
+    releaseRetired(slot, RetiredBefore(safe));
+}
+
+void EpochReclaimer::enter() {
+    EpochSlot *slot = getEpochSlot();
+    if (slot->depth++ == 0) {
+        slot->epoch = globalEpoch.get();
+        ep_sync_synchronize();
+    }
+}
+
+void EpochReclaimer::exit() {
+    EpochSlot *slot = threadEpochSlot.get();
+    assert(slot != NULL && slot->depth > 0);
+    if (--slot->depth == 0) {
+        ep_sync_synchronize();
+        slot->epoch = 0;
+    }
+}
+
+void EpochReclaimer::retire(StoredValue *v) {
+    if (!isEnabled()) {
+        StoredValue::destroy(v);
+        return;
+    }
+    RetiredObject obj;
+    obj.storedValue = v;
+    addRetired(obj);
+}
+
+void EpochReclaimer::retire(const value_t &v) {
+    if (!isEnabled()) {
+        return;
+    }
+    RetiredObject obj;
+    obj.value = v;
+    addRetired(obj);
+}
+
+void EpochReclaimer::retire(StoredValue **buckets) {
+    if (!isEnabled()) {
+        free(buckets);
+        return;
+    }
+    RetiredObject obj;
+    obj.buckets = buckets;
+    addRetired(obj);
+}
+
+void EpochReclaimer::drain(EventuallyPersistentEngine *engine) {
+    for (EpochSlot *s = epochSlots.get(); s != NULL; s = s->next) {
+        SpinLockHolder lh(&s->lock);
+        releaseRetired(s, RetiredBy(engine));
+    }
+}
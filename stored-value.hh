@@ -5,13 +5,16 @@
 #include <climits>
 #include <cstring>
 #include <algorithm>
+#include <limits>
 
 #include "common.hh"
+#include "crc32c.h"
 #include "item.hh"
 #include "locks.hh"
 #include "stats.hh"
 #include "histo.hh"
 #include "queueditem.hh"
+#include "slab_arena.hh"
 
 extern "C" {
     extern rel_time_t (*ep_current_time)();
@@ -19,10 +22,21 @@ extern "C" {
 
 // Forward declaration for StoredValue
 class HashTable;
+class StoredValue;
 class StoredValueFactory;
+class EventuallyPersistentEngine;
+
+/**
+ * Types of stored values.
+ */
+enum stored_value_type {
+    small,                      //!< Small (minimally featured) stored values.
+    featured,                   //!< Full featured stored values.
+    tiny                        //!< Packed featured values whose value was ejected.
+};
 
 // One of the following structs overlays at the end of StoredItem.
-// This is figured out dynamically and stored in one bit in
+// This is figured out dynamically and stored in two bits in
 // StoredValue so it can figure it out at runtime.
 
 /**
@@ -44,6 +58,24 @@ struct feature_data {
     bool       locked : 1;      //!< True if this item is locked
     bool       resident : 1;    //!< True if this object's value is in memory.
     bool       nru : 1;         //!< True if referenced since last sweep
+    uint8_t    access_history : 4; //!< Access scans that found it referenced
+    uint8_t    keylen;          //!< Length of the key
+    char       keybytes[1];     //!< The key itself.
+};
+
+/**
+ * StoredValue "tiny" data type.
+ *
+ * What a featured value that has been ejected needs to keep.  It's
+ * not resident, locked or referenced, its sequence number fits in 32
+ * bits and the length of the ejected value is kept here instead of in
+ * a separately allocated blob.
+ */
+struct tiny_data {
+    uint64_t   cas;             //!< CAS identifier.
+    uint32_t   seqno;           //!< Revision id sequence number
+    uint32_t   exptime;         //!< Expiration time of this item.
+    uint32_t   vallen;          //!< Length of the ejected value.
     uint8_t    keylen;          //!< Length of the key
     char       keybytes[1];     //!< The key itself.
 };
@@ -54,6 +86,7 @@ struct feature_data {
 union stored_value_bodies {
     struct small_data   small;  //!< The small type.
     struct feature_data feature; //!< The featured type.
+    struct tiny_data    tiny;   //!< The packed type.
 };
 
 /**
@@ -64,6 +97,85 @@ union blobval {
     char     chlen[4];          //!< The length as a four byte integer
 };
 
+/**
+ * Deferred reclamation of memory that may still be read by optimistic
+ * (lock-free) hash table lookups.
+ *
+ * A reader brackets its lookup with an EpochGuard.  A writer that
+ * unlinks a StoredValue, drops a value or replaces the bucket array
+ * hands the old memory to retire() instead of releasing it, and it's
+ * released once every reader that may have observed it has left its
+ * epoch.  Until enabled, retiring anything releases it immediately.
+ */
+class EpochReclaimer {
+public:
+
+    /**
+     * Enter a read-side critical section on this thread (may nest).
+     */
+    static void enter();
+
+    /**
+     * Leave a read-side critical section on this thread.
+     */
+    static void exit();
+
+    /**
+     * Delete an unlinked StoredValue once no reader can reach it.
+     */
+    static void retire(StoredValue *v);
+
+    /**
+     * Hold a reference to a value until no reader can reach it.
+     */
+    static void retire(const value_t &v);
+
+    /**
+     * free() an old hash bucket array once no reader can reach it.
+     */
+    static void retire(StoredValue **buckets);
+
+    /**
+     * Release everything retired on behalf of the given engine.
+     *
+     * This ignores reader epochs, so it may only be called once no
+     * readers can be looking at that engine's hash tables.
+     */
+    static void drain(EventuallyPersistentEngine *engine);
+
+    /**
+     * Start deferring releases.  This can't be turned off again, as
+     * readers of existing hash tables may depend on it.
+     */
+    static void enable() {
+        enabled = true;
+    }
+
+    static bool isEnabled() {
+        return enabled;
+    }
+
+private:
+    static volatile bool enabled;
+};
+
+/**
+ * RAII holder of a read-side epoch.
+ */
+class EpochGuard {
+public:
+    EpochGuard() {
+        EpochReclaimer::enter();
+    }
+
+    ~EpochGuard() {
+        EpochReclaimer::exit();
+    }
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(EpochGuard);
+};
+
 /**
  * In-memory storage for an item.
  */
@@ -74,6 +186,19 @@ public:
         ::operator delete(p);
      }
 
+    /**
+     * Delete a StoredValue created by a StoredValueFactory, returning
+     * its memory to the slab arena it came from if any.
+     */
+    static void destroy(StoredValue *v) {
+        if (v->_inArena) {
+            v->~StoredValue();
+            SlabArena::deallocate(v);
+        } else {
+            delete v;
+        }
+    }
+
     /**
      * Update the "last used" time for the object.
      */
@@ -87,6 +212,28 @@ public:
 
     void referenced(HashTable &ht);
 
+    /**
+     * Shift the reference bit into the history of the last few access
+     * scans, clearing it, and return the history as a score.  Items
+     * referenced in more of the scans score higher, and the latest scan
+     * counts most.
+     */
+    uint8_t updateAccessScore(HashTable &ht);
+
+    /**
+     * How recently and how often this item has been used, without
+     * touching its reference bit: referenced since the last access scan
+     * counts more than any history of scans.  0 if not used lately (or
+     * if it's too small to keep track).
+     */
+    uint8_t getAccessScore() const {
+        if (_isSmall || _isTiny) {
+            return 0;
+        }
+        return static_cast<uint8_t>((extra.feature.nru << 4) |
+                                    extra.feature.access_history);
+    }
+
     /**
      * Mark this item as needing to be persisted.
      */
@@ -161,6 +308,8 @@ public:
     const char* getKeyBytes() const {
         if (_isSmall) {
             return extra.small.keybytes;
+        } else if (_isTiny) {
+            return extra.tiny.keybytes;
         } else {
             return extra.feature.keybytes;
         }
@@ -172,6 +321,8 @@ public:
     uint8_t getKeyLen() const {
         if (_isSmall) {
             return extra.small.keylen;
+        } else if (_isTiny) {
+            return extra.tiny.keylen;
         } else {
             return extra.feature.keylen;
         }
@@ -196,12 +347,24 @@ public:
     }
 
     /**
-     * Get this item's value.
+     * Get this item's value as it is held (possibly compressed).
      */
     const value_t &getValue() const {
         return value;
     }
 
+    /**
+     * Get this item's value, uncompressing it if it's held compressed.
+     */
+    value_t getUncompressedValue() const {
+        if (value.get() != NULL && value->isCompressed()) {
+            Blob *raw = value->uncompress();
+            assert(raw);
+            return value_t(raw);
+        }
+        return value;
+    }
+
     /**
      * Get the expiration time of this item.
      *
@@ -210,13 +373,18 @@ public:
     time_t getExptime() const {
         if (_isSmall) {
             return 0;
+        } else if (_isTiny) {
+            return extra.tiny.exptime;
         } else {
             return extra.feature.exptime;
         }
     }
 
     void setExptime(time_t tim) {
-        if (!_isSmall) {
+        if (_isTiny) {
+            extra.tiny.exptime = tim;
+            markDirty();
+        } else if (!_isSmall) {
             extra.feature.exptime = tim;
             markDirty();
         }
@@ -247,9 +415,11 @@ public:
      * @param preserveSeqno Preserve the sequence number from the item.
      */
     void setValue(Item &itm, EPStats &stats, HashTable &ht, bool preserveSeqno) {
+        assert(!_isTiny);
         size_t currSize = size();
         reduceCacheSize(ht, currSize);
         reduceCurrentSize(stats, isDeleted() ? currSize : currSize - value->length());
+        releaseValue();
         value = itm.getValue();
         setResident();
         flags = itm.getFlags();
@@ -274,6 +444,8 @@ public:
      */
     void resetValue() {
         assert(!isDeleted());
+        assert(!_isTiny);
+        releaseValue();
         value.reset();
         // item no longer resident once reset the value
         if (!_isSmall) {
@@ -282,9 +454,14 @@ public:
     }
 
     size_t valLength() {
-        if (isDeleted()) {
+        if (_isTiny) {
+            return extra.tiny.vallen;
+        } else if (isDeleted()) {
             return 0;
         } else if (isResident()) {
+            if (value->isCompressed()) {
+                return value->getUncompressedLength();
+            }
             return value->length();
         } else {
             // This is a special case for two phase warmup as an item's value size
@@ -310,6 +487,32 @@ public:
      */
     bool ejectValue(EPStats &stats, HashTable &ht);
 
+    /**
+     * Replace a resident value by a compressed copy of it.
+     *
+     * Only clean values are compressed; dirty ones are about to be
+     * read by the flusher anyway.
+     *
+     * @param stats the global stat instance
+     * @param ht the hashtable that contains this StoredValue instance
+     * @param minSize the smallest value worth compressing
+     * @param maxRatio the largest compressed size (in percent of the
+     *                 raw size) worth keeping
+     * @return true if the value was compressed
+     */
+    bool compressValue(EPStats &stats, HashTable &ht, size_t minSize,
+                       size_t maxRatio);
+
+    /**
+     * Replace a compressed value by its raw form, so that readers can
+     * share it instead of uncompressing their own copy.
+     *
+     * @param stats the global stat instance
+     * @param ht the hashtable that contains this StoredValue instance
+     * @return true if the value was uncompressed
+     */
+    bool uncompressValue(EPStats &stats, HashTable &ht);
+
     /**
      * Restore the value for this item.
      * @param itm the item to be restored
@@ -336,6 +539,8 @@ public:
     uint64_t getCas() const {
         if (_isSmall) {
             return 0;
+        } else if (_isTiny) {
+            return extra.tiny.cas;
         } else {
             return extra.feature.cas;
         }
@@ -365,7 +570,9 @@ public:
      * This is a NOOP for small item types.
      */
     void setCas(uint64_t c) {
-        if (!_isSmall) {
+        if (_isTiny) {
+            extra.tiny.cas = c;
+        } else if (!_isSmall) {
             extra.feature.cas = c;
         }
     }
@@ -376,6 +583,8 @@ public:
      * This is a NOOP for small item types.
      */
     void lock(rel_time_t expiry) {
+        // Packed items have to be unpacked (see HashTable::unlocked_find).
+        assert(!_isTiny);
         if (!_isSmall) {
             extra.feature.locked = true;
             extra.feature.lock_expiry = expiry;
@@ -386,7 +595,7 @@ public:
      * Unlock this item.
      */
     void unlock() {
-        if (!_isSmall) {
+        if (!_isSmall && !_isTiny) {
             extra.feature.locked = false;
             extra.feature.lock_expiry = 0;
         }
@@ -511,7 +720,7 @@ public:
         // This differs from valLength in that it reports the
         // *resident* length instead of the length of the actual value
         // as it existed.
-        size_t vallen = isDeleted() ? 0 : value->length();
+        size_t vallen = heldValueLength();
         size_t valign = 0;
         if (vallen % sizeof(void*) != 0) {
             valign = sizeof(void*) - vallen % sizeof(void*);
@@ -520,11 +729,49 @@ public:
         if (getKeyLen() % sizeof(void*) != 0) {
             kalign = sizeof(void*) - getKeyLen() % sizeof(void*);
         }
-        return sizeOf(_isSmall) + getKeyLen() + vallen + valign + kalign;
+        return sizeOf(getType()) + getKeyLen() + vallen + valign + kalign;
     }
 
     size_t metaDataSize() {
-        return sizeOf(_isSmall) + getKeyLen();
+        return sizeOf(getType()) + getKeyLen();
+    }
+
+    /**
+     * Get the length of the value (or ejected value placeholder) this
+     * object holds on to.
+     */
+    size_t heldValueLength() const {
+        return value.get() == NULL ? 0 : value->length();
+    }
+
+    /**
+     * Get the number of bytes an ejected item takes up less in the
+     * tiny representation than in the featured one (including the
+     * blob holding the length of the ejected value).
+     */
+    static size_t getPackedSaving() {
+        return sizeOf(featured) - sizeOf(tiny) + sizeof(Blob) + sizeof(blobval);
+    }
+
+    /**
+     * Get the representation of this object.
+     */
+    enum stored_value_type getType() const {
+        if (_isSmall) {
+            return small;
+        }
+        return _isTiny ? tiny : featured;
+    }
+
+    /**
+     * True if this is an ejected featured item that may be replaced by
+     * its tiny representation.
+     */
+    bool isPackable() const {
+        return !_isSmall && !_isTiny && !extra.feature.resident
+            && value.get() != NULL && value->length() == sizeof(blobval)
+            && !_isDirty && !extra.feature.locked && !extra.feature.nru
+            && extra.feature.seqno <= std::numeric_limits<uint32_t>::max();
     }
 
     /**
@@ -534,7 +781,7 @@ public:
      * @return true if the item is locked
      */
     bool isLocked(rel_time_t curtime) {
-        if (_isSmall) {
+        if (_isSmall || _isTiny) {
             return false;
         } else {
             if (extra.feature.locked && (curtime > extra.feature.lock_expiry)) {
@@ -551,6 +798,8 @@ public:
     bool isResident() const {
         if (_isSmall) {
             return true;
+        } else if (_isTiny) {
+            return false;
         } else {
             return extra.feature.resident;
         }
@@ -560,7 +809,7 @@ public:
      * True if this object is logically deleted.
      */
     bool isDeleted() const {
-        return value.get() == NULL;
+        return value.get() == NULL && !_isTiny;
     }
 
     /**
@@ -600,6 +849,8 @@ public:
     uint64_t getSeqno() const {
         if (_isSmall) {
             return 0;
+        } else if (_isTiny) {
+            return extra.tiny.seqno;
         } else {
             return extra.feature.seqno;
         }
@@ -611,7 +862,10 @@ public:
      * This is a NOOP for small item types.
      */
     void setSeqno(uint64_t s) {
-        if (!_isSmall) {
+        if (_isTiny) {
+            assert(s <= std::numeric_limits<uint32_t>::max());
+            extra.tiny.seqno = static_cast<uint32_t>(s);
+        } else if (!_isSmall) {
             extra.feature.seqno = s;
         }
     }
@@ -637,9 +891,23 @@ public:
      * @return the size in bytes required (minus key) for a StoredValue.
      */
     static size_t sizeOf(bool small) {
+        return sizeOf(small ? ::small : featured);
+    }
+
+    /**
+     * Get the size (minus key) of a StoredValue of the given type.
+     */
+    static size_t sizeOf(enum stored_value_type t) {
         // Subtract one because the length of the string is computed on demand.
         size_t base = sizeof(StoredValue) - sizeof(union stored_value_bodies) - 1;
-        return base + (small ? sizeof(struct small_data) : sizeof(struct feature_data));
+        switch (t) {
+        case small:
+            return base + sizeof(struct small_data);
+        case tiny:
+            return base + sizeof(struct tiny_data);
+        default:
+            return base + sizeof(struct feature_data);
+        }
     }
 
     /**
@@ -666,7 +934,8 @@ private:
     StoredValue(const Item &itm, StoredValue *n, EPStats &stats, HashTable &ht,
                 bool setDirty = true, bool small = false) :
         value(itm.getValue()), next(n), id(itm.getId()),
-        dirtiness(0), _isSmall(small), flags(itm.getFlags())
+        dirtiness(0), _inArena(false), _isSmall(small), _isTiny(false),
+        flags(itm.getFlags())
     {
 
         if (_isSmall) {
@@ -676,6 +945,8 @@ private:
             extra.feature.exptime = itm.getExptime();
             extra.feature.locked = false;
             extra.feature.resident = true;
+            extra.feature.nru = false;
+            extra.feature.access_history = 0;
             extra.feature.lock_expiry = 0;
             extra.feature.keylen = itm.getKey().length();
             extra.feature.seqno = itm.getSeqno();
@@ -692,12 +963,28 @@ private:
         increaseCurrentSize(stats, size() - value->length());
     }
 
+    /**
+     * Copy an ejected item into the tiny representation (t == tiny)
+     * or a tiny item back into the featured one.
+     */
+    StoredValue(const StoredValue &v, enum stored_value_type t);
+
     void setResident() {
         if (!_isSmall) {
             extra.feature.resident = true;
         }
     }
 
+    /**
+     * Called before the current value is replaced so that optimistic
+     * readers still looking at it don't see it freed underneath them.
+     */
+    void releaseValue() {
+        if (EpochReclaimer::isEnabled() && value) {
+            EpochReclaimer::retire(value);
+        }
+    }
+
     void timestampEviction() {
         assert(!isResident());
         dirtiness = ep_current_time() >> 2;
@@ -709,8 +996,10 @@ private:
     value_t            value;          // 16 bytes
     StoredValue        *next;          // 8 bytes
     int64_t            id;             // 8 bytes
-    uint32_t           dirtiness : 30; // 30 bits -+
+    uint32_t           dirtiness : 28; // 28 bits -+
+    bool               _inArena  :  1; // 1 bit    |
     bool               _isSmall  :  1; // 1 bit    | 4 bytes
+    bool               _isTiny   :  1; // 1 bit    |
     bool               _isDirty  :  1; // 1 bit  --+
     uint32_t           flags;          // 4 bytes
 
@@ -792,17 +1081,30 @@ public:
      * @param mem counted memory used by this hash table
      */
     virtual void visit(int bucket, int depth, size_t mem) = 0;
+
+    /**
+     * Called for each item of a hashtable bucket as it is counted,
+     * with the bucket locked.
+     *
+     * @param v the item
+     */
+    virtual void visitItem(StoredValue *v) {
+        (void)v;
+    }
 };
 
 /**
- * Hash table visitor that finds the min and max bucket depths.
+ * Hash table visitor that finds the min and max bucket depths, and
+ * counts the packed and compressed items on the way.
  */
 class HashTableDepthStatVisitor : public HashTableDepthVisitor {
 public:
 
     HashTableDepthStatVisitor() : depthHisto(GrowingWidthGenerator<unsigned int>(1, 1, 1.3),
                                              10),
-                                  size(0), memUsed(0), min(-1), max(0) {}
+                                  size(0), memUsed(0), min(-1), max(0),
+                                  numPacked(0), packedSavings(0),
+                                  numCompressed(0), compressedSavings(0) {}
 
     void visit(int bucket, int depth, size_t mem) {
         (void)bucket;
@@ -815,11 +1117,30 @@ public:
         memUsed += mem;
     }
 
+    void visitItem(StoredValue *v) {
+        if (v->getType() == tiny) {
+            ++numPacked;
+            packedSavings += StoredValue::getPackedSaving();
+        } else if (v->isResident() && !v->isDeleted() &&
+                   v->getValue()->isCompressed()) {
+            ++numCompressed;
+            compressedSavings += v->valLength() - v->heldValueLength();
+        }
+    }
+
     Histogram<unsigned int> depthHisto;
     size_t                  size;
     size_t                  memUsed;
     int                     min;
     int                     max;
+    //! Number of ejected items kept in the tiny representation.
+    size_t                  numPacked;
+    //! Bytes the tiny representation saves over the featured one.
+    size_t                  packedSavings;
+    //! Number of resident values held compressed.
+    size_t                  numCompressed;
+    //! Bytes compressed values take up less than their raw form.
+    size_t                  compressedSavings;
 };
 
 /**
@@ -829,18 +1150,28 @@ class HashTableStatVisitor : public HashTableVisitor {
 public:
 
     HashTableStatVisitor() : numNonResident(0), numTotal(0),
-                             memSize(0), valSize(0), cacheSize(0) {}
+                             memSize(0), valSize(0), cacheSize(0),
+                             numPacked(0), packedSavings(0),
+                             numCompressed(0), compressedSavings(0) {}
 
     void visit(StoredValue *v) {
         ++numTotal;
         memSize += v->size();
-        valSize += v->isDeleted() ? 0 : v->getValue()->length();
+        valSize += v->heldValueLength();
 
         if (v->isResident()) {
             cacheSize += v->size();
+            if (!v->isDeleted() && v->getValue()->isCompressed()) {
+                ++numCompressed;
+                compressedSavings += v->valLength() - v->heldValueLength();
+            }
         } else {
             ++numNonResident;
         }
+        if (v->getType() == tiny) {
+            ++numPacked;
+            packedSavings += StoredValue::getPackedSaving();
+        }
     }
 
     size_t numNonResident;
@@ -848,6 +1179,14 @@ public:
     size_t memSize;
     size_t valSize;
     size_t cacheSize;
+    //! Number of ejected items kept in the tiny representation.
+    size_t numPacked;
+    //! Bytes the tiny representation saves over the featured one.
+    size_t packedSavings;
+    //! Number of resident values held compressed.
+    size_t numCompressed;
+    //! Bytes compressed values take up less than their raw form.
+    size_t compressedSavings;
 };
 
 /**
@@ -877,11 +1216,12 @@ private:
 };
 
 /**
- * Types of stored values.
+ * Hash functions a HashTable may use for its keys.
  */
-enum stored_value_type {
-    small,                      //!< Small (minimally featured) stored values.
-    featured                    //!< Full featured stored values.
+enum hash_function_type {
+    hash_djb2,                  //!< The original DJB2 variant.
+    hash_xxhash,                //!< Word-at-a-time 64-bit xxHash mixing.
+    hash_crc32c                 //!< Hardware CRC32C (SSE 4.2).
 };
 
 /**
@@ -893,7 +1233,8 @@ public:
     /**
      * Create a new StoredValueFactory of the given type.
      */
-    StoredValueFactory(EPStats &s, enum stored_value_type t = featured) : stats(&s),type(t) { }
+    StoredValueFactory(EPStats &s, enum stored_value_type t = featured,
+                       SlabArena *a = NULL) : stats(&s), type(t), arena(a) { }
 
     /**
      * Create a new StoredValue with the given item.
@@ -917,8 +1258,27 @@ public:
         };
     }
 
+    /**
+     * Create a copy of an ejected featured StoredValue in the tiny
+     * representation, or of a tiny one in the featured representation.
+     *
+     * @param v the StoredValue to copy
+     * @param t the type of the copy (tiny or featured)
+     */
+    StoredValue *convert(const StoredValue &v, enum stored_value_type t) {
+        StoredValue *rv = new (allocate(StoredValue::sizeOf(t) + v.getKeyLen()))
+            StoredValue(v, t);
+        rv->_inArena = arena != NULL;
+        ep_sync_synchronize();
+        return rv;
+    }
+
 private:
 
+    void *allocate(size_t len) {
+        return arena ? arena->allocate(len) : ::operator new(len);
+    }
+
     StoredValue* newStoredValue(const Item &itm, StoredValue *n, HashTable &ht,
                                 bool setDirty, bool small) {
         size_t base = StoredValue::sizeOf(small);
@@ -927,19 +1287,24 @@ private:
         assert(key.length() < 256);
         size_t len = key.length() + base;
 
-        StoredValue *t = new (::operator new(len))
+        StoredValue *t = new (allocate(len))
             StoredValue(itm, n, *stats, ht, setDirty, small);
+        t->_inArena = arena != NULL;
         if (small) {
             std::memcpy(t->extra.small.keybytes, key.data(), key.length());
         } else {
             std::memcpy(t->extra.feature.keybytes, key.data(), key.length());
         }
+        // Optimistic readers may find this as soon as it's linked into
+        // a bucket, so it must be fully written before that happens.
+        ep_sync_synchronize();
 
         return t;
     }
 
     EPStats                *stats;
     enum stored_value_type  type;
+    SlabArena              *arena;
 
 };
 
@@ -958,15 +1323,33 @@ public:
      * @param t the type of StoredValues this hash table will contain
      */
     HashTable(EPStats &st, size_t s = 0, size_t l = 0,
-              enum stored_value_type t = featured) : stats(st), valFact(st, t) {
+              enum stored_value_type t = featured) : oldValues(NULL), oldSize(0),
+                                                     arena(NULL), stats(st),
+                                                     valFact(st, t) {
+        hashFunction = defaultHashFunction;
+        powerOfTwoSize = defaultPowerOfTwoSize;
+        packEjected = defaultPackEjected;
         size = HashTable::getNumBuckets(s);
+        if (powerOfTwoSize) {
+            size = nextPowerOfTwo(size);
+        }
         n_locks = HashTable::getNumLocks(l);
-        valFact = StoredValueFactory(st, getDefaultStorageValueType());
+        if (defaultSlabArena) {
+            arena = new SlabArena(st, StoredValue::sizeOf(false) +
+                                  std::numeric_limits<uint8_t>::max());
+        }
+        valFact = StoredValueFactory(st, getDefaultStorageValueType(), arena);
         assert(size > 0);
         assert(n_locks > 0);
         assert(visitors == 0);
         values = static_cast<StoredValue**>(calloc(size, sizeof(StoredValue*)));
         mutexes = new Mutex[n_locks];
+        lockSeqs = defaultOptimisticReads ? new LockSequence[n_locks] : NULL;
+        stripeHolders = new LockHolder*[n_locks];
+        for (size_t i = 0; i < n_locks; ++i) {
+            stripeHolders[i] = new LockHolder(mutexes[i], lockSequence(i));
+            stripeHolders[i]->unlock();
+        }
         activeState = true;
     }
 
@@ -976,15 +1359,26 @@ public:
         while (visitors > 0) {
             usleep(100);
         }
+        for (size_t i = 0; i < n_locks; ++i) {
+            delete stripeHolders[i];
+        }
+        delete []stripeHolders;
         delete []mutexes;
+        delete []lockSeqs;
         free(values);
         values = NULL;
+        if (arena) {
+            // Values waiting to be reclaimed may still be in the arena.
+            arena->orphan();
+        }
     }
 
     size_t memorySize() {
         return sizeof(HashTable)
             + (size * sizeof(StoredValue*))
-            + (n_locks * sizeof(Mutex));
+            + (oldSize * sizeof(StoredValue*))
+            + (n_locks * (sizeof(Mutex) + sizeof(LockHolder)))
+            + (lockSeqs ? n_locks * sizeof(LockSequence) : 0);
     }
 
     /**
@@ -998,9 +1392,34 @@ public:
     size_t getNumLocks(void) { return n_locks; }
 
     /**
-     * Get the number of items within this hash table.
+     * Get the number of items within this hash table, including the
+     * items evicted in full (whose keys are on disk only).
+     */
+    size_t getNumItems(void) { return numItems + numEvictedItems; }
+
+    /**
+     * Get the number of items whose keys are held in this hash table.
+     */
+    size_t getNumInMemoryItems(void) { return numItems; }
+
+    /**
+     * Get the number of items evicted in full from this hash table.
      */
-    size_t getNumItems(void) { return numItems; }
+    size_t getNumEvictedItems(void) { return numEvictedItems; }
+
+    /**
+     * Stop counting an item evicted in full, now it is back in memory.
+     */
+    void forgetEvictedItem(void) {
+        size_t val;
+        do {
+            val = numEvictedItems.get();
+            if (val == 0) {
+                // Nothing to forget: the key was never evicted in full.
+                return;
+            }
+        } while (!numEvictedItems.cas(val, val - 1));
+    }
 
     /**
      * Get the number of non-resident items within this hash table.
@@ -1053,9 +1472,56 @@ public:
 
     /**
      * Resize to the specified size.
+     *
+     * The new bucket array takes effect immediately, but items are
+     * only moved into it a few buckets at a time by resizeStep(),
+     * which operations on the table call whenever a resize is in
+     * progress.  An earlier resize still in progress is completed
+     * first.
      */
     void resize(size_t to);
 
+    /**
+     * Move some of the buckets of an in progress resize into the new
+     * bucket array, finishing the resize once all have moved.  Every
+     * bucket is moved while holding only the locks covering it and
+     * its items' new buckets.
+     *
+     * @param maxBuckets the number of buckets to move
+     * @param wait false to give up rather than wait for a busy lock
+     * @return true if any progress was made
+     */
+    bool resizeStep(size_t maxBuckets, bool wait);
+
+    /**
+     * Move all remaining buckets of an in progress resize.
+     *
+     * @return false if visitors prevented the resize from completing
+     */
+    bool completeResize();
+
+    /**
+     * True if items are still being moved by a resize.
+     */
+    bool isResizing() const {
+        return oldValues != NULL;
+    }
+
+    /**
+     * Get the number of buckets an in progress resize has yet to move.
+     */
+    size_t getResizeRemaining() {
+        return oldValues ? oldSize - migrated.get() : 0;
+    }
+
+    /**
+     * Get the times (in microseconds) the most recent resize held
+     * bucket locks, one sample each time it took them.
+     */
+    Histogram<hrtime_t> &getResizePauseHisto() {
+        return resizePauseHisto;
+    }
+
     /**
      * Find the item with the given key.
      *
@@ -1069,6 +1535,34 @@ public:
         return unlocked_find(key, bucket_num, false, trackReference);
     }
 
+    /**
+     * Look up a resident item without taking the bucket lock.
+     *
+     * The bucket's lock sequence is sampled before and after the read
+     * and the read is retried if a writer held the lock in between.
+     * Anything that would require modifying the StoredValue (expiry,
+     * an unset reference bit, a getl lock, a non-resident value) is
+     * left to the caller's locked path, as is a lookup that keeps
+     * losing to writers.
+     *
+     * @param key the key to find
+     * @param vbucket the vbucket the generated item belongs to
+     * @param trackReference true if the item must already be referenced
+     * @param itm output parameter receiving a new item, or NULL on a miss
+     * @param referenced output parameter receiving the reference bit
+     * @return true if the lookup was answered, false if the caller
+     *         must repeat it with the bucket locked
+     */
+    bool optimisticGet(const std::string &key, uint16_t vbucket,
+                       bool trackReference, Item **itm, bool *referenced);
+
+    /**
+     * True if this hash table supports optimisticGet().
+     */
+    bool isOptimistic() const {
+        return lockSeqs != NULL;
+    }
+
     /**
      * Add an item from online restore.
      *
@@ -1083,9 +1577,9 @@ public:
             return false;
         }
 
-        StoredValue *v = valFact(itm, values[bucket_num], *this);
+        StoredValue *v = valFact(itm, bucketHead(bucket_num), *this);
         assert(v);
-        values[bucket_num] = v;
+        bucketHead(bucket_num) = v;
         ++numItems;
         if (op == queue_op_del) {
             unlocked_softDelete(v, itm.getCas());
@@ -1124,14 +1618,35 @@ public:
                         bool allowExisting, bool hasMetaData = true,
                         bool trackReference=true) {
         assert(isActive());
+        int bucket_num(0);
+        LockHolder lh = getLockedBucket(val.getKey(), &bucket_num);
+        return unlocked_set(val, cas, row_id, bucket_num, allowExisting,
+                            hasMetaData, trackReference);
+    }
+
+    /**
+     * Unlocked version of the set() method.
+     *
+     * @param val the Item to store
+     * @param cas This is the cas value for the item <b>in</b> the cache
+     * @param row_id the row id that is assigned to the item to store
+     * @param bucket_num the locked partition where the key belongs
+     * @param allowExisting should we allow existing items or not
+     * @param hasMetaData should we keep the seqno the same or increment it
+     * @param trackReference true if we want to set the nru bit for the item
+     * @return a result indicating the status of the store
+     */
+    mutation_type_t unlocked_set(const Item &val, uint64_t cas,
+                                 int64_t &row_id, int bucket_num,
+                                 bool allowExisting, bool hasMetaData = true,
+                                 bool trackReference=true) {
+        assert(isActive());
         Item &itm = const_cast<Item&>(val);
         if (!StoredValue::hasAvailableSpace(stats, itm)) {
             return NOMEM;
         }
 
         mutation_type_t rv = NOT_FOUND;
-        int bucket_num(0);
-        LockHolder lh = getLockedBucket(val.getKey(), &bucket_num);
         StoredValue *v = unlocked_find(val.getKey(), bucket_num, true,
                                        trackReference);
 
@@ -1191,8 +1706,8 @@ public:
             if (!hasMetaData) {
                 itm.setCas();
             }
-            v = valFact(itm, values[bucket_num], *this);
-            values[bucket_num] = v;
+            v = valFact(itm, bucketHead(bucket_num), *this);
+            bucketHead(bucket_num) = v;
             ++numItems;
             if (trackReference && !v->isTempItem()) {
                 v->referenced(*this);
@@ -1360,9 +1875,14 @@ public:
      */
     StoredValue *unlocked_find(const std::string &key, int bucket_num,
                                bool wantsDeleted=false, bool trackReference=true) {
-        StoredValue *v = values[bucket_num];
-        while (v) {
+        StoredValue **link = &bucketHead(bucket_num);
+        while (*link) {
+            StoredValue *v = *link;
             if (v->hasKey(key)) {
+                if (v->_isTiny) {
+                    // Callers may modify what they find.
+                    v = repack(link, featured);
+                }
                 if (trackReference && !v->isDeleted()) {
                     v->referenced(*this);
                 }
@@ -1372,11 +1892,44 @@ public:
                     return NULL;
                 }
             }
-            v = v->next;
+            link = &v->next;
         }
         return NULL;
     }
 
+    /**
+     * Replace an ejected item by its tiny representation if it
+     * qualifies, assuming the bucket is locked.
+     *
+     * v may have been freed once this returns.
+     *
+     * @param v the item
+     * @param bucket_num the bucket containing the item
+     */
+    void unlocked_pack(StoredValue *v, int bucket_num);
+
+    /**
+     * Remove a clean item whose value was ejected, key and metadata
+     * included, assuming the bucket is locked (full eviction).  The
+     * item still counts towards getNumItems().
+     *
+     * @param key the key of the item
+     * @param bucket_num the bucket containing the item
+     *
+     * @return true if the item was removed
+     */
+    bool unlocked_evict(const std::string &key, int bucket_num);
+
+    /**
+     * Turn the temporary item created for a fully evicted key back
+     * into the (clean) item fetched from disk, assuming the bucket is
+     * locked.
+     *
+     * @param v the temporary item
+     * @param itm the item fetched from disk
+     */
+    void unlocked_restoreItem(StoredValue *v, Item *itm);
+
     /**
      * Compute a hash for the given string.
      *
@@ -1385,15 +1938,16 @@ public:
      *
      * @return the hash value
      */
-    inline int hash(const char *str, const size_t len) {
+    inline uint32_t hash(const char *str, const size_t len) {
         assert(isActive());
-        int h=5381;
-
-        for(size_t i=0; i < len; i++) {
-            h = ((h << 5) + h) ^ str[i];
+        switch (hashFunction) {
+        case hash_xxhash:
+            return xxHash(str, len);
+        case hash_crc32c:
+            return crc32cHash(str, len);
+        default:
+            return djb2Hash(str, len);
         }
-
-        return h;
     }
 
     /**
@@ -1402,7 +1956,7 @@ public:
      * @param s the string
      * @return the hash value
      */
-    inline int hash(const std::string &s) {
+    inline uint32_t hash(const std::string &s) {
         return hash(s.data(), s.length());
     }
 
@@ -1410,16 +1964,35 @@ public:
      * Get a lock holder holding a lock for the bucket for the given
      * hash.
      *
+     * While a resize is in progress, a key in an old bucket that
+     * hasn't been moved yet is found under that bucket's lock.
+     *
      * @param h the input hash
      * @param bucket output parameter to receive a bucket
      * @return a locked LockHolder
      */
-    inline LockHolder getLockedBucket(int h, int *bucket) {
+    inline LockHolder getLockedBucket(uint32_t h, int *bucket) {
+        if (oldValues) {
+            helpResize();
+        }
         while (true) {
             assert(isActive());
+            size_t currOldSize = oldSize;
+            if (currOldSize != 0) {
+                int old_bucket = getBucketForHash(h, currOldSize);
+                int lock_num = mutexForBucket(old_bucket);
+                LockHolder rv(mutexes[lock_num], lockSequence(lock_num));
+                // Moving a bucket requires its lock, so it stays put.
+                if (oldSize == currOldSize &&
+                    static_cast<size_t>(old_bucket) >= migrated.get()) {
+                    *bucket = static_cast<int>(size) + old_bucket;
+                    return rv;
+                }
+            }
             *bucket = getBucketForHash(h);
-            LockHolder rv(mutexes[mutexForBucket(*bucket)]);
-            if (*bucket == getBucketForHash(h)) {
+            int lock_num = mutexForBucket(*bucket);
+            LockHolder rv(mutexes[lock_num], lockSequence(lock_num));
+            if (*bucket == getBucketForHash(h) && !inOldBucket(h)) {
                 return rv;
             }
         }
@@ -1450,6 +2023,50 @@ public:
         return getLockedBucket(hash(s.data(), s.size()), bucket);
     }
 
+    /**
+     * Get the bucket for the given hash without locking it, provided it
+     * is guarded by the same lock as a bucket the caller holds from
+     * getLockedBucket().  Lets a batch of lookups sorted by
+     * lockForHash() find all of its keys behind a lock under a single
+     * acquisition of it.
+     *
+     * @param h the input hash
+     * @param locked a bucket whose lock the caller holds
+     * @param bucket output parameter to receive the bucket
+     * @return false if the key needs getLockedBucket() of its own
+     */
+    inline bool unlocked_getBucketUnder(uint32_t h, int locked, int *bucket) {
+        // Starting and finishing a resize take every lock, so neither
+        // size nor oldSize can change while the caller holds one.
+        if (oldSize != 0 || locked >= static_cast<int>(size)) {
+            return false;
+        }
+        int b = getBucketForHash(h);
+        if (mutexForBucket(b) != mutexForBucket(locked)) {
+            return false;
+        }
+        *bucket = b;
+        return true;
+    }
+
+    /**
+     * Get the lock currently guarding the bucket for the given hash.
+     * Only good for ordering a batch of lookups, as a resize may move
+     * the key before it is locked.
+     */
+    inline int lockForHash(uint32_t h) {
+        return mutexForBucket(getBucketForHash(h));
+    }
+
+    /**
+     * Prefetch the slot of the bucket for the given hash, so a batch of
+     * lookups overlaps the cache misses on the bucket array.  Nothing is
+     * read, so this is safe without the lock.
+     */
+    inline void prefetchBucket(uint32_t h) {
+        __builtin_prefetch(&values[getBucketForHash(h)]);
+    }
+
     /**
      * Delete a key from the cache without trying to lock the cache first
      * (Please note that you <b>MUST</b> acquire the mutex before calling
@@ -1461,7 +2078,7 @@ public:
      */
     bool unlocked_del(const std::string &key, int bucket_num) {
         assert(isActive());
-        StoredValue *v = values[bucket_num];
+        StoredValue *v = bucketHead(bucket_num);
 
         // Special case empty bucket.
         if (!v) {
@@ -1474,18 +2091,17 @@ public:
                 return false;
             }
 
-            values[bucket_num] = v->next;
+            bucketHead(bucket_num) = v->next;
             size_t currSize = v->size();
             StoredValue::reduceCacheSize(*this, currSize);
-            StoredValue::reduceCurrentSize(stats, v->isDeleted() ? currSize
-                                           : currSize - v->getValue()->length());
+            StoredValue::reduceCurrentSize(stats, currSize - v->heldValueLength());
             StoredValue::reduceMetaDataSize(*this, v->metaDataSize());
             if (v->isTempItem()) {
                 --numTempItems;
             } else {
                 --numItems;
             }
-            delete v;
+            releaseStoredValue(v);
             return true;
         }
 
@@ -1499,15 +2115,14 @@ public:
                 v->next = v->next->next;
                 size_t currSize = tmp->size();
                 StoredValue::reduceCacheSize(*this, currSize);
-                StoredValue::reduceCurrentSize(stats, tmp->isDeleted() ? currSize
-                                               : currSize - tmp->getValue()->length());
+                StoredValue::reduceCurrentSize(stats, currSize - tmp->heldValueLength());
                 StoredValue::reduceMetaDataSize(*this, tmp->metaDataSize());
                 if (tmp->isTempItem()) {
                     --numTempItems;
                 } else {
                     --numItems;
                 }
-                delete tmp;
+                releaseStoredValue(tmp);
                 return true;
             } else {
                 v = v->next;
@@ -1535,6 +2150,16 @@ public:
      */
     void visit(HashTableVisitor &visitor);
 
+    /**
+     * Visit the items in the bucket for the given hash (e.g. a random
+     * one, to sample the table without walking it all).
+     *
+     * @param h the hash picking the bucket
+     * @param visitor the visitor
+     * @return the number of items visited
+     */
+    size_t visitBucket(uint32_t h, HashTableVisitor &visitor);
+
     /**
      * Visit all items within this call with a depth visitor.
      */
@@ -1564,6 +2189,73 @@ public:
      */
     static void setDefaultNumLocks(size_t);
 
+    /**
+     * Enable optimistic reads for hash tables created from now on.
+     *
+     * Once enabled, memory that readers may still reach is reclaimed
+     * via EpochReclaimer for the rest of the process lifetime.
+     */
+    static void setDefaultOptimisticReads(bool to);
+
+    /**
+     * Set the hash function for new hash tables by name.
+     *
+     * @param t one of "djb2", "xxhash" or "crc32c"
+     *
+     * @return false if the name is unknown or the function isn't
+     *         supported on this machine (the default is left alone)
+     */
+    static bool setDefaultHashFunction(const char *t);
+
+    /**
+     * Get the hash function new hash tables will use.
+     */
+    static enum hash_function_type getDefaultHashFunction();
+
+    /**
+     * Get the name of a hash function.
+     */
+    static const char* getHashFunctionStr(enum hash_function_type t);
+
+    /**
+     * Set whether new hash tables use power of two bucket counts
+     * (selecting buckets by mask) rather than primes.
+     */
+    static void setDefaultPowerOfTwoSize(bool to);
+
+    /**
+     * Set whether new hash tables allocate their StoredValues from a
+     * slab arena of their own rather than the general heap.
+     */
+    static void setDefaultSlabArena(bool to);
+
+    /**
+     * Set whether new hash tables keep ejected items in the tiny
+     * representation.
+     */
+    static void setDefaultPackEjected(bool to);
+
+    /**
+     * Get the slab arena of this hash table (NULL if it has none).
+     */
+    SlabArena *getSlabArena() {
+        return arena;
+    }
+
+    /**
+     * Get the hash function used by this hash table.
+     */
+    enum hash_function_type getHashFunction() const {
+        return hashFunction;
+    }
+
+    /**
+     * True if this hash table's size is always a power of two.
+     */
+    bool isPowerOfTwoSize() const {
+        return powerOfTwoSize;
+    }
+
     /**
      * Set the stored value type by name.
      *
@@ -1610,16 +2302,16 @@ public:
     }
 
     Atomic<uint64_t>     maxDeletedSeqno;
-    Atomic<size_t>       numNonResidentItems;
+    StripedCounter<size_t> numNonResidentItems;
     Atomic<size_t>       numEjects;
-    Atomic<size_t>       numReferenced;
+    StripedCounter<size_t> numReferenced;
     Atomic<size_t>       numReferencedEjects;
     //! Memory consumed by items in this hashtable.
-    Atomic<size_t>       memSize;
+    StripedCounter<size_t> memSize;
     //! Cache size.
-    Atomic<size_t>       cacheSize;
+    StripedCounter<size_t> cacheSize;
     //! Meta-data size.
-    Atomic<size_t>       metaDataMemory;
+    StripedCounter<size_t> metaDataMemory;
 
 private:
     inline bool isActive() const { return activeState; }
@@ -1628,21 +2320,170 @@ private:
     size_t               size;
     size_t               n_locks;
     StoredValue        **values;
+    //! Buckets an incremental resize is moving into values (or NULL).
+    StoredValue        **oldValues;
+    size_t               oldSize;
+    //! The number of buckets of oldValues that have been moved.
+    Atomic<size_t>       migrated;
+    //! Serializes the steps of resizes against each other and visitors.
+    Mutex                resizeLock;
+    Histogram<hrtime_t>  resizePauseHisto;
+    //! A released holder of each lock for resize steps to take.
+    LockHolder         **stripeHolders;
+    //! Locks and new buckets of the resize step in progress.
+    std::vector<int>     resizeStripes;
+    std::vector<int>     resizeTargets;
     Mutex               *mutexes;
+    LockSequence        *lockSeqs;
+    SlabArena           *arena;
     EPStats&             stats;
     StoredValueFactory   valFact;
     Atomic<size_t>       visitors;
-    Atomic<size_t>       numItems;
+    StripedCounter<size_t> numItems;
     Atomic<size_t>       numResizes;
-    Atomic<size_t>       numTempItems;
+    StripedCounter<size_t> numTempItems;
+    Atomic<size_t>       numEvictedItems;
     bool                 activeState;
+    enum hash_function_type hashFunction;
+    bool                 powerOfTwoSize;
+    bool                 packEjected;
 
     static size_t                 defaultNumBuckets;
     static size_t                 defaultNumLocks;
     static enum stored_value_type defaultStoredValueType;
+    static bool                   defaultOptimisticReads;
+    static enum hash_function_type defaultHashFunction;
+    static bool                   defaultPowerOfTwoSize;
+    static bool                   defaultSlabArena;
+    static bool                   defaultPackEjected;
+
+    static size_t nextPowerOfTwo(size_t n) {
+        size_t rv = 1;
+        while (rv < n) {
+            rv <<= 1;
+        }
+        return rv;
+    }
+
+    int getBucketForHash(uint32_t h) {
+        return getBucketForHash(h, size);
+    }
 
-    int getBucketForHash(int h) {
-        return abs(h % static_cast<int>(size));
+    /**
+     * Get the head of the chain of a bucket from getLockedBucket().
+     * Numbers past the end of values are buckets of oldValues that a
+     * resize hasn't moved yet.
+     */
+    inline StoredValue *&bucketHead(int bucket_num) {
+        if (bucket_num < static_cast<int>(size)) {
+            return values[bucket_num];
+        }
+        return oldValues[bucket_num - static_cast<int>(size)];
+    }
+
+    /**
+     * True if the key with the given hash is still in a bucket of an
+     * in progress resize's old bucket array.
+     */
+    inline bool inOldBucket(uint32_t h) {
+        return oldSize != 0 &&
+            static_cast<size_t>(getBucketForHash(h, oldSize)) >= migrated.get();
+    }
+
+    void helpResize();
+    bool moveBuckets(size_t maxBuckets, bool wait);
+    bool migrateBuckets(size_t n, bool wait);
+    bool finishResize(bool wait);
+    bool lockStripes(const std::vector<int> &stripes, bool wait);
+    void unlockStripes(const std::vector<int> &stripes);
+
+    /**
+     * Get the bucket for a hash in a table of the given size.  Tables
+     * with a power of two size select by mask; the others keep the
+     * original signed modulo.
+     */
+    inline int getBucketForHash(uint32_t h, size_t sz) {
+        if (powerOfTwoSize) {
+            return static_cast<int>(h & (sz - 1));
+        }
+        return abs(static_cast<int>(h) % static_cast<int>(sz));
+    }
+
+public:
+
+    /**
+     * The original byte-at-a-time DJB2 variant.
+     */
+    static inline uint32_t djb2Hash(const char *str, size_t len) {
+        uint32_t h = 5381;
+        for (size_t i = 0; i < len; i++) {
+            h = ((h << 5) + h) ^ static_cast<uint32_t>(str[i]);
+        }
+        return h;
+    }
+
+    static inline uint64_t rotl64(uint64_t x, int r) {
+        return (x << r) | (x >> (64 - r));
+    }
+
+    /**
+     * Word-at-a-time 64-bit hash using the xxHash64 primes, rounds and
+     * final avalanche (identical to XXH64 with seed 0 for keys shorter
+     * than 32 bytes).  Every key bit affects every bit of the result,
+     * so masking off the low bits for a bucket is safe.
+     */
+    static inline uint32_t xxHash(const char *str, size_t len) {
+        static const uint64_t p1 = 11400714785074694791ULL;
+        static const uint64_t p2 = 14029467366897019727ULL;
+        static const uint64_t p3 = 1609587929392839161ULL;
+        static const uint64_t p4 = 9650029242287828579ULL;
+        static const uint64_t p5 = 2870177450012600261ULL;
+
+        const char *end = str + len;
+        uint64_t h = p5 + len;
+        for (; str + 8 <= end; str += 8) {
+            uint64_t k;
+            std::memcpy(&k, str, sizeof(k));
+            k *= p2;
+            k = rotl64(k, 31);
+            k *= p1;
+            h ^= k;
+            h = rotl64(h, 27) * p1 + p4;
+        }
+        if (str + 4 <= end) {
+            uint32_t k;
+            std::memcpy(&k, str, sizeof(k));
+            h ^= static_cast<uint64_t>(k) * p1;
+            h = rotl64(h, 23) * p2 + p3;
+            str += 4;
+        }
+        for (; str < end; ++str) {
+            h ^= static_cast<uint8_t>(*str) * p5;
+            h = rotl64(h, 11) * p1;
+        }
+        h ^= h >> 33;
+        h *= p2;
+        h ^= h >> 29;
+        h *= p3;
+        h ^= h >> 32;
+        return static_cast<uint32_t>(h);
+    }
+
+private:
+
+    /**
+     * CRC32C computed eight bytes at a time with the SSE 4.2 crc32
+     * instruction.  Only selectable when the CPU supports it.
+     */
+    static inline uint32_t crc32cHash(const char *str, size_t len) {
+#ifdef HAVE_HW_CRC32C
+        return ~crc32c_hw(0xffffffff, reinterpret_cast<const uint8_t*>(str),
+                          len);
+#else
+        (void)str;
+        (void)len;
+        abort();
+#endif
     }
 
     inline int mutexForBucket(int bucket_num) {
@@ -1654,6 +2495,21 @@ private:
         return lock_num;
     }
 
+    inline LockSequence *lockSequence(int lock_num) {
+        return lockSeqs ? &lockSeqs[lock_num] : NULL;
+    }
+
+    StoredValue *repack(StoredValue **link, enum stored_value_type t);
+    size_t visitChain(HashTableVisitor &visitor, StoredValue **link);
+
+    void releaseStoredValue(StoredValue *v) {
+        if (lockSeqs) {
+            EpochReclaimer::retire(v);
+        } else {
+            StoredValue::destroy(v);
+        }
+    }
+
     DISALLOW_COPY_AND_ASSIGN(HashTable);
 };
 
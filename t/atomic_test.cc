@@ -41,6 +41,49 @@ static void testAtomicInt() {
     assert(intgen.latest() == (numThreads * numIterations));
 }
 
+class StripedCounterTest : public Generator<int> {
+public:
+
+    StripedCounterTest() : i(0) {}
+
+    int operator()() {
+        for (size_t j = 0; j < numIterations; j++) {
+           ++i;
+           i.incr(2);
+           i.decr(1);
+        }
+        return 0;
+    }
+
+    size_t latest(void) { return i.get(); }
+
+private:
+    StripedCounter<size_t> i;
+};
+
+static void testStripedCounter() {
+    StripedCounterTest gen;
+    getCompletedThreads<int>(numThreads, &gen);
+    assert(gen.latest() == (2 * numThreads * numIterations));
+
+    // A counter may be taken down from a different thread, hence
+    // stripe, than the one that put it up.
+    StripedCounter<size_t> x(5);
+    x -= 7;
+    x += 3;
+    assert(x.get() == 1);
+    x = 42;
+    assert(x == 42);
+
+    // Seeing a decrement before the increment it pairs with reads as 0,
+    // not as a wrapped around huge value.
+    x = 0;
+    x -= 1;
+    assert(x.get() == 0);
+    x += 1;
+    assert(x.get() == 0);
+}
+
 static void testSetIfLess() {
     Atomic<int> x;
 
@@ -64,6 +107,7 @@ static void testSetIfBigger() {
 int main() {
     alarm(60);
     testAtomicInt();
+    testStripedCounter();
     testSetIfLess();
     testSetIfBigger();
 }
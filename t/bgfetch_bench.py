@@ -0,0 +1,96 @@
+#!/usr/bin/env python
+"""
+Measures background fetch latency against a dataset that is entirely
+on disk.
+
+Loads a number of items, waits for them to be persisted and evicts
+them all, then reads them back in random batches with getMulti, so
+every key in a batch needs a background fetch.  With -c the page cache
+is dropped before reading (needs root on the server host), so the
+fetches actually go to the disk.
+
+Usage: bgfetch_bench.py [-h host:port] [-n items] [-s value size]
+                        [-b batch size] [-r batches] [-c]
+"""
+
+import getopt
+import os
+import random
+import sys
+import time
+
+sys.path.append('../management')
+import mc_bin_client
+
+def disk_queue(mc):
+    stats = mc.stats()
+    return (int(stats['ep_queue_size']) + int(stats['ep_flusher_todo'])
+            + int(stats['ep_uncommitted_items']))
+
+def percentile(sorted_vals, p):
+    idx = int(round(p / 100.0 * (len(sorted_vals) - 1)))
+    return sorted_vals[idx]
+
+def load(mc, items, value):
+    for i in xrange(items):
+        mc.set('bgfetch:%d' % i, 0, 0, value)
+    while disk_queue(mc) > 0:
+        time.sleep(0.1)
+
+def evict_all(mc, items):
+    for i in xrange(items):
+        mc.evict_key('bgfetch:%d' % i)
+
+def drop_caches():
+    os.system('sync')
+    f = open('/proc/sys/vm/drop_caches', 'w')
+    f.write('3\n')
+    f.close()
+
+if __name__ == '__main__':
+    host, port = '127.0.0.1', 11211
+    items, size, batch, batches, cold = 100000, 1024, 32, 1000, False
+
+    opts, args = getopt.getopt(sys.argv[1:], 'h:n:s:b:r:c')
+    for o, a in opts:
+        if o == '-h':
+            host, port = a.split(':')
+            port = int(port)
+        elif o == '-n':
+            items = int(a)
+        elif o == '-s':
+            size = int(a)
+        elif o == '-b':
+            batch = int(a)
+        elif o == '-r':
+            batches = int(a)
+        elif o == '-c':
+            cold = True
+
+    mc = mc_bin_client.MemcachedClient(host, port)
+    mc.set_vbucket_state(0, 'active')
+    load(mc, items, 'x' * size)
+    evict_all(mc, items)
+    if cold:
+        drop_caches()
+
+    keys = range(items)
+    random.shuffle(keys)
+    fetched = int(mc.stats()['ep_bg_fetched'])
+    latencies = []
+    start = time.time()
+    for b in range(batches):
+        chunk = keys[b * batch % items:b * batch % items + batch]
+        if not chunk:
+            break
+        t = time.time()
+        mc.getMulti(['bgfetch:%d' % k for k in chunk])
+        latencies.append((time.time() - t) * 1000000)
+    elapsed = time.time() - start
+    fetched = int(mc.stats()['ep_bg_fetched']) - fetched
+
+    latencies.sort()
+    print '%d batches of %d keys, %d bg fetches in %.2fs (%d fetches/s)' % \
+        (len(latencies), batch, fetched, elapsed, fetched / elapsed)
+    print 'batch latency (us): p50 %d, p99 %d, max %d' % \
+        (percentile(latencies, 50), percentile(latencies, 99), latencies[-1])
@@ -6,6 +6,7 @@
 #include <vector>
 #include <set>
 #include <algorithm>
+#include <iostream>
 
 #include "assert.h"
 #include "queueditem.hh"
@@ -17,6 +18,9 @@
 #define NUM_SET_THREADS 4
 #define NUM_ITEMS 50000
 
+#define NUM_BENCH_KEYS 4000
+#define NUM_BENCH_MUTATIONS 100000
+
 EPStats global_stats;
 CheckpointConfig checkpoint_config;
 
@@ -142,10 +146,129 @@ static void *launch_set_thread(void *arg) {
 }
 }
 
+/**
+ * Queue a write-heavy workload (every key updated many times over while
+ * nothing drains the checkpoint) and report the memory overhead the
+ * checkpoint accounts for it.
+ */
+static void testWriteHeavyMemOverhead() {
+    RCPtr<VBucket> vbucket(new VBucket(1, vbucket_state_active, global_stats,
+                                       checkpoint_config));
+    size_t before = global_stats.memOverhead.get();
+    CheckpointManager *checkpoint_manager = new CheckpointManager(global_stats, 1,
+                                                                  checkpoint_config, 1);
+    for (int i = 0; i < NUM_BENCH_MUTATIONS; ++i) {
+        std::stringstream key;
+        key << "key-" << (i % NUM_BENCH_KEYS);
+        queued_item qi(new QueuedItem(key.str(), 1, queue_op_set));
+        checkpoint_manager->queueDirty(qi, vbucket);
+    }
+    assert(checkpoint_manager->getNumCheckpoints() == 1);
+    assert(checkpoint_manager->getNumItemsForPersistence() == NUM_BENCH_KEYS + 1);
+
+    size_t overhead = global_stats.memOverhead.get() - before;
+    std::cout << "Checkpoint overhead for " << NUM_BENCH_MUTATIONS << " mutations of "
+              << NUM_BENCH_KEYS << " keys: " << overhead << " bytes ("
+              << overhead / NUM_BENCH_KEYS << " bytes per key)" << std::endl;
+
+    // Every key comes out once, in the order of its last update.
+    std::vector<queued_item> items;
+    checkpoint_manager->getAllItemsForPersistence(items);
+    assert(items.size() == NUM_BENCH_KEYS + 1);
+    assert(items[0]->getOperation() == queue_op_checkpoint_start);
+    for (int i = 1; i <= NUM_BENCH_KEYS; ++i) {
+        std::stringstream key;
+        key << "key-" << (NUM_BENCH_MUTATIONS - NUM_BENCH_KEYS + i - 1) % NUM_BENCH_KEYS;
+        assert(items[i]->getKey() == key.str());
+    }
+
+    delete checkpoint_manager;
+    assert(global_stats.memOverhead.get() == before);
+}
+
+/**
+ * Read two checkpoints through the persistence cursor and a TAP cursor in
+ * bounded batches.
+ */
+static void testBatchedCursorReads() {
+    RCPtr<VBucket> vbucket(new VBucket(2, vbucket_state_active, global_stats,
+                                       checkpoint_config));
+    CheckpointManager *checkpoint_manager = new CheckpointManager(global_stats, 2,
+                                                                  checkpoint_config, 1);
+    checkpoint_manager->registerTAPCursor("tap");
+    for (int i = 0; i < 15; ++i) {
+        if (i == 10) {
+            assert(checkpoint_manager->createNewCheckpoint() == 2);
+        }
+        std::stringstream key;
+        key << "key-" << i;
+        queued_item qi(new QueuedItem(key.str(), 2, queue_op_set));
+        checkpoint_manager->queueDirty(qi, vbucket);
+    }
+
+    // checkpoint_start, 10 mutations, checkpoint_end, checkpoint_start, 5 mutations.
+    std::vector<queued_item> items;
+    assert(checkpoint_manager->getItemsForPersistence(items, 4, 1024 * 1024));
+    assert(items.size() == 4);
+    assert(items[0]->getOperation() == queue_op_checkpoint_start);
+    assert(checkpoint_manager->getPersistenceCursorPreChkId() == 0);
+    assert(checkpoint_manager->getItemsForPersistence(items, 4, 1024 * 1024));
+    assert(checkpoint_manager->getItemsForPersistence(items, 4, 1024 * 1024));
+    assert(items.size() == 12);
+    assert(items[11]->getOperation() == queue_op_checkpoint_end);
+    // A byte limit smaller than an item still makes progress.
+    assert(checkpoint_manager->getItemsForPersistence(items, 4, 1));
+    assert(items.size() == 13);
+    assert(items[12]->getOperation() == queue_op_checkpoint_start);
+    assert(checkpoint_manager->getPersistenceCursorPreChkId() == 1);
+    assert(!checkpoint_manager->getItemsForPersistence(items, 5, 1024 * 1024));
+    assert(items.size() == 18);
+    assert(items[17]->getKey() == "key-14");
+    assert(checkpoint_manager->getNumItemsForPersistence() == 0);
+    assert(!checkpoint_manager->getItemsForPersistence(items, 4, 1024 * 1024));
+    assert(items.size() == 18);
+
+    // The last mutation of a checkpoint comes alone, and checkpoint_end ends a batch.
+    bool isLastItem = false;
+    std::vector<queued_item> batch;
+    checkpoint_manager->getItemsForCursor("tap", batch, 100, 1024 * 1024, isLastItem);
+    assert(batch.size() == 10 && !isLastItem);
+    assert(batch[0]->getOperation() == queue_op_checkpoint_start);
+    assert(batch[9]->getKey() == "key-8");
+    batch.clear();
+    checkpoint_manager->getItemsForCursor("tap", batch, 100, 1024 * 1024, isLastItem);
+    assert(batch.size() == 1 && isLastItem);
+    assert(batch[0]->getKey() == "key-9");
+    batch.clear();
+    checkpoint_manager->getItemsForCursor("tap", batch, 100, 1024 * 1024, isLastItem);
+    assert(batch.size() == 1);
+    assert(batch[0]->getOperation() == queue_op_checkpoint_end);
+    batch.clear();
+    checkpoint_manager->getItemsForCursor("tap", batch, 3, 1024 * 1024, isLastItem);
+    assert(batch.size() == 3 && !isLastItem);
+    assert(batch[0]->getOperation() == queue_op_checkpoint_start);
+    batch.clear();
+    checkpoint_manager->getItemsForCursor("tap", batch, 100, 1024 * 1024, isLastItem);
+    assert(batch.size() == 2 && !isLastItem);
+    batch.clear();
+    checkpoint_manager->getItemsForCursor("tap", batch, 100, 1024 * 1024, isLastItem);
+    assert(batch.size() == 1 && isLastItem);
+    assert(batch[0]->getKey() == "key-14");
+    batch.clear();
+    checkpoint_manager->getItemsForCursor("tap", batch, 100, 1024 * 1024, isLastItem);
+    assert(batch.empty());
+    assert(checkpoint_manager->getNumItemsForTAPConnection("tap") == 0);
+
+    delete checkpoint_manager;
+}
+
 int main(int argc, char **argv) {
     (void)argc; (void)argv;
     putenv(strdup("ALLOW_NO_STATS_UPDATE=yeah"));
 
+    testWriteHeavyMemOverhead();
+    testBatchedCursorReads();
+
     HashTable::setDefaultNumBuckets(5);
     HashTable::setDefaultNumLocks(1);
     RCPtr<VBucket> vbucket(new VBucket(0, vbucket_state_active, global_stats, checkpoint_config));
@@ -56,6 +56,123 @@ bool TestCallback::callback(Dispatcher &d, TaskId t) {
     return thing->doSomething(d, t);
 }
 
+static Atomic<bool> blocked;
+
+/**
+ * Holds on to a worker until released.
+ */
+class BlockingCallback : public DispatcherCallback {
+public:
+    bool callback(Dispatcher &, TaskId) {
+        blocked.set(true);
+        while (blocked.get()) {
+            usleep(1);
+        }
+        return false;
+    }
+
+    std::string description() { return std::string("Blocking"); }
+};
+
+class CountingCallback : public DispatcherCallback {
+public:
+    bool callback(Dispatcher &, TaskId) {
+        ++callbacks;
+        return false;
+    }
+
+    std::string description() { return std::string("Counting"); }
+};
+
+static void testWorkerPool() {
+    Dispatcher pool(*engine, "Pool", 4);
+    assert(pool.getNumWorkers() == 4);
+    pool.start();
+
+    pool.schedule(shared_ptr<BlockingCallback>(new BlockingCallback),
+                  NULL, Priority::FlusherPriority, 0);
+    while (!blocked.get()) {
+        usleep(1);
+    }
+
+    // The other workers keep running tasks while one is blocked.
+    callbacks = 0;
+    for (int i = 0; i < 20; ++i) {
+        pool.schedule(shared_ptr<CountingCallback>(new CountingCallback),
+                      NULL, Priority::BgFetcherPriority, 0);
+    }
+    while (callbacks < 20) {
+        usleep(1);
+    }
+
+    DispatcherState ds(pool.getDispatcherState());
+    assert(ds.getWorkers().size() == 4);
+    assert(ds.isRunningTask());
+    assert(ds.getTaskName() == "Blocking");
+    size_t runs = 0;
+    std::vector<WorkerState>::const_iterator it;
+    for (it = ds.getWorkers().begin(); it != ds.getWorkers().end(); ++it) {
+        runs += it->getRuns();
+    }
+    assert(runs >= 21);
+
+    blocked.set(false);
+    pool.stop();
+    assert(pool.getState() == dispatcher_stopped);
+}
+
+static Atomic<int> inside;
+static Atomic<int> overlaps;
+
+/**
+ * Blocks like BlockingCallback, and notes a run that overlaps another.
+ */
+class ReentryCallback : public DispatcherCallback {
+public:
+    bool callback(Dispatcher &, TaskId) {
+        if (++inside > 1) {
+            ++overlaps;
+        }
+        blocked.set(true);
+        while (blocked.get()) {
+            usleep(1);
+        }
+        --inside;
+        ++callbacks;
+        return false;
+    }
+
+    std::string description() { return std::string("Reentry"); }
+};
+
+static void testWakeRunningTask() {
+    Dispatcher pool(*engine, "Pool", 4);
+    pool.start();
+
+    callbacks = 0;
+    TaskId task;
+    pool.schedule(shared_ptr<ReentryCallback>(new ReentryCallback),
+                  &task, Priority::FlusherPriority, 0);
+    while (!blocked.get()) {
+        usleep(1);
+    }
+
+    // Idle workers must not pick up the woken copy while it runs.
+    pool.wake(task, &task);
+    pool.reschedule(task);
+    usleep(10000);
+    assert(overlaps == 0);
+
+    while (callbacks < 3) {
+        blocked.set(false);
+        usleep(1000);
+    }
+    assert(overlaps == 0);
+
+    blocked.set(false);
+    pool.stop();
+}
+
 int main(int argc, char **argv) {
     (void)argc; (void)argv;
     int expected_num_callbacks=3;
@@ -87,5 +204,8 @@ int main(int argc, char **argv) {
     IdleTask it;
     assert(hrtime2text(it.maxExpectedDuration()) == std::string("3600 ms"));
 
+    testWorkerPool();
+    testWakeRunningTask();
+
     return 0;
 }
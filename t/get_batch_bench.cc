@@ -0,0 +1,190 @@
+#include "config.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+
+#include <ep.hh>
+#include <item.hh>
+#include <stats.hh>
+
+/*
+ * Compares serving multi-gets of random keys out of a large hash table
+ * one key at a time, the way EventuallyPersistentStore::get does it,
+ * with looking each batch up the way EventuallyPersistentStore::getBatch
+ * does it: hashes computed and bucket slots prefetched up front, the
+ * lock-free reads done first, and the rest done in the order of the
+ * bucket locks with one acquisition per lock.  Reports nanoseconds per
+ * key and lock acquisitions per key for batches of increasing size,
+ * with optimistic reads on and off (off, every key goes through a lock).
+ *
+ * Fetches from disk aren't covered; getBatch queues those to the
+ * background fetcher as one batch per vbucket.
+ *
+ * Usage: get_batch_bench [keys fetched per batch size]
+ */
+
+extern "C" {
+    static rel_time_t basic_current_time(void) {
+        return 0;
+    }
+
+    rel_time_t (*ep_current_time)() = basic_current_time;
+
+    time_t ep_real_time() {
+        return time(NULL);
+    }
+}
+
+EPStats global_stats;
+
+static const size_t numKeys = 1000000;
+
+static size_t lockAcquisitions;
+
+static std::vector<std::string> generateKeys(size_t num) {
+    std::vector<std::string> rv;
+    for (size_t i = 0; i < num; i++) {
+        char buf[64];
+        snprintf(buf, sizeof(buf), "get_batch_bench::user::%08d",
+                 static_cast<int>(i));
+        rv.push_back(std::string(buf));
+    }
+    return rv;
+}
+
+static Item *get(HashTable &h, const std::string &key) {
+    Item *itm = NULL;
+    bool referenced = false;
+    if (h.optimisticGet(key, 0, true, &itm, &referenced)) {
+        return itm;
+    }
+    int bucket_num(0);
+    LockHolder lh = h.getLockedBucket(key, &bucket_num);
+    ++lockAcquisitions;
+    StoredValue *v = h.unlocked_find(key, bucket_num, false, true);
+    return v ? v->toItem(false, 0) : NULL;
+}
+
+struct BatchKey {
+    bool operator<(const BatchKey &other) const {
+        return lock < other.lock;
+    }
+
+    const std::string *key;
+    uint32_t hash;
+    int lock;
+    Item *itm;
+};
+
+static void getBatch(HashTable &h, std::vector<BatchKey> &batch) {
+    std::vector<BatchKey>::iterator it;
+    for (it = batch.begin(); it != batch.end(); ++it) {
+        it->hash = h.hash(*it->key);
+        it->lock = h.lockForHash(it->hash);
+        it->itm = NULL;
+        h.prefetchBucket(it->hash);
+    }
+    std::sort(batch.begin(), batch.end());
+
+    std::vector<BatchKey*> locked;
+    for (it = batch.begin(); it != batch.end(); ++it) {
+        bool referenced = false;
+        if (!h.optimisticGet(*it->key, 0, true, &it->itm, &referenced)) {
+            locked.push_back(&*it);
+        }
+    }
+
+    size_t i = 0;
+    while (i < locked.size()) {
+        int lockedBucket(0);
+        LockHolder lh = h.getLockedBucket(locked[i]->hash, &lockedBucket);
+        ++lockAcquisitions;
+        int bucket_num = lockedBucket;
+        do {
+            StoredValue *v = h.unlocked_find(*locked[i]->key, bucket_num,
+                                             false, true);
+            locked[i]->itm = v ? v->toItem(false, 0) : NULL;
+            ++i;
+        } while (i < locked.size() &&
+                 h.unlocked_getBucketUnder(locked[i]->hash, lockedBucket,
+                                           &bucket_num));
+    }
+}
+
+static void run(HashTable &h, const std::vector<std::string> &keys,
+                size_t batchSize, size_t total, bool batched) {
+    srand(42);
+    std::vector<BatchKey> batch(batchSize);
+    size_t batches = total / batchSize;
+
+    // Keeps the value accesses from being optimized away.
+    volatile char sink = 0;
+    lockAcquisitions = 0;
+    hrtime_t start = gethrtime();
+    for (size_t b = 0; b < batches; ++b) {
+        for (size_t i = 0; i < batchSize; ++i) {
+            batch[i].key = &keys[rand() % keys.size()];
+        }
+        if (batched) {
+            getBatch(h, batch);
+        } else {
+            for (size_t i = 0; i < batchSize; ++i) {
+                batch[i].itm = get(h, *batch[i].key);
+            }
+        }
+        for (size_t i = 0; i < batchSize; ++i) {
+            assert(batch[i].itm);
+            sink += batch[i].itm->getData()[0];
+            delete batch[i].itm;
+        }
+    }
+    hrtime_t elapsed = gethrtime() - start;
+    size_t fetched = batches * batchSize;
+
+    printf(" %10.0f %7.2f", static_cast<double>(elapsed) / fetched,
+           static_cast<double>(lockAcquisitions) / fetched);
+}
+
+static void runAll(const std::vector<std::string> &keys, size_t total,
+                   bool optimistic) {
+    HashTable::setDefaultOptimisticReads(optimistic);
+    HashTable h(global_stats);
+    HashTable::setDefaultOptimisticReads(false);
+    h.resize(keys.size());
+
+    std::string value(256, 'x');
+    std::vector<std::string>::const_iterator it;
+    for (it = keys.begin(); it != keys.end(); ++it) {
+        Item i(*it, 0, 0, value.data(), value.length());
+        int64_t row_id = -1;
+        h.set(i, row_id);
+    }
+
+    printf("optimistic reads %s\n", optimistic ? "on" : "off");
+    printf("%8s %18s %18s\n", "", "per key", "batched");
+    printf("%8s %10s %7s %10s %7s\n", "batch", "ns/key", "locks",
+           "ns/key", "locks");
+    for (size_t size = 10; size <= 1000; size *= 10) {
+        printf("%8d", static_cast<int>(size));
+        run(h, keys, size, total, false);
+        run(h, keys, size, total, true);
+        printf("\n");
+    }
+}
+
+int main(int argc, char **argv) {
+    putenv(strdup("ALLOW_NO_STATS_UPDATE=yeah"));
+    global_stats.setMaxDataSize(std::numeric_limits<size_t>::max());
+
+    size_t total = argc > 1 ? strtoul(argv[1], NULL, 10) : 1000000;
+    std::vector<std::string> keys = generateKeys(numKeys);
+
+    printf("%d keys like \"%s\", %d keys fetched per batch size\n",
+           static_cast<int>(numKeys), keys.back().c_str(),
+           static_cast<int>(total));
+    runAll(keys, total, true);
+    runAll(keys, total, false);
+    return 0;
+}
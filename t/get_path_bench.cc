@@ -0,0 +1,173 @@
+#include "config.h"
+
+#include <sys/uio.h>
+
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+#include <ep.hh>
+#include <item.hh>
+#include <stats.hh>
+
+/*
+ * Measures the cost of serving a GET out of the hash table the way
+ * EventuallyPersistentStore::get does it (an optimistic read, falling
+ * back to the bucket lock), handing the value to memcached the way
+ * get_item_info does and releasing the Item again.  Reports nanoseconds
+ * and heap allocations per get for values of increasing size:
+ *
+ * - raw: values stored as they came in,
+ * - compressed: values compressed by the value compressor; the first
+ *   read of a value uncompresses it in place,
+ * - copying: compressed values read without uncompressing them in
+ *   place, so every read uncompresses its own copy.
+ *
+ * As the Item shares the value with the hash table, neither the time
+ * nor the allocations per get should grow with the value size other
+ * than for copying reads.
+ *
+ * Usage: get_path_bench [gets per value size]
+ */
+
+extern "C" {
+    static rel_time_t basic_current_time(void) {
+        return 0;
+    }
+
+    rel_time_t (*ep_current_time)() = basic_current_time;
+
+    time_t ep_real_time() {
+        return time(NULL);
+    }
+}
+
+EPStats global_stats;
+
+static size_t allocations;
+
+void *operator new(size_t len) throw(std::bad_alloc) {
+    ++allocations;
+    void *p = malloc(len == 0 ? 1 : len);
+    if (p == NULL) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void *p) throw() {
+    free(p);
+}
+
+static const size_t numKeys = 1000;
+
+enum read_mode {
+    raw,
+    compressed,
+    copying
+};
+
+static std::vector<std::string> generateKeys(size_t num) {
+    std::vector<std::string> rv;
+    for (size_t i = 0; i < num; i++) {
+        char buf[64];
+        snprintf(buf, sizeof(buf), "get_path_bench::user::%08d",
+                 static_cast<int>(i));
+        rv.push_back(std::string(buf));
+    }
+    return rv;
+}
+
+class CompressingVisitor : public HashTableVisitor {
+public:
+    CompressingVisitor(HashTable &ht) : h(ht) {}
+
+    void visit(StoredValue *v) {
+        v->markClean(NULL);
+        v->compressValue(global_stats, h, 0, 100);
+    }
+
+private:
+    HashTable &h;
+};
+
+static Item *get(HashTable &h, const std::string &key, bool inPlace) {
+    Item *itm = NULL;
+    bool referenced = false;
+    if (h.optimisticGet(key, 0, true, &itm, &referenced)) {
+        return itm;
+    }
+    int bucket_num(0);
+    LockHolder lh = h.getLockedBucket(key, &bucket_num);
+    StoredValue *v = h.unlocked_find(key, bucket_num, false, true);
+    if (v == NULL) {
+        return NULL;
+    }
+    if (inPlace) {
+        v->uncompressValue(global_stats, h);
+    }
+    return v->toItem(false, 0);
+}
+
+static void run(const std::vector<std::string> &keys, size_t valueSize,
+                size_t gets, enum read_mode mode) {
+    HashTable::setDefaultOptimisticReads(true);
+    HashTable h(global_stats);
+    HashTable::setDefaultOptimisticReads(false);
+
+    std::string value(valueSize, 'x');
+    std::vector<std::string>::const_iterator it;
+    for (it = keys.begin(); it != keys.end(); ++it) {
+        value.replace(0, std::min(it->length(), valueSize), *it);
+        Item i(*it, 0, 0, value.data(), value.length());
+        int64_t row_id = -1;
+        h.set(i, row_id);
+    }
+    if (mode != raw) {
+        CompressingVisitor cv(h);
+        h.visit(cv);
+    }
+
+    // Keeps the value accesses from being optimized away.
+    volatile char sink = 0;
+    size_t before = allocations;
+    hrtime_t start = gethrtime();
+    for (size_t i = 0; i < gets; ++i) {
+        Item *itm = get(h, keys[i % keys.size()], mode != copying);
+        assert(itm);
+        struct iovec iov;
+        iov.iov_base = const_cast<char*>(itm->getData());
+        iov.iov_len = itm->getNBytes();
+        sink += static_cast<char*>(iov.iov_base)[iov.iov_len - 1];
+        delete itm;
+    }
+    hrtime_t elapsed = gethrtime() - start;
+    size_t allocs = allocations - before;
+
+    printf(" %10.0f %7.2f", static_cast<double>(elapsed) / gets,
+           static_cast<double>(allocs) / gets);
+}
+
+int main(int argc, char **argv) {
+    putenv(strdup("ALLOW_NO_STATS_UPDATE=yeah"));
+    global_stats.setMaxDataSize(std::numeric_limits<size_t>::max());
+
+    size_t gets = argc > 1 ? strtoul(argv[1], NULL, 10) : 100000;
+    std::vector<std::string> keys = generateKeys(numKeys);
+
+    printf("%d keys like \"%s\", %d gets per value size\n",
+           static_cast<int>(numKeys), keys.back().c_str(),
+           static_cast<int>(gets));
+    printf("%8s %18s %18s %18s\n", "", "raw", "compressed", "copying");
+    printf("%8s %10s %7s %10s %7s %10s %7s\n", "size", "ns/get", "allocs",
+           "ns/get", "allocs", "ns/get", "allocs");
+    for (size_t size = 64; size <= 1024 * 1024; size *= 4) {
+        printf("%8d", static_cast<int>(size));
+        run(keys, size, gets, raw);
+        run(keys, size, gets, compressed);
+        run(keys, size, gets, copying);
+        printf("\n");
+    }
+    return 0;
+}
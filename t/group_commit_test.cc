@@ -0,0 +1,94 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+#include "config.h"
+
+#include <cassert>
+
+#include "couch-kvstore/group-commit.hh"
+
+static void testFixed() {
+    GroupCommitController gc(100, 1000, 0);
+    assert(!gc.isAdaptive());
+    assert(!gc.shouldCommit(99, 10000000));
+    assert(gc.shouldCommit(100, 0));
+    for (int i = 0; i < 10; ++i) {
+        gc.committed(100, 500000, 500000, 2.0);
+    }
+    assert(gc.getBatchSize() == 100);
+    assert(gc.getCommitInterval() == 0);
+    assert(gc.getCommitTime() == 500000);
+    assert(gc.getQueuePressure() == 200);
+}
+
+static void testBounds() {
+    GroupCommitController gc(5000, 1000, 100000);
+    assert(gc.getBatchSize() == 1000);
+    GroupCommitController gc2(0, 0, 100000);
+    assert(gc2.getBatchSize() == 1);
+    assert(gc2.getMaxBatchSize() == 1);
+}
+
+static void testShrinkOnMissedTarget() {
+    // Fast commits, but docs wait too long for the batch to fill up.
+    GroupCommitController gc(1000, 4000, 100000);
+    for (int i = 0; i < 20; ++i) {
+        gc.committed(gc.getBatchSize(), 150000, 5000, 0.0);
+    }
+    assert(gc.getBatchSize() < 1000);
+    assert(gc.getNumShrinks() > 0);
+    assert(gc.getNumGrows() == 0);
+    // What's left of the target after the commit is the interval.
+    assert(gc.getCommitInterval() == 100000 - gc.getCommitTime());
+    assert(gc.shouldCommit(1, gc.getCommitInterval()));
+    assert(!gc.shouldCommit(1, gc.getCommitInterval() - 1));
+    assert(!gc.shouldCommit(0, gc.getCommitInterval()));
+}
+
+static void testGrowWhenWellWithinTarget() {
+    GroupCommitController gc(100, 4000, 100000);
+    for (int i = 0; i < 20; ++i) {
+        gc.committed(gc.getBatchSize(), 1000, 2000, 0.0);
+    }
+    assert(gc.getBatchSize() > 100);
+    assert(gc.getNumShrinks() == 0);
+
+    // Batches cut short by the interval don't say anything about
+    // larger ones.
+    size_t batch = gc.getBatchSize();
+    gc.committed(batch / 2, 1000, 2000, 0.0);
+    assert(gc.getBatchSize() == batch);
+}
+
+static void testGrowOnSlowCommits() {
+    // The fsync alone misses the target; smaller batches won't help.
+    GroupCommitController gc(100, 4000, 100000);
+    for (int i = 0; i < 10; ++i) {
+        gc.committed(gc.getBatchSize(), 1000, 200000, 0.0);
+    }
+    assert(gc.getBatchSize() > 100);
+    assert(gc.getNumShrinks() == 0);
+    assert(gc.getCommitInterval() == 0);
+}
+
+static void testGrowWhenBehind() {
+    GroupCommitController gc(100, 4000, 100000);
+    gc.committed(100, 150000, 5000, 0.0);
+    assert(gc.getCommitInterval() > 0);
+    for (int i = 0; i < 10; ++i) {
+        gc.committed(gc.getBatchSize(), 150000, 5000, 1.5);
+    }
+    assert(gc.getBatchSize() == 4000);
+    assert(gc.getCommitInterval() == 0);
+    assert(gc.getQueuePressure() == 150);
+    assert(!gc.shouldCommit(3999, 10000000));
+    assert(gc.shouldCommit(4000, 0));
+}
+
+int main() {
+    testFixed();
+    testBounds();
+    testShrinkOnMissedTarget();
+    testGrowWhenWellWithinTarget();
+    testGrowOnSlowCommits();
+    testGrowWhenBehind();
+    return 0;
+}
@@ -0,0 +1,250 @@
+#include "config.h"
+
+#include <pthread.h>
+
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+
+#include <ep.hh>
+#include <item.hh>
+#include <stats.hh>
+
+#include "threadtests.hh"
+
+/*
+ * Reports the bucket depths and hashing cost of each hash function and
+ * sizing policy for sequential keys, then compares the throughput of
+ * hash table gets through the bucket lock against
+ * HashTable::optimisticGet with 1 to 32 reader threads, with and
+ * without a thread concurrently rewriting the same keys.
+ *
+ * Usage: hash_table_bench [gets per reader thread]
+ */
+
+extern "C" {
+    static rel_time_t basic_current_time(void) {
+        return 0;
+    }
+
+    rel_time_t (*ep_current_time)() = basic_current_time;
+
+    time_t ep_real_time() {
+        return time(NULL);
+    }
+}
+
+EPStats global_stats;
+
+static const size_t numKeys = 100000;
+
+static std::vector<std::string> generateKeys(size_t num) {
+    std::vector<std::string> rv;
+    for (size_t i = 0; i < num; i++) {
+        char buf[32];
+        snprintf(buf, sizeof(buf), "user::%06d", static_cast<int>(i));
+        rv.push_back(std::string(buf));
+    }
+    return rv;
+}
+
+static void fill(HashTable &h, const std::vector<std::string> &keys) {
+    h.resize(keys.size());
+    std::vector<std::string>::const_iterator it;
+    for (it = keys.begin(); it != keys.end(); ++it) {
+        Item i(*it, 0, 0, it->c_str(), it->length());
+        int64_t row_id = -1;
+        h.set(i, row_id);
+    }
+}
+
+/**
+ * Depth stats plus the average number of entries a successful lookup
+ * has to compare against.
+ */
+class ProbeCountingVisitor : public HashTableDepthStatVisitor {
+public:
+    ProbeCountingVisitor() : probes(0), empty(0) {}
+
+    void visit(int bucket, int depth, size_t mem) {
+        HashTableDepthStatVisitor::visit(bucket, depth, mem);
+        probes += static_cast<size_t>(depth) * (depth + 1) / 2;
+        if (depth == 0) {
+            ++empty;
+        }
+    }
+
+    size_t probes;
+    size_t empty;
+};
+
+static void reportDepth(enum hash_function_type t, bool pow2,
+                        const std::vector<std::string> &keys) {
+    HashTable::setDefaultPowerOfTwoSize(pow2);
+    if (!HashTable::setDefaultHashFunction(HashTable::getHashFunctionStr(t))) {
+        return;
+    }
+    HashTable h(global_stats);
+    HashTable::setDefaultHashFunction("djb2");
+    HashTable::setDefaultPowerOfTwoSize(false);
+
+    fill(h, keys);
+    h.resize();
+    ProbeCountingVisitor depth;
+    h.visitDepth(depth);
+
+    size_t rounds = 20;
+    // Keeps the hashing from being optimized away.
+    volatile uint32_t sink = 0;
+    hrtime_t start = gethrtime();
+    for (size_t r = 0; r < rounds; ++r) {
+        std::vector<std::string>::const_iterator it;
+        for (it = keys.begin(); it != keys.end(); ++it) {
+            sink += h.hash(*it);
+        }
+    }
+    hrtime_t elapsed = gethrtime() - start;
+
+    printf("%7s %6s %8d %6d %8.1f%% %8.3f %8.2f\n",
+           HashTable::getHashFunctionStr(t), pow2 ? "pow2" : "prime",
+           static_cast<int>(h.getSize()), depth.max,
+           100.0 * depth.empty / h.getSize(),
+           static_cast<double>(depth.probes) / keys.size(),
+           static_cast<double>(elapsed) / (rounds * keys.size()));
+}
+
+/**
+ * Each reader thread gets a run of keys starting at its own offset.
+ */
+class ReadGenerator : public Generator<size_t> {
+public:
+    ReadGenerator(HashTable &h, const std::vector<std::string> &k,
+                  size_t n, bool opt) :
+        ht(h), keys(k), gets(n), optimistic(opt) {}
+
+    size_t operator()() {
+        size_t pos = (++threads * 7919) % keys.size();
+        size_t found = 0;
+        for (size_t i = 0; i < gets; ++i) {
+            const std::string &key = keys[pos];
+            if (++pos == keys.size()) {
+                pos = 0;
+            }
+            Item *itm = NULL;
+            bool referenced = false;
+            if (!optimistic ||
+                !ht.optimisticGet(key, 0, false, &itm, &referenced)) {
+                int bucket_num(0);
+                LockHolder lh = ht.getLockedBucket(key, &bucket_num);
+                StoredValue *v = ht.unlocked_find(key, bucket_num, false, false);
+                itm = v ? v->toItem(false, 0) : NULL;
+            }
+            if (itm) {
+                ++found;
+                delete itm;
+            }
+        }
+        return found;
+    }
+
+private:
+    HashTable                      &ht;
+    const std::vector<std::string> &keys;
+    size_t                          gets;
+    bool                            optimistic;
+    Atomic<size_t>                  threads;
+};
+
+struct WriterArgs {
+    HashTable                      *ht;
+    const std::vector<std::string> *keys;
+    volatile bool                   stop;
+};
+
+extern "C" {
+    static void *runWriter(void *arg) {
+        WriterArgs *args = static_cast<WriterArgs*>(arg);
+        const std::vector<std::string> &keys = *args->keys;
+        size_t pos = 0;
+        while (!args->stop) {
+            const std::string &key = keys[pos];
+            pos = (pos + 1) % keys.size();
+            Item i(key, 0, 0, key.c_str(), key.length());
+            int64_t row_id = -1;
+            args->ht->set(i, row_id);
+        }
+        return NULL;
+    }
+}
+
+static double run(HashTable &h, const std::vector<std::string> &keys,
+                  size_t nthreads, size_t gets, bool optimistic,
+                  bool withWriter) {
+    WriterArgs args;
+    args.ht = &h;
+    args.keys = &keys;
+    args.stop = false;
+    pthread_t writer;
+    if (withWriter && pthread_create(&writer, NULL, runWriter, &args) != 0) {
+        throw std::runtime_error("Failed to start the writer thread");
+    }
+
+    ReadGenerator gen(h, keys, gets, optimistic);
+    hrtime_t start = gethrtime();
+    std::vector<size_t> found = getCompletedThreads(nthreads, &gen);
+    hrtime_t elapsed = gethrtime() - start;
+
+    if (withWriter) {
+        args.stop = true;
+        if (pthread_join(writer, NULL) != 0) {
+            throw std::runtime_error("Failed to join the writer thread");
+        }
+    }
+
+    std::vector<size_t>::iterator it;
+    for (it = found.begin(); it != found.end(); ++it) {
+        assert(*it == gets);
+    }
+    return static_cast<double>(nthreads * gets) * 1000.0 /
+        static_cast<double>(elapsed);
+}
+
+int main(int argc, char **argv) {
+    putenv(strdup("ALLOW_NO_STATS_UPDATE=yeah"));
+    global_stats.setMaxDataSize(std::numeric_limits<size_t>::max());
+
+    size_t gets = argc > 1 ? strtoul(argv[1], NULL, 10) : 1000000;
+    std::vector<std::string> keys = generateKeys(numKeys);
+
+    printf("%d sequential keys like \"%s\"\n", static_cast<int>(numKeys),
+           keys.back().c_str());
+    printf("%7s %6s %8s %6s %9s %8s %8s\n", "hash", "sizing", "buckets",
+           "max", "empty", "probes", "ns/hash");
+    enum hash_function_type hashes[] = { hash_djb2, hash_xxhash, hash_crc32c };
+    for (size_t i = 0; i < sizeof(hashes) / sizeof(hashes[0]); ++i) {
+        reportDepth(hashes[i], false, keys);
+        reportDepth(hashes[i], true, keys);
+    }
+    printf("\n");
+
+    HashTable locked(global_stats);
+    fill(locked, keys);
+    HashTable::setDefaultOptimisticReads(true);
+    HashTable optimistic(global_stats);
+    HashTable::setDefaultOptimisticReads(false);
+    fill(optimistic, keys);
+
+    printf("%d keys, %d gets per reader, %d locks, Mops/s\n",
+           static_cast<int>(numKeys), static_cast<int>(gets),
+           static_cast<int>(locked.getNumLocks()));
+    printf("%7s %10s %10s %10s %10s\n", "readers", "locked",
+           "optimistic", "locked+w", "opt+w");
+    for (size_t n = 1; n <= 32; n *= 2) {
+        printf("%7d %10.2f %10.2f %10.2f %10.2f\n", static_cast<int>(n),
+               run(locked, keys, n, gets, false, false),
+               run(optimistic, keys, n, gets, true, false),
+               run(locked, keys, n, gets, false, true),
+               run(optimistic, keys, n, gets, true, true));
+    }
+    return 0;
+}
@@ -330,6 +330,586 @@ static void testAutoResize() {
     verifyFound(h, keys);
 }
 
+static void testIncrementalResize(bool pow2) {
+    HashTable::setDefaultPowerOfTwoSize(pow2);
+    HashTable h(global_stats, 769, 3);
+    HashTable::setDefaultPowerOfTwoSize(false);
+    size_t oldSize = h.getSize();
+
+    std::vector<std::string> keys = generateKeys(5000);
+    storeMany(h, keys);
+    assert(!h.isResizing());
+
+    h.resize(6143);
+    assert(h.getSize() == (pow2 ? 8192 : 6143));
+    assert(h.isResizing());
+    assert(h.getResizeRemaining() == oldSize);
+    assert(count(h) == 5000);
+
+    // Every operation moves a couple of buckets along the way.
+    std::vector<std::string> some(keys.begin(), keys.begin() + 100);
+    std::vector<std::string>::iterator it;
+    for (it = some.begin(); it != some.end(); ++it) {
+        assert(h.del(*it));
+    }
+    assert(h.getResizeRemaining() == oldSize - 200);
+    assert(count(h) == 4900);
+    storeMany(h, some);
+
+    HashTableDepthStatVisitor depthCounter;
+    h.visitDepth(depthCounter);
+    assert(depthCounter.size == 5000);
+
+    assert(h.resizeStep(10, true));
+    assert(h.getResizeRemaining() == oldSize - 410);
+    assert(h.completeResize());
+    assert(!h.isResizing());
+    assert(h.getResizeRemaining() == 0);
+    assert(!h.resizeStep(10, true));
+    assert(h.getNumResizes() == 1);
+
+    // Samples to start, for every group of buckets moved and to finish.
+    assert(h.getResizePauseHisto().total() > 2);
+
+    verifyFound(h, keys);
+    assert(count(h) == 5000);
+
+    // A resize in progress is finished before the next one starts.
+    h.resize(769);
+    assert(h.isResizing());
+    h.resize(3067);
+    assert(h.getNumResizes() == 3);
+    assert(h.getResizePauseHisto().total() == 1);
+    verifyFound(h, keys);
+    assert(!h.isResizing());
+}
+
+static void testHashFunction(enum hash_function_type t, bool pow2) {
+    HashTable::setDefaultPowerOfTwoSize(pow2);
+    assert(HashTable::setDefaultHashFunction(HashTable::getHashFunctionStr(t)));
+    HashTable h(global_stats, 5, 3);
+    HashTable::setDefaultHashFunction("djb2");
+    HashTable::setDefaultPowerOfTwoSize(false);
+    assert(h.getHashFunction() == t);
+    assert(h.isPowerOfTwoSize() == pow2);
+    if (pow2) {
+        assert(h.getSize() == 8);
+    }
+
+    std::vector<std::string> keys = generateKeys(5000);
+    storeMany(h, keys);
+    verifyFound(h, keys);
+
+    h.resize();
+    if (pow2) {
+        assert(h.getSize() == 4096);
+    }
+    verifyFound(h, keys);
+    assert(count(h) == 5000);
+
+    h.resize(1000);
+    if (pow2) {
+        assert(h.getSize() == 1024);
+    }
+    verifyFound(h, keys);
+}
+
+static void testHashFunctions() {
+    assert(!HashTable::setDefaultHashFunction("md5"));
+    assert(HashTable::getDefaultHashFunction() == hash_djb2);
+
+    testHashFunction(hash_djb2, false);
+    testHashFunction(hash_djb2, true);
+    testHashFunction(hash_xxhash, false);
+    testHashFunction(hash_xxhash, true);
+
+    HashTable::setDefaultHashFunction("xxhash");
+    HashTable xx(global_stats, 5, 3);
+    HashTable::setDefaultHashFunction("djb2");
+    // XXH64 with seed 0, folded to the low 32 bits.
+    assert(xx.hash("", 0) == 0x51d8e999);
+    assert(xx.hash("abc", 3) == 0xad770999);
+
+    if (HashTable::setDefaultHashFunction("crc32c")) {
+        HashTable crc(global_stats, 5, 3);
+        HashTable::setDefaultHashFunction("djb2");
+        assert(crc.hash("123456789", 9) == 0xe3069283);
+        testHashFunction(hash_crc32c, false);
+        testHashFunction(hash_crc32c, true);
+    }
+}
+
+static void testBatchedLookups() {
+    HashTable h(global_stats, 769, 3);
+    std::vector<std::string> keys = generateKeys(5000);
+    storeMany(h, keys);
+
+    // Keys found under a lock held for another bucket land in the same
+    // bucket getLockedBucket() gives them.
+    int locked(0);
+    LockHolder lh = h.getLockedBucket(keys[0], &locked);
+    size_t shared = 0;
+    std::vector<std::string>::iterator it;
+    for (it = keys.begin(); it != keys.end(); ++it) {
+        uint32_t hash = h.hash(*it);
+        int bucket(-1);
+        if (h.lockForHash(hash) != h.lockForHash(h.hash(keys[0]))) {
+            assert(!h.unlocked_getBucketUnder(hash, locked, &bucket));
+            continue;
+        }
+        assert(h.unlocked_getBucketUnder(hash, locked, &bucket));
+        assert(h.unlocked_find(*it, bucket, false, false));
+        ++shared;
+    }
+    lh.unlock();
+    assert(shared > 1000 && shared < 2500);
+
+    for (it = keys.begin(); it != keys.end(); ++it) {
+        int bucket(-1), expected(-1);
+        uint32_t hash = h.hash(*it);
+        LockHolder blh = h.getLockedBucket(hash, &expected);
+        assert(h.unlocked_getBucketUnder(hash, expected, &bucket));
+        assert(bucket == expected);
+    }
+
+    // Not while a resize is in progress.
+    h.resize(6143);
+    assert(h.isResizing());
+    {
+        LockHolder rlh = h.getLockedBucket(keys[0], &locked);
+        int bucket(-1);
+        assert(!h.unlocked_getBucketUnder(h.hash(keys[0]), locked, &bucket));
+    }
+    assert(h.completeResize());
+    verifyFound(h, keys);
+}
+
+static void testVisitBucket() {
+    HashTable h(global_stats, 769, 3);
+    std::vector<std::string> keys = generateKeys(5000);
+    storeMany(h, keys);
+
+    // Visiting the bucket of each key finds the key.
+    std::vector<std::string>::iterator it;
+    for (it = keys.begin(); it != keys.end(); ++it) {
+        Counter c(true);
+        size_t visited = h.visitBucket(h.hash(*it), c);
+        assert(visited > 0);
+        assert(visited == c.count);
+    }
+
+    // Visiting every bucket once finds every key once, whatever the
+    // hash picking it.
+    size_t total = 0;
+    for (uint32_t i = 0; i < 769; ++i) {
+        Counter c(true);
+        total += h.visitBucket(i + 769 * 17, c);
+    }
+    assert(total == keys.size());
+
+    // Buckets a resize hasn't moved yet are visited too.
+    h.resize(6143);
+    assert(h.isResizing());
+    for (it = keys.begin(); it != keys.end(); ++it) {
+        Counter c(false);
+        assert(h.visitBucket(h.hash(*it), c) > 0);
+    }
+    assert(h.completeResize());
+    verifyFound(h, keys);
+}
+
+static void testOptimisticGet() {
+    HashTable::setDefaultOptimisticReads(true);
+    HashTable h(global_stats, 5, 3);
+    HashTable::setDefaultOptimisticReads(false);
+    assert(h.isOptimistic());
+
+    std::vector<std::string> keys = generateKeys(5000);
+    storeMany(h, keys);
+    h.resize();
+    // Lookups are left to the locked path until the resize is done.
+    assert(!h.optimisticGet(keys[0], 3, true, NULL, NULL));
+    assert(h.completeResize());
+
+    std::vector<std::string>::iterator it;
+    for (it = keys.begin(); it != keys.end(); ++it) {
+        Item *itm = NULL;
+        bool referenced = false;
+        assert(h.optimisticGet(*it, 3, true, &itm, &referenced));
+        assert(itm);
+        assert(referenced);
+        assert(itm->getKey() == *it);
+        assert(itm->getVBucketId() == 3);
+        assert(itm->getValue()->to_s() == *it);
+        delete itm;
+    }
+
+    Item *itm = NULL;
+    bool referenced = true;
+    std::string missing("not-there");
+    assert(h.optimisticGet(missing, 0, true, &itm, &referenced));
+    assert(itm == NULL);
+    assert(!referenced);
+
+    // Deleted items are misses, as with the locked path.
+    int64_t row_id = -1;
+    assert(h.softDelete(keys[0], 0, row_id) == WAS_DIRTY);
+    assert(h.optimisticGet(keys[0], 0, true, &itm, &referenced));
+    assert(itm == NULL);
+
+    // Anything needing a modification is left to the locked path.
+    std::string k(keys[1]);
+    StoredValue *v = h.find(k);
+    assert(v);
+    v->markClean(NULL);
+    assert(v->ejectValue(global_stats, h));
+    assert(!h.optimisticGet(k, 0, true, &itm, &referenced));
+
+    k = keys[2];
+    v = h.find(k);
+    v->lock(ep_current_time() + 10);
+    assert(!h.optimisticGet(k, 0, true, &itm, &referenced));
+
+    k = keys[3];
+    v = h.find(k);
+    v->isReferenced(true, &h);
+    assert(!h.optimisticGet(k, 0, true, &itm, &referenced));
+    assert(h.optimisticGet(k, 0, false, &itm, &referenced));
+    assert(itm && !referenced);
+    delete itm;
+
+    HashTable plain(global_stats, 5, 3);
+    assert(!plain.isOptimistic());
+    assert(!plain.optimisticGet(k, 0, false, &itm, &referenced));
+}
+
+/**
+ * Reads keys optimistically while one thread keeps rewriting and
+ * deleting them and resizing the table.
+ */
+class OptimisticAccessGenerator : public Generator<bool> {
+public:
+
+    OptimisticAccessGenerator(const std::vector<std::string> &k,
+                              HashTable &h) : keys(k), ht(h) {}
+
+    bool operator()() {
+        if (writerClaimed.cas(false, true)) {
+            write();
+        } else {
+            read();
+        }
+        return true;
+    }
+
+private:
+
+    void write() {
+        for (int round = 0; round < 4; ++round) {
+            std::vector<std::string>::iterator it;
+            for (it = keys.begin(); it != keys.end(); ++it) {
+                if (rand() % 997 == 0) {
+                    ht.resize(ht.getSize() == 10007 ? 3001 : 10007);
+                }
+                std::string val(*it + "-rewritten");
+                Item i(*it, 0, 0, val.c_str(), val.length());
+                int64_t row_id = -1;
+                ht.set(i, row_id);
+                if (rand() % 3 == 0) {
+                    ht.del(*it);
+                }
+            }
+        }
+    }
+
+    void read() {
+        for (int round = 0; round < 4; ++round) {
+            std::vector<std::string>::iterator it;
+            for (it = keys.begin(); it != keys.end(); ++it) {
+                Item *itm = NULL;
+                bool referenced = false;
+                if (ht.optimisticGet(*it, 0, false, &itm, &referenced) && itm) {
+                    assert(itm->getKey() == *it);
+                    std::string val(itm->getValue()->to_s());
+                    assert(val.compare(0, it->length(), *it) == 0);
+                    delete itm;
+                }
+            }
+        }
+    }
+
+    std::vector<std::string> keys;
+    HashTable &ht;
+    Atomic<bool> writerClaimed;
+};
+
+static void testConcurrentOptimisticGet() {
+    HashTable::setDefaultOptimisticReads(true);
+    HashTable h(global_stats, 5, 3);
+    HashTable::setDefaultOptimisticReads(false);
+
+    std::vector<std::string> keys = generateKeys(20000);
+    h.resize(keys.size());
+    storeMany(h, keys);
+
+    srand(918475);
+    OptimisticAccessGenerator gen(keys, h);
+    getCompletedThreads(8, &gen);
+}
+
+static void testSlabArena(bool optimistic) {
+    HashTable::setDefaultOptimisticReads(optimistic);
+    HashTable::setDefaultSlabArena(true);
+    HashTable *h = new HashTable(global_stats, 5, 3);
+    HashTable::setDefaultSlabArena(false);
+    HashTable::setDefaultOptimisticReads(false);
+
+    SlabArena *arena = h->getSlabArena();
+    assert(arena);
+    const int nkeys = 5000;
+    std::vector<std::string> keys = generateKeys(nkeys);
+    storeMany(*h, keys);
+    assert(count(*h) == nkeys);
+    assert(arena->getNumObjects() == static_cast<size_t>(nkeys));
+    assert(arena->getUsedBytes() >= nkeys * StoredValue::sizeOf(false));
+    assert(arena->getUsedBytes() <= arena->getSlabBytes());
+    assert(global_stats.slabArenaUsed.get() == arena->getUsedBytes());
+    assert(global_stats.slabArenaSize.get() == arena->getSlabBytes());
+
+    // Freed entries get reused rather than growing the arena.
+    size_t slabBytes = arena->getSlabBytes();
+    std::vector<std::string>::iterator it;
+    for (it = keys.begin(); it != keys.end(); it += 2) {
+        assert(h->del(*it));
+    }
+    if (!optimistic) {
+        assert(arena->getNumObjects() == static_cast<size_t>(nkeys / 2));
+    }
+    EpochReclaimer::drain(NULL);
+    for (it = keys.begin(); it != keys.end(); it += 2) {
+        store(*h, *it);
+    }
+    assert(count(*h) == nkeys);
+    assert(arena->getSlabBytes() <= slabBytes);
+
+    h->clear();
+    EpochReclaimer::drain(NULL);
+    assert(arena->getNumObjects() == 0);
+    if (!optimistic) {
+        assert(arena->getSlabBytes() == 0);
+    }
+
+    // Values retired by the table may outlive it along with the arena.
+    storeMany(*h, keys);
+    delete h;
+    EpochReclaimer::drain(NULL);
+    assert(global_stats.slabArenaUsed.get() == 0);
+    assert(global_stats.slabArenaSize.get() == 0);
+}
+
+static void testAccessScore() {
+    HashTable h(global_stats, 5, 1);
+    std::vector<std::string> keys = generateKeys(3);
+    storeMany(h, keys);
+    StoredValue *often = h.find(keys[0]);
+    StoredValue *lately = h.find(keys[1]);
+    StoredValue *once = h.find(keys[2]);
+    assert(often && lately && once);
+    // Storing them referenced them.
+    often->isReferenced(true, &h);
+    lately->isReferenced(true, &h);
+    once->isReferenced(true, &h);
+
+    // First scan: "often" and "once" were referenced.
+    often->referenced(h);
+    once->referenced(h);
+    assert(often->updateAccessScore(h) == 8);
+    assert(lately->updateAccessScore(h) == 0);
+    assert(once->updateAccessScore(h) == 8);
+    assert(!often->isReferenced());
+
+    // Second scan: "often" and "lately" were referenced.
+    often->referenced(h);
+    lately->referenced(h);
+    uint8_t oftenScore = often->updateAccessScore(h);
+    uint8_t latelyScore = lately->updateAccessScore(h);
+    uint8_t onceScore = once->updateAccessScore(h);
+    assert(oftenScore > latelyScore);
+    assert(latelyScore > onceScore);
+    assert(onceScore > 0);
+
+    // Reading the score leaves the reference bit be, and a reference
+    // since the last scan counts more than any history.
+    assert(often->getAccessScore() == oftenScore);
+    once->referenced(h);
+    assert(once->getAccessScore() > oftenScore);
+    assert(once->isReferenced());
+    once->isReferenced(true, &h);
+    assert(once->getAccessScore() == onceScore);
+
+    // The history fades out without references.
+    for (int i = 0; i < 4; ++i) {
+        often->updateAccessScore(h);
+    }
+    assert(often->updateAccessScore(h) == 0);
+}
+
+static void testPackEjected() {
+    global_stats.reset();
+    HashTable::setDefaultPackEjected(true);
+    HashTable h(global_stats, 5, 1);
+    HashTable::setDefaultPackEjected(false);
+    size_t initialSize = global_stats.currentSize.get();
+
+    const int nkeys = 1000;
+    std::vector<std::string> keys = generateKeys(nkeys);
+    std::vector<std::string>::iterator it;
+    for (it = keys.begin(); it != keys.end(); ++it) {
+        Item i(*it, 0, 0, it->c_str(), it->length());
+        i.setCas();
+        assert(h.insert(i, true, false) == NOT_FOUND);
+    }
+
+    HashTableStatVisitor packed;
+    h.visit(packed);
+    assert(packed.numTotal == static_cast<size_t>(nkeys));
+    assert(packed.numNonResident == static_cast<size_t>(nkeys));
+    assert(packed.numPacked == static_cast<size_t>(nkeys));
+    assert(packed.packedSavings == nkeys * StoredValue::getPackedSaving());
+    assert(StoredValue::sizeOf(tiny) < StoredValue::sizeOf(featured));
+    assert(h.memSize.get() == packed.memSize);
+    HashTableDepthStatVisitor depthPacked;
+    h.visitDepth(depthPacked);
+    assert(depthPacked.numPacked == packed.numPacked);
+    assert(depthPacked.packedSavings == packed.packedSavings);
+
+    // Finding an item hands out the featured representation again.
+    StoredValue *v = h.find(keys[0]);
+    assert(v);
+    assert(v->getType() == featured);
+    assert(!v->isResident());
+    assert(v->valLength() == keys[0].length());
+    assert(v->getKey() == keys[0]);
+    assert(v->getCas() != 0);
+    Item restored(keys[0], 0, 0, keys[0].c_str(), keys[0].length(),
+                  v->getCas());
+    assert(v->unlocked_restoreValue(&restored, global_stats, h));
+    assert(v->isResident());
+
+    // The item pager ejecting it again gets it packed.
+    class EjectingVisitor : public HashTableVisitor {
+    public:
+        EjectingVisitor(HashTable &ht) : h(ht) {}
+        void visit(StoredValue *sv) {
+            sv->isReferenced(true, &h);
+            if (sv->isResident()) {
+                assert(sv->ejectValue(global_stats, h));
+            }
+        }
+        HashTable &h;
+    } ejector(h);
+    h.visit(ejector);
+    HashTableStatVisitor repacked;
+    h.visit(repacked);
+    assert(repacked.numPacked == static_cast<size_t>(nkeys));
+    assert(h.memSize.get() == repacked.memSize);
+    assert(count(h, false) == nkeys);
+
+    for (it = keys.begin(); it != keys.end(); ++it) {
+        assert(h.del(*it));
+    }
+    assert(h.memSize.get() == 0);
+    assert(h.cacheSize.get() == 0);
+    assert(initialSize == global_stats.currentSize.get());
+}
+
+static void testFullEviction() {
+    global_stats.reset();
+    HashTable h(global_stats, 5, 1);
+    size_t initialSize = global_stats.currentSize.get();
+
+    const int nkeys = 1000;
+    std::vector<std::string> keys = generateKeys(nkeys);
+    std::vector<std::string>::iterator it;
+    for (it = keys.begin(); it != keys.end(); ++it) {
+        Item i(*it, 0, 0, it->c_str(), it->length());
+        i.setCas();
+        assert(h.insert(i, true, false) == NOT_FOUND);
+    }
+    std::string resident("resident");
+    Item r(resident, 0, 0, resident.c_str(), resident.length());
+    r.setCas();
+    assert(h.insert(r, false, false) == NOT_FOUND);
+    assert(h.getNumNonResidentItems() == static_cast<size_t>(nkeys));
+
+    int bucket_num(0);
+    for (it = keys.begin(); it != keys.end(); ++it) {
+        LockHolder lh = h.getLockedBucket(*it, &bucket_num);
+        assert(h.unlocked_evict(*it, bucket_num));
+        assert(!h.unlocked_find(*it, bucket_num, true, false));
+    }
+    {
+        // Only ejected items go.
+        LockHolder lh = h.getLockedBucket(resident, &bucket_num);
+        assert(!h.unlocked_evict(resident, bucket_num));
+    }
+    // Evicted items still count, only their keys are gone.
+    assert(h.getNumItems() == static_cast<size_t>(nkeys) + 1);
+    assert(h.getNumInMemoryItems() == 1);
+    assert(h.getNumEvictedItems() == static_cast<size_t>(nkeys));
+    assert(h.getNumNonResidentItems() == 0);
+    assert(global_stats.numKeyEjects.get() == static_cast<size_t>(nkeys));
+
+    {
+        // A miss adds a temporary item, which the item fetched from
+        // disk then replaces.
+        LockHolder lh = h.getLockedBucket(keys[0], &bucket_num);
+        assert(h.unlocked_addTempDeletedItem(bucket_num, keys[0]) == ADD_SUCCESS);
+        StoredValue *v = h.unlocked_find(keys[0], bucket_num, true, false);
+        assert(v && v->isTempInitialItem());
+        assert(h.getNumTempItems() == 1);
+        Item fetched(keys[0], 0, 0, keys[0].c_str(), keys[0].length(), 1234,
+                     42);
+        fetched.setSeqno(7);
+        h.unlocked_restoreItem(v, &fetched);
+        assert(!v->isTempItem());
+        // The disk id comes along, so the next write is an update.
+        assert(v->getId() == 42);
+        assert(v->isResident());
+        assert(v->isClean());
+        assert(v->getCas() == 1234);
+        assert(v->getSeqno() == 7);
+        assert(h.getNumTempItems() == 0);
+        assert(h.getNumItems() == static_cast<size_t>(nkeys) + 1);
+        assert(h.getNumInMemoryItems() == 2);
+        assert(h.getNumEvictedItems() == static_cast<size_t>(nkeys) - 1);
+    }
+    std::string missing("missing");
+    {
+        // A key found not to exist on disk can be added.
+        LockHolder lh = h.getLockedBucket(missing, &bucket_num);
+        assert(h.unlocked_addTempDeletedItem(bucket_num, missing) == ADD_SUCCESS);
+        StoredValue *v = h.unlocked_find(missing, bucket_num, true, false);
+        assert(v->unlocked_restoreMeta(NULL, ENGINE_KEY_ENOENT));
+        assert(v->isTempNonExistentItem());
+        Item added(missing, 0, 0, missing.c_str(), missing.length());
+        assert(h.unlocked_add(bucket_num, added) == ADD_UNDEL);
+        assert(!v->isTempItem());
+        assert(h.getNumTempItems() == 0);
+        assert(h.getNumItems() == static_cast<size_t>(nkeys) + 2);
+        assert(h.getNumInMemoryItems() == 3);
+    }
+
+    assert(h.del(resident));
+    assert(h.del(keys[0]));
+    assert(h.del(missing));
+    h.clear();
+    assert(h.getNumItems() == 0);
+    assert(h.memSize.get() == 0);
+    assert(h.cacheSize.get() == 0);
+    assert(initialSize == global_stats.currentSize.get());
+}
+
 static void testAdd() {
     HashTable h(global_stats, 5, 1);
     const int nkeys = 5000;
@@ -556,6 +1136,70 @@ static void testSizeStatsEjectFlush() {
     free(someval);
 }
 
+#ifdef HAVE_LIBSNAPPY
+static void testCompressValue() {
+    global_stats.reset();
+    HashTable ht(global_stats, 5, 1);
+    size_t initialSize = global_stats.currentSize.get();
+
+    std::string k("somekey");
+    std::string val(std::string(4096, 'a') + "some raw bytes" +
+                    std::string(4096, 'b'));
+    Item i(k, 0, 0, val.data(), val.length());
+    int64_t row_id = -1;
+    assert(ht.set(i, row_id) == NOT_FOUND);
+
+    StoredValue *v(ht.find(k));
+    assert(v);
+    // Dirty values are left for the flusher.
+    assert(!v->compressValue(global_stats, ht, 0, 100));
+    v->markClean(NULL);
+    // Too small, or not compressing well enough.
+    assert(!v->compressValue(global_stats, ht, val.length() + 1, 100));
+    assert(!v->compressValue(global_stats, ht, 0, 0));
+    assert(global_stats.numFailedCompressions.get() == 1);
+
+    size_t cacheSize = ht.cacheSize.get();
+    assert(v->compressValue(global_stats, ht, 0, 100));
+    assert(!v->compressValue(global_stats, ht, 0, 100));
+    assert(v->getValue()->isCompressed());
+    assert(v->heldValueLength() < val.length());
+    assert(v->valLength() == val.length());
+    assert(ht.cacheSize.get() < cacheSize);
+    assert(global_stats.numValueCompressions.get() == 1);
+
+    HashTableStatVisitor statVisitor;
+    ht.visit(statVisitor);
+    assert(statVisitor.numCompressed == 1);
+    assert(statVisitor.compressedSavings ==
+           val.length() - v->heldValueLength());
+    assert(ht.memSize.get() == statVisitor.memSize);
+
+    // Readers get the raw value back.
+    Item *itm = v->toItem(false, 0);
+    assert(itm->getValue()->to_s() == val);
+    assert(!itm->getValue()->isCompressed());
+    delete itm;
+
+    // Values being read get uncompressed in place.
+    assert(v->uncompressValue(global_stats, ht));
+    assert(!v->uncompressValue(global_stats, ht));
+    assert(!v->getValue()->isCompressed());
+    assert(v->getValue()->to_s() == val);
+    assert(ht.cacheSize.get() == cacheSize);
+    assert(v->compressValue(global_stats, ht, 0, 100));
+
+    // Compressed values get ejected like raw ones.
+    assert(v->ejectValue(global_stats, ht));
+    assert(v->valLength() == val.length());
+
+    ht.clear();
+    assert(ht.memSize.get() == 0);
+    assert(ht.cacheSize.get() == 0);
+    assert(initialSize == global_stats.currentSize.get());
+}
+#endif
+
 int main() {
     putenv(strdup("ALLOW_NO_STATS_UPDATE=yeah"));
     global_stats.setMaxDataSize(64*1024*1024);
@@ -574,11 +1218,26 @@ int main() {
     testResize();
     testConcurrentAccessResize();
     testAutoResize();
+    testIncrementalResize(false);
+    testIncrementalResize(true);
+    testHashFunctions();
+    testBatchedLookups();
+    testVisitBucket();
+    testOptimisticGet();
+    testConcurrentOptimisticGet();
+    testSlabArena(false);
+    testSlabArena(true);
+    testAccessScore();
+    testPackEjected();
+    testFullEviction();
     testSizeStats();
     testSizeStatsFlush();
     testSizeStatsSoftDel();
     testSizeStatsSoftDelFlush();
     testSizeStatsEject();
     testSizeStatsEjectFlush();
+#ifdef HAVE_LIBSNAPPY
+    testCompressValue();
+#endif
     exit(0);
 }
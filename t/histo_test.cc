@@ -89,10 +89,60 @@ static void test_complete_range() {
     } while (i != 0);
 }
 
+static void test_log_linear_buckets() {
+    typedef LogLinearHistogram<hrtime_t> LLH;
+    assert(LLH::bucketStart(0) == 0);
+    assert(LLH::bucketEnd(LLH::NUM_BUCKETS - 1) ==
+           std::numeric_limits<hrtime_t>::max());
+
+    for (size_t b = 0; b < LLH::NUM_BUCKETS; ++b) {
+        hrtime_t start = LLH::bucketStart(b);
+        hrtime_t end = LLH::bucketEnd(b);
+        assert(start < end);
+        assert(LLH::bucketOf(start) == b);
+        if (b < LLH::NUM_BUCKETS - 1) {
+            assert(LLH::bucketOf(end - 1) == b);
+            assert(LLH::bucketStart(b + 1) == end);
+            // No bucket is wider than 1/32 of the values it counts.
+            assert((end - start) * 32 <= std::max(start, hrtime_t(32)));
+        }
+
+        size_t octave = LLH::octaveOf(b);
+        assert(LLH::octaveStart(octave) <= start);
+        assert(end <= LLH::octaveEnd(octave));
+    }
+    assert(LLH::bucketOf(std::numeric_limits<hrtime_t>::max()) ==
+           LLH::NUM_BUCKETS - 1);
+}
+
+static void test_log_linear_percentiles() {
+    LogLinearHistogram<hrtime_t> histo;
+    assert(histo.total() == 0);
+    assert(histo.getPercentile(99.0) == 0);
+
+    for (hrtime_t i = 1; i <= 10000; ++i) {
+        histo.add(i);
+    }
+    histo.add(1000000, 20);
+    assert(histo.total() == 10020);
+
+    hrtime_t p50 = histo.getPercentile(50.0);
+    assert(p50 >= 5010 && p50 <= 5010 + 5010 / 32);
+    hrtime_t p99 = histo.getPercentile(99.0);
+    assert(p99 >= 9920 && p99 <= 9920 + 9920 / 32);
+    hrtime_t p999 = histo.getPercentile(99.9);
+    assert(p999 >= 1000000 && p999 <= 1000000 + 1000000 / 32);
+
+    histo.reset();
+    assert(histo.total() == 0);
+}
+
 int main() {
     test_basic();
     test_fixed_input();
     test_exponential();
     test_complete_range();
+    test_log_linear_buckets();
+    test_log_linear_percentiles();
     return 0;
 }
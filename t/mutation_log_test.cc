@@ -11,6 +11,10 @@
 
 #include "assert.h"
 #include "mutation_log.hh"
+#include "crc32c.h"
+extern "C" {
+#include "crc32.h"
+}
 
 #define TMP_LOG_FILE "/tmp/mlt_test.log"
 
@@ -165,6 +169,47 @@ static void testLogging() {
     remove(TMP_LOG_FILE);
 }
 
+static void testAccessLog() {
+    remove(TMP_LOG_FILE);
+
+    {
+        MutationLog ml(TMP_LOG_FILE);
+        ml.open();
+
+        ml.accessedItem(3, "key1", 8);
+        ml.accessedItem(2, "key1", 15);
+        ml.accessedItem(3, "key2", 1);
+        ml.commit1();
+        ml.commit2();
+
+        assert(ml.itemsLogged[ML_ACCESS] == 3);
+        assert(ml.itemsLogged[ML_NEW] == 0);
+    }
+
+    {
+        MutationLog ml(TMP_LOG_FILE);
+        ml.open();
+        MutationLogHarvester h(ml);
+        h.setVBucket(2);
+        h.setVBucket(3);
+
+        assert(h.load());
+        assert(h.getItemsSeen()[ML_ACCESS] == 3);
+        assert(h.total() == 5);
+
+        // The scores come in place of the rowids.
+        std::map<std::string, uint64_t> maps[4];
+        h.apply(&maps, loaderFun);
+        assert(maps[2].size() == 1);
+        assert(maps[3].size() == 2);
+        assert(maps[2]["key1"] == 15);
+        assert(maps[3]["key1"] == 8);
+        assert(maps[3]["key2"] == 1);
+    }
+
+    remove(TMP_LOG_FILE);
+}
+
 static void testDelAll() {
     remove(TMP_LOG_FILE);
 
@@ -472,6 +517,192 @@ static void testYUNOOPEN() {
     assert(remove(TMP_LOG_FILE) == 0);
 }
 
+static void testCRC32C() {
+    const uint8_t check[] = "123456789";
+    assert(crc32c(check, 9) == 0xe3069283);
+    assert(crc32c(check, 0) == 0);
+
+    // Unaligned starts and odd lengths agree with a byte at a time.
+    uint8_t buf[100];
+    for (size_t i = 0; i < sizeof(buf); ++i) {
+        buf[i] = static_cast<uint8_t>(i * 7 + 3);
+    }
+    for (size_t off = 0; off < 9; ++off) {
+        uint8_t copy[100];
+        memcpy(copy + off, buf, sizeof(buf) - off);
+        assert(crc32c(copy + off, sizeof(buf) - off) == crc32c(buf, sizeof(buf) - off));
+    }
+}
+
+static void testVersion1Log() {
+    remove(TMP_LOG_FILE);
+
+    {
+        MutationLog ml(TMP_LOG_FILE);
+        ml.open();
+        assert(ml.header().version() == LOG_VERSION);
+        ml.newItem(3, "key1", 1);
+        ml.newItem(2, "key1", 2);
+        ml.commit1();
+        ml.commit2();
+    }
+
+    // Turn it into a log of the first version, with IEEE CRC32 checksums.
+    int file = open(TMP_LOG_FILE, O_RDWR, 0666);
+    uint32_t version(htonl(LOG_VERSION_CRC32));
+    assert(pwrite(file, &version, sizeof(version), 0) == sizeof(version));
+    uint8_t block[4096];
+    for (off_t offset = 4096; pread(file, block, sizeof(block), offset) == sizeof(block);
+         offset += sizeof(block)) {
+        uint16_t crc16(htons(crc32buf(block + 2, sizeof(block) - 2) & 0xffff));
+        assert(pwrite(file, &crc16, sizeof(crc16), offset) == sizeof(crc16));
+    }
+    close(file);
+
+    {
+        // Appending to it sticks to its checksums.
+        MutationLog ml(TMP_LOG_FILE);
+        ml.open();
+        assert(ml.header().version() == LOG_VERSION_CRC32);
+        ml.newItem(3, "key2", 3);
+        ml.commit1();
+        ml.commit2();
+    }
+
+    {
+        MutationLog ml(TMP_LOG_FILE);
+        ml.open();
+        MutationLogHarvester h(ml);
+        h.setVBucket(2);
+        h.setVBucket(3);
+        assert(h.load());
+        assert(h.getItemsSeen()[ML_NEW] == 3);
+
+        std::map<std::string, uint64_t> maps[4];
+        h.apply(&maps, loaderFun);
+        assert(maps[2].size() == 1);
+        assert(maps[3].size() == 2);
+    }
+
+    {
+        // A reset starts over with the current version.
+        MutationLog ml(TMP_LOG_FILE);
+        ml.open();
+        assert(ml.reset());
+        assert(ml.header().version() == LOG_VERSION);
+    }
+
+    remove(TMP_LOG_FILE);
+}
+
+static void writeManyVBuckets(MutationLog &ml) {
+    for (int round = 0; round < 20; ++round) {
+        for (int i = 0; i < 500; ++i) {
+            std::stringstream key;
+            key << "key-" << (i * 7 + round) % 300;
+            uint16_t vb = static_cast<uint16_t>(i % 16);
+            if ((i + round) % 5 == 0) {
+                ml.delItem(vb, key.str());
+            } else {
+                ml.newItem(vb, key.str(), round * 1000 + i);
+            }
+        }
+        if (round % 7 == 3) {
+            ml.deleteAll(static_cast<uint16_t>(round % 16));
+        }
+        ml.commit1();
+        if (round != 19) {
+            ml.commit2();
+        }
+    }
+}
+
+static void harvestManyVBuckets(size_t threads, bool &clean,
+                                std::map<std::string, uint64_t> *maps,
+                                std::vector<mutation_log_uncommitted_t> &leftovers,
+                                size_t *seen) {
+    MutationLog ml(TMP_LOG_FILE);
+    ml.open();
+    MutationLogHarvester h(ml);
+    h.setNumThreads(threads);
+    for (uint16_t vb = 0; vb < 16; ++vb) {
+        h.setVBucket(vb);
+    }
+    clean = h.load();
+    h.apply(maps, loaderFun);
+    h.getUncommitted(leftovers);
+    std::sort(leftovers.begin(), leftovers.end(), leftover_compare);
+    memcpy(seen, h.getItemsSeen(), MUTATION_LOG_TYPES * sizeof(size_t));
+}
+
+static void testParallelHarvest() {
+    remove(TMP_LOG_FILE);
+
+    {
+        MutationLog ml(TMP_LOG_FILE);
+        ml.open();
+        writeManyVBuckets(ml);
+    }
+
+    bool clean1, clean4;
+    std::map<std::string, uint64_t> maps1[16], maps4[16];
+    std::vector<mutation_log_uncommitted_t> left1, left4;
+    size_t seen1[MUTATION_LOG_TYPES], seen4[MUTATION_LOG_TYPES];
+    harvestManyVBuckets(1, clean1, maps1, left1, seen1);
+    harvestManyVBuckets(4, clean4, maps4, left4, seen4);
+
+    assert(!clean1 && !clean4);
+    assert(seen1[ML_NEW] + seen1[ML_DEL] == 10000);
+    assert(memcmp(seen1, seen4, sizeof(seen1)) == 0);
+    size_t total(0);
+    for (int vb = 0; vb < 16; ++vb) {
+        assert(maps1[vb] == maps4[vb]);
+        total += maps1[vb].size();
+    }
+    assert(total > 0);
+    assert(left1.size() == 500);
+    assert(left1.size() == left4.size());
+    for (size_t i = 0; i < left1.size(); ++i) {
+        assert(left1[i].vbucket == left4[i].vbucket);
+        assert(left1[i].key == left4[i].key);
+        assert(left1[i].rowid == left4[i].rowid);
+    }
+
+    // Break a block past the first thread's share.
+    int file = open(TMP_LOG_FILE, O_RDWR, 0666);
+    off_t size = lseek(file, 0, SEEK_END);
+    off_t broken = size - 4096 - 100;
+    uint8_t b;
+    assert(pread(file, &b, sizeof(b), broken) == 1);
+    b = ~b;
+    assert(pwrite(file, &b, sizeof(b), broken) == 1);
+    close(file);
+
+    {
+        MutationLog ml(TMP_LOG_FILE);
+        ml.open();
+        MutationLogHarvester h(ml);
+        h.setNumThreads(4);
+        for (uint16_t vb = 0; vb < 16; ++vb) {
+            h.setVBucket(vb);
+        }
+        try {
+            h.load();
+            abort();
+        } catch(MutationLog::CRCReadException &e) {
+            // expected
+        }
+        assert(h.total() == 0);
+        std::map<std::string, uint64_t> maps[16];
+        h.apply(&maps, loaderFun);
+        for (int vb = 0; vb < 16; ++vb) {
+            assert(maps[vb].empty());
+        }
+    }
+
+    remove(TMP_LOG_FILE);
+}
+
 // @todo
 //   Test Read Only log
 //   Test close / open / close / open
@@ -507,11 +738,15 @@ int main(int, char **) {
     testUnconfigured();
     testSyncSet();
     testLogging();
+    testAccessLog();
     testDelAll();
     testLoggingDirty();
     testLoggingBadCRC();
     testLoggingShortRead();
     testYUNOOPEN();
+    testCRC32C();
+    testVersion1Log();
+    testParallelHarvest();
 
     remove(TMP_LOG_FILE);
     return 0;
@@ -0,0 +1,69 @@
+#!/usr/bin/env python
+"""
+Measures how fast a running server persists a burst of writes spread
+over a number of vbuckets.
+
+The flusher shard count can't be changed at runtime, so start the
+server with flusher_shards=1, 2, 4, ... in turn and run this against
+each of them; the shard count in use is part of the report.
+
+Usage: persistence_bench.py [-h host:port] [-n items] [-v vbuckets]
+                            [-s value size] [-r rounds]
+"""
+
+import getopt
+import sys
+import time
+
+sys.path.append('../management')
+import mc_bin_client
+
+def disk_queue(mc):
+    stats = mc.stats()
+    return (int(stats['ep_queue_size']) + int(stats['ep_flusher_todo'])
+            + int(stats['ep_uncommitted_items']))
+
+def run_round(mc, rnd, items, vbuckets, value):
+    start = time.time()
+    for i in xrange(items):
+        mc.vbucketId = i % vbuckets
+        mc.set('bench:%d:%d' % (rnd, i), 0, 0, value)
+    queued = time.time()
+    while disk_queue(mc) > 0:
+        time.sleep(0.01)
+    done = time.time()
+    return queued - start, done - start
+
+if __name__ == '__main__':
+    host, port = '127.0.0.1', 11211
+    items, vbuckets, size, rounds = 100000, 64, 256, 3
+
+    opts, args = getopt.getopt(sys.argv[1:], 'h:n:v:s:r:')
+    for o, a in opts:
+        if o == '-h':
+            host, port = a.split(':')
+            port = int(port)
+        elif o == '-n':
+            items = int(a)
+        elif o == '-v':
+            vbuckets = int(a)
+        elif o == '-s':
+            size = int(a)
+        elif o == '-r':
+            rounds = int(a)
+
+    mc = mc_bin_client.MemcachedClient(host, port)
+    for vb in range(vbuckets):
+        mc.set_vbucket_state(vb, 'active')
+    while disk_queue(mc) > 0:
+        time.sleep(0.1)
+
+    shards = mc.stats().get('ep_flusher_shards', '1')
+    print 'flusher shards: %s, %d items of %d bytes over %d vbuckets' % \
+        (shards, items, size, vbuckets)
+
+    value = 'x' * size
+    for rnd in range(rounds):
+        load, persist = run_round(mc, rnd, items, vbuckets, value)
+        print 'round %d: loaded in %.2fs, persisted in %.2fs (%d items/s)' % \
+            (rnd, load, persist, items / persist)
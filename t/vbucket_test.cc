@@ -6,6 +6,7 @@
 #include <cassert>
 #include <vector>
 #include <algorithm>
+#include <sstream>
 
 #include "configuration.hh"
 #include "vbucket.hh"
@@ -198,6 +199,75 @@ static void testGetVBucketsByState(void) {
 
 }
 
+static std::string filterKey(const char *prefix, int i) {
+    std::stringstream ss;
+    ss << prefix << i;
+    return ss.str();
+}
+
+static void testKeyFilter(void) {
+    RCPtr<VBucket> unfiltered(new VBucket(0, vbucket_state_active,
+                                          global_stats, checkpoint_config));
+    assert(unfiltered->getFilterStatus() == BFILTER_DISABLED);
+    unfiltered->setFilterStatus(BFILTER_ENABLED);
+    assert(unfiltered->getFilterStatus() == BFILTER_DISABLED);
+    assert(unfiltered->maybeKeyExistsInFilter("key"));
+
+    VBucket::setDefaultKeyFilter(100, 0.01);
+    RCPtr<VBucket> vb(new VBucket(1, vbucket_state_active,
+                                  global_stats, checkpoint_config));
+    assert(vb->getFilterStatus() == BFILTER_PENDING);
+    for (int i = 0; i < 100; ++i) {
+        vb->addToFilter(filterKey("key", i));
+    }
+    // Not trusted until it has all keys.
+    assert(vb->maybeKeyExistsInFilter("missing"));
+    assert(!vb->startFilterRebuild());
+
+    vb->setFilterStatus(BFILTER_ENABLED);
+    for (int i = 0; i < 100; ++i) {
+        assert(vb->maybeKeyExistsInFilter(filterKey("key", i)));
+    }
+    int falsePositives = 0;
+    for (int i = 0; i < 1000; ++i) {
+        if (vb->maybeKeyExistsInFilter(filterKey("missing", i))) {
+            ++falsePositives;
+        }
+    }
+    assert(falsePositives < 50);
+    assert(!vb->startFilterRebuild());
+
+    // Overfill it, then rebuild from "disk".
+    for (int i = 100; i < 1000; ++i) {
+        vb->addToFilter(filterKey("key", i));
+    }
+    assert(vb->startFilterRebuild());
+    assert(!vb->startFilterRebuild());
+    for (int i = 0; i < 1000; ++i) {
+        vb->addToRebuildFilter(filterKey("key", i));
+    }
+    // Persisted while rebuilding.
+    vb->addToFilter("latecomer");
+    vb->completeFilterRebuild();
+    assert(vb->getFilterStatus() == BFILTER_ENABLED);
+    assert(vb->maybeKeyExistsInFilter("latecomer"));
+    for (int i = 0; i < 1000; ++i) {
+        assert(vb->maybeKeyExistsInFilter(filterKey("key", i)));
+    }
+    falsePositives = 0;
+    for (int i = 1000; i < 2000; ++i) {
+        if (vb->maybeKeyExistsInFilter(filterKey("missing", i))) {
+            ++falsePositives;
+        }
+    }
+    assert(falsePositives < 50);
+    assert(!vb->startFilterRebuild());
+
+    vb->setFilterStatus(BFILTER_DISABLED);
+    assert(vb->maybeKeyExistsInFilter("missing"));
+    VBucket::setDefaultKeyFilter(0, 0.01);
+}
+
 int main(int argc, char **argv) {
     (void)argc; (void)argv;
     putenv(strdup("ALLOW_NO_STATS_UPDATE=yeah"));
@@ -212,4 +282,5 @@ int main(int argc, char **argv) {
     testVBucketFilter();
     testVBucketFilterFormatter();
     testGetVBucketsByState();
+    testKeyFilter();
 }
@@ -1511,6 +1511,8 @@ queued_item TapProducer::nextFgFetched_UNLOCKED(bool &shouldPause) {
         uint16_t invalid_count = 0;
         uint16_t open_checkpoint_count = 0;
         uint16_t wait_for_ack_count = 0;
+        const CheckpointConfig &chkConfig = engine.getCheckpointConfig();
+        std::vector<queued_item> items;
 
         std::map<uint16_t, TapCheckpointState>::iterator it = tapCheckpointState.begin();
         for (; it != tapCheckpointState.end(); ++it) {
@@ -1525,62 +1527,70 @@ queued_item TapProducer::nextFgFetched_UNLOCKED(bool &shouldPause) {
             }
 
             bool isLastItem = false;
-            queued_item qi = vb->checkpointManager.nextItem(name, isLastItem);
-            switch(qi->getOperation()) {
-            case queue_op_set:
-            case queue_op_del:
-                if (supportCheckpointSync && isLastItem) {
-                    it->second.lastItem = true;
-                } else {
-                    it->second.lastItem = false;
-                }
-                addEvent_UNLOCKED(qi);
-                break;
-            case queue_op_checkpoint_start:
-                {
-                    it->second.currentCheckpointId = (uint64_t) qi->getRowId();
-                    if (supportCheckpointSync) {
-                        it->second.state = checkpoint_start;
-                        addCheckpointMessage_UNLOCKED(qi);
+            items.clear();
+            vb->checkpointManager.getItemsForCursor(name, items,
+                                                    chkConfig.getTapBatchItems(),
+                                                    chkConfig.getTapBatchBytes(),
+                                                    isLastItem);
+            if (items.empty()) {
+                ++open_checkpoint_count;
+                if (closedCheckpointOnly) {
+                    // If all the cursors are at the open checkpoints, send the OPAQUE message
+                    // to the TAP client so that it can close the connection if necessary.
+                    if (open_checkpoint_count == (tapCheckpointState.size() - invalid_count)) {
+                        TapVBucketEvent ev(TAP_OPAQUE, vbid,
+                                           (vbucket_state_t)htonl(TAP_OPAQUE_OPEN_CHECKPOINT));
+                        addVBucketHighPriority_UNLOCKED(ev);
                     }
                 }
-                break;
-            case queue_op_checkpoint_end:
-                if (supportCheckpointSync) {
-                    it->second.state = checkpoint_end;
-                    uint32_t seqno_acked;
-                    if (seqnoReceived == 0) {
-                        seqno_acked = 0;
+                continue;
+            }
+
+            std::vector<queued_item>::iterator iit = items.begin();
+            for (; iit != items.end(); ++iit) {
+                const queued_item &qi = *iit;
+                switch(qi->getOperation()) {
+                case queue_op_set:
+                case queue_op_del:
+                    if (supportCheckpointSync && isLastItem) {
+                        it->second.lastItem = true;
                     } else {
-                        seqno_acked = isLastAckSucceed ? seqnoReceived : seqnoReceived - 1;
+                        it->second.lastItem = false;
                     }
-                    if (it->second.lastSeqNum <= seqno_acked &&
-                        it->second.isBgFetchCompleted()) {
-                        // All resident and non-resident items in a checkpoint are sent
-                        // and acked. CHEKCPOINT_END message is going to be sent.
-                        addCheckpointMessage_UNLOCKED(qi);
-                    } else {
-                        vb->checkpointManager.decrTapCursorFromCheckpointEnd(name);
-                        ++wait_for_ack_count;
+                    addEvent_UNLOCKED(qi);
+                    break;
+                case queue_op_checkpoint_start:
+                    {
+                        it->second.currentCheckpointId = (uint64_t) qi->getRowId();
+                        if (supportCheckpointSync) {
+                            it->second.state = checkpoint_start;
+                            addCheckpointMessage_UNLOCKED(qi);
+                        }
                     }
-                }
-                break;
-            case queue_op_empty:
-                {
-                    ++open_checkpoint_count;
-                    if (closedCheckpointOnly) {
-                        // If all the cursors are at the open checkpoints, send the OPAQUE message
-                        // to the TAP client so that it can close the connection if necessary.
-                        if (open_checkpoint_count == (tapCheckpointState.size() - invalid_count)) {
-                            TapVBucketEvent ev(TAP_OPAQUE, qi->getVBucketId(),
-                                               (vbucket_state_t)htonl(TAP_OPAQUE_OPEN_CHECKPOINT));
-                            addVBucketHighPriority_UNLOCKED(ev);
+                    break;
+                case queue_op_checkpoint_end:
+                    if (supportCheckpointSync) {
+                        it->second.state = checkpoint_end;
+                        uint32_t seqno_acked;
+                        if (seqnoReceived == 0) {
+                            seqno_acked = 0;
+                        } else {
+                            seqno_acked = isLastAckSucceed ? seqnoReceived : seqnoReceived - 1;
+                        }
+                        if (it->second.lastSeqNum <= seqno_acked &&
+                            it->second.isBgFetchCompleted()) {
+                            // All resident and non-resident items in a checkpoint are sent
+                            // and acked. CHEKCPOINT_END message is going to be sent.
+                            addCheckpointMessage_UNLOCKED(qi);
+                        } else {
+                            vb->checkpointManager.decrTapCursorFromCheckpointEnd(name);
+                            ++wait_for_ack_count;
                         }
                     }
+                    break;
+                default:
+                    break;
                 }
-                break;
-            default:
-                break;
             }
         }
 
@@ -27,6 +27,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <sys/time.h>
 #include <pthread.h>
 #include <netinet/in.h>
 
@@ -212,6 +213,57 @@ static test_result test_persistence(ENGINE_HANDLE *h, ENGINE_HANDLE_V1 *h1) {
 }
 }
 
+extern "C" {
+static test_result test_get_path(ENGINE_HANDLE *h, ENGINE_HANDLE_V1 *h1) {
+    size_t total = env_int("TEST_TOTAL_KEYS", 1000);
+    size_t size = env_int("TEST_VAL_SIZE", 65536);
+    size_t gets = env_int("TEST_TOTAL_GETS", 100000);
+
+    char key[24];
+    char *data;
+    data = static_cast<char *>(malloc(sizeof(char) * size));
+    assert(data);
+
+    for (size_t i = 0; i < (sizeof(char) * size); ++i) {
+        data[i] = 0xff & rand();
+    }
+
+    for (size_t i = 0; i < total; ++i) {
+        item *it = NULL;
+        snprintf(key, sizeof(key), "k%d", static_cast<int>(i));
+
+        check(storeCasVb11(h, h1, NULL, OPERATION_SET, key, data,
+                           size, 9713, &it, 0, 0) == ENGINE_SUCCESS,
+                  "store failure");
+        h1->release(h, NULL, it);
+    }
+    wait_for_flusher_to_settle(h, h1);
+
+    struct timeval start, end;
+    gettimeofday(&start, NULL);
+    for (size_t i = 0; i < gets; ++i) {
+        item *it = NULL;
+        snprintf(key, sizeof(key), "k%d", static_cast<int>(i % total));
+        check(h1->get(h, NULL, &it, key, strlen(key), 0) == ENGINE_SUCCESS,
+              "get failure");
+        item_info info;
+        info.nvalue = 1;
+        check(h1->get_item_info(h, NULL, it, &info), "get_item_info failure");
+        check(info.value[0].iov_len == size, "wrong value size");
+        h1->release(h, NULL, it);
+    }
+    gettimeofday(&end, NULL);
+    double elapsed = (end.tv_sec - start.tv_sec) * 1000000.0
+        + (end.tv_usec - start.tv_usec);
+
+    std::cout << gets << " gets of " << size << " - "
+              << elapsed / gets << " us/get" << std::endl;
+    free(data);
+
+    return SUCCESS;
+}
+}
+
 extern "C" MEMCACHED_PUBLIC_API
 bool setup_suite(struct test_harness *th) {
     testHarness = *th;
@@ -224,6 +276,8 @@ engine_test_t* get_tests(void) {
     static engine_test_t tests[]  = {
         {"test persistence", test_persistence, NULL, teardown, NULL,
          NULL, NULL},
+        {"test get path", test_get_path, NULL, teardown, NULL,
+         NULL, NULL},
         {NULL, NULL, NULL, NULL, NULL, NULL, NULL}
     };
     return tests;
@@ -1,5 +1,6 @@
 /* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
 #include "config.h"
+#include <cmath>
 #include <functional>
 
 #include "vbucket.hh"
@@ -9,6 +10,9 @@
 #include "statwriter.hh"
 #undef STATWRITER_NAMESPACE
 
+size_t VBucket::defaultFilterKeyCount = 0;
+double VBucket::defaultFilterFalsePositiveProb = 0.01;
+
 VBucketFilter VBucketFilter::filter_diff(const VBucketFilter &other) const {
     std::vector<uint16_t> tmp(acceptable.size() + other.size());
     std::vector<uint16_t>::iterator end;
@@ -86,6 +90,105 @@ const vbucket_state_t VBucket::REPLICA = static_cast<vbucket_state_t>(htonl(vbuc
 const vbucket_state_t VBucket::PENDING = static_cast<vbucket_state_t>(htonl(vbucket_state_pending));
 const vbucket_state_t VBucket::DEAD = static_cast<vbucket_state_t>(htonl(vbucket_state_dead));
 
+void VBucket::setDefaultKeyFilter(size_t keyCount, double falsePositiveProb) {
+    defaultFilterKeyCount = keyCount;
+    if (falsePositiveProb > 0.0 && falsePositiveProb < 1.0) {
+        defaultFilterFalsePositiveProb = falsePositiveProb;
+    }
+}
+
+BloomFilter *VBucket::createFilter(size_t keyCount) {
+    BloomFilter *filter = new BloomFilter(keyCount,
+                                          defaultFilterFalsePositiveProb);
+    stats.memOverhead.incr(filter->memorySize());
+    return filter;
+}
+
+void VBucket::setKeyFilter(BloomFilter *filter) {
+    keyFilter = filter;
+    // Rebuild once the false positive probability doubles.
+    double prob = std::min(2 * defaultFilterFalsePositiveProb, 0.5);
+    double fill = std::pow(prob, 1.0 / static_cast<double>(filter->getNumHashes()));
+    filterSaturationBits = static_cast<size_t>(fill * filter->getNumBits());
+}
+
+void VBucket::addToFilter(const std::string &key) {
+    SpinLockHolder lh(&filterLock);
+    if (keyFilter != NULL) {
+        keyFilter->addKey(key);
+    }
+    if (rebuildFilter != NULL) {
+        rebuildFilter->addKey(key);
+    }
+}
+
+bool VBucket::maybeKeyExistsInFilter(const std::string &key) {
+    SpinLockHolder lh(&filterLock);
+    if (filterStatus != BFILTER_ENABLED || keyFilter->maybeKeyExists(key)) {
+        return true;
+    }
+    lh.unlock();
+    ++numFilterAvoidedFetches;
+    return false;
+}
+
+bool VBucket::filterMayHoldKey(const std::string &key) {
+    SpinLockHolder lh(&filterLock);
+    return filterStatus == BFILTER_ENABLED && keyFilter->maybeKeyExists(key);
+}
+
+void VBucket::notifyFilterFalsePositive() {
+    if (getFilterStatus() == BFILTER_ENABLED) {
+        ++numFilterFalsePositives;
+    }
+}
+
+bfilter_status_t VBucket::getFilterStatus() {
+    SpinLockHolder lh(&filterLock);
+    return filterStatus;
+}
+
+void VBucket::setFilterStatus(bfilter_status_t to) {
+    SpinLockHolder lh(&filterLock);
+    if (keyFilter == NULL) {
+        return;
+    }
+    if (to == BFILTER_DISABLED) {
+        destroyFilter(keyFilter);
+        destroyFilter(rebuildFilter);
+        keyFilter = rebuildFilter = NULL;
+    }
+    filterStatus = to;
+}
+
+bool VBucket::startFilterRebuild() {
+    SpinLockHolder lh(&filterLock);
+    if (filterStatus != BFILTER_ENABLED || rebuildFilter != NULL ||
+        keyFilter->getNumBitsSet() < filterSaturationBits) {
+        return false;
+    }
+    size_t keyCount = std::max(2 * keyFilter->getEstimatedKeyCount(),
+                               defaultFilterKeyCount);
+    rebuildFilter = createFilter(keyCount);
+    return true;
+}
+
+void VBucket::addToRebuildFilter(const std::string &key) {
+    SpinLockHolder lh(&filterLock);
+    if (rebuildFilter != NULL) {
+        rebuildFilter->addKey(key);
+    }
+}
+
+void VBucket::completeFilterRebuild() {
+    SpinLockHolder lh(&filterLock);
+    if (rebuildFilter != NULL) {
+        destroyFilter(keyFilter);
+        setKeyFilter(rebuildFilter);
+        rebuildFilter = NULL;
+    }
+}
+
 void VBucket::fireAllOps(EventuallyPersistentEngine &engine, ENGINE_ERROR_CODE code) {
     if (pendingOpsStart > 0) {
         hrtime_t now = gethrtime();
@@ -137,16 +240,6 @@ void VBucket::setState(vbucket_state_t to, SERVER_HANDLE_V1 *sapi) {
     state = to;
 }
 
-void VBucket::doStatsForQueueing(QueuedItem& qi, size_t itemBytes)
-{
-    ++dirtyQueueSize;
-    dirtyQueueMem.incr(sizeof(QueuedItem));
-    ++dirtyQueueFill;
-    dirtyQueueAge.incr(qi.getQueuedTime());
-    dirtyQueuePendingWrites.incr(itemBytes);
-}
-
-
 void VBucket::doStatsForFlushing(QueuedItem& qi, size_t itemBytes)
 {
     if (dirtyQueueSize > 0) {
@@ -184,6 +277,9 @@ void VBucket::resetStats() {
     dirtyQueueAge.set(0);
     dirtyQueuePendingWrites.set(0);
     dirtyQueueDrain.set(0);
+
+    numFilterAvoidedFetches.set(0);
+    numFilterFalsePositives.set(0);
 }
 
 template <typename T>
@@ -207,6 +303,20 @@ void VBucket::queueBGFetchItem(VBucketBGFetchItem *fetch,
     bgFetcher->notifyBGEvent();
 }
 
+void VBucket::queueBGFetchItems(std::vector<VBucketBGFetchItem *> &fetches,
+                                BgFetcher *bgFetcher) {
+    if (fetches.empty()) {
+        return;
+    }
+    LockHolder lh(pendingBGFetchesLock);
+    std::vector<VBucketBGFetchItem *>::iterator it;
+    for (it = fetches.begin(); it != fetches.end(); ++it) {
+        pendingBGFetches.push(*it);
+    }
+    assert(bgFetcher);
+    bgFetcher->notifyBGEvents(fetches.size());
+}
+
 bool VBucket::getBGFetchItems(vb_bgfetch_queue_t &fetches) {
     LockHolder lh(pendingBGFetchesLock);
     while (!pendingBGFetches.empty()) {
@@ -228,7 +338,7 @@ void VBucket::addStats(bool details, ADD_STAT add_stat, const void *c) {
         addStat("num_referenced", ht.getNumReferenced(), add_stat, c);
         addStat("ht_memory", ht.memorySize(), add_stat, c);
         addStat("ht_item_memory", ht.getItemMemory(), add_stat, c);
-        addStat("ht_cache_size", ht.cacheSize, add_stat, c);
+        addStat("ht_cache_size", ht.cacheSize.get(), add_stat, c);
         addStat("num_ejects", ht.getNumEjects(), add_stat, c);
         addStat("ops_create", opsCreate, add_stat, c);
         addStat("ops_update", opsUpdate, add_stat, c);
@@ -240,5 +350,39 @@ void VBucket::addStats(bool details, ADD_STAT add_stat, const void *c) {
         addStat("queue_drain", dirtyQueueDrain, add_stat, c);
         addStat("queue_age", getQueueAge(), add_stat, c);
         addStat("pending_writes", dirtyQueuePendingWrites, add_stat, c);
+        addFilterStats(add_stat, c);
     }
 }
+
+void VBucket::addFilterStats(ADD_STAT add_stat, const void *c) {
+    const char *status = "disabled";
+    size_t bits(0), keys(0);
+    double prob(0.0);
+    {
+        SpinLockHolder lh(&filterLock);
+        if (filterStatus == BFILTER_PENDING) {
+            status = "pending";
+        } else if (filterStatus == BFILTER_ENABLED) {
+            status = rebuildFilter ? "rebuilding" : "enabled";
+        }
+        if (keyFilter != NULL) {
+            bits = keyFilter->getNumBits();
+            keys = keyFilter->getEstimatedKeyCount();
+            prob = keyFilter->getFalsePositiveProb();
+        }
+    }
+    size_t avoided = numFilterAvoidedFetches.get();
+    size_t falsePositives = numFilterFalsePositives.get();
+    double rate = 0.0;
+    if (avoided + falsePositives > 0) {
+        rate = static_cast<double>(falsePositives) / (avoided + falsePositives);
+    }
+
+    addStat("bfilter_status", status, add_stat, c);
+    addStat("bfilter_size", bits, add_stat, c);
+    addStat("bfilter_key_count", keys, add_stat, c);
+    addStat("bfilter_fp_prob", prob, add_stat, c);
+    addStat("bfilter_avoided_fetches", avoided, add_stat, c);
+    addStat("bfilter_false_positives", falsePositives, add_stat, c);
+    addStat("bfilter_fp_rate", rate, add_stat, c);
+}
@@ -17,6 +17,7 @@
 #include "atomic.hh"
 #include "stored-value.hh"
 #include "checkpoint.hh"
+#include "bloomfilter.hh"
 
 const size_t BASE_VBUCKET_SIZE=1024;
 
@@ -102,10 +103,48 @@ private:
 class EventuallyPersistentEngine;
 class BgFetcher;
 
+/**
+ * Background fetches queued together for one request (a batched get),
+ * so the request is notified once, when the last of them completes,
+ * instead of once per fetch.
+ *
+ * The request holds a reference of its own while it queues fetches,
+ * so the group can't complete before all of them are queued.
+ */
+class BGFetchGroup {
+public:
+    BGFetchGroup(const void *c) : cookie(c), outstanding(1) {}
+
+    /**
+     * Account for one more fetch of the group.
+     */
+    void add() {
+        ++outstanding;
+    }
+
+    /**
+     * Complete a fetch of the group (or drop the request's reference).
+     *
+     * @return true if that was the last one, in which case the caller
+     *         notifies the cookie and deletes the group
+     */
+    bool complete() {
+        return outstanding.decr(1) == 0;
+    }
+
+    const void *cookie;
+
+private:
+    Atomic<size_t> outstanding;
+
+    DISALLOW_COPY_AND_ASSIGN(BGFetchGroup);
+};
+
 class VBucketBGFetchItem {
 public:
-    VBucketBGFetchItem(const std::string k, uint64_t s, const void *c) :
-                       key(k), cookie(c), initTime(gethrtime()) {
+    VBucketBGFetchItem(const std::string k, uint64_t s, const void *c,
+                       BGFetchGroup *g = NULL) :
+                       key(k), cookie(c), group(g), initTime(gethrtime()) {
         value.setId(s);
     }
     ~VBucketBGFetchItem() {
@@ -114,12 +153,23 @@ public:
 
     const std::string key;
     const void * cookie;
+    //! The batched get this fetch is part of, or NULL.
+    BGFetchGroup *group;
     GetValue value;
     hrtime_t initTime;
 };
 
 typedef unordered_map<uint64_t, std::list<VBucketBGFetchItem *> > vb_bgfetch_queue_t;
 
+/**
+ * States of the key filter of a vbucket.
+ */
+typedef enum {
+    BFILTER_DISABLED,           //!< No filter is kept
+    BFILTER_PENDING,            //!< Being populated, can't answer lookups yet
+    BFILTER_ENABLED             //!< Answers lookups
+} bfilter_status_t;
+
 /**
  * An individual vbucket.
  */
@@ -129,13 +179,19 @@ public:
     VBucket(int i, vbucket_state_t newState, EPStats &st, CheckpointConfig &checkpointConfig,
             vbucket_state_t initState = vbucket_state_dead, uint64_t checkpointId = 1) :
         ht(st), checkpointManager(st, i, checkpointConfig, checkpointId), id(i), state(newState),
-        initialState(initState), stats(st) {
+        initialState(initState), stats(st), keyFilter(NULL),
+        rebuildFilter(NULL), filterStatus(BFILTER_DISABLED),
+        filterSaturationBits(0) {
 
         backfill.isBackfillPhase = false;
         pendingOpsStart = 0;
-        stats.memOverhead.incr(sizeof(VBucket)
-                               + ht.memorySize() + sizeof(CheckpointManager));
+        stats.memOverhead.incr(sizeof(VBucket) + ht.memorySize()
+                               + sizeof(CheckpointManager));
         assert(stats.memOverhead.get() < GIGANTOR);
+        if (defaultFilterKeyCount > 0) {
+            setKeyFilter(createFilter(defaultFilterKeyCount));
+            filterStatus = BFILTER_PENDING;
+        }
     }
 
     ~VBucket() {
@@ -150,7 +206,10 @@ public:
             delete pendingBGFetches.front();
             pendingBGFetches.pop();
         }
-        stats.memOverhead.decr(sizeof(VBucket) + ht.memorySize() + sizeof(CheckpointManager));
+        destroyFilter(keyFilter);
+        destroyFilter(rebuildFilter);
+        stats.memOverhead.decr(sizeof(VBucket) + ht.memorySize()
+                               + sizeof(CheckpointManager));
         assert(stats.memOverhead.get() < GIGANTOR);
         getLogger()->log(EXTENSION_LOG_INFO, NULL,
                          "Destroying vbucket %d\n", id);
@@ -181,7 +240,14 @@ public:
         return true;
     }
 
-    void doStatsForQueueing(QueuedItem& item, size_t itemBytes);
+    void doStatsForQueueing(QueuedItem& qi, size_t itemBytes) {
+        ++dirtyQueueSize;
+        dirtyQueueMem.incr(sizeof(QueuedItem));
+        ++dirtyQueueFill;
+        dirtyQueueAge.incr(qi.getQueuedTime());
+        dirtyQueuePendingWrites.incr(itemBytes);
+    }
+
     void doStatsForFlushing(QueuedItem& item, size_t itemBytes);
     void resetStats();
 
@@ -236,6 +302,8 @@ public:
 
     bool getBGFetchItems(vb_bgfetch_queue_t &fetches);
     void queueBGFetchItem(VBucketBGFetchItem *fetch, BgFetcher *bgFetcher);
+    void queueBGFetchItems(std::vector<VBucketBGFetchItem *> &fetches,
+                           BgFetcher *bgFetcher);
     size_t numPendingBGFetchItems(void) {
         LockHolder lh(pendingBGFetchesLock);
         return pendingBGFetches.size();
@@ -245,6 +313,71 @@ public:
         return !pendingBGFetches.empty();
     }
 
+    /**
+     * Remember that an item or a deletion of this key may be on disk.
+     */
+    void addToFilter(const std::string &key);
+
+    /**
+     * False if neither an item nor a deletion of this key is on disk,
+     * so there is no point in fetching it.  Always true unless the key
+     * filter is enabled.  Every false answer counts as an avoided
+     * fetch.
+     */
+    bool maybeKeyExistsInFilter(const std::string &key);
+
+    /**
+     * True if the key filter is enabled and may hold this key.  Unlike
+     * maybeKeyExistsInFilter(), a vbucket without a filter answers
+     * false, and no answer counts as an avoided fetch.
+     */
+    bool filterMayHoldKey(const std::string &key);
+
+    /**
+     * Count a fetch let through by the key filter that found nothing
+     * on disk.
+     */
+    void notifyFilterFalsePositive();
+
+    bfilter_status_t getFilterStatus();
+
+    /**
+     * Change the state of the key filter.  Disabling it frees it for
+     * good; vbuckets without a filter stay disabled.
+     */
+    void setFilterStatus(bfilter_status_t to);
+
+    /**
+     * Start rebuilding the key filter if it has filled up beyond its
+     * false positive probability.  Until completeFilterRebuild() is
+     * called lookups keep using the current filter, and new keys go
+     * into both.
+     *
+     * @return true if the caller must feed every key of the vbucket on
+     *         disk to addToRebuildFilter() and then complete the rebuild
+     */
+    bool startFilterRebuild();
+
+    /**
+     * Add a key found on disk to the filter being rebuilt.
+     */
+    void addToRebuildFilter(const std::string &key);
+
+    /**
+     * Replace the key filter with the rebuilt one.
+     */
+    void completeFilterRebuild();
+
+    /**
+     * Set up the key filter of vbuckets created from now on.
+     *
+     * @param keyCount the number of keys to size the filter for, or 0
+     *                 for no filter
+     * @param falsePositiveProb the false positive probability to size
+     *                          the filter for
+     */
+    static void setDefaultKeyFilter(size_t keyCount, double falsePositiveProb);
+
     static const char* toString(vbucket_state_t s) {
         switch(s) {
         case vbucket_state_active: return "active"; break;
@@ -292,8 +425,21 @@ private:
     template <typename T>
     void addStat(const char *nm, T val, ADD_STAT add_stat, const void *c);
 
+    void addFilterStats(ADD_STAT add_stat, const void *c);
+
     void fireAllOps(EventuallyPersistentEngine &engine, ENGINE_ERROR_CODE code);
 
+    BloomFilter *createFilter(size_t keyCount);
+
+    void destroyFilter(BloomFilter *filter) {
+        if (filter != NULL) {
+            stats.memOverhead.decr(filter->memorySize());
+            delete filter;
+        }
+    }
+
+    void setKeyFilter(BloomFilter *filter);
+
     int                      id;
     Atomic<vbucket_state_t>  state;
     vbucket_state_t          initialState;
@@ -305,6 +451,19 @@ private:
     Mutex pendingBGFetchesLock;
     std::queue<VBucketBGFetchItem *> pendingBGFetches;
 
+    //! Keys with an item or a deletion on disk (NULL when disabled).
+    SpinLock          filterLock;
+    BloomFilter      *keyFilter;
+    BloomFilter      *rebuildFilter;
+    bfilter_status_t  filterStatus;
+    //! Bits set in keyFilter beyond which it gets rebuilt.
+    size_t            filterSaturationBits;
+    Atomic<size_t>    numFilterAvoidedFetches;
+    Atomic<size_t>    numFilterFalsePositives;
+
+    static size_t defaultFilterKeyCount;
+    static double defaultFilterFalsePositiveProb;
+
     DISALLOW_COPY_AND_ASSIGN(VBucket);
 };
 
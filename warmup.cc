@@ -127,7 +127,7 @@ public:
         : vbuckets(ep->vbuckets), stats(ep->getEPEngine().getEpStats()),
           epstore(ep), startTime(ep_real_time()),
           hasPurged(false), maybeEnableTraffic(_maybeEnableTraffic),
-          warmupState(_warmupState)
+          warmupState(_warmupState), loaded(0)
     {
         assert(epstore);
     }
@@ -137,6 +137,9 @@ public:
 
     void callback(GetValue &val);
 
+    //! The number of items passed through this callback
+    size_t getNumLoaded() const { return loaded; }
+
 private:
 
     bool shouldEject() {
@@ -152,6 +155,7 @@ private:
     bool        hasPurged;
     bool        maybeEnableTraffic;
     int         warmupState;
+    size_t      loaded;
 };
 
 void LoadStorageKVPairCallback::initVBucket(uint16_t vbid,
@@ -182,6 +186,11 @@ void LoadStorageKVPairCallback::callback(GetValue &val) {
                                  epstore->getEPEngine().getCheckpointConfig()));
             vbuckets.addBucket(vb);
         }
+        if (warmupState != WarmupState::LoadingData &&
+            warmupState != WarmupState::LoadingAccessLog) {
+            // Every key on disk comes by once while loading keys.
+            vb->addToFilter(i->getKey());
+        }
         bool succeeded(false);
         int retry = 2;
         do {
@@ -239,15 +248,19 @@ void LoadStorageKVPairCallback::callback(GetValue &val) {
         }
 
         if (succeeded && epstore->warmupTask->doReconstructLog()) {
-            epstore->mutationLog.newItem(i->getVBucketId(), i->getKey(), i->getId());
+            epstore->warmupTask->reconstructLogItem(*i);
         }
         delete i;
         val.setValue(NULL);
 
         if (maybeEnableTraffic) {
             epstore->maybeEnableTraffic();
+            if (!epstore->getEPEngine().stillWarmingUp()) {
+                epstore->warmupTask->trafficEnabled();
+            }
         }
     }
+    ++loaded;
 
     switch (warmupState) {
         case WarmupState::KeyDump:
@@ -289,6 +302,88 @@ void LoadStorageKVPairCallback::purge() {
     hasPurged = true;
 }
 
+/**
+ * One of the threads loading a warmup phase in parallel.  The readers
+ * take vbuckets off a list they share one at a time, so the vbuckets
+ * at the front of the list are loaded first, and read them with a
+ * KVStore of their own.  They stop taking vbuckets once warmup is
+ * complete, just as the serial load stops reading.
+ */
+class WarmupReader {
+public:
+    WarmupReader(EventuallyPersistentEngine &e, LoadStorageKVPairCallback *cb,
+                 const std::vector<uint16_t> &vbs, Atomic<size_t> &n,
+                 bool ko)
+        : engine(e), callback(cb), vbids(vbs), next(n), keysOnly(ko) {}
+
+    void run() {
+        hrtime_t start = gethrtime();
+        KVStore *kvstore = NULL;
+        try {
+            kvstore = KVStoreFactory::create(engine, true);
+            if (kvstore == NULL) {
+                throw std::runtime_error("Failed to create a KVStore");
+            }
+            while (engine.stillWarmingUp()) {
+                size_t idx = next++;
+                if (idx >= vbids.size()) {
+                    break;
+                }
+                std::vector<uint16_t> vb(1, vbids[idx]);
+                if (keysOnly) {
+                    kvstore->dumpKeys(vb, callback);
+                } else {
+                    kvstore->dumpVBuckets(vb, callback);
+                }
+                ++stats.vbuckets;
+            }
+        } catch (std::exception &e) {
+            error.assign(e.what());
+        }
+        delete kvstore;
+        stats.items = callback->getNumLoaded();
+        stats.time = gethrtime() - start;
+    }
+
+    pthread_t thread;
+    WarmupReaderStats stats;
+    std::string error;
+
+private:
+    EventuallyPersistentEngine &engine;
+    shared_ptr<LoadStorageKVPairCallback> callback;
+    const std::vector<uint16_t> &vbids;
+    Atomic<size_t> &next;
+    bool keysOnly;
+
+    DISALLOW_COPY_AND_ASSIGN(WarmupReader);
+};
+
+static void *warmupReaderThread(void *arg) {
+    static_cast<WarmupReader*>(arg)->run();
+    return NULL;
+}
+
+/**
+ * The name of a state in the timing stats, or NULL if it isn't timed.
+ */
+static const char *phaseName(int st) {
+    switch (st) {
+    case WarmupState::LoadingMutationLog:
+        return "mutation_log";
+    case WarmupState::KeyDump:
+        return "key_dump";
+    case WarmupState::LoadingAccessLog:
+        return "access_log";
+    case WarmupState::LoadingKVPairs:
+        return "kv_pairs";
+    case WarmupState::LoadingData:
+        return "data";
+    default:
+        return NULL;
+    }
+}
+
 //////////////////////////////////////////////////////////////////////////////
 //                                                                          //
 //    Implementation of the warmup class                                    //
@@ -302,7 +397,8 @@ Warmup::Warmup(EventuallyPersistentStore *st, Dispatcher *d) :
     estimatedItemCount(std::numeric_limits<size_t>::max()),
     corruptMutationLog(false),
     corruptAccessLog(false),
-    estimatedWarmupCount(std::numeric_limits<size_t>::max())
+    estimatedWarmupCount(std::numeric_limits<size_t>::max()),
+    phaseTimes(WarmupState::Done + 1, 0), trafficTime(0)
 {
 
 }
@@ -321,6 +417,17 @@ void Warmup::setReconstructLog(bool val) {
     reconstructLog = val;
 }
 
+void Warmup::trafficEnabled(void) {
+    if (trafficTime.get() == 0) {
+        trafficTime.cas(0, gethrtime() - startTime);
+    }
+}
+
+void Warmup::reconstructLogItem(const Item &itm) {
+    LockHolder lh(reconstructLogMutex);
+    store->mutationLog.newItem(itm.getVBucketId(), itm.getKey(), itm.getId());
+}
+
 void Warmup::start(void)
 {
     store->stats.warmupComplete.set(false);
@@ -385,6 +492,9 @@ bool Warmup::keyDump(Dispatcher&, TaskId)
 {
     bool success = false;
     if (store->roUnderlying->isKeyDumpSupported()) {
+        success = loadInParallel(true, false);
+    }
+    if (!success && store->roUnderlying->isKeyDumpSupported()) {
         shared_ptr<Callback<GetValue> > cb(createLKVPCB(initialVbState, false,
                                                         state.getState()));
         std::map<uint16_t, vbucket_state>::const_iterator it;
@@ -428,6 +538,7 @@ private:
 
 bool Warmup::checkForAccessLog(Dispatcher&, TaskId)
 {
+    store->warmupKeyFilters();
     metadata = gethrtime() - startTime;
     getLogger()->log(EXTENSION_LOG_WARNING, NULL,
                      "metadata loaded in %s",
@@ -504,9 +615,12 @@ bool Warmup::loadingAccessLog(Dispatcher&, TaskId)
 
 bool Warmup::loadingKVPairs(Dispatcher&, TaskId)
 {
-    shared_ptr<Callback<GetValue> > cb(createLKVPCB(initialVbState, false,
-                                                    state.getState()));
-    store->roUnderlying->dump(cb);
+    if (!loadInParallel(false, false)) {
+        shared_ptr<Callback<GetValue> > cb(createLKVPCB(initialVbState, false,
+                                                        state.getState()));
+        store->roUnderlying->dump(cb);
+    }
+    store->warmupKeyFilters();
 
     if (doReconstructLog()) {
         store->mutationLog.commit1();
@@ -519,16 +633,94 @@ bool Warmup::loadingKVPairs(Dispatcher&, TaskId)
 
 bool Warmup::loadingData(Dispatcher&, TaskId)
 {
-    shared_ptr<Callback<GetValue> > cb(createLKVPCB(initialVbState, true,
-                                       state.getState()));
-    store->roUnderlying->dump(cb);
+    if (!loadInParallel(false, true)) {
+        shared_ptr<Callback<GetValue> > cb(createLKVPCB(initialVbState, true,
+                                                        state.getState()));
+        store->roUnderlying->dump(cb);
+    }
     transition(WarmupState::Done);
     return true;
 }
 
+bool Warmup::loadInParallel(bool keysOnly, bool maybeEnable)
+{
+    EventuallyPersistentEngine &engine = store->getEPEngine();
+    size_t numReaders = engine.getConfiguration().getWarmupReaderThreads();
+    StorageProperties props(store->roUnderlying->getStorageProperties());
+    if (numReaders < 2 || !props.hasEfficientVBDump() ||
+        props.maxReaders() < 2) {
+        return false;
+    }
+
+    std::vector<uint16_t> vbids;
+    std::vector<uint16_t> replicas;
+    std::map<uint16_t, vbucket_state>::const_iterator it;
+    for (it = initialVbState.begin(); it != initialVbState.end(); ++it) {
+        if (it->second.state == vbucket_state_active) {
+            vbids.push_back(it->first);
+        } else if (it->second.state == vbucket_state_replica) {
+            replicas.push_back(it->first);
+        }
+    }
+    vbids.insert(vbids.end(), replicas.begin(), replicas.end());
+    numReaders = std::min(numReaders, props.maxReaders());
+    numReaders = std::max(static_cast<size_t>(1),
+                          std::min(numReaders, vbids.size()));
+
+    // The first callback sets up the vbuckets for all of them.
+    Atomic<size_t> next(0);
+    std::vector<WarmupReader*> readers;
+    for (size_t i = 0; i < numReaders; ++i) {
+        LoadStorageKVPairCallback *cb;
+        if (i == 0) {
+            cb = createLKVPCB(initialVbState, maybeEnable, state.getState());
+        } else {
+            cb = new LoadStorageKVPairCallback(store, maybeEnable,
+                                               state.getState());
+        }
+        readers.push_back(new WarmupReader(engine, cb, vbids, next,
+                                           keysOnly));
+    }
+
+    std::vector<WarmupReader*>::iterator rit;
+    for (rit = readers.begin() + 1; rit != readers.end(); ++rit) {
+        int rc = pthread_create(&(*rit)->thread, NULL, warmupReaderThread,
+                                *rit);
+        assert(rc == 0);
+    }
+    readers.front()->run();
+    for (rit = readers.begin() + 1; rit != readers.end(); ++rit) {
+        int rc = pthread_join((*rit)->thread, NULL);
+        assert(rc == 0);
+    }
+
+    std::vector<WarmupReaderStats> rstats;
+    std::string error;
+    for (rit = readers.begin(); rit != readers.end(); ++rit) {
+        rstats.push_back((*rit)->stats);
+        if (error.empty()) {
+            error = (*rit)->error;
+        }
+        delete *rit;
+    }
+    {
+        LockHolder lh(readerStats.mutex);
+        readerStats.phases[state.getState()] = rstats;
+    }
+    if (!error.empty()) {
+        throw std::runtime_error(error);
+    }
+
+    getLogger()->log(EXTENSION_LOG_INFO, NULL,
+                     "Warmup loaded %ld vbuckets in state \"%s\" with %ld readers",
+                     vbids.size(), state.toString(), numReaders);
+    return true;
+}
+
 bool Warmup::done(Dispatcher&, TaskId)
 {
     warmup = gethrtime() - startTime;
+    trafficTime.cas(0, warmup);
     store->warmupCompleted();
     store->stats.warmupComplete.set(true);
     getLogger()->log(EXTENSION_LOG_WARNING, NULL,
@@ -539,31 +731,45 @@ bool Warmup::done(Dispatcher&, TaskId)
 
 bool Warmup::step(Dispatcher &d, TaskId t) {
     try {
-        switch (state.getState()) {
+        int phase = state.getState();
+        hrtime_t start = gethrtime();
+        bool rv;
+        switch (phase) {
         case WarmupState::Initialize:
-            return initialize(d, t);
+            rv = initialize(d, t);
+            break;
         case WarmupState::LoadingMutationLog:
-            return loadingMutationLog(d, t);
+            rv = loadingMutationLog(d, t);
+            break;
         case WarmupState::EstimateDatabaseItemCount:
-            return estimateDatabaseItemCount(d, t);
+            rv = estimateDatabaseItemCount(d, t);
+            break;
         case WarmupState::KeyDump:
-            return keyDump(d, t);
+            rv = keyDump(d, t);
+            break;
         case WarmupState::CheckForAccessLog:
-            return checkForAccessLog(d, t);
+            rv = checkForAccessLog(d, t);
+            break;
         case WarmupState::LoadingAccessLog:
-            return loadingAccessLog(d, t);
+            rv = loadingAccessLog(d, t);
+            break;
         case WarmupState::LoadingKVPairs:
-            return loadingKVPairs(d, t);
+            rv = loadingKVPairs(d, t);
+            break;
         case WarmupState::LoadingData:
-            return loadingData(d, t);
+            rv = loadingData(d, t);
+            break;
         case WarmupState::Done:
-            return done(d, t);
+            rv = done(d, t);
+            break;
         default:
             getLogger()->log(EXTENSION_LOG_WARNING, NULL,
                              "Internal error.. Illegal warmup state %d",
                              state.getState());
             abort();
         }
+        phaseTimes[phase] += gethrtime() - start;
+        return rv;
     } catch(std::runtime_error &e) {
         std::stringstream ss;
         ss << "Exception in warmup loop: " << e.what() << std::endl;
@@ -665,6 +871,36 @@ void Warmup::addStats(ADD_STAT add_stat, const void *c) const
         } else {
             addStat("estimated_warmup_count", estimatedWarmupCount, add_stat, c);
         }
+
+        if (trafficTime > 0) {
+            addStat("traffic_time", trafficTime / 1000, add_stat, c);
+        }
+
+        char name[80];
+        for (int st = 0; st < static_cast<int>(phaseTimes.size()); ++st) {
+            if (phaseName(st) != NULL && phaseTimes[st] > 0) {
+                snprintf(name, sizeof(name), "%s_time", phaseName(st));
+                addStat(name, phaseTimes[st] / 1000, add_stat, c);
+            }
+        }
+
+        LockHolder lh(readerStats.mutex);
+        std::map<int, std::vector<WarmupReaderStats> >::const_iterator it;
+        for (it = readerStats.phases.begin(); it != readerStats.phases.end();
+             ++it) {
+            for (size_t i = 0; i < it->second.size(); ++i) {
+                const WarmupReaderStats &rs = it->second[i];
+                snprintf(name, sizeof(name), "%s_reader_%d_vbuckets",
+                         phaseName(it->first), static_cast<int>(i));
+                addStat(name, rs.vbuckets, add_stat, c);
+                snprintf(name, sizeof(name), "%s_reader_%d_items",
+                         phaseName(it->first), static_cast<int>(i));
+                addStat(name, rs.items, add_stat, c);
+                snprintf(name, sizeof(name), "%s_reader_%d_time",
+                         phaseName(it->first), static_cast<int>(i));
+                addStat(name, rs.time / 1000, add_stat, c);
+            }
+        }
    } else {
         addStat(NULL, "disabled", add_stat, c);
     }
@@ -56,6 +56,17 @@ public:
 
 class LoadStorageKVPairCallback;
 
+/**
+ * What one reader thread of a parallel warmup phase did.
+ */
+struct WarmupReaderStats {
+    WarmupReaderStats() : vbuckets(0), items(0), time(0) {}
+
+    size_t vbuckets;
+    size_t items;
+    hrtime_t time;
+};
+
 class Warmup {
 public:
     Warmup(EventuallyPersistentStore *st, Dispatcher *d);
@@ -80,6 +91,17 @@ public:
 
     hrtime_t getTime(void) { return warmup; }
 
+    /**
+     * Record the time traffic got enabled, the first time it happens.
+     */
+    void trafficEnabled(void);
+
+    /**
+     * Add a loaded item to the mutation log being reconstructed.  Safe
+     * to call from several reader threads.
+     */
+    void reconstructLogItem(const Item &itm);
+
 private:
     template <typename T>
     void addStat(const char *nm, T val, ADD_STAT add_stat, const void *c) const;
@@ -98,6 +120,16 @@ private:
 
     void transition(int to);
 
+    /**
+     * Load the active and replica vbuckets on a number of reader
+     * threads, each with a KVStore of its own, active vbuckets first.
+     *
+     * @param keysOnly true to only load the keys
+     * @param maybeEnable true if traffic may be enabled along the way
+     * @return false if the store can't be read in parallel, in which
+     *         case nothing was loaded
+     */
+    bool loadInParallel(bool keysOnly, bool maybeEnable);
 
     LoadStorageKVPairCallback *createLKVPCB(const std::map<uint16_t, vbucket_state> &st,
                                             bool maybeEnable, int warmupState);
@@ -120,6 +152,16 @@ private:
     bool corruptAccessLog;
     size_t estimatedWarmupCount;
 
+    // Time spent in each state
+    std::vector<hrtime_t> phaseTimes;
+    Atomic<hrtime_t> trafficTime;
+    Mutex reconstructLogMutex;
+
+    struct {
+        mutable Mutex mutex;
+        std::map<int, std::vector<WarmupReaderStats> > phases;
+    } readerStats;
+
     struct {
         Mutex mutex;
         std::list<WarmupStateListener*> listeners;